@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include "assembler.h"
+#include "commands.h"
+#include "diagnostics.h"
+#include "lexer.h"
+#include "parser.h"
+#include "stats.h"
+#include "symbol.h"
+
+void copy_words(CommandStore* commands, HackProgram* program);
+void copy_symbols(SymbolTable* symbol_table, HackProgram* program);
+int compare_symbols(const void* a, const void* b);
+
+bool hack_assemble(const char* text, size_t length, int threads, HackProgram* program) {
+  memset(program, 0, sizeof(HackProgram));
+  Source source;
+  Source_init(&source, text, length);
+  CommandStore commands;
+  CommandStore_init(&commands);
+  SymbolTable symbol_table;
+  SymbolTable_init(&symbol_table);
+  Diagnostics diagnostics;
+  Diagnostics_init(&diagnostics);
+  Stats stats;
+  Stats_init(&stats);
+
+  bool success = assemble(&source, &commands, &symbol_table, threads, false, &stats, &diagnostics);
+  copy_words(&commands, program);
+  copy_symbols(&symbol_table, program);
+  // the program takes over the diagnostics
+  program->diagnostics = diagnostics.items;
+  program->diagnostic_count = diagnostics.count;
+
+  SymbolTable_free(&symbol_table);
+  CommandStore_free(&commands);
+  return success;
+}
+
+void hack_program_free(HackProgram* program) {
+  free(program->words);
+  free(program->diagnostics);
+  free(program->symbols);
+  free(program->names);
+  memset(program, 0, sizeof(HackProgram));
+}
+
+void copy_words(CommandStore* commands, HackProgram* program) {
+  program->count = commands->count;
+  program->words = malloc((commands->count > 0 ? commands->count : 1) * sizeof(uint16_t));
+  for (int page = 0; page * WORDS_PER_PAGE < commands->count; page++) {
+    int words = commands->count - page * WORDS_PER_PAGE;
+    if (words > WORDS_PER_PAGE) {
+      words = WORDS_PER_PAGE;
+    }
+    memcpy(program->words + page * WORDS_PER_PAGE, commands->pages[page], words * sizeof(uint16_t));
+  }
+}
+
+// The names are copied out of the arena, which goes away with the table,
+// into one block owned by the program
+void copy_symbols(SymbolTable* symbol_table, HackProgram* program) {
+  size_t name_bytes = 0;
+  for (int i = 0; i < symbol_table->capacity; i++) {
+    if (symbol_table->table[i].map.assembly != NULL) {
+      name_bytes += symbol_table->table[i].map.length + 1;
+    }
+  }
+  program->symbols = malloc((symbol_table->count > 0 ? symbol_table->count : 1) * sizeof(HackSymbol));
+  program->names = malloc(name_bytes > 0 ? name_bytes : 1);
+  char* name = program->names;
+  for (int i = 0; i < symbol_table->capacity; i++) {
+    SymbolSlot* slot = &symbol_table->table[i];
+    if (slot->map.assembly != NULL) {
+      HackSymbol* symbol = &program->symbols[program->symbol_count++];
+      memcpy(name, slot->map.assembly, slot->map.length + 1);
+      symbol->name = name;
+      symbol->address = slot->map.address;
+      symbol->kind = slot->variable ? HACK_VARIABLE : HACK_LABEL;
+      name += slot->map.length + 1;
+    }
+  }
+  qsort(program->symbols, program->symbol_count, sizeof(HackSymbol), compare_symbols);
+}
+
+int compare_symbols(const void* a, const void* b) {
+  const HackSymbol* first = a;
+  const HackSymbol* second = b;
+  if (first->kind != second->kind) {
+    return first->kind - second->kind;
+  }
+  if (first->address != second->address) {
+    return first->address - second->address;
+  }
+  return strcmp(first->name, second->name);
+}
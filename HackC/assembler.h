@@ -0,0 +1,58 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// In-memory interface to the Hack assembler, for programs that want to
+// assemble without going through files or stdout (emulators, test runners,
+// compilers). Every call works on its own state, so any number of threads
+// may assemble at once.
+//
+//   HackProgram program;
+//   if (hack_assemble(text, length, 1, &program)) {
+//     ... program.words[0 .. program.count) ...
+//   }
+//   hack_program_free(&program);
+
+typedef enum {HACK_WARNING, HACK_ERROR} HackSeverity;
+
+// line is 1-based. address is the ROM address of the instruction the
+// diagnostic is about, or of the next instruction for errors between
+// instructions.
+typedef struct {
+  HackSeverity severity;
+  int line;
+  int address;
+  char message[96];
+} HackDiagnostic;
+
+typedef enum {HACK_LABEL, HACK_VARIABLE} HackSymbolKind;
+
+// Labels have ROM addresses, variables RAM addresses. Built-in symbols
+// such as SP and SCREEN are not listed.
+typedef struct {
+  const char* name;
+  int address;
+  HackSymbolKind kind;
+} HackSymbol;
+
+// Symbols are sorted by kind, then address, then name.
+typedef struct {
+  uint16_t* words;
+  int count;
+  HackDiagnostic* diagnostics;
+  int diagnostic_count;
+  HackSymbol* symbols;
+  int symbol_count;
+  char* names;
+} HackProgram;
+
+// Assembles length bytes of text. Large inputs are split over up to
+// threads threads. Returns false if there were errors; the program is
+// filled in either way and must be released with hack_program_free.
+bool hack_assemble(const char* text, size_t length, int threads, HackProgram* program);
+void hack_program_free(HackProgram* program);
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "pool.h"
+
+// Assembles many files at once. Each input may be an .asm file or a
+// directory, which is searched recursively for .asm files. Every output is
+// written next to its input, with .hack (or .bin for ROM images) in place
+// of .asm.
+
+// Shared by the workers. Each worker claims the next unassembled file until
+// none are left.
+typedef struct {
+  FileList* files;
+  Options* options;
+  WorkQueue queue;
+  atomic_int failures;
+} Batch;
+
+void collect_directory(FileList* files, const char* path, const char* extension, bool top_level);
+void add_file(FileList* files, const char* path);
+bool has_extension(const char* path, const char* extension);
+char* output_path(const char* path, Options* options);
+void* assemble_worker(void* argument);
+int compare_paths(const void* a, const void* b);
+
+int assemble_files(char** paths, int count, Options* options, int threads) {
+  FileList files = {NULL, 0, 0};
+  for (int i = 0; i < count; i++) {
+    collect_files(&files, paths[i], ".asm");
+  }
+  // assemble in a predictable order so reports are easy to compare
+  sort_files(&files);
+
+  Batch batch;
+  batch.files = &files;
+  batch.options = options;
+  WorkQueue_init(&batch.queue, files.count);
+  atomic_init(&batch.failures, 0);
+  run_threads(assemble_worker, &batch, 0, threads < files.count ? threads : files.count);
+  FileList_free(&files);
+  return atomic_load(&batch.failures);
+}
+
+bool is_directory(const char* path) {
+  struct stat info;
+  return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+int default_thread_count() {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? cores : 1;
+}
+
+void* assemble_worker(void* argument) {
+  Batch* batch = argument;
+  int index;
+  while ((index = claim_work(&batch->queue)) >= 0) {
+    const char* path = batch->files->paths[index];
+    // files are already spread over the threads, so each one is assembled
+    // on a single thread
+    Options options = *batch->options;
+    options.threads = 1;
+    char* output = output_path(path, &options);
+    options.output = output;
+    if (!parse(path, &options)) {
+      atomic_fetch_add(&batch->failures, 1);
+    }
+    free(output);
+  }
+  return NULL;
+}
+
+// Adds path to files, or when it is a directory, every file below it with
+// the extension. Paths named directly are taken as they are, even when
+// they don't exist, for whoever opens them to report.
+void collect_files(FileList* files, const char* path, const char* extension) {
+  collect_directory(files, path, extension, true);
+}
+
+void collect_directory(FileList* files, const char* path, const char* extension, bool top_level) {
+  struct stat info;
+  if (stat(path, &info) == -1 || !S_ISDIR(info.st_mode)) {
+    if (top_level || has_extension(path, extension)) {
+      add_file(files, path);
+    }
+    return;
+  }
+  DIR* directory = opendir(path);
+  if (directory == NULL) {
+    return;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(directory)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    size_t length = strlen(path) + strlen(entry->d_name) + 2;
+    char* child = malloc(length);
+    snprintf(child, length, "%s/%s", path, entry->d_name);
+    collect_directory(files, child, extension, false);
+    free(child);
+  }
+  closedir(directory);
+}
+
+void add_file(FileList* files, const char* path) {
+  if (files->count == files->capacity) {
+    files->capacity = files->capacity == 0 ? 64 : files->capacity * 2;
+    files->paths = realloc(files->paths, files->capacity * sizeof(char*));
+  }
+  files->paths[files->count++] = strdup(path);
+}
+
+void sort_files(FileList* files) {
+  qsort(files->paths, files->count, sizeof(char*), compare_paths);
+}
+
+void FileList_free(FileList* files) {
+  for (int i = 0; i < files->count; i++) {
+    free(files->paths[i]);
+  }
+  free(files->paths);
+  files->paths = NULL;
+  files->count = 0;
+  files->capacity = 0;
+}
+
+bool has_extension(const char* path, const char* extension) {
+  size_t length = strlen(path);
+  size_t extension_length = strlen(extension);
+  return length >= extension_length && strcmp(path + length - extension_length, extension) == 0;
+}
+
+// Foo.asm becomes Foo.hack, or Foo.bin for ROM images
+char* output_path(const char* path, Options* options) {
+  const char* extension = options->format == BINARY_OUTPUT ? ".bin" : ".hack";
+  size_t length = strlen(path);
+  if (has_extension(path, ".asm")) {
+    length -= 4;
+  }
+  char* output = malloc(length + strlen(extension) + 1);
+  memcpy(output, path, length);
+  strcpy(output + length, extension);
+  return output;
+}
+
+int compare_paths(const void* a, const void* b) {
+  return strcmp(*(char* const*) a, *(char* const*) b);
+}
@@ -0,0 +1,20 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "parser.h"
+
+// Paths found by collect_files, each allocated on its own
+typedef struct {
+  char** paths;
+  int count;
+  int capacity;
+} FileList;
+
+int assemble_files(char** paths, int count, Options* options, int threads);
+int default_thread_count();
+bool is_directory(const char* path);
+void collect_files(FileList* files, const char* path, const char* extension);
+void sort_files(FileList* files);
+void FileList_free(FileList* files);
+
+#endif
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "../commands.h"
+#include "../lexer.h"
+#include "../parser.h"
+#include "../symbol.h"
+
+// Times each phase of the assembler over the given .asm files and reports
+// throughput and peak memory per phase.
+//
+//   bench <input.asm>...
+//
+// The phases follow parse():
+//
+//   open    map the file and fault in every page
+//   lex     read_command over the whole file, nothing else
+//   pass1   the real first pass: lex, encode, record labels
+//   symbols update_symbols
+//   output  format the program as text into /dev/null
+//
+// Each file is assembled several times and the fastest time per phase is
+// kept. Peak RSS is the high-water mark reached during the phase, reset
+// before it starts where the kernel allows it. A file that doesn't fit in
+// ROM, or doesn't lex, is skipped: the first pass would stop part way and
+// leave the later phases next to nothing to time.
+
+#define PHASES 5
+#define MIN_BYTES_PER_FILE (64 << 20)
+#define MAX_ROUNDS 50
+
+const char* phase_names[PHASES] = {"open", "lex", "pass1", "symbols", "output"};
+
+typedef struct {
+  double seconds;
+  double bytes;
+  double instructions;
+  long peak_kb;
+} Phase;
+
+typedef struct {
+  struct timespec start;
+} Timer;
+
+void start_phase(Timer* timer);
+void end_phase(Timer* timer, Phase* phase, double bytes, double instructions);
+void reset_peak();
+long peak_kb();
+bool run(const char* filename, Phase phases[]);
+void report(const char* filename, Phase phases[]);
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <input.asm>...\n", argv[0]);
+    return 1;
+  }
+  printf("%-32s %-8s %10s %10s %14s %12s\n", "file", "phase", "ms", "MB/s", "instr/s", "peak RSS KB");
+  for (int i = 1; i < argc; i++) {
+    Phase phases[PHASES];
+    for (int p = 0; p < PHASES; p++) {
+      phases[p].seconds = -1;
+      phases[p].peak_kb = 0;
+    }
+    if (run(argv[i], phases)) {
+      report(argv[i], phases);
+    }
+  }
+  return 0;
+}
+
+bool run(const char* filename, Phase phases[]) {
+  int rounds = 1;
+  for (int round = 0; round < rounds; round++) {
+    Timer timer;
+    Source source;
+
+    start_phase(&timer);
+    if (!Source_open(&source, filename)) {
+      fprintf(stderr, "%s: Could not open file\n", filename);
+      return false;
+    }
+    volatile char touched = 0;
+    for (size_t offset = 0; offset < source.size; offset += 4096) {
+      touched += source.data[offset];
+    }
+    end_phase(&timer, &phases[0], source.size, 0);
+    if (round == 0 && source.size > 0) {
+      rounds = MIN_BYTES_PER_FILE / source.size;
+      rounds = rounds < 1 ? 1 : rounds > MAX_ROUNDS ? MAX_ROUNDS : rounds;
+    }
+
+    start_phase(&timer);
+    Command command;
+    long lexed = 0;
+    while (read_command(&source, &command)) {
+      lexed += command.type != S_COMMAND;
+    }
+    end_phase(&timer, &phases[1], source.size, lexed);
+
+    // the same first pass as parse(), from the top of the file again
+    source.pos = source.data;
+    source.line = 1;
+    source.failed = false;
+    CommandStore commands;
+    CommandStore_init(&commands);
+    SymbolTable symbol_table;
+    SymbolTable_init(&symbol_table);
+    start_phase(&timer);
+    bool truncated = false;
+    while (!truncated && read_command(&source, &command)) {
+      if (command.type == S_COMMAND) {
+        add_symbol(&symbol_table, command.address, commands.count);
+      } else if (!store_command(&commands, &command)) {
+        truncated = true;
+      }
+    }
+    end_phase(&timer, &phases[2], source.pos - source.data, commands.count);
+    if (truncated || source.failed) {
+      const char* name = strrchr(filename, '/');
+      name = name != NULL ? name + 1 : filename;
+      if (truncated) {
+        printf("%-32s skipped: more than %i instructions by line %i\n", name, ROM_SIZE,
+            source.line);
+      } else {
+        printf("%-32s skipped: unexpected char '%c' at line %i\n", name, source.unexpected,
+            source.line);
+      }
+      CommandStore_free(&commands);
+      SymbolTable_free(&symbol_table);
+      Source_close(&source);
+      return false;
+    }
+
+    start_phase(&timer);
+    update_symbols(&commands, &symbol_table);
+    end_phase(&timer, &phases[3], 0, commands.pending_count);
+
+    FILE* null = fopen("/dev/null", "w");
+    start_phase(&timer);
+    print_commands(&commands, null);
+    fflush(null);
+    end_phase(&timer, &phases[4], commands.count * 17.0, commands.count);
+    fclose(null);
+
+    CommandStore_free(&commands);
+    SymbolTable_free(&symbol_table);
+    Source_close(&source);
+  }
+  return true;
+}
+
+void report(const char* filename, Phase phases[]) {
+  const char* name = strrchr(filename, '/');
+  name = name != NULL ? name + 1 : filename;
+  for (int p = 0; p < PHASES; p++) {
+    Phase* phase = &phases[p];
+    double seconds = phase->seconds > 0 ? phase->seconds : 1e-9;
+    printf("%-32s %-8s %10.3f", p == 0 ? name : "", phase_names[p], phase->seconds * 1e3);
+    if (phase->bytes > 0) {
+      printf(" %10.1f", phase->bytes / seconds / 1e6);
+    } else {
+      printf(" %10s", "-");
+    }
+    if (phase->instructions > 0) {
+      printf(" %14.0f", phase->instructions / seconds);
+    } else {
+      printf(" %14s", "-");
+    }
+    printf(" %12ld\n", phase->peak_kb);
+  }
+}
+
+void start_phase(Timer* timer) {
+  reset_peak();
+  clock_gettime(CLOCK_MONOTONIC, &timer->start);
+}
+
+void end_phase(Timer* timer, Phase* phase, double bytes, double instructions) {
+  struct timespec stop;
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double seconds = (stop.tv_sec - timer->start.tv_sec) + (stop.tv_nsec - timer->start.tv_nsec) / 1e9;
+  if (phase->seconds < 0 || seconds < phase->seconds) {
+    phase->seconds = seconds;
+  }
+  phase->bytes = bytes;
+  phase->instructions = instructions;
+  long peak = peak_kb();
+  if (peak > phase->peak_kb) {
+    phase->peak_kb = peak;
+  }
+}
+
+// Linux resets the VmHWM high-water mark when 5 is written to clear_refs.
+// Elsewhere the peak simply covers the whole run so far.
+void reset_peak() {
+  FILE* file = fopen("/proc/self/clear_refs", "w");
+  if (file != NULL) {
+    fputs("5", file);
+    fclose(file);
+  }
+}
+
+long peak_kb() {
+  FILE* file = fopen("/proc/self/status", "r");
+  if (file != NULL) {
+    char line[256];
+    long peak = -1;
+    while (fgets(line, sizeof(line), file) != NULL) {
+      if (strncmp(line, "VmHWM:", 6) == 0) {
+        peak = atol(line + 6);
+      }
+    }
+    fclose(file);
+    if (peak >= 0) {
+      return peak;
+    }
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../code.h"
+#include "../lexer.h"
+
+// Measures the cost of turning one lexed C instruction into its 16-bit
+// encoding, i.e. the comp/dest/jump decode and field assembly.
+
+#define ITERATIONS 2000
+
+const char* samples[] = {
+  "D=A", "D=M", "M=D", "AM=M-1", "A=A-1", "D=M-D", "M=0", "D;JNE",
+  "M=-1", "A=M", "0;JMP", "D;JLE", "M=M+1", "D=D+A", "MD=M+1", "D=D|M",
+  "AMD=D&A", "D;JGT", "D=!M", "M=D+M", "D=A-D", "A=-1", "D;JEQ", "M=M-D",
+};
+
+int main() {
+  int sample_count = sizeof(samples) / sizeof(samples[0]);
+  int lines = 4096;
+  // build a source buffer of C instructions to lex once up front
+  size_t size = 1;
+  for (int i = 0; i < lines; i++) {
+    size += strlen(samples[i % sample_count]) + 1;
+  }
+  char* text = malloc(size);
+  char* end = text;
+  for (int i = 0; i < lines; i++) {
+    end += sprintf(end, "%s\n", samples[i % sample_count]);
+  }
+  Source source;
+  Source_init(&source, text, end - text);
+  Command* commands = malloc(lines * sizeof(Command));
+  int count = 0;
+  while (read_command(&source, &commands[count])) {
+    count++;
+  }
+
+  struct timespec start, stop;
+  unsigned checksum = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int n = 0; n < ITERATIONS; n++) {
+    for (int i = 0; i < count; i++) {
+      checksum += encode_c_command(&commands[i]);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double elapsed = (stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec);
+  long total = (long) ITERATIONS * count;
+  printf("decoded %ld C instructions in %.2f ms\n", total, elapsed / 1e6);
+  printf("%.2f ns per C instruction (checksum %u)\n", elapsed / total, checksum);
+  free(commands);
+  free(text);
+  return 0;
+}
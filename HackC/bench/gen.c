@@ -0,0 +1,148 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Writes a synthetic .asm corpus to stdout.
+//
+//   gen <kind> <lines>
+//
+// labels     mostly label definitions, with the odd jump to one of them
+// variables  A instructions naming distinct variables
+// comments   comment lines and blank lines around sparse instructions
+// mixed      code shaped like VM translator output: stack pushes and pops,
+//            calls with return labels and comparisons
+//
+// The output is the same for the same arguments, so runs can be compared.
+// A program has at most 32768 instructions, so once a corpus has used them
+// up the rest of its lines are ones the first pass reads but doesn't store:
+// label definitions for labels, comments and blank lines for the others.
+// Every size up to ten million lines then assembles.
+
+#define MAX_INSTRUCTIONS 32768
+
+unsigned long long state = 88172645463325252ull;
+long instructions = 0;
+
+unsigned next_random() {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state >> 32;
+}
+
+// Whether count more instructions fit in ROM. If so they are counted.
+bool fits(long count) {
+  if (instructions + count > MAX_INSTRUCTIONS) {
+    return false;
+  }
+  instructions += count;
+  return true;
+}
+
+// One line of padding, a blank line every seventh
+long filler(long i) {
+  if (i % 7 == 0) {
+    printf("\n");
+  } else {
+    printf("// %ld: comment text that the lexer has to skip over\n", i);
+  }
+  return 1;
+}
+
+long labels(long lines) {
+  long written = 0;
+  for (long i = 0; written < lines; i++) {
+    printf("(LOOP_%ld)\n", i);
+    written++;
+    if (i % 256 == 255 && written + 2 <= lines && fits(2)) {
+      printf("@LOOP_%u\nD;JNE\n", next_random() % (unsigned) (i + 1));
+      written += 2;
+    }
+  }
+  return written;
+}
+
+long variables(long lines) {
+  long written = 0;
+  for (long i = 0; written < lines; i++) {
+    if (written + 2 <= lines && fits(2)) {
+      printf("@var_%ld\nM=D\n", i % 16000);
+      written += 2;
+    } else {
+      written += filler(i);
+    }
+  }
+  return written;
+}
+
+long comments(long lines) {
+  long written = 0;
+  for (long i = 0; written < lines; i++) {
+    if (i % 300 == 0 && written + 3 <= lines && fits(3)) {
+      printf("@SP\nAM=M-1 // pop\nD=M\n");
+      written += 3;
+    } else {
+      written += filler(i);
+    }
+  }
+  return written;
+}
+
+long mixed(long lines) {
+  long written = 0;
+  // room for the function every call jumps to
+  instructions = 2;
+  for (long i = 0; written + 3 < lines; i++) {
+    unsigned kind = next_random() % 4;
+    long size[] = {7, 5, 10, 12};
+    // labels take a line but no instruction
+    long stored[] = {7, 5, 9, 11};
+    if (written + 3 + size[kind] > lines || !fits(stored[kind])) {
+      written += filler(i);
+      continue;
+    }
+    switch (kind) {
+      case 0:
+        // push constant
+        printf("@%u\nD=A\n@SP\nA=M\nM=D\n@SP\nM=M+1\n", next_random() % 32768);
+        break;
+      case 1:
+        // pop static
+        printf("@SP\nAM=M-1\nD=M\n@Main.%u\nM=D\n", next_random() % 200);
+        break;
+      case 2:
+        // call with a return label
+        printf("@Main.f$ret.%ld\nD=A\n@SP\nA=M\nM=D\n@SP\nM=M+1\n@Main.f\n0;JMP\n(Main.f$ret.%ld)\n", i, i);
+        break;
+      default:
+        // eq
+        printf("@SP\nAM=M-1\nD=M\nA=A-1\nD=M-D\nM=-1\n@EQ_%ld\nD;JEQ\n@SP\nA=M-1\nM=0\n(EQ_%ld)\n", i, i);
+        break;
+    }
+    written += size[kind];
+  }
+  printf("(Main.f)\n@Main.f\n0;JMP\n");
+  return written + 3;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <labels|variables|comments|mixed> <lines>\n", argv[0]);
+    return 1;
+  }
+  long lines = atol(argv[2]);
+  if (strcmp(argv[1], "labels") == 0) {
+    labels(lines);
+  } else if (strcmp(argv[1], "variables") == 0) {
+    variables(lines);
+  } else if (strcmp(argv[1], "comments") == 0) {
+    comments(lines);
+  } else if (strcmp(argv[1], "mixed") == 0) {
+    mixed(lines);
+  } else {
+    fprintf(stderr, "unknown corpus kind: %s\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "parser.h"
+#include "rom.h"
+
+// Content addressed cache of assembled programs. Each entry is a ROM image
+// with a header, named after a hash of the source file and the assembler
+// version:
+//
+//   <cache dir>/<16 hex digit hash>-v<version>.rom
+//
+// After the image come the program's counters for --stats and -O, so a
+// program taken from the cache reports the same numbers as one assembled:
+//
+//   lines, comments, A commands, C commands, labels, variables, removed,
+//   then a CRC-32 of those, each a little-endian uint32
+//
+// Both CRCs are checked on every load, so a damaged entry is simply
+// treated as a miss. The emulators keep their compiled programs and chips
+// in the same directory under the same kind of name, <hash>-aot-v2.so and
+// <hash>-chip-v2.so, and everything is written through temporary files
+// whose names start with the entry's.
+
+#define CACHE_EXTENSION ".rom"
+#define CACHE_HASH_DIGITS 16
+#define CACHE_COUNTERS 7
+#define CACHE_COUNTERS_SIZE ((CACHE_COUNTERS + 1) * 4)
+
+// tells apart temporary files written by threads of the same process
+atomic_int temporary_files;
+
+char* cache_path(const char* directory, uint64_t key, const char* suffix);
+bool is_cache_entry(const char* name);
+bool make_directories(const char* path);
+uint64_t mix(uint64_t value);
+
+uint64_t hash_source(const char* data, size_t size) {
+  uint64_t hash = mix(size ^ 0x9E3779B97F4A7C15ull);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t block;
+    memcpy(&block, data + i, 8);
+    hash = (hash ^ mix(block)) * 0x100000001B3ull;
+  }
+  uint64_t tail = 0;
+  if (i < size) {
+    memcpy(&tail, data + i, size - i);
+  }
+  return mix(hash ^ mix(tail));
+}
+
+// Fills commands, and the program's counters in stats, from the cache.
+// Returns false on a miss.
+bool cache_load(const char* directory, uint64_t key, CommandStore* commands, Stats* stats) {
+  char* path = cache_path(directory, key, "");
+  if (path == NULL) {
+    return false;
+  }
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == -1 || info.st_size < ROM_HEADER_SIZE + CACHE_COUNTERS_SIZE) {
+    close(fd);
+    return false;
+  }
+  size_t size = info.st_size;
+  const uint8_t* image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    return false;
+  }
+  const uint8_t* words = image + ROM_HEADER_SIZE;
+  uint32_t count = get_uint32(image + 4);
+  const uint8_t* counters = image + rom_image_size(count, true);
+  bool valid = memcmp(image, ROM_MAGIC, 4) == 0 && count <= ROM_SIZE &&
+      size == rom_image_size(count, true) + CACHE_COUNTERS_SIZE &&
+      rom_checksum(words, count * 2) == get_uint32(image + 8) &&
+      rom_checksum(counters, CACHE_COUNTERS * 4) == get_uint32(counters + CACHE_COUNTERS * 4);
+  if (valid) {
+    for (uint32_t i = 0; i < count; i++) {
+      CommandStore_add(commands, words[i * 2] | words[i * 2 + 1] << 8);
+    }
+    long* fields[CACHE_COUNTERS] = {&stats->lines, &stats->comments, &stats->a_commands,
+        &stats->c_commands, &stats->labels, &stats->variables, &stats->removed};
+    for (int i = 0; i < CACHE_COUNTERS; i++) {
+      *fields[i] = get_uint32(counters + i * 4);
+    }
+  }
+  munmap((void*) image, size);
+  return valid;
+}
+
+// Saves an assembled program and its counters. The entry is written under
+// a temporary name and renamed into place, so concurrent runs never see
+// half an entry.
+void cache_store(const char* directory, uint64_t key, CommandStore* commands, Stats* stats) {
+  if (!make_directories(directory)) {
+    return;
+  }
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%ld.%d.tmp", (long) getpid(), atomic_fetch_add(&temporary_files, 1));
+  char* temporary = cache_path(directory, key, suffix);
+  char* path = cache_path(directory, key, "");
+  if (temporary == NULL || path == NULL) {
+    free(temporary);
+    free(path);
+    return;
+  }
+  size_t size = rom_image_size(commands->count, true);
+  uint8_t* entry = malloc(size + CACHE_COUNTERS_SIZE);
+  if (entry != NULL) {
+    fill_rom_image(commands, true, entry);
+    long fields[CACHE_COUNTERS] = {stats->lines, stats->comments, stats->a_commands,
+        stats->c_commands, stats->labels, stats->variables, stats->removed};
+    for (int i = 0; i < CACHE_COUNTERS; i++) {
+      put_uint32(entry + size + i * 4, fields[i]);
+    }
+    put_uint32(entry + size + CACHE_COUNTERS * 4, rom_checksum(entry + size, CACHE_COUNTERS * 4));
+    if (write_file(temporary, entry, size + CACHE_COUNTERS_SIZE)) {
+      rename(temporary, path);
+    } else {
+      unlink(temporary);
+    }
+  }
+  free(entry);
+  free(temporary);
+  free(path);
+}
+
+
+// Deletes every entry any of the tools cached, and temporary files left
+// behind by runs that were stopped. Returns how many were removed, or -1
+// if there wasn't the memory to do it.
+int cache_clear(const char* directory) {
+  DIR* entries = opendir(directory);
+  if (entries == NULL) {
+    return 0;
+  }
+  int removed = 0;
+  struct dirent* entry;
+  while ((entry = readdir(entries)) != NULL) {
+    if (!is_cache_entry(entry->d_name)) {
+      continue;
+    }
+    char* path = malloc(strlen(directory) + strlen(entry->d_name) + 2);
+    if (path == NULL) {
+      removed = -1;
+      break;
+    }
+    sprintf(path, "%s/%s", directory, entry->d_name);
+    if (unlink(path) == 0) {
+      removed++;
+    }
+    free(path);
+  }
+  closedir(entries);
+  return removed;
+}
+
+// Whether a file is named like a cache entry: a hash in hex, then a dash.
+// Other files that happen to be in the directory are left alone.
+bool is_cache_entry(const char* name) {
+  for (int i = 0; i < CACHE_HASH_DIGITS; i++) {
+    if (!isxdigit((unsigned char) name[i])) {
+      return false;
+    }
+  }
+  return name[CACHE_HASH_DIGITS] == '-';
+}
+
+// $XDG_CACHE_HOME/hackc, or ~/.cache/hackc. NULL if neither is known.
+char* default_cache_dir() {
+  const char* base = getenv("XDG_CACHE_HOME");
+  const char* suffix = "/hackc";
+  if (base == NULL || base[0] == '\0') {
+    base = getenv("HOME");
+    suffix = "/.cache/hackc";
+  }
+  if (base == NULL || base[0] == '\0') {
+    return NULL;
+  }
+  char* directory = malloc(strlen(base) + strlen(suffix) + 1);
+  if (directory == NULL) {
+    return NULL;
+  }
+  sprintf(directory, "%s%s", base, suffix);
+  return directory;
+}
+
+char* cache_path(const char* directory, uint64_t key, const char* suffix) {
+  size_t length = strlen(directory) + strlen(suffix) + 48;
+  char* path = malloc(length);
+  if (path == NULL) {
+    return NULL;
+  }
+  snprintf(path, length, "%s/%016llx-v%d%s%s", directory, (unsigned long long) key,
+      ASSEMBLER_VERSION, CACHE_EXTENSION, suffix);
+  return path;
+}
+
+// mkdir -p
+bool make_directories(const char* path) {
+  char* partial = strdup(path);
+  if (partial == NULL) {
+    return false;
+  }
+  bool made = true;
+  for (char* slash = partial + 1; made; slash++) {
+    bool end = *slash == '\0';
+    if (*slash == '/' || end) {
+      *slash = '\0';
+      made = mkdir(partial, 0755) == 0 || errno == EEXIST;
+      if (end) {
+        break;
+      }
+      *slash = '/';
+    }
+  }
+  free(partial);
+  return made;
+}
+
+// finaliser from MurmurHash3
+uint64_t mix(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xFF51AFD7ED558CCDull;
+  value ^= value >> 33;
+  value *= 0xC4CEB9FE1A85EC53ull;
+  value ^= value >> 33;
+  return value;
+}
@@ -0,0 +1,17 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "commands.h"
+#include "stats.h"
+
+uint64_t hash_source(const char* data, size_t size);
+bool cache_load(const char* directory, uint64_t key, CommandStore* commands, Stats* stats);
+void cache_store(const char* directory, uint64_t key, CommandStore* commands, Stats* stats);
+int cache_clear(const char* directory);
+char* default_cache_dir();
+bool make_directories(const char* path);
+
+#endif
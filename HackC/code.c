@@ -1,89 +1,139 @@
-#include <string.h>
+#include "code.h"
 
-// Used to store lookup tables of comp, dest and jump machine code
-// from assembly instruction
-struct codeMap {
-  char* assembly;
-  char* machine_code;
-};
+// Mnemonics are packed into a 32-bit key, one byte per character with the
+// kind of field in the top byte, and placed in codeTable by a perfect
+// multiplicative hash. CODE_HASH_MULTIPLIER was chosen so that no two keys
+// share a slot; adding a mnemonic means searching for a new odd multiplier
+// that keeps every key in its own slot.
+//
+// Comp values include the a-bit (bit 6) so the whole 7-bit field comes
+// from one lookup. Commutative operations are listed in both orders.
+enum {COMP = 1, DEST = 2, JUMP = 3};
 
-const struct codeMap instructionMap[] = {
-  {"0",   "101010"},
-  {"1",   "111111"},
-  {"-1",  "111010"},
-  {"D",   "001100"},
-  {"A",   "110000"},
-  {"M",   "110000"},
-  {"!D",  "001101"},
-  {"!A",  "110011"},
-  {"!M",  "110001"},
-  {"-D",  "001111"},
-  {"-A",  "110011"},
-  {"-M",  "110011"},
-  {"D+1", "011111"},
-  {"A+1", "110111"},
-  {"M+1", "110111"},
-  {"D-1", "001110"},
-  {"A-1", "110010"},
-  {"M-1", "110010"},
-  {"D+A", "000010"},
-  {"D+M", "000010"},
-  {"D-A", "010011"},
-  {"D-M", "010011"},
-  {"A-D", "000111"},
-  {"M-D", "000111"},
-  {"D&A", "000000"},
-  {"D&M", "000000"},
-  {"D|A", "010101"},
-  {"D|M", "010101"},
-  {NULL, 0}
-};
+#define CODE_KEY1(kind, a) ((uint32_t) (a) | (uint32_t) (kind) << 24)
+#define CODE_KEY2(kind, a, b) (CODE_KEY1(kind, a) | (uint32_t) (b) << 8)
+#define CODE_KEY3(kind, a, b, c) (CODE_KEY2(kind, a, b) | (uint32_t) (c) << 16)
+#define CODE_HASH_MULTIPLIER 0x5684a5adu
+#define CODE_HASH_BITS 7
 
-const struct codeMap destMap[] = {
-  {"M",   "001"},
-  {"D",   "010"},
-  {"MD",  "011"},
-  {"A",   "100"},
-  {"AM",  "101"},
-  {"AD",  "110"},
-  {"AMD", "111"},
-  {NULL, 0}
-};
+typedef struct {
+  uint32_t key;
+  uint16_t machine_code;
+} CodeSlot;
 
-const struct codeMap jumpMap[] = {
-  {"JGT", "001"},
-  {"JEQ", "010"},
-  {"JGE", "011"},
-  {"JLT", "100"},
-  {"JNE", "101"},
-  {"JLE", "110"},
-  {"JMP", "111"},
-  {NULL, 0}
+const CodeSlot codeTable[1 << CODE_HASH_BITS] = {
+  [0] = {CODE_KEY3(COMP, 'D', '+', 'A'), 0x02},
+  [1] = {CODE_KEY2(DEST, 'D', 'A'), 6},
+  [2] = {CODE_KEY3(COMP, 'M', '-', 'D'), 0x47},
+  [5] = {CODE_KEY3(COMP, 'D', '-', 'A'), 0x13},
+  [6] = {CODE_KEY2(DEST, 'M', 'A'), 5},
+  [7] = {CODE_KEY3(DEST, 'M', 'A', 'D'), 7},
+  [8] = {CODE_KEY2(COMP, '!', 'D'), 0x0D},
+  [9] = {CODE_KEY3(JUMP, 'J', 'L', 'E'), 6},
+  [13] = {CODE_KEY3(JUMP, 'J', 'N', 'E'), 5},
+  [15] = {CODE_KEY2(COMP, '-', 'D'), 0x0F},
+  [22] = {CODE_KEY3(COMP, 'D', '&', 'M'), 0x40},
+  [24] = {CODE_KEY3(JUMP, 'J', 'G', 'T'), 1},
+  [26] = {CODE_KEY3(JUMP, 'J', 'E', 'Q'), 2},
+  [27] = {CODE_KEY2(DEST, 'A', 'M'), 5},
+  [28] = {CODE_KEY3(DEST, 'A', 'M', 'D'), 7},
+  [29] = {CODE_KEY2(DEST, 'D', 'M'), 3},
+  [30] = {CODE_KEY1(COMP, '1'), 0x3F},
+  [35] = {CODE_KEY2(COMP, '-', '1'), 0x3A},
+  [37] = {CODE_KEY3(DEST, 'D', 'M', 'A'), 7},
+  [40] = {CODE_KEY1(DEST, 'A'), 4},
+  [42] = {CODE_KEY1(DEST, 'D'), 2},
+  [43] = {CODE_KEY3(COMP, 'A', '&', 'D'), 0x00},
+  [44] = {CODE_KEY3(COMP, '1', '+', 'M'), 0x77},
+  [47] = {CODE_KEY1(DEST, 'M'), 1},
+  [49] = {CODE_KEY3(DEST, 'A', 'D', 'M'), 7},
+  [50] = {CODE_KEY3(COMP, 'M', '&', 'D'), 0x40},
+  [52] = {CODE_KEY3(COMP, 'D', '&', 'A'), 0x00},
+  [61] = {CODE_KEY3(JUMP, 'J', 'G', 'E'), 3},
+  [65] = {CODE_KEY2(COMP, '!', 'A'), 0x31},
+  [67] = {CODE_KEY3(COMP, '1', '+', 'D'), 0x1F},
+  [70] = {CODE_KEY2(DEST, 'A', 'D'), 6},
+  [72] = {CODE_KEY2(COMP, '-', 'A'), 0x33},
+  [74] = {CODE_KEY3(COMP, '1', '+', 'A'), 0x37},
+  [77] = {CODE_KEY2(DEST, 'M', 'D'), 3},
+  [81] = {CODE_KEY3(COMP, 'A', '+', '1'), 0x37},
+  [82] = {CODE_KEY1(COMP, 'A'), 0x30},
+  [83] = {CODE_KEY3(COMP, 'D', '+', '1'), 0x1F},
+  [84] = {CODE_KEY1(COMP, 'D'), 0x0C},
+  [85] = {CODE_KEY3(COMP, 'A', '-', '1'), 0x32},
+  [86] = {CODE_KEY3(DEST, 'M', 'D', 'A'), 7},
+  [87] = {CODE_KEY3(COMP, 'D', '-', '1'), 0x0E},
+  [88] = {CODE_KEY3(COMP, 'M', '+', '1'), 0x77},
+  [89] = {CODE_KEY1(COMP, 'M'), 0x70},
+  [90] = {CODE_KEY3(JUMP, 'J', 'M', 'P'), 7},
+  [92] = {CODE_KEY2(COMP, '!', 'M'), 0x71},
+  [93] = {CODE_KEY3(COMP, 'M', '-', '1'), 0x72},
+  [94] = {CODE_KEY3(COMP, 'D', '|', 'M'), 0x55},
+  [98] = {CODE_KEY3(COMP, 'D', '+', 'M'), 0x42},
+  [99] = {CODE_KEY3(JUMP, 'J', 'L', 'T'), 4},
+  [100] = {CODE_KEY2(COMP, '-', 'M'), 0x73},
+  [103] = {CODE_KEY3(COMP, 'D', '-', 'M'), 0x53},
+  [108] = {CODE_KEY3(DEST, 'D', 'A', 'M'), 7},
+  [114] = {CODE_KEY1(COMP, '0'), 0x2A},
+  [115] = {CODE_KEY3(COMP, 'A', '|', 'D'), 0x15},
+  [119] = {CODE_KEY3(COMP, 'A', '+', 'D'), 0x02},
+  [122] = {CODE_KEY3(COMP, 'M', '|', 'D'), 0x55},
+  [123] = {CODE_KEY3(COMP, 'A', '-', 'D'), 0x07},
+  [124] = {CODE_KEY3(COMP, 'D', '|', 'A'), 0x15},
+  [126] = {CODE_KEY3(COMP, 'M', '+', 'D'), 0x42},
 };
 
-char* comp(char* assembly) {
-  for (int i = 0; instructionMap[i].assembly != NULL; i++) {
-    if (strcmp(assembly, instructionMap[i].assembly) == 0) {
-      return instructionMap[i].machine_code;
-    }
-  }  
-  return NULL;
+int lookup(int kind, Span assembly);
+
+// Each returns the field value, or -1 if the mnemonic is unknown
+int comp(Span assembly) {
+  return lookup(COMP, assembly);
 }
 
-char* dest(char* assembly) {
-  for (int i = 0; destMap[i].assembly != NULL; i++) {
-    if (strcmp(assembly, destMap[i].assembly) == 0) {
-      return destMap[i].machine_code;
-    }
+int dest(Span assembly) {
+  return lookup(DEST, assembly);
+}
+
+int jump(Span assembly) {
+  return lookup(JUMP, assembly);
+}
+
+int lookup(int kind, Span assembly) {
+  if (assembly.length < 1 || assembly.length > 3) {
+    return -1;
   }
-  return NULL;
+  uint32_t key = (uint32_t) kind << 24;
+  for (int i = 0; i < assembly.length; i++) {
+    key |= (uint32_t) (unsigned char) assembly.start[i] << (8 * i);
+  }
+  const CodeSlot* slot = &codeTable[(key * CODE_HASH_MULTIPLIER) >> (32 - CODE_HASH_BITS)];
+  return slot->key == key ? slot->machine_code : -1;
+}
+
+uint16_t encode_a_command(int address) {
+  return (uint16_t) address;
 }
 
-char* jump(char* assembly) {
-  for (int i = 0; jumpMap[i].assembly != NULL; i++) {
-    if (strcmp(assembly, jumpMap[i].assembly) == 0) {
-      return jumpMap[i].machine_code;
+// C instruction layout: 111a cccc ccdd djjj
+// Unknown mnemonics leave their field as zeros.
+uint16_t encode_c_command(const Command* command) {
+  uint16_t instruction = 0xE000;
+  // the comp field carries the a-bit, so it lands on bit 12
+  int code = comp(command->comp);
+  if (code != -1) {
+    instruction |= code << 6;
+  }
+  if (command->has_dest) {
+    code = dest(command->dest);
+    if (code != -1) {
+      instruction |= code << 3;
+    }
+  }
+  if (command->has_jump) {
+    code = jump(command->jump);
+    if (code != -1) {
+      instruction |= code;
     }
   }
-  return NULL;
+  return instruction;
 }
@@ -1,3 +1,8 @@
-char* comp(char* assembly);
-char* dest(char* assembly);
-char* jump(char* assembly);
+#include <stdint.h>
+#include "lexer.h"
+
+int comp(Span assembly);
+int dest(Span assembly);
+int jump(Span assembly);
+uint16_t encode_a_command(int address);
+uint16_t encode_c_command(const Command* command);
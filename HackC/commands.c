@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include "commands.h"
+
+void CommandStore_init(CommandStore* store) {
+  store->pages = NULL;
+  store->page_count = 0;
+  store->page_capacity = 0;
+  store->count = 0;
+  store->pending = NULL;
+  store->pending_count = 0;
+  store->pending_capacity = 0;
+}
+
+void CommandStore_free(CommandStore* store) {
+  for (int i = 0; i < store->page_count; i++) {
+    free(store->pages[i]);
+  }
+  free(store->pages);
+  free(store->pending);
+  CommandStore_init(store);
+}
+
+// Appends an instruction. Returns false once the program no longer fits
+// in ROM.
+bool CommandStore_add(CommandStore* store, uint16_t word) {
+  if (store->count == ROM_SIZE) {
+    return false;
+  }
+  int page = store->count / WORDS_PER_PAGE;
+  if (page == store->page_count) {
+    if (store->page_count == store->page_capacity) {
+      store->page_capacity = store->page_capacity == 0 ? 4 : store->page_capacity * 2;
+      store->pages = realloc(store->pages, store->page_capacity * sizeof(uint16_t*));
+    }
+    store->pages[store->page_count++] = malloc(WORDS_PER_PAGE * sizeof(uint16_t));
+  }
+  *CommandStore_word(store, store->count++) = word;
+  return true;
+}
+
+// Marks the most recently added word as waiting on a symbol
+void CommandStore_add_pending(CommandStore* store, Span symbol) {
+  if (store->pending_count == store->pending_capacity) {
+    store->pending_capacity = store->pending_capacity == 0 ? 256 : store->pending_capacity * 2;
+    store->pending = realloc(store->pending, store->pending_capacity * sizeof(PendingSymbol));
+  }
+  store->pending[store->pending_count].index = store->count - 1;
+  store->pending[store->pending_count].symbol = symbol;
+  store->pending_count++;
+}
+
+uint16_t* CommandStore_word(CommandStore* store, int index) {
+  return &store->pages[index / WORDS_PER_PAGE][index % WORDS_PER_PAGE];
+}
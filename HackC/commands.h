@@ -0,0 +1,39 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lexer.h"
+
+// The Hack ROM holds 32K instructions, which is the only limit on the
+// size of a program.
+#define ROM_SIZE 32768
+#define WORDS_PER_PAGE 4096
+
+// An A instruction whose symbol can't be resolved until every label has
+// been seen. The word at index is filled in by the second pass.
+typedef struct {
+  int index;
+  Span symbol;
+} PendingSymbol;
+
+// Growable store of encoded instructions. Words are kept in fixed size
+// pages so growing never moves a word that has already been stored, and
+// memory use follows the size of the program.
+typedef struct {
+  uint16_t** pages;
+  int page_count;
+  int page_capacity;
+  int count;
+  PendingSymbol* pending;
+  int pending_count;
+  int pending_capacity;
+} CommandStore;
+
+void CommandStore_init(CommandStore* store);
+void CommandStore_free(CommandStore* store);
+bool CommandStore_add(CommandStore* store, uint16_t word);
+void CommandStore_add_pending(CommandStore* store, Span symbol);
+uint16_t* CommandStore_word(CommandStore* store, int index);
+
+#endif
@@ -0,0 +1,75 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "code.h"
+#include "diagnostics.h"
+
+void Diagnostics_init(Diagnostics* diagnostics) {
+  diagnostics->items = NULL;
+  diagnostics->count = 0;
+  diagnostics->capacity = 0;
+}
+
+void Diagnostics_free(Diagnostics* diagnostics) {
+  free(diagnostics->items);
+  Diagnostics_init(diagnostics);
+}
+
+void add_diagnostic(Diagnostics* diagnostics, HackSeverity severity, int line, int address, const char* format, ...) {
+  if (diagnostics->count == diagnostics->capacity) {
+    diagnostics->capacity = diagnostics->capacity == 0 ? 16 : diagnostics->capacity * 2;
+    diagnostics->items = realloc(diagnostics->items, diagnostics->capacity * sizeof(HackDiagnostic));
+  }
+  HackDiagnostic* diagnostic = &diagnostics->items[diagnostics->count++];
+  diagnostic->severity = severity;
+  diagnostic->line = line;
+  diagnostic->address = address;
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(diagnostic->message, sizeof(diagnostic->message), format, arguments);
+  va_end(arguments);
+}
+
+bool has_errors(Diagnostics* diagnostics) {
+  for (int i = 0; i < diagnostics->count; i++) {
+    if (diagnostics->items[i].severity == HACK_ERROR) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Warns about commands that will encode, but not as written. Unknown
+// mnemonics leave their field as zeros and addresses wider than 15 bits
+// turn into C instructions. An @ with no address has nothing to encode,
+// and a label without its ')' may have run into what follows it, so those
+// are errors.
+void check_command(Diagnostics* diagnostics, Command* command, int line, int address) {
+  if (command->type == A_COMMAND) {
+    if (command->address.length == 0) {
+      add_diagnostic(diagnostics, HACK_ERROR, line, address, "Missing address after '@'");
+    } else if (isdigit((unsigned char) command->address.start[0]) && span_to_int(command->address) > 32767) {
+      add_diagnostic(diagnostics, HACK_WARNING, line, address, "Address %.*s does not fit in 15 bits",
+          command->address.length, command->address.start);
+    }
+  } else if (command->type == S_COMMAND) {
+    if (!command->has_close) {
+      add_diagnostic(diagnostics, HACK_ERROR, line, address, "Expected ')' after label '(%.*s'",
+          command->address.length, command->address.start);
+    }
+  } else if (command->type == C_COMMAND) {
+    if (comp(command->comp) == -1) {
+      add_diagnostic(diagnostics, HACK_WARNING, line, address, "Unknown comp '%.*s'",
+          command->comp.length, command->comp.start);
+    }
+    if (command->has_dest && dest(command->dest) == -1) {
+      add_diagnostic(diagnostics, HACK_WARNING, line, address, "Unknown dest '%.*s'",
+          command->dest.length, command->dest.start);
+    }
+    if (command->has_jump && jump(command->jump) == -1) {
+      add_diagnostic(diagnostics, HACK_WARNING, line, address, "Unknown jump '%.*s'",
+          command->jump.length, command->jump.start);
+    }
+  }
+}
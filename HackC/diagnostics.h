@@ -0,0 +1,21 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stdbool.h>
+#include "assembler.h"
+#include "lexer.h"
+
+// A growing list of diagnostics for one run of the assembler
+typedef struct {
+  HackDiagnostic* items;
+  int count;
+  int capacity;
+} Diagnostics;
+
+void Diagnostics_init(Diagnostics* diagnostics);
+void Diagnostics_free(Diagnostics* diagnostics);
+void add_diagnostic(Diagnostics* diagnostics, HackSeverity severity, int line, int address, const char* format, ...);
+bool has_errors(Diagnostics* diagnostics);
+void check_command(Diagnostics* diagnostics, Command* command, int line, int address);
+
+#endif
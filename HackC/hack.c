@@ -1,18 +1,110 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "cache.h"
 #include "parser.h"
 
 void usage(char* executable_name);
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
+  Options options = {TEXT_OUTPUT, false, NULL, 1, NULL, false, false};
+  char* cache_dir = NULL;
+  bool use_cache = false;
+  bool clear_cache = false;
+  char** inputs = malloc(argc * sizeof(char*));
+  int input_count = 0;
+  int threads = 0;
+  bool valid = true;
+  for (int i = 1; i < argc && valid; i++) {
+    if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--binary") == 0) {
+      options.format = BINARY_OUTPUT;
+    } else if (strcmp(argv[i], "--header") == 0) {
+      options.header = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      options.output = argv[++i];
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+      valid = threads > 0;
+    } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+      free(cache_dir);
+      cache_dir = strdup(argv[++i]);
+      use_cache = true;
+    } else if (strcmp(argv[i], "--cache") == 0) {
+      use_cache = true;
+    } else if (strcmp(argv[i], "-O") == 0) {
+      options.optimize = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      options.stats = true;
+    } else if (strcmp(argv[i], "--no-cache") == 0) {
+      use_cache = false;
+    } else if (strcmp(argv[i], "--clear-cache") == 0) {
+      clear_cache = true;
+    } else if (argv[i][0] != '-') {
+      inputs[input_count++] = argv[i];
+    } else {
+      valid = false;
+    }
+  }
+  // the cache is only used when asked for, in ~/.cache/hackc unless
+  // another directory is given
+  if (cache_dir == NULL && (use_cache || clear_cache)) {
+    cache_dir = default_cache_dir();
+  }
+  if (clear_cache && cache_dir != NULL) {
+    int removed = cache_clear(cache_dir);
+    if (removed < 0) {
+      fprintf(stderr, "%s: Could not clear the cache\n", cache_dir);
+    } else {
+      fprintf(stderr, "Removed %i cached files from %s\n", removed, cache_dir);
+    }
+    if (valid && input_count == 0) {
+      free(cache_dir);
+      free(inputs);
+      return 0;
+    }
+  }
+  if (use_cache) {
+    options.cache_dir = cache_dir;
+  }
+  bool batch = input_count > 1 || (input_count == 1 && is_directory(inputs[0]));
+  if (!valid || input_count == 0 || (batch && options.output != NULL)) {
     usage(argv[0]);
+    free(cache_dir);
+    free(inputs);
+    return 1;
+  }
+  if (threads == 0) {
+    threads = default_thread_count();
+  }
+  int status = 0;
+  if (batch) {
+    status = assemble_files(inputs, input_count, &options, threads) == 0 ? 0 : 1;
   } else {
-    parse(argv[1]);
+    options.threads = threads;
+    status = parse(inputs[0], &options) ? 0 : 1;
   }
-  return 0;
+  free(cache_dir);
+  free(inputs);
+  return status;
 }
 
 void usage(char* executable_name) {
-  printf("usage: %s <input.asm>\n", executable_name);
+  printf("usage: %s [options] [-o output] <input.asm>\n", executable_name);
+  printf("       %s [options] <input.asm|directory>...\n", executable_name);
   printf("An assembler for the Hack platform.\n");
+  printf("  -b, --binary  write a little-endian 16-bit ROM image\n");
+  printf("  --header      start the ROM image with a count and CRC-32\n");
+  printf("  -o output     write to a file instead of stdout\n");
+  printf("  --cache       reuse programs assembled before, keeping them in\n");
+  printf("                $XDG_CACHE_HOME/hackc or ~/.cache/hackc\n");
+  printf("  --cache-dir d use the cache, kept in d instead\n");
+  printf("  --no-cache    neither read nor write the cache (the default)\n");
+  printf("  --clear-cache delete everything in the cache first\n");
+  printf("  -O            remove redundant instructions and report how many\n");
+  printf("  --stats       write phase timings and counters to stderr as JSON\n");
+  printf("  -j threads    threads to use (defaults to one per core). Several\n");
+  printf("                inputs are assembled at once, each output written\n");
+  printf("                next to its input; a large single file is split\n");
+  printf("                into chunks assembled in parallel\n");
 }
@@ -0,0 +1,213 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lexer.h"
+
+bool is_start_of_command(char c);
+bool skip_to_next_command(Source* source);
+void split_c_command(Span string, Command* command);
+
+// Maps the whole file into memory so the lexer can scan it in place.
+// Commands read from the source point straight into this mapping, so it
+// must stay open until the last command has been printed.
+bool Source_open(Source* source, const char* filename) {
+  Source_init(source, NULL, 0);
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == -1) {
+    close(fd);
+    return false;
+  }
+  source->size = info.st_size;
+  if (source->size > 0) {
+    void* data = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    source->data = data;
+    source->mapped = true;
+  }
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+  source->pos = source->data;
+  source->end = source->data + source->size;
+  return true;
+}
+
+// Sets up a source over text that is already in memory
+void Source_init(Source* source, const char* data, size_t size) {
+  source->line = 1;
+  source->command_index = 0;
+  source->total_commands = 0;
+  source->data = data;
+  source->pos = data;
+  source->end = data + size;
+  source->size = size;
+  source->mapped = false;
+  source->failed = false;
+  source->comments = 0;
+  source->a_commands = 0;
+  source->c_commands = 0;
+  source->labels = 0;
+}
+
+// Unmaps the file if Source_open mapped one. Text given to Source_init is
+// left to the caller.
+void Source_close(Source* source) {
+  if (source->mapped) {
+    munmap((void*) source->data, source->size);
+  }
+  source->mapped = false;
+  source->data = NULL;
+  source->pos = NULL;
+  source->end = NULL;
+  source->size = 0;
+}
+
+// Reads the next command from the source. Returns false once the end of
+// the file has been reached, or on a parse error (source->failed is set).
+bool read_command(Source* source, Command* command) {
+  if (!skip_to_next_command(source)) {
+    return false;
+  }
+  // a command runs until the next whitespace or the start of a comment
+  const char* start = source->pos;
+  while (source->pos < source->end && !isspace((unsigned char) *source->pos) && *source->pos != '/') {
+    source->pos++;
+  }
+  Span string = {start, source->pos - start};
+  command->has_dest = false;
+  command->has_jump = false;
+  command->has_close = false;
+  // the at symbol tells us it's a A instruction
+  if (string.start[0] == '@') {
+    command->type = A_COMMAND;
+    source->a_commands++;
+    // everything after the at is a postitive integer or a symbol name
+    command->address.start = string.start + 1;
+    command->address.length = string.length - 1;
+  } else if (string.start[0] == '(') {
+    command->type = S_COMMAND;
+    source->labels++;
+    command->address.start = string.start + 1;
+    command->address.length = string.length - 1;
+    if (command->address.length > 0 && command->address.start[command->address.length - 1] == ')') {
+      command->address.length--;
+      command->has_close = true;
+    }
+  } else {
+    command->type = C_COMMAND;
+    source->c_commands++;
+    split_c_command(string, command);
+  }
+  return true;
+}
+
+//
+// Works out the C instruction fields
+//
+// C instruction
+// dest=comp;jump
+// either dest or jump may be empty
+// if dest is empty. the '=' is omitted
+// if jump is empty, the ';' is omitted
+//
+// i.e dest=comp;jump, comp;jump, dest=comp.
+void split_c_command(Span string, Command* command) {
+  const char* end = string.start + string.length;
+  const char* equals = memchr(string.start, '=', string.length);
+  const char* semicolon = memchr(string.start, ';', string.length);
+  const char* comp_start = string.start;
+  const char* comp_end = end;
+  if (equals != NULL) {
+    command->has_dest = true;
+    command->dest.start = string.start;
+    command->dest.length = equals - string.start;
+    comp_start = equals + 1;
+  }
+  if (semicolon != NULL) {
+    command->has_jump = true;
+    command->jump.start = semicolon + 1;
+    command->jump.length = end - (semicolon + 1);
+    comp_end = semicolon;
+  }
+  command->comp.start = comp_start;
+  command->comp.length = comp_end - comp_start;
+}
+
+// Skips all whitespace and comments until the
+// start of the next command
+bool skip_to_next_command(Source* source) {
+  while (source->pos < source->end) {
+    char c = *source->pos;
+    if (c == '\n') {
+      source->line++;
+      source->pos++;
+    } else if (isspace((unsigned char) c)) {
+      source->pos++;
+    } else if (c == '/') {
+      // will skip anything starting with a forward slash to the end of the
+      // line. Although comments start with two forward slashes, slashes
+      // don't appear in assembler instructions so we can avoid looking ahead
+      // one character.
+      const char* newline = memchr(source->pos, '\n', source->end - source->pos);
+      source->comments++;
+      source->pos = newline != NULL ? newline : source->end;
+    } else if (is_start_of_command(c)) {
+      return true;
+    } else {
+      source->failed = true;
+      source->unexpected = c;
+      return false;
+    }
+  }
+  return false;
+}
+
+// Returns true if start of a command.
+// Uses a really simple switch on all possible chars
+// in the assembly language (or a digit).
+bool is_start_of_command(char c) {
+  switch(c) {
+    case '@':
+    case 'D':
+    case 'M':
+    case 'A':
+    case '=':
+    case '+':
+    case '-':
+    case ';':
+    case 'J':
+    case 'G':
+    case 'T':
+    case 'L':
+    case 'E':
+    case '(':
+    case '!':
+      return true;
+      break;
+    default:
+      return isdigit((unsigned char) c);
+  }
+}
+
+bool span_equals(Span span, const char* string) {
+  return strncmp(span.start, string, span.length) == 0 && string[span.length] == '\0';
+}
+
+// Stops growing past a million, which is already far outside any address
+int span_to_int(Span span) {
+  int value = 0;
+  for (int i = 0; i < span.length && isdigit((unsigned char) span.start[i]) && value < 1000000; i++) {
+    value = value * 10 + (span.start[i] - '0');
+  }
+  return value;
+}
@@ -0,0 +1,57 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A run of characters inside the mapped source file. Spans are not null
+// terminated, so the length always travels with the pointer.
+typedef struct {
+  const char* start;
+  int length;
+} Span;
+
+// All information about a command
+// Added a type for symbol definitions, although not really a command
+typedef struct {
+  enum {A_COMMAND, C_COMMAND, S_COMMAND} type;
+  Span address;
+  Span dest;
+  Span comp;
+  Span jump;
+  bool has_dest;
+  bool has_jump;
+  // whether a label ends with its ')'
+  bool has_close;
+} Command;
+
+// stores info about the current source file
+typedef struct {
+  int line;
+  int command_index;
+  int total_commands;
+  const char* data;
+  const char* pos;
+  const char* end;
+  size_t size;
+  // whether data is a mapping made by Source_open, which Source_close
+  // unmaps. Text given to Source_init belongs to the caller.
+  bool mapped;
+  // set when the lexer stops on a character it doesn't understand
+  bool failed;
+  char unexpected;
+  // what the lexer has seen so far
+  long comments;
+  long a_commands;
+  long c_commands;
+  long labels;
+} Source;
+
+bool Source_open(Source* source, const char* filename);
+void Source_init(Source* source, const char* data, size_t size);
+void Source_close(Source* source);
+bool read_command(Source* source, Command* command);
+bool span_equals(Span span, const char* string);
+int span_to_int(Span span);
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include "parallel.h"
+#include "diagnostics.h"
+#include "parser.h"
+#include "pool.h"
+
+// Two-pass assembly of one large file on several threads.
+//
+// The mapped file is cut into chunks at line boundaries and each chunk is
+// lexed and encoded on its own thread, collecting its labels and symbol
+// references locally. A prefix sum over the chunk instruction counts gives
+// every chunk its base address, and the labels are then entered into the
+// symbol table in file order. References to labels and built-in symbols
+// are resolved per chunk in parallel. Whatever is left must be a variable,
+// and those are allocated on one thread in file order, so RAM addresses
+// from 16 up are handed out exactly as the serial assembler would.
+
+typedef struct {
+  Span name;
+  int index;
+} Label;
+
+typedef struct {
+  Source source;
+  CommandStore commands;
+  Label* labels;
+  int label_count;
+  int label_capacity;
+  // pending references that aren't labels or built-in symbols
+  int* unresolved;
+  int unresolved_count;
+  // address of the chunk's first instruction
+  int base;
+  // set when the chunk alone holds more instructions than fit in ROM
+  bool full;
+  // lookups made while resolving the chunk's references
+  SymbolCounters counters;
+  // warnings, with lines and addresses relative to the chunk
+  Diagnostics diagnostics;
+  const SymbolTable* symbol_table;
+} Chunk;
+
+void* scan_chunk(void* argument);
+void* resolve_chunk(void* argument);
+void add_label(Chunk* chunk, Span name, int index);
+int pending_in_rom(Chunk* chunk);
+int line_of_instruction(Chunk* chunk, int index);
+
+// Runs both passes and fills commands. Returns true if the program was
+// truncated to fit in ROM. On a parse error source->failed is set, along
+// with the line and character, as the serial lexer would. Warnings are
+// added to diagnostics in file order.
+bool parallel_passes(Source* source, CommandStore* commands, SymbolTable* symbol_table, int threads,
+    Stats* stats, Diagnostics* diagnostics) {
+  struct timespec clock;
+  clock_gettime(CLOCK_MONOTONIC, &clock);
+  Chunk* chunks = calloc(threads, sizeof(Chunk));
+  int count = 0;
+  const char* start = source->data;
+  for (int i = 0; i < threads && start < source->end; i++) {
+    const char* end = source->data + source->size * (i + 1) / threads;
+    if (i == threads - 1) {
+      end = source->end;
+    } else if (end < start) {
+      end = start;
+    }
+    // move the cut to just after the next newline
+    const char* newline = memchr(end, '\n', source->end - end);
+    end = newline != NULL ? newline + 1 : source->end;
+    Chunk* chunk = &chunks[count++];
+    Source_init(&chunk->source, start, end - start);
+    chunk->symbol_table = symbol_table;
+    CommandStore_init(&chunk->commands);
+    Diagnostics_init(&chunk->diagnostics);
+    start = end;
+  }
+
+  // First pass, in parallel
+  run_threads(scan_chunk, chunks, sizeof(Chunk), count);
+
+  // Place the chunks, enter labels in file order and stop where the serial
+  // assembler would have stopped: at the first instruction past the end of
+  // ROM, or at the first parse error.
+  bool truncated = false;
+  int base = 0;
+  int line = 1;
+  int last = count;
+  for (int i = 0; i < count && !truncated && !source->failed; i++) {
+    Chunk* chunk = &chunks[i];
+    chunk->base = base;
+    for (int j = 0; j < chunk->label_count; j++) {
+      if (base + chunk->labels[j].index <= ROM_SIZE) {
+        add_symbol(symbol_table, chunk->labels[j].name, base + chunk->labels[j].index);
+      }
+    }
+    for (int j = 0; j < chunk->diagnostics.count; j++) {
+      HackDiagnostic* diagnostic = &chunk->diagnostics.items[j];
+      if (base + diagnostic->address < ROM_SIZE) {
+        add_diagnostic(diagnostics, diagnostic->severity, line + diagnostic->line - 1,
+            base + diagnostic->address, "%s", diagnostic->message);
+      }
+    }
+    // an error after the end of ROM is never reached
+    if (chunk->full || base + chunk->commands.count > ROM_SIZE) {
+      truncated = true;
+      source->line = line + line_of_instruction(chunk, ROM_SIZE - base) - 1;
+    } else if (chunk->source.failed) {
+      source->failed = true;
+      source->unexpected = chunk->source.unexpected;
+      source->line = line + chunk->source.line - 1;
+      source->command_index = base + chunk->commands.count;
+    }
+    base += chunk->commands.count;
+    line += chunk->source.line - 1;
+    last = i + 1;
+  }
+  for (int i = 0; i < last; i++) {
+    Stats_add_source(stats, &chunks[i].source);
+  }
+  stats->first_pass_seconds = seconds_since(&clock);
+
+  // Second pass - labels in parallel, then variables in order
+  if (!source->failed) {
+    run_threads(resolve_chunk, chunks, sizeof(Chunk), last);
+    for (int i = 0; i < last; i++) {
+      symbol_table->counters.lookups += chunks[i].counters.lookups;
+      symbol_table->counters.probes += chunks[i].counters.probes;
+      symbol_table->counters.hits += chunks[i].counters.hits;
+    }
+    for (int i = 0; i < last; i++) {
+      Chunk* chunk = &chunks[i];
+      for (int j = 0; j < chunk->unresolved_count; j++) {
+        PendingSymbol* pending = &chunk->commands.pending[chunk->unresolved[j]];
+        int address = get_address(symbol_table, pending->symbol);
+        if (address == -1) {
+          address = add_variable(symbol_table, pending->symbol);
+        }
+        *CommandStore_word(&chunk->commands, pending->index) = address;
+      }
+    }
+    for (int i = 0; i < last; i++) {
+      Chunk* chunk = &chunks[i];
+      for (int j = 0; j < chunk->commands.count && commands->count < ROM_SIZE; j++) {
+        CommandStore_add(commands, *CommandStore_word(&chunk->commands, j));
+      }
+    }
+    source->command_index = commands->count;
+    stats->symbols_seconds = seconds_since(&clock);
+  }
+
+  for (int i = 0; i < count; i++) {
+    CommandStore_free(&chunks[i].commands);
+    free(chunks[i].labels);
+    free(chunks[i].unresolved);
+    Diagnostics_free(&chunks[i].diagnostics);
+  }
+  free(chunks);
+  return truncated;
+}
+
+void* scan_chunk(void* argument) {
+  Chunk* chunk = argument;
+  Command command;
+  while (read_command(&chunk->source, &command)) {
+    if (command.type == S_COMMAND) {
+      add_label(chunk, command.address, chunk->commands.count);
+      check_command(&chunk->diagnostics, &command, chunk->source.line, chunk->commands.count);
+    } else if (!store_command(&chunk->commands, &command)) {
+      chunk->full = true;
+      break;
+    } else {
+      check_command(&chunk->diagnostics, &command, chunk->source.line, chunk->commands.count - 1);
+    }
+  }
+  return NULL;
+}
+
+// Lexes the chunk again to find the line of its instruction at index.
+// Only needed to report where a program overflows ROM.
+int line_of_instruction(Chunk* chunk, int index) {
+  Source source;
+  Source_init(&source, chunk->source.data, chunk->source.size);
+  Command command;
+  int count = 0;
+  while (read_command(&source, &command)) {
+    if (command.type != S_COMMAND && count++ == index) {
+      break;
+    }
+  }
+  return source.line;
+}
+
+// The symbol table only holds labels and built-in symbols while this runs,
+// so threads can share it for lookups.
+void* resolve_chunk(void* argument) {
+  Chunk* chunk = argument;
+  int count = pending_in_rom(chunk);
+  chunk->unresolved = malloc((count > 0 ? count : 1) * sizeof(int));
+  for (int i = 0; i < count; i++) {
+    PendingSymbol* pending = &chunk->commands.pending[i];
+    int address = find_address(chunk->symbol_table, pending->symbol, &chunk->counters);
+    if (address == -1) {
+      chunk->unresolved[chunk->unresolved_count++] = i;
+    } else {
+      *CommandStore_word(&chunk->commands, pending->index) = address;
+    }
+  }
+  return NULL;
+}
+
+// Number of the chunk's symbol references that land inside ROM
+int pending_in_rom(Chunk* chunk) {
+  int count = 0;
+  while (count < chunk->commands.pending_count &&
+      chunk->base + chunk->commands.pending[count].index < ROM_SIZE) {
+    count++;
+  }
+  return count;
+}
+
+void add_label(Chunk* chunk, Span name, int index) {
+  if (chunk->label_count == chunk->label_capacity) {
+    chunk->label_capacity = chunk->label_capacity == 0 ? 64 : chunk->label_capacity * 2;
+    chunk->labels = realloc(chunk->labels, chunk->label_capacity * sizeof(Label));
+  }
+  chunk->labels[chunk->label_count].name = name;
+  chunk->labels[chunk->label_count].index = index;
+  chunk->label_count++;
+}
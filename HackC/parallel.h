@@ -0,0 +1,19 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include "commands.h"
+#include "diagnostics.h"
+#include "lexer.h"
+#include "stats.h"
+#include "symbol.h"
+
+// Files smaller than this aren't worth splitting
+#ifndef PARALLEL_THRESHOLD
+#define PARALLEL_THRESHOLD (1 << 20)
+#endif
+
+bool parallel_passes(Source* source, CommandStore* commands, SymbolTable* symbol_table, int threads,
+    Stats* stats, Diagnostics* diagnostics);
+
+#endif
@@ -1,435 +1,263 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
-#include <math.h>
 #include <stdlib.h>
+#include <time.h>
+#include "cache.h"
 #include "code.h"
+#include "commands.h"
+#include "diagnostics.h"
+#include "lexer.h"
+#include "parallel.h"
+#include "parser.h"
+#include "peephole.h"
+#include "rom.h"
+#include "stats.h"
 #include "symbol.h"
 
-// TODO: use a linked list of commands
-int MAX_COMMANDS_ALLOWED = 30000;
+#define OUTPUT_BUFFER_LINES 4096
+#define OPTIMIZED_CACHE_KEY 0x9e3779b97f4a7c15ull
 
-// All information about a command
-// Added a type for symbol definitions, although not really a command
-typedef struct {
-  enum {A_COMMAND, C_COMMAND, S_COMMAND} type;
-  char address[65];
-  char instruction[34];
-  bool has_dest;
-  bool has_jump;
-  char dest[4];
-  char comp[5];
-  char jump[4];
-} Command;
+bool write_output(CommandStore* commands, Options* options, long* bytes_written);
+void format_instruction(uint16_t instruction, char* line);
 
-// stores info about the current source file
-typedef struct {
-  int line;
-  int command_index;
-  int total_commands;
-  FILE *file;
-} Source;
+// Assembles one file. Everything the assembler needs lives on this call's
+// stack, so several files can be assembled at once on different threads.
+// Returns false if the file could not be read, parsed or written.
+bool parse(const char* filename, Options* options) {
+  Stats stats;
+  Stats_init(&stats);
+  struct timespec clock;
+  clock_gettime(CLOCK_MONOTONIC, &clock);
 
-bool is_start_of_command(char c);
-bool is_start_of_symbol(char c);
-void dec_to_bin(int decimal, char* binary);
-char skip_to_next_command(Source* source);
-char skip_whitespace(Source* source);
-char skip_comments(Source* source);
-char read_command(Source* source, Command commands[]);
-void print_commands(Source source, Command commands[]);
-void update_symbols(Command commands[], int total);
-void print_command_description(Command command);
-void print_command_machine_code(Command command);
-void set_address(Command* command);
-void set_a(Command* command);
-void set_command(Command* command);
-void set_dest(Command* command);
-void set_jump(Command* command);
-
-void parse(char* filename) {
   // Struct to keep track of position etc.
   Source source;
-  source.file = fopen(filename, "r");
-  source.line = 1;
-  if (source.file == 0) {
-    printf("Could not open file\n");
-  } else {
-    // Array of assembly commands. It would be better if this was a linked
-    // list.
-    Command commands[MAX_COMMANDS_ALLOWED];
-
-    // Struct to keep track of position etc.
-    source.command_index = 0;
-    source.total_commands = 0;
-
-    // initialise the symbol table
-    SymbolTable_init();
-
-    // First pass - read instructions and parse A and C instructions.
-    // If an A instruction refers to an undefined symbol or label, store 
-    // the symbol name in the address field. If a label is found, add it to 
-    // the symbol table.
-    while (!feof(source.file) && source.command_index < MAX_COMMANDS_ALLOWED) {
-      skip_to_next_command(&source);
-      read_command(&source, commands);
-      if (!feof(source.file)) {
-        source.total_commands++;
-        if (commands[source.command_index].type != S_COMMAND) {
-          source.command_index++;
-        }
-      }  
-    }
-
-    // Second pass - resolve previously undefined symbols.
-    // Symbols already in the symbol table refer to labels in the assembly code.
-    // These can be simply replaced. For others, they must be variables so
-    // they should be allocated in RAM.
-    update_symbols(commands, source.total_commands);
-
-    // Now ready to print commands
-    print_commands(source, commands);
-    if (source.command_index == MAX_COMMANDS_ALLOWED) {
-      printf("----\n");
-      printf("Exceeded maximum allowed instructions (%i). Program truncated.\n", MAX_COMMANDS_ALLOWED);
-    }
-
-    fclose(source.file);
+  if (!Source_open(&source, filename)) {
+    fprintf(stderr, "%s: Could not open file\n", filename);
+    return false;
   }
-}
 
-void update_symbols(Command commands[], int total) {
-  for (int i=0; i<total; i++) {
-    if (commands[i].type == A_COMMAND) {
-      if (!isdigit(commands[i].address[0])) {
-        int address = get_address(commands[i].address);
-        if (address == -1) {
-          // new symbols found are variables, not labels
-          // add them at the next address in RAM
-          add_symbol(commands[i].address, symbol_table.address++);
-          address = get_address(commands[i].address);
-        }
-        dec_to_bin(address, commands[i].instruction);
-      }
+  // Encoded instructions, in the order they will be placed in ROM
+  CommandStore commands;
+  CommandStore_init(&commands);
+  Diagnostics diagnostics;
+  Diagnostics_init(&diagnostics);
+
+  // A file that has been assembled before is taken from the cache
+  // without being parsed at all.
+  uint64_t key = 0;
+  bool cached = false;
+  if (options->cache_dir != NULL) {
+    key = hash_source(source.data, source.size);
+    // optimized programs are kept apart from plain ones
+    if (options->optimize) {
+      key ^= OPTIMIZED_CACHE_KEY;
     }
+    cached = cache_load(options->cache_dir, key, &commands, &stats);
   }
-}
+  stats.cached = cached;
+  stats.open_seconds = seconds_since(&clock);
 
-void print_commands(Source source, Command commands[]) {
-  for (int i=0; i<source.command_index; i++) {
-    //printf("%i\t%s\t", i+1, commands[i].string);
-    //print_command_description(commands[i]);
-    //printf("\n\t");
-    print_command_machine_code(commands[i]);
+  if (!cached) {
+    SymbolTable symbol_table;
+    SymbolTable_init(&symbol_table);
+    assemble(&source, &commands, &symbol_table, options->threads, options->optimize,
+        &stats, &diagnostics);
+    SymbolTable_free(&symbol_table);
+    clock_gettime(CLOCK_MONOTONIC, &clock);
   }
-}
 
-void print_command_description(Command command) {
-  printf("// ");
-  switch(command.type) {
-    case A_COMMAND:
-      printf("Loads %s into the A register.", command.address);
-      break;
-    case C_COMMAND:
-      if (command.has_dest) {
-        printf("%s=", command.dest);
-      }
-      printf("%s", command.comp);
-      if (command.has_jump) {
-        printf(";%s", command.jump);
-      }
-      break;
-    case S_COMMAND:
-      break;
+  for (int i = 0; i < diagnostics.count; i++) {
+    HackDiagnostic* diagnostic = &diagnostics.items[i];
+    fprintf(stderr, "%s:%i: %s: %s\n", filename, diagnostic->line,
+        diagnostic->severity == HACK_ERROR ? "error" : "warning", diagnostic->message);
   }
-}
 
-void print_command_machine_code(Command command) {
-  int dec_address = 0;
-  // initialise all bits to zero
-  for (int i=0; i<16; i++) {
-    command.instruction[i] = '0';
-  }
-  command.instruction[16] = '\0';
-  switch(command.type) {
-    case A_COMMAND:
-      if (isdigit(command.address[0])) {
-        sscanf(command.address, "%d", &dec_address);
-        dec_to_bin(dec_address, command.instruction);
-      } else {
-        set_address(&command);
-      }
-      printf("%s\n", command.instruction);
-      break;
-    case C_COMMAND:
-      command.instruction[0] = '1';
-      // unused bits
-      command.instruction[1] = '1';
-      command.instruction[2] = '1';
-      set_command(&command);
-      set_a(&command);
-      set_dest(&command);
-      set_jump(&command);
-      command.instruction[16] = '\0';
-      printf("%s\n", command.instruction);
-      break;
-    case S_COMMAND:
-      printf("%s\n", command.address);
-      break;
+  // Now ready to print commands
+  bool success = !has_errors(&diagnostics) &&
+      write_output(&commands, options, &stats.bytes_written);
+  if (success) {
+    // programs with warnings are assembled again next time, so the
+    // warnings are seen again
+    if (!cached && diagnostics.count == 0 && options->cache_dir != NULL) {
+      cache_store(options->cache_dir, key, &commands, &stats);
+    }
+    if (options->optimize) {
+      fprintf(stderr, "%s: Removed %ld redundant instructions\n", filename, stats.removed);
+    }
   }
-}
+  stats.output_seconds = seconds_since(&clock);
 
-void set_address(Command* command) {
-  int address = get_address(command->address);
-  if (address != -1) {
-    dec_to_bin(address, command->instruction);
+  Diagnostics_free(&diagnostics);
+  CommandStore_free(&commands);
+  Source_close(&source);
+  if (options->stats) {
+    print_stats(stderr, filename, &stats);
   }
+  return success;
 }
 
-void set_command(Command* command) {
-  char* code = comp(command->comp);
-  if (code != NULL) {
-    command->instruction[4] = code[0];
-    command->instruction[5] = code[1];
-    command->instruction[6] = code[2];
-    command->instruction[7] = code[3];
-    command->instruction[8] = code[4];
-    command->instruction[9] = code[5];
-  }
-}
+// Runs both passes over the source, leaving the encoded program in
+// commands and its labels and variables in symbol_table. Problems are
+// added to diagnostics. Returns false if there were errors.
+bool assemble(Source* source, CommandStore* commands, SymbolTable* symbol_table, int threads,
+    bool optimize, Stats* stats, Diagnostics* diagnostics) {
+  bool truncated = false;
+  struct timespec clock;
+  clock_gettime(CLOCK_MONOTONIC, &clock);
 
-void set_a(Command* command) {
-  // If the comp section uses M, then the a-bit shoul be on
-  if (strchr(command->comp, 'M') != NULL) {
-    command->instruction[3] = '1';
+  // First pass - read instructions and encode A and C instructions.
+  // If an A instruction refers to a symbol, remember it so the address
+  // can be filled in once all labels are known. If a label is found, add
+  // it to the symbol table.
+  //
+  // Large files are split into chunks that go through both passes on
+  // several threads (see parallel.c). The result is the same either way.
+  // The optimizer needs the whole program between the passes, so it
+  // always takes the serial path.
+  if (threads > 1 && source->size >= PARALLEL_THRESHOLD && !optimize) {
+    truncated = parallel_passes(source, commands, symbol_table, threads, stats, diagnostics);
   } else {
-    command->instruction[3] = '0';
-  }
-}
-
-void set_dest(Command* command) {
-  if (command->has_dest) {
-    char* code = dest(command->dest);
-    if (code != NULL) {
-      command->instruction[10] = code[0];
-      command->instruction[11] = code[1];
-      command->instruction[12] = code[2];
+    Command command;
+    while (!truncated && read_command(source, &command)) {
+      source->total_commands++;
+      if (command.type == S_COMMAND) {
+        add_symbol(symbol_table, command.address, source->command_index);
+        check_command(diagnostics, &command, source->line, source->command_index);
+      } else if (!store_command(commands, &command)) {
+        truncated = true;
+      } else {
+        check_command(diagnostics, &command, source->line, source->command_index);
+        source->command_index++;
+      }
     }
-  }
-}
+    Stats_add_source(stats, source);
+    stats->first_pass_seconds = seconds_since(&clock);
 
-void set_jump(Command* command) {
-  if (command->has_jump) {
-    char* code = jump(command->jump);
-    if (code != NULL) {
-      command->instruction[13] = code[0];
-      command->instruction[14] = code[1];
-      command->instruction[15] = code[2];
+    // Optionally, remove redundant instructions while the labels can
+    // still be moved.
+    if (optimize && !source->failed && !truncated) {
+      stats->removed = peephole(commands, symbol_table, diagnostics);
     }
-  }
-}
-
-void dec_to_bin(int decimal, char* binary) {
-  if (decimal == 0) {
-    return;
-  }
-  int rem = 0;
-  for(int i = 15; decimal != 0; i--) {
-    rem = decimal % 2;
-    decimal /= 2;
-    binary[i] = rem+'0';
-  }
-}
+    stats->peephole_seconds = seconds_since(&clock);
 
-// Skips all whitespace and comments until the
-// start of the next command
-char skip_to_next_command(Source* source) {
-  char c = fgetc(source->file);
-  while (!(feof(source->file) || is_start_of_command(c) || is_start_of_symbol(c))) {
-    c = skip_whitespace(source);
-    c = skip_comments(source);
-    if (!(is_start_of_command(c) || is_start_of_symbol(c) || isspace(c) || c == '/' || c == '\n' || c == -1)) {
-      printf("Parse error on line %i. Unexpected char: '%c'.\n", source->line, c);
-      exit(0);
+    // Second pass - resolve symbols.
+    // Symbols already in the symbol table refer to labels in the assembly
+    // code. These can be simply replaced. For others, they must be
+    // variables so they should be allocated in RAM.
+    if (!source->failed) {
+      update_symbols(commands, symbol_table);
     }
+    stats->symbols_seconds = seconds_since(&clock);
   }
-  return c;
-}
 
-// Skips whitespace (including newlines)
-char skip_whitespace(Source* source) {
-  char c = fgetc(source->file);
-  while (!feof(source->file) && isspace(c)) {
-    c = fgetc(source->file);
-    if (c == '\n') {
-      source->line++;
-    }
+  if (source->failed) {
+    add_diagnostic(diagnostics, HACK_ERROR, source->line, commands->count,
+        "Unexpected char: '%c'.", source->unexpected);
   }
-  ungetc(c, source->file);
-  return c;
+  if (truncated) {
+    add_diagnostic(diagnostics, HACK_ERROR, source->line, ROM_SIZE,
+        "Exceeded ROM size (%i instructions).", ROM_SIZE);
+  }
+  stats->symbols = symbol_table->counters;
+  stats->variables = symbol_table->address - 16;
+  return !has_errors(diagnostics);
 }
 
-// will skip anything starting with a forward slash to the end of the line.
-// Although comments start with two forward slashes, slashes don't appear
-// in assembler instructions so we can avoid looking ahead on character. 
-char skip_comments(Source* source) {
-  char c = fgetc(source->file);
-  if (c == '/') {
-    while (!feof(source->file) && c != '\n') {
-      c = fgetc(source->file);
-    }
-    if (c == '\n') { 
-      source->line++;
+// Encodes an A or C command and appends it to the store. Returns false if
+// the program no longer fits in ROM.
+bool store_command(CommandStore* commands, Command* command) {
+  uint16_t instruction = 0;
+  bool is_symbol = false;
+  if (command->type == A_COMMAND) {
+    // a lone @ is reported by check_command, and stored as @0 meanwhile
+    is_symbol = command->address.length > 0 && !isdigit((unsigned char) command->address.start[0]);
+    if (!is_symbol) {
+      instruction = encode_a_command(span_to_int(command->address));
     }
   } else {
-    ungetc(c, source->file);
+    instruction = encode_c_command(command);
   }
-  return c;
-}
-
-// Returns true if start of a command.
-// Uses a really simple switch on all possible chars
-// in the assembly language (or a digit).
-bool is_start_of_command(char c) {
-  switch(c) {
-    case '@':
-    case 'D':
-    case 'M':
-    case 'A':
-    case '=':
-    case '+':
-    case '-':
-    case ';':
-    case 'J':
-    case 'G':
-    case 'T':
-    case 'L':
-    case 'E':
-    case '(':
-      return true;
-      break;
-    default:
-      return isdigit(c);
+  if (!CommandStore_add(commands, instruction)) {
+    return false;
   }
+  if (is_symbol) {
+    CommandStore_add_pending(commands, command->address);
+  }
+  return true;
 }
 
-bool is_start_of_symbol(char c) {
-  if (c == '(') {
-    return true;
-  } else {
-    return false;
+void update_symbols(CommandStore* commands, SymbolTable* symbol_table) {
+  for (int i=0; i<commands->pending_count; i++) {
+    PendingSymbol* pending = &commands->pending[i];
+    int address = get_address(symbol_table, pending->symbol);
+    if (address == -1) {
+      // new symbols found are variables, not labels
+      // add them at the next address in RAM
+      address = add_variable(symbol_table, pending->symbol);
+    }
+    *CommandStore_word(commands, pending->index) = encode_a_command(address);
   }
 }
 
-char read_command(Source* source, Command commands[]) {
-  char c = fgetc(source->file);
-  char string[34];
-  if (feof(source->file)) {
-    return c;
-  }
-  Command command;
-  int pos = 0;
-  int address_pos = 0;
-  int symbol_pos = 0;
-  // the at symbol tells us it's a A instruction
-  if (c == '@') {
-    command.type = A_COMMAND;
-  } else if (c == '(') {
-    command.type = S_COMMAND;
-    while (!feof(source->file) && !isspace(c)) {
-      if (c != '(' && c != ')') {
-        command.address[symbol_pos++] = c;
-      }
-      c = fgetc(source->file);
-      pos++;
+// Writes the program in the chosen format, adding how many bytes reached
+// the output to bytes_written
+bool write_output(CommandStore* commands, Options* options, long* bytes_written) {
+  if (options->format == BINARY_OUTPUT) {
+    if (!write_rom(commands, options->output, options->header)) {
+      fprintf(stderr, "%s: Could not write ROM image\n", options->output ? options->output : "stdout");
+      return false;
     }
-    command.address[symbol_pos++] = '\0';
-    add_symbol(command.address, source->command_index);
-  } else {
-    command.type = C_COMMAND;    
+    // write_rom only succeeds once the whole image is written
+    *bytes_written += rom_image_size(commands->count, options->header);
+    return true;
   }
-  while (!feof(source->file) && !isspace(c)) {
-    string[pos] = c;
-    // everything after the at is a postitive integer or a symbol name
-    if (command.type == A_COMMAND && pos > 0) {
-      command.address[address_pos++] = c;
+  FILE* file = stdout;
+  if (options->output != NULL) {
+    file = fopen(options->output, "w");
+    if (file == NULL) {
+      fprintf(stderr, "%s: Could not open output file\n", options->output);
+      return false;
     }
-    c = fgetc(source->file);
-    pos++;
   }
-  if (command.type == A_COMMAND) {
-    command.address[address_pos++] = '\0';
-  } else if (command.type == C_COMMAND) {
-    string[pos++] = '\0';
-  }
-  //
-  // Now we can work out the C instruction fields
-  //
-  // C instruction
-  // dest=comp;jump
-  // either dest or jump may be empty
-  // if dest is empty. the '=' is omitted
-  // if jump is empty, the ';' is omitted
-  //
-  // i.e dest=comp;jump, comp;jump, dest=comp.
-  command.has_dest = false;
-  command.has_jump = false;
-  if (strchr(string, '=') != NULL) {
-    command.has_dest = true;
+  *bytes_written += print_commands(commands, file);
+  bool written = !ferror(file);
+  if (file != stdout) {
+    written = fclose(file) == 0 && written;
+  } else {
+    written = fflush(file) == 0 && written;
   }
-  if (strchr(string, ';') != NULL) {
-    command.has_jump = true;
-  }
-  // dest
-  if (command.has_dest) {
-    int i = 0;
-    char c = string[i];
-    while(c != '=') {
-      command.dest[i++] = c;
-      c = string[i];
-    }
-    command.dest[i++] = '\0';
+  if (!written) {
+    fprintf(stderr, "%s: Could not write output\n", options->output ? options->output : "stdout");
   }
+  return written;
+}
 
-  // comp
-  if (!command.has_dest) {
-    int i = 0;
-    char c = string[i];
-    while(c != ';' && c != '\0') {
-      command.comp[i++] = c;
-      c = string[i];
-    }
-    command.comp[i++] = '\0';
-  }
-  if (!command.has_jump) {
-    int i = 0;
-    char c = string[i];
-    while(c != '=') {
-      c = string[i++];
+// Writes the machine code as text, one line of 16 binary digits per
+// instruction, in blocks rather than a line at a time. Returns how many
+// bytes were written.
+long print_commands(CommandStore* commands, FILE* file) {
+  char* buffer = malloc(OUTPUT_BUFFER_LINES * 17);
+  long written = 0;
+  int lines = 0;
+  for (int i=0; i<commands->count; i++) {
+    format_instruction(*CommandStore_word(commands, i), buffer + lines * 17);
+    if (++lines == OUTPUT_BUFFER_LINES) {
+      written += fwrite(buffer, 1, lines * 17, file);
+      lines = 0;
     }
-    int j=0;
-    while(c != '\0') {
-      c = string[i++];
-      command.comp[j++] = c;
-    }
-    command.comp[i++] = '\0';
   }
+  written += fwrite(buffer, 1, lines * 17, file);
+  free(buffer);
+  return written;
+}
 
-  // jump
-  if (command.has_jump) {
-    int i = 0;
-    char c = string[i];
-    while(c != ';') {
-      c = string[i++];
-    }
-    int j=0;
-    while(c != '\0') {
-      c = string[i++];
-      command.jump[j++] = c;
-    }
-    command.jump[i++] = '\0';
+void format_instruction(uint16_t instruction, char* line) {
+  for (int i = 15; i >= 0; i--) {
+    line[i] = '0' + (instruction & 1);
+    instruction >>= 1;
   }
-  commands[source->command_index] = command;
-  return c;
+  line[16] = '\n';
 }
@@ -1 +1,40 @@
-void parse(char* filename);
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "commands.h"
+#include "diagnostics.h"
+#include "lexer.h"
+#include "stats.h"
+#include "symbol.h"
+
+typedef enum {TEXT_OUTPUT, BINARY_OUTPUT} OutputFormat;
+
+// Bumped whenever a change to the assembler could change its output, or
+// to what the cache keeps with it, so older cached results are not reused
+#define ASSEMBLER_VERSION 2
+
+// How and where parse writes the machine code. A NULL output means stdout.
+// threads is how many threads may share the work of assembling a large
+// file. Results are cached in cache_dir unless it is NULL. With stats set,
+// a JSON line of timings and counters is written to stderr per file.
+// optimize runs the peephole optimizer (see peephole.c).
+typedef struct {
+  OutputFormat format;
+  bool header;
+  const char* output;
+  int threads;
+  const char* cache_dir;
+  bool stats;
+  bool optimize;
+} Options;
+
+bool parse(const char* filename, Options* options);
+bool assemble(Source* source, CommandStore* commands, SymbolTable* symbol_table, int threads,
+    bool optimize, Stats* stats, Diagnostics* diagnostics);
+bool store_command(CommandStore* commands, Command* command);
+void update_symbols(CommandStore* commands, SymbolTable* symbol_table);
+long print_commands(CommandStore* commands, FILE* file);
+
+#endif
@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <string.h>
+#include "code.h"
+#include "lexer.h"
+#include "peephole.h"
+
+#define MAX_PATTERN 7
+#define WILDCARD -1
+#define C_BIT 0x8000
+// the zx bit of the comp field. The ALU only reads D when it is clear.
+#define COMP_ZX 0x0800
+#define DEST_A 0x0020
+#define DEST_D 0x0010
+#define DEST_BITS 0x0038
+#define JUMP_BITS 0x0007
+
+// A rewrite of a short run of instructions into a shorter one that leaves
+// A, D, PC and memory the same. "*" matches any C instruction that leaves
+// A alone. The replacement keeps the matched instruction wherever it has
+// an A instruction or "*", so only C instructions are ever rewritten.
+//
+// Patterns that look past a write to M assume the stack pointer never
+// points at itself, which holds for any program with a stack at 256.
+typedef struct {
+  const char* match[MAX_PATTERN + 1];
+  const char* replace[MAX_PATTERN + 1];
+} Pattern;
+
+const Pattern peepholePatterns[] = {
+  // a push undone by the next pop, or the other way round
+  {{"@SP", "M=M+1", "@SP", "M=M-1"}, {"@SP"}},
+  {{"@SP", "M=M-1", "@SP", "M=M+1"}, {"@SP"}},
+  {{"@SP", "M=M+1", "@SP", "AM=M-1"}, {"@SP", "A=M"}},
+  {{"@SP", "AM=M+1", "A=A-1", "M=D", "@SP", "AM=M-1"}, {"@SP", "A=M", "M=D"}},
+  {{"@SP", "AM=M-1", "D=M", "@SP", "AM=M+1", "A=A-1", "M=D"}, {"@SP", "A=M-1", "D=M"}},
+  // the stack pointer reloaded into A while it is still there
+  {{"@SP", "A=M", "@SP", "A=M"}, {"@SP", "A=M"}},
+  {{"@SP", "A=M", "*", "@SP", "A=M"}, {"@SP", "A=M", "*"}},
+  // D and the selected word already agree
+  {{"M=D", "D=M"}, {"M=D"}},
+  {{"D=M", "M=D"}, {"D=M"}},
+};
+
+#define PATTERN_COUNT ((int) (sizeof(peepholePatterns) / sizeof(Pattern)))
+
+// Patterns as words. An A instruction is matched on its address, so @SP
+// also matches @0 and @R0.
+typedef struct {
+  int length;
+  int match[MAX_PATTERN];
+  int replace_length;
+  int replace[MAX_PATTERN];
+} CompiledPattern;
+
+typedef struct {
+  uint16_t word;
+  // the word once symbols are resolved, or -1 while it waits on a label
+  // or variable
+  int value;
+  // position before optimization
+  int index;
+  Span symbol;
+  // a label, or a literal jump, points here
+  bool target;
+  // a literal address that is jumped to, moved along with the code
+  bool code_address;
+} Entry;
+
+typedef struct {
+  Entry* entries;
+  int count;
+  CompiledPattern patterns[PATTERN_COUNT];
+} Peephole;
+
+void compile_patterns(Peephole* peephole);
+int compile_instruction(const char* text);
+bool rewrite(Peephole* peephole);
+bool matches(Peephole* peephole, CompiledPattern* pattern);
+void remove_entries(Peephole* peephole, int start, int count);
+bool is_a(Entry* entry);
+
+// Removes redundant instructions from a program whose labels are known but
+// whose symbols are not yet resolved. Labels, pending symbols, literal
+// jump addresses and diagnostics are moved to match. Returns how many
+// instructions were removed.
+//
+// Instructions are pushed one at a time and the end of what has been kept
+// is rewritten until no rule applies, so a rewrite can expose another.
+// Only the first instruction of a match may be a jump target; the others
+// must only be reachable by falling through.
+//
+// A literal address is only known to be code when it is jumped to straight
+// away (@95 then 0;JMP). Programs without labels that jump are left alone,
+// and programs that keep other literal code addresses in memory must not
+// be optimized.
+int peephole(CommandStore* commands, SymbolTable* symbol_table, Diagnostics* diagnostics) {
+  int count = commands->count;
+  Entry* input = malloc((count > 0 ? count : 1) * sizeof(Entry));
+  bool* targets = calloc(count + 1, sizeof(bool));
+  for (int i = 0; i < count; i++) {
+    Entry* entry = &input[i];
+    entry->word = *CommandStore_word(commands, i);
+    entry->value = entry->word;
+    entry->index = i;
+    entry->symbol.start = NULL;
+    entry->symbol.length = 0;
+    entry->code_address = false;
+  }
+  for (int i = 0; i < commands->pending_count; i++) {
+    Entry* entry = &input[commands->pending[i].index];
+    entry->symbol = commands->pending[i].symbol;
+    entry->value = predefined_address(entry->symbol);
+  }
+  for (int i = 0; i < symbol_table->capacity; i++) {
+    SymbolSlot* slot = &symbol_table->table[i];
+    if (slot->map.assembly != NULL && slot->map.address <= count) {
+      targets[slot->map.address] = true;
+    }
+  }
+  // without any labels, literal addresses are the only way to refer to
+  // code and there is no telling which of them are code
+  bool labels = false;
+  for (int i = 0; i < symbol_table->capacity && !labels; i++) {
+    labels = symbol_table->table[i].map.assembly != NULL;
+  }
+  for (int i = 1; i < count; i++) {
+    Entry* address = &input[i - 1];
+    if ((input[i].word & C_BIT) && (input[i].word & JUMP_BITS) &&
+        is_a(address) && address->symbol.length == 0) {
+      if (!labels) {
+        free(targets);
+        free(input);
+        return 0;
+      }
+      address->code_address = true;
+      if (address->value <= count) {
+        targets[address->value] = true;
+      }
+    }
+  }
+
+  Peephole peephole;
+  peephole.entries = malloc((count > 0 ? count : 1) * sizeof(Entry));
+  peephole.count = 0;
+  compile_patterns(&peephole);
+  for (int i = 0; i < count; i++) {
+    input[i].target = targets[i];
+    peephole.entries[peephole.count++] = input[i];
+    while (rewrite(&peephole)) {
+    }
+  }
+
+  // every old position moves to the first instruction kept at or after it
+  int* moved = malloc((count + 1) * sizeof(int));
+  for (int old = 0, kept = 0; old <= count; old++) {
+    while (kept < peephole.count && peephole.entries[kept].index < old) {
+      kept++;
+    }
+    moved[old] = kept;
+  }
+  CommandStore optimized;
+  CommandStore_init(&optimized);
+  for (int i = 0; i < peephole.count; i++) {
+    Entry* entry = &peephole.entries[i];
+    if (entry->code_address && entry->value <= count) {
+      entry->word = encode_a_command(moved[entry->value]);
+    }
+    CommandStore_add(&optimized, entry->word);
+    if (entry->symbol.length > 0) {
+      CommandStore_add_pending(&optimized, entry->symbol);
+    }
+  }
+  for (int i = 0; i < symbol_table->capacity; i++) {
+    SymbolSlot* slot = &symbol_table->table[i];
+    if (slot->map.assembly != NULL && slot->map.address <= count) {
+      slot->map.address = moved[slot->map.address];
+    }
+  }
+  for (int i = 0; i < diagnostics->count; i++) {
+    HackDiagnostic* diagnostic = &diagnostics->items[i];
+    if (diagnostic->address >= 0 && diagnostic->address <= count) {
+      diagnostic->address = moved[diagnostic->address];
+    }
+  }
+
+  int removed = count - optimized.count;
+  CommandStore_free(commands);
+  *commands = optimized;
+  free(moved);
+  free(peephole.entries);
+  free(targets);
+  free(input);
+  return removed;
+}
+
+void compile_patterns(Peephole* peephole) {
+  for (int i = 0; i < PATTERN_COUNT; i++) {
+    const Pattern* pattern = &peepholePatterns[i];
+    CompiledPattern* compiled = &peephole->patterns[i];
+    compiled->length = 0;
+    while (compiled->length < MAX_PATTERN && pattern->match[compiled->length] != NULL) {
+      compiled->match[compiled->length] = compile_instruction(pattern->match[compiled->length]);
+      compiled->length++;
+    }
+    compiled->replace_length = 0;
+    while (compiled->replace_length < MAX_PATTERN && pattern->replace[compiled->replace_length] != NULL) {
+      int word = compile_instruction(pattern->replace[compiled->replace_length]);
+      // only C instructions are written, everything else is kept
+      compiled->replace[compiled->replace_length++] = word != WILDCARD && (word & C_BIT) ? word : WILDCARD;
+    }
+  }
+}
+
+// Returns the word for an A or C instruction, or WILDCARD for "*"
+int compile_instruction(const char* text) {
+  if (strcmp(text, "*") == 0) {
+    return WILDCARD;
+  }
+  Source source;
+  Source_init(&source, text, strlen(text));
+  Command command;
+  read_command(&source, &command);
+  if (command.type == A_COMMAND) {
+    int address = predefined_address(command.address);
+    return address != -1 ? address : span_to_int(command.address);
+  }
+  return encode_c_command(&command);
+}
+
+// Applies one rule to the end of the kept instructions. Returns false if
+// none applies.
+bool rewrite(Peephole* peephole) {
+  int count = peephole->count;
+  Entry* last = &peephole->entries[count - 1];
+
+  // an A instruction overwritten by the next one does nothing
+  if (count >= 2 && is_a(last) && is_a(last - 1)) {
+    remove_entries(peephole, count - 2, 1);
+    return true;
+  }
+
+  // a value put in D and nothing else is dead if D is written again
+  // before it is read. A instructions in between don't read D.
+  if (!is_a(last) && (last->word & DEST_D) && (last->word & COMP_ZX)) {
+    int i = count - 2;
+    while (i >= 0 && is_a(&peephole->entries[i])) {
+      i--;
+    }
+    if (i >= 0 && (peephole->entries[i].word & (DEST_BITS | JUMP_BITS)) == DEST_D) {
+      remove_entries(peephole, i, 1);
+      return true;
+    }
+  }
+
+  for (int i = 0; i < PATTERN_COUNT; i++) {
+    CompiledPattern* pattern = &peephole->patterns[i];
+    if (matches(peephole, pattern)) {
+      int start = count - pattern->length;
+      for (int j = 0; j < pattern->replace_length; j++) {
+        if (pattern->replace[j] != WILDCARD) {
+          peephole->entries[start + j].word = pattern->replace[j];
+          peephole->entries[start + j].value = pattern->replace[j];
+        }
+      }
+      remove_entries(peephole, start + pattern->replace_length, pattern->length - pattern->replace_length);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool matches(Peephole* peephole, CompiledPattern* pattern) {
+  int start = peephole->count - pattern->length;
+  if (start < 0) {
+    return false;
+  }
+  for (int i = 0; i < pattern->length; i++) {
+    Entry* entry = &peephole->entries[start + i];
+    int word = pattern->match[i];
+    if (i > 0 && entry->target) {
+      return false;
+    }
+    if (word == WILDCARD) {
+      if (is_a(entry) || (entry->word & DEST_A)) {
+        return false;
+      }
+    } else if (word & C_BIT) {
+      if (entry->word != word) {
+        return false;
+      }
+    } else if (!is_a(entry) || entry->code_address || entry->value != word) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// A label on a removed instruction moves to the next one kept
+void remove_entries(Peephole* peephole, int start, int count) {
+  int end = start + count;
+  bool target = false;
+  for (int i = start; i < end; i++) {
+    target = target || peephole->entries[i].target;
+  }
+  if (target && end < peephole->count) {
+    peephole->entries[end].target = true;
+  }
+  memmove(&peephole->entries[start], &peephole->entries[end], (peephole->count - end) * sizeof(Entry));
+  peephole->count -= count;
+}
+
+bool is_a(Entry* entry) {
+  return (entry->word & C_BIT) == 0;
+}
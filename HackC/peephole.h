@@ -0,0 +1,10 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "commands.h"
+#include "diagnostics.h"
+#include "symbol.h"
+
+int peephole(CommandStore* commands, SymbolTable* symbol_table, Diagnostics* diagnostics);
+
+#endif
@@ -0,0 +1,42 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+
+// Runs worker on threads threads, one of them the calling thread, and
+// waits for all of them. Thread i is given the i-th of arguments, each
+// argument_size bytes long; with an argument_size of 0 every thread is
+// given the same argument. Nothing runs when threads is 0. Any worker a
+// thread could not be started for runs on the calling thread afterwards.
+void run_threads(ThreadWorker worker, void* arguments, size_t argument_size, int threads) {
+  if (threads < 1) {
+    return;
+  }
+  pthread_t* running = malloc(threads * sizeof(pthread_t));
+  bool* started = calloc(threads, sizeof(bool));
+  for (int i = 1; i < threads && running != NULL && started != NULL; i++) {
+    void* argument = (char*) arguments + i * argument_size;
+    started[i] = pthread_create(&running[i], NULL, worker, argument) == 0;
+  }
+  worker(arguments);
+  for (int i = 1; i < threads; i++) {
+    if (started != NULL && started[i]) {
+      pthread_join(running[i], NULL);
+    } else {
+      worker((char*) arguments + i * argument_size);
+    }
+  }
+  free(started);
+  free(running);
+}
+
+void WorkQueue_init(WorkQueue* queue, int count) {
+  atomic_init(&queue->next, 0);
+  queue->count = count;
+}
+
+// Returns the next item, or -1 once every item has been handed out
+int claim_work(WorkQueue* queue) {
+  int index = atomic_fetch_add(&queue->next, 1);
+  return index < queue->count ? index : -1;
+}
@@ -0,0 +1,20 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+typedef void* (*ThreadWorker)(void* argument);
+
+// Work items numbered from 0, handed out one at a time to whichever thread
+// asks next
+typedef struct {
+  atomic_int next;
+  int count;
+} WorkQueue;
+
+void run_threads(ThreadWorker worker, void* arguments, size_t argument_size, int threads);
+void WorkQueue_init(WorkQueue* queue, int count);
+int claim_work(WorkQueue* queue);
+
+#endif
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "rom.h"
+
+size_t rom_image_size(int count, bool header) {
+  return (header ? ROM_HEADER_SIZE : 0) + (size_t) count * 2;
+}
+
+void fill_rom_image(CommandStore* commands, bool header, uint8_t* image) {
+  uint8_t* words = image + (header ? ROM_HEADER_SIZE : 0);
+  for (int i = 0; i < commands->count; i++) {
+    uint16_t word = *CommandStore_word(commands, i);
+    words[i * 2] = word & 0xFF;
+    words[i * 2 + 1] = word >> 8;
+  }
+  if (header) {
+    memcpy(image, ROM_MAGIC, 4);
+    put_uint32(image + 4, commands->count);
+    put_uint32(image + 8, rom_checksum(words, (size_t) commands->count * 2));
+  }
+}
+
+// Builds the image in memory and writes it in one go, to stdout when
+// filename is NULL. Returns false if any of it could not be written.
+bool write_rom(CommandStore* commands, const char* filename, bool header) {
+  size_t size = rom_image_size(commands->count, header);
+  uint8_t* image = malloc(size > 0 ? size : 1);
+  if (image == NULL) {
+    return false;
+  }
+  fill_rom_image(commands, header, image);
+  bool written;
+  if (filename == NULL) {
+    written = fwrite(image, 1, size, stdout) == size && fflush(stdout) == 0;
+  } else {
+    written = write_file(filename, image, size);
+  }
+  free(image);
+  return written;
+}
+
+// Creates or replaces filename with size bytes of data
+bool write_file(const char* filename, const uint8_t* data, size_t size) {
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+  size_t written = 0;
+  while (written < size) {
+    ssize_t result = write(fd, data + written, size - written);
+    if (result > 0) {
+      written += result;
+    } else if (result == 0 || errno != EINTR) {
+      break;
+    }
+  }
+  return close(fd) == 0 && written == size;
+}
+
+// CRC-32 (IEEE 802.3), the same as zlib's crc32
+uint32_t rom_checksum(const uint8_t* words, size_t length) {
+  uint32_t table[256];
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+    }
+    table[i] = crc;
+  }
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < length; i++) {
+    crc = table[(crc ^ words[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+void put_uint32(uint8_t* bytes, uint32_t value) {
+  bytes[0] = value & 0xFF;
+  bytes[1] = (value >> 8) & 0xFF;
+  bytes[2] = (value >> 16) & 0xFF;
+  bytes[3] = value >> 24;
+}
+
+uint32_t get_uint32(const uint8_t* bytes) {
+  return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
@@ -0,0 +1,26 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "commands.h"
+
+// Binary ROM images are the instructions as little-endian 16-bit words.
+// They may start with a 12 byte header:
+//
+//   offset 0  "HACK"
+//   offset 4  instruction count (uint32, little-endian)
+//   offset 8  CRC-32 of the instruction bytes (uint32, little-endian)
+#define ROM_MAGIC "HACK"
+#define ROM_HEADER_SIZE 12
+
+size_t rom_image_size(int count, bool header);
+void fill_rom_image(CommandStore* commands, bool header, uint8_t* image);
+bool write_rom(CommandStore* commands, const char* filename, bool header);
+bool write_file(const char* filename, const uint8_t* data, size_t size);
+uint32_t rom_checksum(const uint8_t* words, size_t length);
+void put_uint32(uint8_t* bytes, uint32_t value);
+uint32_t get_uint32(const uint8_t* bytes);
+
+#endif
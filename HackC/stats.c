@@ -0,0 +1,53 @@
+#include <string.h>
+#include "stats.h"
+
+void Stats_init(Stats* stats) {
+  memset(stats, 0, sizeof(Stats));
+}
+
+void Stats_add_source(Stats* stats, Source* source) {
+  stats->lines += source->line - 1;
+  // a last line without a newline still counts
+  if (source->size > 0 && source->end[-1] != '\n' && source->pos == source->end) {
+    stats->lines++;
+  }
+  stats->comments += source->comments;
+  stats->a_commands += source->a_commands;
+  stats->c_commands += source->c_commands;
+  stats->labels += source->labels;
+}
+
+// Returns the seconds since start and restarts the clock
+double seconds_since(struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double seconds = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+  *start = now;
+  return seconds;
+}
+
+// One JSON object on a single line, written with a single call so lines
+// from different threads don't interleave
+void print_stats(FILE* file, const char* filename, Stats* stats) {
+  char name[1024];
+  int length = 0;
+  for (const char* c = filename; *c != '\0' && length < (int) sizeof(name) - 2; c++) {
+    if (*c == '"' || *c == '\\') {
+      name[length++] = '\\';
+    }
+    name[length++] = *c;
+  }
+  name[length] = '\0';
+  fprintf(file, "{\"file\":\"%s\",\"cached\":%s,"
+      "\"open_ms\":%.3f,\"first_pass_ms\":%.3f,"
+      "\"peephole_ms\":%.3f,\"symbols_ms\":%.3f,\"output_ms\":%.3f,"
+      "\"lines\":%ld,\"comments\":%ld,\"a_commands\":%ld,\"c_commands\":%ld,\"labels\":%ld,"
+      "\"symbol_lookups\":%ld,\"symbol_probes\":%ld,\"symbol_hits\":%ld,"
+      "\"variables\":%ld,\"bytes_written\":%ld,\"removed\":%ld}\n",
+      name, stats->cached ? "true" : "false",
+      stats->open_seconds * 1e3, stats->first_pass_seconds * 1e3,
+      stats->peephole_seconds * 1e3, stats->symbols_seconds * 1e3, stats->output_seconds * 1e3,
+      stats->lines, stats->comments, stats->a_commands, stats->c_commands, stats->labels,
+      stats->symbols.lookups, stats->symbols.probes, stats->symbols.hits,
+      stats->variables, stats->bytes_written, stats->removed);
+}
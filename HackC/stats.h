@@ -0,0 +1,38 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include "lexer.h"
+#include "symbol.h"
+
+// Timings and counters for one run of parse(). Collecting them costs a
+// handful of increments and clock reads per file, so it is always on and
+// --stats only decides whether they are printed. A cached program keeps
+// its counters, but does no symbol lookups.
+typedef struct {
+  bool cached;
+  double open_seconds;
+  double first_pass_seconds;
+  double peephole_seconds;
+  double symbols_seconds;
+  double output_seconds;
+  long lines;
+  long comments;
+  long a_commands;
+  long c_commands;
+  long labels;
+  SymbolCounters symbols;
+  long variables;
+  long bytes_written;
+  // instructions removed by the peephole optimizer
+  long removed;
+} Stats;
+
+void Stats_init(Stats* stats);
+void Stats_add_source(Stats* stats, Source* source);
+double seconds_since(struct timespec* start);
+void print_stats(FILE* file, const char* filename, Stats* stats);
+
+#endif
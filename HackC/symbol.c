@@ -3,59 +3,188 @@
 #include <stdlib.h>
 #include "symbol.h"
 
-const SymbolMap predefinedSymbolMap[] = {
-  {"SP", 0},
-  {"LCL", 1},
-  {"ARG", 2},
-  {"THIS", 3},
-  {"THAT", 4},
-  {"R0", 0},
-  {"R1", 1},
-  {"R2", 2},
-  {"R3", 3},
-  {"R4", 4},
-  {"R5", 5},
-  {"R6", 6},
-  {"R7", 7},
-  {"R8", 8},
-  {"R9", 9},
-  {"R10", 10},
-  {"R11", 11},
-  {"R12", 12},
-  {"R13", 13},
-  {"R14", 14},
-  {"R15", 15},
-  {"SCREEN", 16384},
-  {"KBD", 24576},
-  {NULL, 0}
+#define INITIAL_CAPACITY 1024
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+// Built-in symbols, placed by a perfect hash of their first character,
+// last character and length (see predefined_slot). No two of them collide,
+// so a lookup is a single comparison.
+const SymbolMap predefinedSymbolMap[32] = {
+  [0] = {"R7", 2, 7},
+  [1] = {"KBD", 3, 24576},
+  [3] = {"LCL", 3, 1},
+  [4] = {"THAT", 4, 4},
+  [6] = {"R0", 2, 0},
+  [7] = {"R10", 3, 10},
+  [8] = {"R3", 2, 3},
+  [9] = {"R13", 3, 13},
+  [10] = {"R6", 2, 6},
+  [12] = {"R9", 2, 9},
+  [14] = {"THIS", 4, 3},
+  [15] = {"ARG", 3, 2},
+  [16] = {"SCREEN", 6, 16384},
+  [18] = {"R2", 2, 2},
+  [19] = {"R12", 3, 12},
+  [20] = {"R5", 2, 5},
+  [21] = {"R15", 3, 15},
+  [22] = {"R8", 2, 8},
+  [24] = {"SP", 2, 0},
+  [28] = {"R1", 2, 1},
+  [29] = {"R11", 3, 11},
+  [30] = {"R4", 2, 4},
+  [31] = {"R14", 3, 14},
 };
 
-SymbolTable symbol_table;
+int predefined_slot(Span symbol);
+uint32_t hash_symbol(Span symbol);
+const char* intern(SymbolTable* symbol_table, Span symbol);
+void grow_table(SymbolTable* symbol_table);
 
 // Initialises the symbole table
-void SymbolTable_init() {
-  symbol_table.count = 0;
+void SymbolTable_init(SymbolTable* symbol_table) {
+  symbol_table->count = 0;
+  symbol_table->capacity = INITIAL_CAPACITY;
+  symbol_table->table = calloc(symbol_table->capacity, sizeof(SymbolSlot));
+  symbol_table->arena = NULL;
+  symbol_table->counters.lookups = 0;
+  symbol_table->counters.probes = 0;
+  symbol_table->counters.hits = 0;
   // variables begin at RAM address 16
-  symbol_table.address = 16;
+  symbol_table->address = 16;
 }
 
-int get_address(char* symbol) {
-  for (int i = 0; predefinedSymbolMap[i].assembly != NULL; i++) {
-    if (strcmp(symbol, predefinedSymbolMap[i].assembly) == 0) {
-      return predefinedSymbolMap[i].address;
-    }
+void SymbolTable_free(SymbolTable* symbol_table) {
+  free(symbol_table->table);
+  symbol_table->table = NULL;
+  symbol_table->capacity = 0;
+  symbol_table->count = 0;
+  while (symbol_table->arena != NULL) {
+    ArenaBlock* next = symbol_table->arena->next;
+    free(symbol_table->arena);
+    symbol_table->arena = next;
+  }
+}
+
+int get_address(SymbolTable* symbol_table, Span symbol) {
+  return find_address(symbol_table, symbol, &symbol_table->counters);
+}
+
+// Looks a symbol up without changing the table, so threads can share it.
+// The work done is added to counters instead.
+int find_address(const SymbolTable* symbol_table, Span symbol, SymbolCounters* counters) {
+  counters->lookups++;
+  if (symbol.length == 0) {
+    return -1;
+  }
+  int predefined = predefined_address(symbol);
+  if (predefined != -1) {
+    counters->hits++;
+    return predefined;
   }
-  for (int i = 0; i < symbol_table.count; i++) {
-    if (strcmp(symbol, symbol_table.table[i]->assembly) == 0) {
-      return symbol_table.table[i]->address;
+  uint32_t hash = hash_symbol(symbol);
+  int mask = symbol_table->capacity - 1;
+  for (int i = hash & mask; symbol_table->table[i].map.assembly != NULL; i = (i + 1) & mask) {
+    const SymbolSlot* slot = &symbol_table->table[i];
+    counters->probes++;
+    if (slot->hash == hash && slot->map.length == symbol.length &&
+        memcmp(slot->map.assembly, symbol.start, symbol.length) == 0) {
+      counters->hits++;
+      return slot->map.address;
     }
   }
   return -1;
 }
 
-void add_symbol(char* symbol, int address) {
-  SymbolMap *map = malloc(sizeof(SymbolMap));
-  map->assembly = strdup(symbol);
-  map->address = address;
-  symbol_table.table[symbol_table.count++] = map;
+// Returns the address of a built-in symbol such as SP or SCREEN, or -1
+int predefined_address(Span symbol) {
+  if (symbol.length == 0) {
+    return -1;
+  }
+  const SymbolMap* predefined = &predefinedSymbolMap[predefined_slot(symbol)];
+  if (predefined->length == symbol.length &&
+      memcmp(predefined->assembly, symbol.start, symbol.length) == 0) {
+    return predefined->address;
+  }
+  return -1;
+}
+
+// Allocates the next RAM address to a new variable and returns it
+int add_variable(SymbolTable* symbol_table, Span symbol) {
+  int address = symbol_table->address++;
+  add_symbol(symbol_table, symbol, address);
+  symbol_table->table[symbol_table->last].variable = true;
+  return address;
+}
+
+void add_symbol(SymbolTable* symbol_table, Span symbol, int address) {
+  if ((symbol_table->count + 1) * 2 > symbol_table->capacity) {
+    grow_table(symbol_table);
+  }
+  uint32_t hash = hash_symbol(symbol);
+  int mask = symbol_table->capacity - 1;
+  int i = hash & mask;
+  while (symbol_table->table[i].map.assembly != NULL) {
+    i = (i + 1) & mask;
+  }
+  symbol_table->table[i].map.assembly = intern(symbol_table, symbol);
+  symbol_table->table[i].map.length = symbol.length;
+  symbol_table->table[i].map.address = address;
+  symbol_table->table[i].hash = hash;
+  symbol_table->table[i].variable = false;
+  symbol_table->last = i;
+  symbol_table->count++;
+}
+
+void grow_table(SymbolTable* symbol_table) {
+  SymbolSlot* old = symbol_table->table;
+  int old_capacity = symbol_table->capacity;
+  symbol_table->capacity *= 2;
+  symbol_table->table = calloc(symbol_table->capacity, sizeof(SymbolSlot));
+  int mask = symbol_table->capacity - 1;
+  for (int j = 0; j < old_capacity; j++) {
+    if (old[j].map.assembly != NULL) {
+      int i = old[j].hash & mask;
+      while (symbol_table->table[i].map.assembly != NULL) {
+        i = (i + 1) & mask;
+      }
+      symbol_table->table[i] = old[j];
+    }
+  }
+  free(old);
+}
+
+// Copies the symbol name into the arena, starting a new block when the
+// current one is full.
+const char* intern(SymbolTable* symbol_table, Span symbol) {
+  size_t needed = symbol.length + 1;
+  ArenaBlock* block = symbol_table->arena;
+  if (block == NULL || block->used + needed > block->size) {
+    size_t size = needed > ARENA_BLOCK_SIZE ? needed : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(ArenaBlock) + size);
+    block->next = symbol_table->arena;
+    block->used = 0;
+    block->size = size;
+    symbol_table->arena = block;
+  }
+  char* copy = block->data + block->used;
+  memcpy(copy, symbol.start, symbol.length);
+  copy[symbol.length] = '\0';
+  block->used += needed;
+  return copy;
+}
+
+int predefined_slot(Span symbol) {
+  unsigned char first = symbol.start[0];
+  unsigned char last = symbol.start[symbol.length - 1];
+  return (first * 18 + last * 22 + symbol.length) & 31;
+}
+
+// FNV-1a
+uint32_t hash_symbol(Span symbol) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < symbol.length; i++) {
+    hash ^= (unsigned char) symbol.start[i];
+    hash *= 16777619u;
+  }
+  return hash;
 }
@@ -1,18 +1,60 @@
-int get_address(char* symbol);
-void add_symbol(char* symbol, int address);
-void SymbolTable_init();
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "lexer.h"
 
-#define MAX_SYMBOLS 10000
 
 typedef struct {
-  char* assembly;
+  const char* assembly;
+  int length;
   int address;
 } SymbolMap;
 
+// Symbol names are interned into a chain of bump allocated blocks, so
+// adding a symbol costs no allocation in the common case and the whole
+// table is released at once.
+typedef struct ArenaBlock {
+  struct ArenaBlock* next;
+  size_t used;
+  size_t size;
+  char data[];
+} ArenaBlock;
+
+typedef struct {
+  SymbolMap map;
+  uint32_t hash;
+  bool variable;
+} SymbolSlot;
+
+// How much work lookups did. probes counts the table slots inspected.
 typedef struct {
-  SymbolMap *table[MAX_SYMBOLS];
+  long lookups;
+  long probes;
+  long hits;
+} SymbolCounters;
+
+// Open addressing hash table with linear probing. The capacity is always
+// a power of two and the table doubles once it is half full.
+typedef struct {
+  SymbolSlot *table;
+  int capacity;
   int count;
   int address;
+  ArenaBlock* arena;
+  SymbolCounters counters;
+  // slot of the most recently added symbol
+  int last;
 } SymbolTable;
 
-SymbolTable symbol_table;
+void SymbolTable_init(SymbolTable* symbol_table);
+void SymbolTable_free(SymbolTable* symbol_table);
+int get_address(SymbolTable* symbol_table, Span symbol);
+int predefined_address(Span symbol);
+int find_address(const SymbolTable* symbol_table, Span symbol, SymbolCounters* counters);
+void add_symbol(SymbolTable* symbol_table, Span symbol, int address);
+int add_variable(SymbolTable* symbol_table, Span symbol);
+
+#endif
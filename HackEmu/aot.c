@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "aot.h"
+#include "cache.h"
+#include "native.h"
+
+// Ahead of time translation. The ROM is split into basic blocks, each
+// block becomes a C function, and the functions are compiled with the
+// system C compiler into a shared object that is loaded with dlopen.
+//
+// A block starts at address 0, after every jump, and at every address an
+// A instruction loads, since any of those may be jumped to (return
+// addresses are pushed as @RET / D=A and jumped to much later). A jump
+// always ends a block, so a block either runs all of its instructions or
+// stops at the jump that ends it. The few jumps that land inside a block
+// are interpreted until they reach the start of one.
+//
+// Compiled programs are kept in the cache directory, named after a hash of
+// the ROM, and are only compiled again when the ROM changes. native.c
+// compiles and loads them.
+
+#define AOT_VERSION 2
+
+// The ROM that write_program translates
+typedef struct {
+  const uint16_t* words;
+  int count;
+} ProgramWords;
+
+const char* compExpressions[128] = {
+  [0x2A] = "0", [0x3F] = "1", [0x3A] = "0xFFFF",
+  [0x0C] = "d", [0x30] = "a", [0x70] = "M",
+  [0x0D] = "~d", [0x31] = "~a", [0x71] = "~M",
+  [0x0F] = "-d", [0x33] = "-a", [0x73] = "-M",
+  [0x1F] = "d + 1", [0x37] = "a + 1", [0x77] = "M + 1",
+  [0x0E] = "d - 1", [0x32] = "a - 1", [0x72] = "M - 1",
+  [0x02] = "d + a", [0x42] = "d + M",
+  [0x13] = "d - a", [0x53] = "d - M",
+  [0x07] = "a - d", [0x47] = "M - d",
+  [0x00] = "d & a", [0x40] = "d & M",
+  [0x15] = "d | a", [0x55] = "d | M",
+};
+
+// indexed by the jump bits, and only used for conditional jumps
+const char* jumpConditions[8] = {
+  NULL, "(int16_t) out > 0", "out == 0", "(int16_t) out >= 0",
+  "(int16_t) out < 0", "out != 0", "(int16_t) out <= 0", NULL,
+};
+
+bool* find_leaders(const uint16_t* words, int count);
+bool is_halt(const uint16_t* words, int count, int address);
+void translate_instruction(FILE* file, uint16_t word);
+void write_program(FILE* file, const void* argument);
+
+// Writes the program as C: one function per block, then the tables
+// NativeProgram_load looks up.
+void translate(const uint16_t* words, int count, FILE* file) {
+  bool* leaders = find_leaders(words, count);
+  fprintf(file, "#include <stdint.h>\n\n");
+  fprintf(file, "#define M ram[a & 0x7FFF]\n");
+  // the same as MARK_SCREEN_WRITE
+  fprintf(file, "#define STORE(value) \\\n"
+      "  do { \\\n"
+      "    uint16_t offset = (uint16_t) ((a & 0x7FFF) - %i); \\\n"
+      "    M = (value); \\\n"
+      "    dirty[(offset < %i ? offset : %i) / %i] = 1; \\\n"
+      "  } while (0)\n\n", SCREEN, SCREEN_WORDS, SCREEN_WORDS, SCREEN_ROW_WORDS);
+  fprintf(file, "static uint16_t alu(int comp, uint16_t d, uint16_t a, uint16_t m) {\n"
+      "  uint16_t x = (comp & 0x20) ? 0 : d;\n"
+      "  uint16_t y = (comp & 0x08) ? 0 : (comp & 0x40) ? m : a;\n"
+      "  x = (comp & 0x10) ? ~x : x;\n"
+      "  y = (comp & 0x04) ? ~y : y;\n"
+      "  uint16_t out = (comp & 0x02) ? x + y : x & y;\n"
+      "  return (comp & 0x01) ? ~out : out;\n"
+      "}\n");
+  for (int start = 0; start < count; start++) {
+    if (!leaders[start]) {
+      continue;
+    }
+    fprintf(file, "\nstatic uint16_t block_%i(uint16_t* r, uint16_t* ram, uint8_t* dirty) {\n", start);
+    if (is_halt(words, count, start)) {
+      fprintf(file, "  r[0] = %i;\n  return %i | 0x%X;\n}\n", start, start, BLOCK_HALTED);
+      continue;
+    }
+    fprintf(file, "  uint16_t a = r[0], d = r[1], out, target;\n"
+        "  (void) out;\n  (void) target;\n");
+    int address = start;
+    bool returned = false;
+    do {
+      uint16_t word = words[address++];
+      translate_instruction(file, word);
+      returned = (word & 0x8000) && (word & 0x7) == 0x7;
+    } while (address < count && !leaders[address]);
+    if (!returned) {
+      fprintf(file, "  r[0] = a;\n  r[1] = d;\n  return %i;\n", address & ADDRESS_MASK);
+    }
+    fprintf(file, "}\n");
+  }
+
+  fprintf(file, "\nuint16_t (*const hack_blocks[%i])(uint16_t*, uint16_t*, uint8_t*) = {\n", ROM_WORDS);
+  for (int i = 0; i < count; i++) {
+    if (leaders[i]) {
+      fprintf(file, "  [%i] = block_%i,\n", i, i);
+    }
+  }
+  fprintf(file, "};\n\nconst uint16_t hack_lengths[%i] = {\n", ROM_WORDS);
+  for (int i = 0, start = -1; i <= count; i++) {
+    if (i == count || leaders[i]) {
+      if (start != -1 && !is_halt(words, count, start)) {
+        fprintf(file, "  [%i] = %i,\n", start, i - start);
+      }
+      start = i;
+    }
+  }
+  fprintf(file, "};\n");
+  free(leaders);
+}
+
+// Marks every address a block starts at. The instruction after a jump
+// starts a block too, so blocks never contain a jump before their end.
+bool* find_leaders(const uint16_t* words, int count) {
+  bool* leaders = calloc(count + 1, sizeof(bool));
+  leaders[0] = true;
+  for (int i = 0; i < count; i++) {
+    uint16_t word = words[i];
+    if ((word & 0x8000) == 0) {
+      if (word < count) {
+        leaders[word] = true;
+      }
+    } else if (word & 0x7) {
+      leaders[i + 1] = true;
+    }
+  }
+  return leaders;
+}
+
+// The same test load_rom uses to find the final loop
+bool is_halt(const uint16_t* words, int count, int address) {
+  return address + 1 < count && words[address] == address &&
+      (words[address + 1] & 0x8000) && (words[address + 1] & 0x3F) == 0x7;
+}
+
+// One instruction as C. M is written at the old A, and the jump goes to
+// the old A.
+void translate_instruction(FILE* file, uint16_t word) {
+  Op op = decode(word);
+  if (op.comp == OP_LOAD) {
+    fprintf(file, "  a = %i;\n", op.value);
+    return;
+  }
+  if (compExpressions[op.comp] != NULL) {
+    fprintf(file, "  out = %s;\n", compExpressions[op.comp]);
+  } else {
+    fprintf(file, "  out = alu(%i, d, a, M);\n", op.comp);
+  }
+  int jump = op.control & 0x7;
+  if (jump != 0) {
+    fprintf(file, "  target = a & 0x7FFF;\n");
+  }
+  if (op.control & DEST_M) {
+    fprintf(file, "  STORE(out);\n");
+  }
+  if (op.control & DEST_A) {
+    fprintf(file, "  a = out;\n");
+  }
+  if (op.control & DEST_D) {
+    fprintf(file, "  d = out;\n");
+  }
+  if (jump == 0x7) {
+    fprintf(file, "  r[0] = a;\n  r[1] = d;\n  return target;\n");
+  } else if (jump != 0) {
+    fprintf(file, "  if (%s) {\n    r[0] = a;\n    r[1] = d;\n    return target;\n  }\n",
+        jumpConditions[jump]);
+  }
+}
+
+// Finds the compiled program in the cache, compiling it first if it isn't
+// there. Returns false if it could not be compiled or loaded.
+bool NativeProgram_load(NativeProgram* native, const uint16_t* words, int count, const char* cache_dir) {
+  native->library = NULL;
+  native->blocks = NULL;
+  native->lengths = NULL;
+  uint64_t key = hash_source((const char*) words, (size_t) count * sizeof(uint16_t));
+  char name[16];
+  snprintf(name, sizeof(name), "aot-v%d", AOT_VERSION);
+  ProgramWords program = {words, count};
+  native->library = load_native(key, name, write_program, &program, "-O1", cache_dir);
+  if (native->library == NULL) {
+    return false;
+  }
+  native->blocks = dlsym(native->library, "hack_blocks");
+  native->lengths = dlsym(native->library, "hack_lengths");
+  if (native->blocks == NULL || native->lengths == NULL) {
+    NativeProgram_free(native);
+    return false;
+  }
+  return true;
+}
+
+void NativeProgram_free(NativeProgram* native) {
+  if (native->library != NULL) {
+    dlclose(native->library);
+  }
+  native->library = NULL;
+  native->blocks = NULL;
+  native->lengths = NULL;
+}
+
+void write_program(FILE* file, const void* argument) {
+  const ProgramWords* program = argument;
+  translate(program->words, program->count, file);
+}
+
+// Runs compiled blocks while the budget allows a whole block, and
+// interprets everywhere else: inside a block after a computed jump, past
+// the end of the program, and for the last few instructions of the budget.
+// Counts instructions exactly like run.
+uint64_t run_native(Machine* machine, NativeProgram* native, uint64_t limit) {
+  if (machine->halted) {
+    return 0;
+  }
+  uint16_t registers[2] = {machine->a, machine->d};
+  uint16_t pc = machine->pc;
+  uint64_t remaining = limit;
+  uint64_t compiled = 0;
+  while (remaining > 0) {
+    HackBlock block = native->blocks[pc];
+    if (block != NULL && native->lengths[pc] <= remaining) {
+      uint16_t next = block(registers, machine->ram, machine->dirty_rows);
+      compiled += native->lengths[pc];
+      remaining -= native->lengths[pc];
+      pc = next & ADDRESS_MASK;
+      if (next & BLOCK_HALTED) {
+        machine->halted = true;
+        break;
+      }
+    } else {
+      machine->a = registers[0];
+      machine->d = registers[1];
+      machine->pc = pc;
+      uint64_t executed = run(machine, 1);
+      registers[0] = machine->a;
+      registers[1] = machine->d;
+      pc = machine->pc;
+      if (executed == 0) {
+        break;
+      }
+      remaining -= executed;
+    }
+  }
+  machine->a = registers[0];
+  machine->d = registers[1];
+  machine->pc = pc;
+  machine->cycles += compiled;
+  return limit - remaining;
+}
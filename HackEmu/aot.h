@@ -0,0 +1,31 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "machine.h"
+
+// Set in a block's return value when it reached the final @n / 0;JMP loop
+#define BLOCK_HALTED 0x8000
+
+// A basic block compiled to native code. registers holds A and D, and
+// dirty_rows is Machine.dirty_rows. Returns the address of the next
+// instruction.
+typedef uint16_t (*HackBlock)(uint16_t* registers, uint16_t* ram, uint8_t* dirty_rows);
+
+// A program translated to C and loaded from a shared object. blocks has
+// an entry for every address a block starts at, and lengths says how many
+// instructions each of them runs.
+typedef struct {
+  void* library;
+  const HackBlock* blocks;
+  const uint16_t* lengths;
+} NativeProgram;
+
+void translate(const uint16_t* words, int count, FILE* file);
+bool NativeProgram_load(NativeProgram* native, const uint16_t* words, int count, const char* cache_dir);
+void NativeProgram_free(NativeProgram* native);
+uint64_t run_native(Machine* machine, NativeProgram* native, uint64_t limit);
+
+#endif
@@ -0,0 +1,1710 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "cache.h"
+#include "chipaot.h"
+#include "native.h"
+#include "optimize.h"
+
+// Ahead of time translation of netlists. A chip becomes one C function
+// that runs clock cycles in a loop: every gate in order, then the RAM
+// writes, then the flip-flops take their inputs. The flip-flops live in
+// local variables for the whole loop.
+//
+// Buses are packed into words. The bits of a chip input, a memory's out
+// and a run of flip-flops are each one word, and gates that do the same
+// thing to neighbouring bits of a word become a group, one word operation:
+// the sixteen Nands of a Not16 are p3 = ~(p1 & p1). Groups are grown from
+// each packed bit to the gates that read the bits beside it the same way,
+// so packing spreads through the chip from its buses. A group's other
+// input is mostly the bits of one word shifted into place, but may be one
+// signal in every bit, or signals gathered from wherever they are.
+//
+// A ripple carry is found from what its gates work out rather than how:
+// each gate's cuts, the sets of at most three signals it is a function
+// of, say when it is the majority of the carry before it and two other
+// signals. A chain of carries becomes an adder, one addition whose bits
+// are the sums and whose carries are where it differs from a ^ b, so an
+// Add16 is a few word operations instead of a long line of gates.
+//
+// Gates that don't line up otherwise run one signal to a word, kept in
+// the bit that what reads it wants it in, so a packed bit is read where
+// it is and a carry is ready to be gathered.
+//
+// Only what the flip-flops and memories need is worked out in the loop,
+// since nothing else outlasts a cycle. run_native_chip works out the rest
+// once the cycles are done.
+//
+// Compiled chips are kept in the cache directory, named after a hash of
+// their translation, and are only compiled again when the netlist changes.
+// native.c compiles and loads them.
+
+#define CHIP_AOT_VERSION 2
+#define MAX_PACK_WIDTH 64
+#define MAX_CUTS 12
+// shorter chains are as quick as gates
+#define MIN_ADDER_WIDTH 4
+
+// Truth tables of cuts, for the leaves' values as bits of the index
+#define TABLE_LEAF 0xAA
+#define TABLE_AND 0x88
+#define TABLE_OR 0xEE
+#define TABLE_XOR 0x66
+#define TABLE_XNOR 0x99
+#define TABLE_MAJORITY 0xE8
+#define TABLE_XOR3 0x96
+#define TABLE_XNOR3 0x69
+
+typedef enum {
+  PACK_INPUT, PACK_FLIP_FLOPS, PACK_MEMORY, PACK_GATES, PACK_SUMS, PACK_CARRIES
+} PackKind;
+
+// Signals held in the bits of a word. index is the input port, the first
+// flip-flop, the memory, the group or the adder the bits come from. An
+// adder's packs can have gaps, which are SIGNAL_FALSE.
+typedef struct {
+  PackKind kind;
+  int index;
+  int width;
+  uint32_t signals[MAX_PACK_WIDTH];
+} Pack;
+
+// Gates that each Nand bit k of a with bit k of b, and whose outputs are
+// the bits of pack. A group whose gates turn out to need each other,
+// through other groups, is dissolved and its gates run one at a time.
+typedef struct {
+  int width;
+  int members[MAX_PACK_WIDTH];
+  uint32_t a[MAX_PACK_WIDTH];
+  uint32_t b[MAX_PACK_WIDTH];
+  int pack;
+  bool dissolved;
+} Group;
+
+// How the gates beside the first one in a group are found from the input
+// that isn't packed with theirs: it is the bit at the same distance in a
+// pack, the same signal, or a signal shaped like the first gate's
+typedef enum {MATCH_ALIGNED, MATCH_BROADCAST, MATCH_FREE} MatchKind;
+
+// A ripple carry: carries[k] is the majority of a[k], b[k] and the carry
+// before it, carry_in for the first, and sums[k], where a gate works it
+// out, is their exclusive or. Both can have gaps, which are SIGNAL_FALSE.
+typedef struct {
+  int width;
+  uint32_t a[MAX_PACK_WIDTH];
+  uint32_t b[MAX_PACK_WIDTH];
+  uint32_t carry_in;
+  uint32_t carries[MAX_PACK_WIDTH];
+  uint32_t sums[MAX_PACK_WIDTH];
+  int sum_pack;
+  int carry_pack;
+} Adder;
+
+// A set of at most three signals, in order, that a signal is a function
+// of, and the function: bit m of table is its value when each leaf j is
+// bit j of m
+typedef struct {
+  uint32_t leaves[3];
+  int count;
+  uint8_t table;
+} Cut;
+
+// How a gate is a carry, and how many carries lead up to it
+typedef struct {
+  uint32_t a;
+  uint32_t b;
+  uint32_t carry_in;
+  int length;
+} Stage;
+
+// The C that write_translation hands to the compiler
+typedef struct {
+  const char* text;
+  size_t size;
+} Translation;
+
+// A gate, group, memory read or addition, in the order they run
+typedef enum {STEP_GATE, STEP_GROUP, STEP_MEMORY, STEP_ADDER} StepKind;
+
+typedef struct {
+  StepKind kind;
+  int index;
+} Step;
+
+typedef struct {
+  const Netlist* netlist;
+  // the netlist's gates with their inputs replaced by the signals they
+  // equal, and whether each gate is translated, or equals one before it
+  NandGate* gates;
+  bool* kept;
+  MemoryPart* memories;
+  uint32_t* flip_flop_inputs;
+  // for each signal, the longest path to it from an input, flip-flop or
+  // memory, what drives it: the gate, -2 - the memory, -2 - memory_count
+  // - the adder, or -1, and a hash of the gates just before it
+  int* levels;
+  int* drivers;
+  uint32_t* shapes;
+  // each signal's pack and bit, or -1
+  int* pack_of;
+  int* slot_of;
+  Pack* packs;
+  int pack_count;
+  int pack_capacity;
+  Group* groups;
+  int group_count;
+  int group_capacity;
+  int* group_of;
+  Adder* adders;
+  int adder_count;
+  int adder_capacity;
+  // the gates that read each signal, from readers[reader_start[signal]]
+  int* reader_start;
+  int* readers;
+  // the gates of the group being grown, and the signals a search has seen,
+  // marked with the number of the group or search
+  int* members;
+  int member_mark;
+  int* visited;
+  int visit_mark;
+  // the bit of its word that each signal that isn't packed is kept in, and
+  // whether a group reads a signal in every bit, so it needs a mask
+  int* positions;
+  bool* broadcast_use;
+} Packer;
+
+void start_packer(Packer* packer, const Netlist* netlist);
+void finish_packer(Packer* packer);
+void find_equal_signals(Packer* packer);
+void find_drivers(Packer* packer);
+void find_adders(Packer* packer);
+void find_cuts(const Packer* packer, Cut* cuts, int* counts);
+void add_cut(Cut* cuts, int* count, const Cut* cut);
+bool has_leaves(const Cut* cut, const Cut* part);
+bool merge_cuts(const Cut* x, const Cut* y, Cut* merged);
+uint8_t expand_table(const Cut* cut, const Cut* into);
+void find_stages(const Packer* packer, const Cut* cuts, const int* counts, Stage* stages);
+void consider_stage(Stage* stages, uint32_t carry, uint32_t carry_in, uint32_t a, uint32_t b);
+void find_sums(const Packer* packer, Adder* adders, int adder_count, const Cut* cuts,
+    const int* counts, bool* claimed);
+bool sum_cut(uint32_t a, uint32_t b, uint32_t carry, Cut* cut);
+void add_last_stages(const Packer* packer, Adder* adders, int adder_count, const Cut* cuts,
+    const int* counts, bool* claimed);
+uint32_t hash_cut(const Cut* cut);
+bool adder_loops(Packer* packer, const Adder* adder, int* outputs, int mark);
+void add_adder(Packer* packer, const Adder* adder);
+int driver_inputs(const Packer* packer, int driver, uint32_t* inputs);
+void drop_unread_gates(Packer* packer);
+void find_levels(Packer* packer);
+void find_shapes(Packer* packer);
+void find_readers(Packer* packer);
+int add_pack(Packer* packer, PackKind kind, int index, const uint32_t* signals, int width);
+void pack_sources(Packer* packer);
+void pack_gates(Packer* packer);
+int try_group(Packer* packer, int gate, int side, MatchKind match, Group* group);
+int find_member(Packer* packer, uint32_t signal, MatchKind match, uint32_t expected,
+    Group* group, int low, int high, int* min_level);
+bool reaches_member(Packer* packer, uint32_t signal, int min_level);
+Step* order_steps(Packer* packer, int* count);
+void add_reads(const Packer* packer, const int* producers, const Step* steps, int step,
+    int* waiting, int** readers);
+void dissolve_group(Packer* packer, int index);
+void place_signals(Packer* packer, const Step* steps, int count);
+void add_demand(const Packer* packer, uint16_t (*demands)[MAX_PACK_WIDTH], uint32_t signal,
+    int position);
+void line_up_operands(Packer* packer);
+bool follows(const Packer* packer, uint32_t before, uint32_t signal);
+void find_broadcasts(Packer* packer);
+bool is_broadcast(const uint32_t* signals, int width);
+int position_of(const Packer* packer, uint32_t signal);
+void write_operand(FILE* file, const Packer* packer, uint32_t signal, int position);
+void write_mask(FILE* file, const Packer* packer, uint32_t signal, const char* indent);
+void write_word(FILE* file, const Packer* packer, const uint32_t* signals, int width);
+void write_gather(FILE* file, const Packer* packer, const uint32_t* bits, int width);
+void write_masks(FILE* file, const Packer* packer, int pack, const char* indent);
+void write_translation(FILE* file, const void* argument);
+
+// Writes the netlist as C: chip_cycles, which NativeChip_load looks up
+void translate_netlist(const Netlist* netlist, FILE* file) {
+  Packer packer;
+  start_packer(&packer, netlist);
+  int step_count;
+  Step* steps = order_steps(&packer, &step_count);
+  line_up_operands(&packer);
+  place_signals(&packer, steps, step_count);
+  find_broadcasts(&packer);
+  int grouped = 0;
+  int single = 0;
+  for (int i = 0; i < step_count; i++) {
+    grouped += steps[i].kind == STEP_GROUP;
+    single += steps[i].kind == STEP_GATE;
+  }
+  fprintf(file, "// %s: %i gates, run as %i word operations, %i additions and %i single gates\n",
+      netlist->name, netlist->gate_count, grouped, packer.adder_count, single);
+  fprintf(file, "#include <stdint.h>\n\n");
+  fprintf(file, "void chip_cycles(uint64_t* values, uint16_t** contents, uint64_t cycles) {\n");
+  for (int i = 0; i < netlist->input_count; i++) {
+    const Port* port = &netlist->inputs[i];
+    int pack = packer.pack_of[port->bits[0]];
+    if (port->memory >= 0) {
+      continue;
+    } else if (pack < 0) {
+      fprintf(file, "  const uint64_t s%u = values[%u];\n", port->bits[0], port->bits[0]);
+      write_mask(file, &packer, port->bits[0], "  const ");
+      continue;
+    }
+    fprintf(file, "  const uint64_t p%i = 0", pack);
+    for (int bit = 0; bit < port->width; bit++) {
+      fprintf(file, " | (values[%u] & 1) << %i", port->bits[bit], bit);
+    }
+    fprintf(file, ";\n");
+    write_masks(file, &packer, pack, "  const ");
+  }
+  for (int i = 0; i < packer.pack_count; i++) {
+    const Pack* pack = &packer.packs[i];
+    if (pack->kind != PACK_FLIP_FLOPS) {
+      continue;
+    }
+    fprintf(file, "  uint64_t p%i = 0", i);
+    for (int bit = 0; bit < pack->width; bit++) {
+      fprintf(file, " | (values[%u] & 1) << %i", pack->signals[bit], bit);
+    }
+    fprintf(file, ";\n");
+  }
+
+  fprintf(file, "  for (; cycles > 0; cycles--) {\n");
+  for (int i = 0; i < packer.pack_count; i++) {
+    if (packer.packs[i].kind == PACK_FLIP_FLOPS) {
+      write_masks(file, &packer, i, "    ");
+    }
+  }
+  for (int i = 0; i < step_count; i++) {
+    if (steps[i].kind == STEP_GATE) {
+      const NandGate* gate = &packer.gates[steps[i].index];
+      int position = packer.positions[gate->out];
+      fprintf(file, "    uint64_t s%u = ~(", gate->out);
+      write_operand(file, &packer, gate->a, position);
+      fprintf(file, " & ");
+      write_operand(file, &packer, gate->b, position);
+      fprintf(file, ");\n");
+      write_mask(file, &packer, gate->out, "    ");
+    } else if (steps[i].kind == STEP_GROUP) {
+      const Group* group = &packer.groups[steps[i].index];
+      fprintf(file, "    uint64_t p%i = ~(", group->pack);
+      write_word(file, &packer, group->a, group->width);
+      fprintf(file, " & ");
+      write_word(file, &packer, group->b, group->width);
+      fprintf(file, ");\n");
+      write_masks(file, &packer, group->pack, "    ");
+    } else if (steps[i].kind == STEP_ADDER) {
+      const Adder* adder = &packer.adders[steps[i].index];
+      int index = steps[i].index;
+      fprintf(file, "    uint64_t a%i = ", index);
+      write_gather(file, &packer, adder->a, adder->width);
+      fprintf(file, ";\n    uint64_t b%i = ", index);
+      write_gather(file, &packer, adder->b, adder->width);
+      fprintf(file, ";\n    uint64_t p%i = a%i + b%i + (", adder->sum_pack, index, index);
+      write_operand(file, &packer, adder->carry_in, 0);
+      fprintf(file, " & 1);\n    uint64_t p%i = (p%i ^ a%i ^ b%i) >> 1;\n", adder->carry_pack,
+          adder->sum_pack, index, index);
+      write_masks(file, &packer, adder->sum_pack, "    ");
+      write_masks(file, &packer, adder->carry_pack, "    ");
+    } else {
+      const MemoryPart* memory = &packer.memories[steps[i].index];
+      int pack = packer.pack_of[memory->out[0]];
+      fprintf(file, "    uint64_t p%i = contents[%i][", pack, steps[i].index);
+      if (memory->kind == MEMORY_KEYBOARD) {
+        fprintf(file, "0");
+      } else {
+        write_gather(file, &packer, memory->address, memory->address_bits);
+      }
+      fprintf(file, "];\n");
+      write_masks(file, &packer, pack, "    ");
+    }
+  }
+  // a RAM takes what the gates gave it this cycle, and is read next cycle
+  for (int i = 0; i < netlist->memory_count; i++) {
+    const MemoryPart* memory = &packer.memories[i];
+    if (memory->kind != MEMORY_RAM || memory->load == SIGNAL_FALSE) {
+      continue;
+    }
+    fprintf(file, "    if (");
+    write_operand(file, &packer, memory->load, 0);
+    fprintf(file, " & 1) {\n      contents[%i][", i);
+    write_gather(file, &packer, memory->address, memory->address_bits);
+    fprintf(file, "] = (uint16_t) (");
+    write_gather(file, &packer, memory->in, 16);
+    fprintf(file, ");\n    }\n");
+  }
+  for (int i = 0; i < packer.pack_count; i++) {
+    const Pack* pack = &packer.packs[i];
+    if (pack->kind != PACK_FLIP_FLOPS) {
+      continue;
+    }
+    fprintf(file, "    uint64_t n%i = ", i);
+    write_gather(file, &packer, &packer.flip_flop_inputs[pack->index], pack->width);
+    fprintf(file, ";\n");
+  }
+  for (int i = 0; i < packer.pack_count; i++) {
+    if (packer.packs[i].kind == PACK_FLIP_FLOPS) {
+      fprintf(file, "    p%i = n%i;\n", i, i);
+    }
+  }
+  fprintf(file, "  }\n");
+  for (int i = 0; i < packer.pack_count; i++) {
+    const Pack* pack = &packer.packs[i];
+    for (int bit = 0; bit < pack->width && pack->kind == PACK_FLIP_FLOPS; bit++) {
+      fprintf(file, "  values[%u] = -((p%i >> %i) & 1);\n", pack->signals[bit], i, bit);
+    }
+  }
+  fprintf(file, "}\n");
+  free(steps);
+  finish_packer(&packer);
+}
+
+// Finds the compiled chip in the cache, compiling it first if it isn't
+// there. Returns false if it could not be compiled or loaded.
+bool NativeChip_load(NativeChip* native, const Netlist* netlist, const char* cache_dir) {
+  native->library = NULL;
+  native->run = NULL;
+  char* text;
+  size_t size;
+  FILE* translation = open_memstream(&text, &size);
+  if (translation == NULL) {
+    return false;
+  }
+  translate_netlist(netlist, translation);
+  fclose(translation);
+  uint64_t key = hash_source(text, size);
+  char name[16];
+  snprintf(name, sizeof(name), "chip-v%d", CHIP_AOT_VERSION);
+  Translation source = {text, size};
+  native->library = load_native(key, name, write_translation, &source, "-O2",
+      cache_dir);
+  free(text);
+  if (native->library == NULL) {
+    return false;
+  }
+  native->run = (ChipCycles) dlsym(native->library, "chip_cycles");
+  if (native->run == NULL) {
+    NativeChip_free(native);
+    return false;
+  }
+  return true;
+}
+
+void NativeChip_free(NativeChip* native) {
+  if (native->library != NULL) {
+    dlclose(native->library);
+  }
+  native->library = NULL;
+  native->run = NULL;
+}
+
+// Clocks a one-lane simulation, leaving it as tock would
+void run_native_chip(Simulation* simulation, const NativeChip* native, uint64_t cycles) {
+  if (cycles == 0) {
+    return;
+  }
+  native->run(simulation->values, simulation->contents, cycles);
+  evaluate(simulation);
+}
+
+void start_packer(Packer* packer, const Netlist* netlist) {
+  memset(packer, 0, sizeof(Packer));
+  packer->netlist = netlist;
+  uint32_t signals = netlist->signal_count;
+  packer->levels = calloc(signals, sizeof(int));
+  packer->drivers = malloc(signals * sizeof(int));
+  packer->shapes = calloc(signals, sizeof(uint32_t));
+  packer->pack_of = malloc(signals * sizeof(int));
+  packer->slot_of = calloc(signals, sizeof(int));
+  packer->group_of = malloc((netlist->gate_count + 1) * sizeof(int));
+  packer->members = calloc(netlist->gate_count + 1, sizeof(int));
+  packer->visited = calloc(signals, sizeof(int));
+  packer->positions = calloc(signals, sizeof(int));
+  packer->broadcast_use = calloc(signals, sizeof(bool));
+  for (uint32_t i = 0; i < signals; i++) {
+    packer->drivers[i] = -1;
+    packer->pack_of[i] = -1;
+  }
+  for (int i = 0; i < netlist->gate_count; i++) {
+    packer->group_of[i] = -1;
+  }
+  find_equal_signals(packer);
+  find_drivers(packer);
+  // adders are only looked for among the gates that are needed, and leave
+  // some of those unread
+  drop_unread_gates(packer);
+  find_adders(packer);
+  drop_unread_gates(packer);
+  find_levels(packer);
+  find_shapes(packer);
+  find_readers(packer);
+  pack_sources(packer);
+  pack_gates(packer);
+}
+
+void finish_packer(Packer* packer) {
+  free(packer->gates);
+  free(packer->kept);
+  free(packer->memories);
+  free(packer->flip_flop_inputs);
+  free(packer->levels);
+  free(packer->drivers);
+  free(packer->shapes);
+  free(packer->pack_of);
+  free(packer->slot_of);
+  free(packer->packs);
+  free(packer->groups);
+  free(packer->group_of);
+  free(packer->adders);
+  free(packer->reader_start);
+  free(packer->readers);
+  free(packer->members);
+  free(packer->visited);
+  free(packer->positions);
+  free(packer->broadcast_use);
+}
+
+// Finds the signals that are the same as another, as fold_gates does for
+// optimize_netlist, so each value is worked out once and the translation
+// sees a bus's copies of a shared signal as that signal: the sixteen
+// Not(sel) of a Mux16 are one Not, and so a Mux16 packs. Signals keep the
+// numbers they have in the simulation the translation runs for.
+void find_equal_signals(Packer* packer) {
+  const Netlist* netlist = packer->netlist;
+  packer->gates = malloc((netlist->gate_count + 1) * sizeof(NandGate));
+  packer->kept = calloc(netlist->gate_count + 1, sizeof(bool));
+  uint32_t* same = fold_gates(netlist, packer->gates, packer->kept);
+  packer->memories = malloc((netlist->memory_count + 1) * sizeof(MemoryPart));
+  for (int i = 0; i < netlist->memory_count; i++) {
+    MemoryPart* memory = &packer->memories[i];
+    *memory = netlist->memories[i];
+    for (int bit = 0; bit < 16; bit++) {
+      memory->in[bit] = same[memory->in[bit]];
+    }
+    for (int bit = 0; bit < memory->address_bits; bit++) {
+      memory->address[bit] = same[memory->address[bit]];
+    }
+    memory->load = same[memory->load];
+  }
+  packer->flip_flop_inputs = malloc((netlist->flip_flop_count + 1) * sizeof(uint32_t));
+  for (int i = 0; i < netlist->flip_flop_count; i++) {
+    packer->flip_flop_inputs[i] = same[netlist->flip_flops[i].in];
+  }
+  free(same);
+}
+
+// What drives each signal: its gate, or the memory that reads it out
+void find_drivers(Packer* packer) {
+  const Netlist* netlist = packer->netlist;
+  for (int i = 0; i < netlist->gate_count; i++) {
+    if (packer->kept[i]) {
+      packer->drivers[packer->gates[i].out] = i;
+    }
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    for (int bit = 0; bit < 16; bit++) {
+      packer->drivers[packer->memories[i].out[bit]] = -2 - i;
+    }
+  }
+}
+
+// Finds the ripple carries among the gates, and makes each an adder
+// whose carries and sums the gates no longer work out. A gate is a carry
+// if it is the majority of three signals, one of them the carry before
+// it, or the And or Or of two, the majority of them and false or true.
+// A chain is only taken if no input of it comes from the chain, since
+// the adder runs all of it at once.
+void find_adders(Packer* packer) {
+  const Netlist* netlist = packer->netlist;
+  Cut* cuts = malloc((size_t) netlist->signal_count * MAX_CUTS * sizeof(Cut));
+  int* counts = malloc(netlist->signal_count * sizeof(int));
+  Stage* stages = calloc(netlist->signal_count, sizeof(Stage));
+  bool* claimed = calloc(netlist->signal_count, sizeof(bool));
+  find_cuts(packer, cuts, counts);
+  find_stages(packer, cuts, counts, stages);
+
+  // from the last carry of each chain, whose readers come after it
+  Adder* found = NULL;
+  int found_count = 0;
+  int capacity = 0;
+  for (int i = netlist->gate_count - 1; i >= 0; i--) {
+    uint32_t carry = packer->gates[i].out;
+    if (!packer->kept[i] || stages[carry].length < MIN_ADDER_WIDTH || claimed[carry]) {
+      continue;
+    }
+    uint32_t chain[MAX_PACK_WIDTH];
+    int width = 0;
+    // carry k is bit k + 1 of where the sum differs from a ^ b
+    while (width < MAX_PACK_WIDTH - 1 && stages[carry].length > 0 && !claimed[carry]) {
+      chain[width++] = carry;
+      carry = stages[carry].carry_in;
+    }
+    if (width < MIN_ADDER_WIDTH) {
+      continue;
+    }
+    if (found_count == capacity) {
+      capacity = capacity == 0 ? 16 : capacity * 2;
+      found = realloc(found, capacity * sizeof(Adder));
+    }
+    Adder* adder = &found[found_count++];
+    adder->width = width;
+    adder->carry_in = carry;
+    for (int k = 0; k < width; k++) {
+      const Stage* stage = &stages[chain[width - 1 - k]];
+      adder->a[k] = stage->a;
+      adder->b[k] = stage->b;
+      adder->carries[k] = chain[width - 1 - k];
+      adder->sums[k] = SIGNAL_FALSE;
+      claimed[chain[width - 1 - k]] = true;
+    }
+  }
+  find_sums(packer, found, found_count, cuts, counts, claimed);
+  add_last_stages(packer, found, found_count, cuts, counts, claimed);
+  int* outputs = calloc(netlist->signal_count, sizeof(int));
+  for (int i = 0; i < found_count; i++) {
+    if (!adder_loops(packer, &found[i], outputs, i + 1)) {
+      add_adder(packer, &found[i]);
+    }
+  }
+  free(outputs);
+  free(found);
+  free(claimed);
+  free(stages);
+  free(counts);
+  free(cuts);
+}
+
+// Finds up to MAX_CUTS cuts of each signal, the smallest there are. The
+// first is the signal itself, and a gate's others are those of its inputs
+// put together.
+void find_cuts(const Packer* packer, Cut* cuts, int* counts) {
+  const Netlist* netlist = packer->netlist;
+  for (uint32_t i = 0; i < netlist->signal_count; i++) {
+    Cut* cut = &cuts[(size_t) i * MAX_CUTS];
+    cut->leaves[0] = i;
+    cut->count = i > SIGNAL_TRUE;
+    cut->table = i == SIGNAL_FALSE ? 0 : i == SIGNAL_TRUE ? 0xFF : TABLE_LEAF;
+    counts[i] = 1;
+  }
+  for (int i = 0; i < netlist->gate_count; i++) {
+    if (!packer->kept[i]) {
+      continue;
+    }
+    const NandGate* gate = &packer->gates[i];
+    const Cut* a = &cuts[(size_t) gate->a * MAX_CUTS];
+    const Cut* b = &cuts[(size_t) gate->b * MAX_CUTS];
+    for (int x = 0; x < counts[gate->a]; x++) {
+      for (int y = 0; y < counts[gate->b]; y++) {
+        Cut merged;
+        if (merge_cuts(&a[x], &b[y], &merged)) {
+          add_cut(&cuts[(size_t) gate->out * MAX_CUTS], &counts[gate->out], &merged);
+        }
+      }
+    }
+  }
+}
+
+// Adds cut, unless there is one with only some of its leaves: the gate
+// doesn't depend on the others, and it is the functions of all their
+// leaves that carries and sums are found by. The cuts that have all of
+// its leaves and more go, and if there's still no room it takes the place
+// of the largest, if that is larger.
+void add_cut(Cut* cuts, int* count, const Cut* cut) {
+  for (int i = 1; i < *count; i++) {
+    if (has_leaves(cut, &cuts[i])) {
+      return;
+    }
+  }
+  int kept = 1;
+  for (int i = 1; i < *count; i++) {
+    if (!has_leaves(&cuts[i], cut)) {
+      cuts[kept++] = cuts[i];
+    }
+  }
+  *count = kept;
+  int largest = 1;
+  for (int i = 1; i < *count; i++) {
+    largest = cuts[i].count > cuts[largest].count ? i : largest;
+  }
+  if (*count < MAX_CUTS) {
+    cuts[(*count)++] = *cut;
+  } else if (cuts[largest].count > cut->count) {
+    cuts[largest] = *cut;
+  }
+}
+
+// Whether every leaf of part is a leaf of cut
+bool has_leaves(const Cut* cut, const Cut* part) {
+  int i = 0;
+  for (int j = 0; j < part->count; j++) {
+    while (i < cut->count && cut->leaves[i] < part->leaves[j]) {
+      i++;
+    }
+    if (i == cut->count || cut->leaves[i] != part->leaves[j]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The cut of the Nand of x and y, if they have at most three leaves
+// between them
+bool merge_cuts(const Cut* x, const Cut* y, Cut* merged) {
+  merged->count = 0;
+  int i = 0;
+  int j = 0;
+  while (i < x->count || j < y->count) {
+    uint32_t leaf;
+    if (j == y->count || (i < x->count && x->leaves[i] < y->leaves[j])) {
+      leaf = x->leaves[i++];
+    } else if (i == x->count || y->leaves[j] < x->leaves[i]) {
+      leaf = y->leaves[j++];
+    } else {
+      leaf = x->leaves[i++];
+      j++;
+    }
+    if (merged->count == 3) {
+      return false;
+    }
+    merged->leaves[merged->count++] = leaf;
+  }
+  merged->table = ~(expand_table(x, merged) & expand_table(y, merged));
+  return true;
+}
+
+// The table of cut as a function of the leaves of into, which has them all
+uint8_t expand_table(const Cut* cut, const Cut* into) {
+  int places[3];
+  for (int j = 0; j < cut->count; j++) {
+    for (int k = 0; k < into->count; k++) {
+      if (into->leaves[k] == cut->leaves[j]) {
+        places[j] = k;
+      }
+    }
+  }
+  uint8_t table = 0;
+  for (int m = 0; m < 8; m++) {
+    int from = 0;
+    for (int j = 0; j < cut->count; j++) {
+      from |= ((m >> places[j]) & 1) << j;
+    }
+    table |= ((cut->table >> from) & 1) << m;
+  }
+  return table;
+}
+
+// Finds how each gate is a carry, if it is one, choosing the carry before
+// it that makes the longest chain
+void find_stages(const Packer* packer, const Cut* cuts, const int* counts, Stage* stages) {
+  const Netlist* netlist = packer->netlist;
+  for (int i = 0; i < netlist->gate_count; i++) {
+    uint32_t out = packer->gates[i].out;
+    for (int c = 1; packer->kept[i] && c < counts[out]; c++) {
+      const Cut* cut = &cuts[(size_t) out * MAX_CUTS + c];
+      const uint32_t* leaves = cut->leaves;
+      if (cut->count == 3 && cut->table == TABLE_MAJORITY) {
+        for (int k = 0; k < 3; k++) {
+          consider_stage(stages, out, leaves[k], leaves[(k + 1) % 3], leaves[(k + 2) % 3]);
+        }
+      } else if (cut->count == 2 && (cut->table == TABLE_AND || cut->table == TABLE_OR)) {
+        uint32_t constant = cut->table == TABLE_AND ? SIGNAL_FALSE : SIGNAL_TRUE;
+        consider_stage(stages, out, constant, leaves[0], leaves[1]);
+        consider_stage(stages, out, leaves[0], leaves[1], constant);
+        consider_stage(stages, out, leaves[1], leaves[0], constant);
+      }
+    }
+  }
+}
+
+void consider_stage(Stage* stages, uint32_t carry, uint32_t carry_in, uint32_t a, uint32_t b) {
+  int length = stages[carry_in].length + 1;
+  if (length > stages[carry].length) {
+    stages[carry] = (Stage) {a, b, carry_in, length};
+  }
+}
+
+// Finds the gates that work out the adders' sums, looking each gate's cuts
+// up in a table of what the sum of each stage would be. A sum is only
+// taken once, and never from a carry.
+void find_sums(const Packer* packer, Adder* adders, int adder_count, const Cut* cuts,
+    const int* counts, bool* claimed) {
+  const Netlist* netlist = packer->netlist;
+  int stage_count = 0;
+  for (int i = 0; i < adder_count; i++) {
+    stage_count += adders[i].width;
+  }
+  int size = 16;
+  while (size < 2 * stage_count) {
+    size *= 2;
+  }
+  Cut* keys = malloc(size * sizeof(Cut));
+  int* bits = malloc(size * sizeof(int));
+  for (int i = 0; i < size; i++) {
+    bits[i] = -1;
+  }
+  for (int i = 0; i < adder_count; i++) {
+    const Adder* adder = &adders[i];
+    for (int k = 0; k < adder->width; k++) {
+      Cut key;
+      uint32_t carry = k == 0 ? adder->carry_in : adder->carries[k - 1];
+      if (!sum_cut(adder->a[k], adder->b[k], carry, &key)) {
+        continue;
+      }
+      uint32_t slot = hash_cut(&key) & (size - 1);
+      while (bits[slot] >= 0 && memcmp(&keys[slot], &key, sizeof(Cut)) != 0) {
+        slot = (slot + 1) & (size - 1);
+      }
+      if (bits[slot] < 0) {
+        keys[slot] = key;
+        bits[slot] = i * MAX_PACK_WIDTH + k;
+      }
+    }
+  }
+  for (int i = 0; i < netlist->gate_count; i++) {
+    uint32_t out = packer->gates[i].out;
+    for (int c = 1; packer->kept[i] && c < counts[out] && !claimed[out]; c++) {
+      const Cut* cut = &cuts[(size_t) out * MAX_CUTS + c];
+      Cut key;
+      memset(&key, 0, sizeof(Cut));
+      key.count = cut->count;
+      key.table = cut->table;
+      memcpy(key.leaves, cut->leaves, cut->count * sizeof(uint32_t));
+      uint32_t slot = hash_cut(&key) & (size - 1);
+      while (bits[slot] >= 0 && memcmp(&keys[slot], &key, sizeof(Cut)) != 0) {
+        slot = (slot + 1) & (size - 1);
+      }
+      Adder* adder = bits[slot] >= 0 ? &adders[bits[slot] / MAX_PACK_WIDTH] : NULL;
+      if (adder != NULL && adder->sums[bits[slot] % MAX_PACK_WIDTH] == SIGNAL_FALSE) {
+        adder->sums[bits[slot] % MAX_PACK_WIDTH] = out;
+        claimed[out] = true;
+      }
+    }
+  }
+  free(keys);
+  free(bits);
+}
+
+// The cut a stage's sum has: its inputs that aren't constants, without a
+// signal that is there twice, and their exclusive or, negated if true is
+// among them. There is no such cut for fewer than two leaves, which one
+// gate or none works out anyway.
+bool sum_cut(uint32_t a, uint32_t b, uint32_t carry, Cut* cut) {
+  uint32_t inputs[3] = {a, b, carry};
+  bool negated = false;
+  memset(cut, 0, sizeof(Cut));
+  for (int i = 0; i < 3; i++) {
+    negated ^= inputs[i] == SIGNAL_TRUE;
+    if (inputs[i] <= SIGNAL_TRUE) {
+      continue;
+    }
+    int k = 0;
+    while (k < cut->count && cut->leaves[k] < inputs[i]) {
+      k++;
+    }
+    if (k < cut->count && cut->leaves[k] == inputs[i]) {
+      memmove(&cut->leaves[k], &cut->leaves[k + 1], (cut->count - k - 1) * sizeof(uint32_t));
+      cut->leaves[--cut->count] = 0;
+      continue;
+    }
+    memmove(&cut->leaves[k + 1], &cut->leaves[k], (cut->count - k) * sizeof(uint32_t));
+    cut->leaves[k] = inputs[i];
+    cut->count++;
+  }
+  if (cut->count == 3) {
+    cut->table = negated ? TABLE_XNOR3 : TABLE_XOR3;
+  } else {
+    cut->table = negated ? TABLE_XNOR : TABLE_XOR;
+  }
+  return cut->count >= 2;
+}
+
+// Adds a stage after each adder's last carry for the gate that works out
+// its sum, if there is one: the exclusive or of the carry and one or two
+// other signals. The carry out of it is a gap, as nothing reads it.
+void add_last_stages(const Packer* packer, Adder* adders, int adder_count, const Cut* cuts,
+    const int* counts, bool* claimed) {
+  const Netlist* netlist = packer->netlist;
+  int* last = malloc(netlist->signal_count * sizeof(int));
+  for (uint32_t i = 0; i < netlist->signal_count; i++) {
+    last[i] = -1;
+  }
+  for (int i = 0; i < adder_count; i++) {
+    if (adders[i].width < MAX_PACK_WIDTH) {
+      last[adders[i].carries[adders[i].width - 1]] = i;
+    }
+  }
+  for (int i = 0; i < netlist->gate_count; i++) {
+    uint32_t out = packer->gates[i].out;
+    for (int c = 1; packer->kept[i] && c < counts[out] && !claimed[out]; c++) {
+      const Cut* cut = &cuts[(size_t) out * MAX_CUTS + c];
+      bool negated = cut->table == TABLE_XNOR;
+      if (cut->count == 3 ? cut->table != TABLE_XOR3 : cut->table != TABLE_XOR && !negated) {
+        continue;
+      }
+      for (int k = 0; k < cut->count && !claimed[out]; k++) {
+        if (last[cut->leaves[k]] < 0) {
+          continue;
+        }
+        Adder* adder = &adders[last[cut->leaves[k]]];
+        last[cut->leaves[k]] = -1;
+        uint32_t others[2] = {SIGNAL_FALSE, negated ? SIGNAL_TRUE : SIGNAL_FALSE};
+        int count = 0;
+        for (int j = 0; j < cut->count; j++) {
+          if (j != k) {
+            others[count++] = cut->leaves[j];
+          }
+        }
+        adder->a[adder->width] = others[0];
+        adder->b[adder->width] = others[1];
+        adder->carries[adder->width] = SIGNAL_FALSE;
+        adder->sums[adder->width++] = out;
+        claimed[out] = true;
+      }
+    }
+  }
+  free(last);
+}
+
+uint32_t hash_cut(const Cut* cut) {
+  uint32_t hash = cut->table * 0x9E3779B1u + cut->count;
+  for (int i = 0; i < cut->count; i++) {
+    hash = (hash ^ cut->leaves[i]) * 0x85EBCA77u;
+  }
+  return hash ^ (hash >> 15);
+}
+
+// Whether an input of the adder comes from one of its carries or sums,
+// which outputs marks with mark
+bool adder_loops(Packer* packer, const Adder* adder, int* outputs, int mark) {
+  for (int k = 0; k < adder->width; k++) {
+    if (adder->carries[k] > SIGNAL_TRUE) {
+      outputs[adder->carries[k]] = mark;
+    }
+    if (adder->sums[k] > SIGNAL_TRUE) {
+      outputs[adder->sums[k]] = mark;
+    }
+  }
+  int capacity = 4 * MAX_PACK_WIDTH;
+  uint32_t* stack = malloc(capacity * sizeof(uint32_t));
+  int count = 0;
+  for (int k = 0; k < adder->width; k++) {
+    stack[count++] = adder->a[k];
+    stack[count++] = adder->b[k];
+  }
+  stack[count++] = adder->carry_in;
+  packer->visit_mark++;
+  bool loops = false;
+  while (count > 0 && !loops) {
+    uint32_t next = stack[--count];
+    if (packer->visited[next] == packer->visit_mark) {
+      continue;
+    }
+    packer->visited[next] = packer->visit_mark;
+    loops = outputs[next] == mark;
+    if (count + 2 * MAX_PACK_WIDTH + 1 > capacity) {
+      capacity *= 2;
+      stack = realloc(stack, capacity * sizeof(uint32_t));
+    }
+    count += driver_inputs(packer, packer->drivers[next], stack + count);
+  }
+  free(stack);
+  return loops;
+}
+
+// Takes the adder's carries and sums from their gates
+void add_adder(Packer* packer, const Adder* adder) {
+  if (packer->adder_count == packer->adder_capacity) {
+    packer->adder_capacity = packer->adder_capacity == 0 ? 16 : packer->adder_capacity * 2;
+    packer->adders = realloc(packer->adders, packer->adder_capacity * sizeof(Adder));
+  }
+  int driver = -2 - packer->netlist->memory_count - packer->adder_count;
+  packer->adders[packer->adder_count++] = *adder;
+  for (int k = 0; k < adder->width; k++) {
+    uint32_t outputs[2] = {adder->carries[k], adder->sums[k]};
+    for (int j = 0; j < 2; j++) {
+      if (outputs[j] > SIGNAL_TRUE) {
+        packer->kept[packer->drivers[outputs[j]]] = false;
+        packer->drivers[outputs[j]] = driver;
+      }
+    }
+  }
+}
+
+// Puts the signals that driver reads into inputs, which has room for
+// 2 * MAX_PACK_WIDTH + 1, and returns how many there are
+int driver_inputs(const Packer* packer, int driver, uint32_t* inputs) {
+  int memory_count = packer->netlist->memory_count;
+  if (driver >= 0) {
+    inputs[0] = packer->gates[driver].a;
+    inputs[1] = packer->gates[driver].b;
+    return 2;
+  } else if (driver == -1) {
+    return 0;
+  } else if (-2 - driver < memory_count) {
+    const MemoryPart* memory = &packer->memories[-2 - driver];
+    int count = memory->kind == MEMORY_KEYBOARD ? 0 : memory->address_bits;
+    memcpy(inputs, memory->address, count * sizeof(uint32_t));
+    return count;
+  }
+  const Adder* adder = &packer->adders[-2 - memory_count - driver];
+  memcpy(inputs, adder->a, adder->width * sizeof(uint32_t));
+  memcpy(inputs + adder->width, adder->b, adder->width * sizeof(uint32_t));
+  inputs[2 * adder->width] = adder->carry_in;
+  return 2 * adder->width + 1;
+}
+
+// Keeps only the gates that the flip-flops and memories need
+void drop_unread_gates(Packer* packer) {
+  const Netlist* netlist = packer->netlist;
+  bool* needed = calloc(netlist->signal_count, sizeof(bool));
+  int capacity = netlist->flip_flop_count + 4 * MAX_PACK_WIDTH;
+  for (int i = 0; i < netlist->memory_count; i++) {
+    capacity += packer->memories[i].address_bits + 17;
+  }
+  uint32_t* stack = malloc(capacity * sizeof(uint32_t));
+  int count = 0;
+  for (int i = 0; i < netlist->flip_flop_count; i++) {
+    stack[count++] = packer->flip_flop_inputs[i];
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    const MemoryPart* memory = &packer->memories[i];
+    count += driver_inputs(packer, -2 - i, stack + count);
+    for (int bit = 0; bit < 16 && memory->kind == MEMORY_RAM; bit++) {
+      stack[count++] = memory->in[bit];
+    }
+    stack[count++] = memory->load;
+  }
+  while (count > 0) {
+    uint32_t next = stack[--count];
+    if (needed[next]) {
+      continue;
+    }
+    needed[next] = true;
+    if (count + 2 * MAX_PACK_WIDTH + 1 > capacity) {
+      capacity *= 2;
+      stack = realloc(stack, capacity * sizeof(uint32_t));
+    }
+    count += driver_inputs(packer, packer->drivers[next], stack + count);
+  }
+  for (int i = 0; i < netlist->gate_count; i++) {
+    if (packer->kept[i] && !needed[packer->gates[i].out]) {
+      packer->kept[i] = false;
+      packer->drivers[packer->gates[i].out] = -1;
+    }
+  }
+  free(needed);
+  free(stack);
+}
+
+// Goes through the gates and memories in the order evaluate runs them,
+// and then the adders, again until the adders' levels have reached what
+// reads them
+void find_levels(Packer* packer) {
+  const Netlist* netlist = packer->netlist;
+  int* levels = packer->levels;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    int gate = 0;
+    for (int i = 0; i <= netlist->memory_count; i++) {
+      int end = i < netlist->memory_count ? netlist->memories[i].position : netlist->gate_count;
+      for (; gate < end; gate++) {
+        if (!packer->kept[gate]) {
+          continue;
+        }
+        const NandGate* nand = &packer->gates[gate];
+        int level = levels[nand->a] > levels[nand->b] ? levels[nand->a] : levels[nand->b];
+        changed |= levels[nand->out] != level + 1;
+        levels[nand->out] = level + 1;
+      }
+      if (i == netlist->memory_count) {
+        break;
+      }
+      const MemoryPart* memory = &packer->memories[i];
+      int level = 0;
+      for (int bit = 0; bit < memory->address_bits; bit++) {
+        level = levels[memory->address[bit]] > level ? levels[memory->address[bit]] : level;
+      }
+      for (int bit = 0; bit < 16; bit++) {
+        changed |= levels[memory->out[bit]] != level + 1;
+        levels[memory->out[bit]] = level + 1;
+      }
+    }
+    for (int i = 0; i < packer->adder_count; i++) {
+      const Adder* adder = &packer->adders[i];
+      uint32_t inputs[2 * MAX_PACK_WIDTH + 1];
+      int count = driver_inputs(packer, -2 - netlist->memory_count - i, inputs);
+      int level = 0;
+      for (int k = 0; k < count; k++) {
+        level = levels[inputs[k]] > level ? levels[inputs[k]] : level;
+      }
+      for (int k = 0; k < adder->width; k++) {
+        uint32_t outputs[2] = {adder->carries[k], adder->sums[k]};
+        for (int j = 0; j < 2; j++) {
+          if (outputs[j] > SIGNAL_TRUE) {
+            changed |= levels[outputs[j]] != level + 1;
+            levels[outputs[j]] = level + 1;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Hashes each gate's output with the two gates before it, so the gates of
+// a ripple carry, whose inputs differ only in which bit they come from,
+// hash the same
+void find_shapes(Packer* packer) {
+  const Netlist* netlist = packer->netlist;
+  uint32_t* previous = malloc(netlist->signal_count * sizeof(uint32_t));
+  for (uint32_t i = 0; i < netlist->signal_count; i++) {
+    packer->shapes[i] = packer->drivers[i] >= 0 ? 3 : i <= SIGNAL_TRUE ? i + 1 : 4;
+  }
+  for (int depth = 0; depth < 2; depth++) {
+    memcpy(previous, packer->shapes, netlist->signal_count * sizeof(uint32_t));
+    for (int i = 0; i < netlist->gate_count; i++) {
+      if (!packer->kept[i]) {
+        continue;
+      }
+      const NandGate* nand = &packer->gates[i];
+      uint32_t a = previous[nand->a];
+      uint32_t b = previous[nand->b];
+      uint32_t low = a < b ? a : b;
+      uint32_t high = a < b ? b : a;
+      packer->shapes[nand->out] = (low * 0x9E3779B1u + high) * 0x85EBCA77u +
+          (nand->a == nand->b) + 5;
+    }
+  }
+  free(previous);
+}
+
+void find_readers(Packer* packer) {
+  const Netlist* netlist = packer->netlist;
+  const NandGate* gates = packer->gates;
+  packer->reader_start = calloc(netlist->signal_count + 1, sizeof(int));
+  packer->readers = malloc((2 * netlist->gate_count + 1) * sizeof(int));
+  for (int i = 0; i < netlist->gate_count; i++) {
+    if (packer->kept[i]) {
+      packer->reader_start[gates[i].a + 1]++;
+      packer->reader_start[gates[i].b + 1] += gates[i].b != gates[i].a;
+    }
+  }
+  for (uint32_t i = 0; i < netlist->signal_count; i++) {
+    packer->reader_start[i + 1] += packer->reader_start[i];
+  }
+  int* next = malloc((netlist->signal_count + 1) * sizeof(int));
+  memcpy(next, packer->reader_start, netlist->signal_count * sizeof(int));
+  for (int i = 0; i < netlist->gate_count; i++) {
+    if (!packer->kept[i]) {
+      continue;
+    }
+    packer->readers[next[gates[i].a]++] = i;
+    if (gates[i].b != gates[i].a) {
+      packer->readers[next[gates[i].b]++] = i;
+    }
+  }
+  free(next);
+}
+
+int add_pack(Packer* packer, PackKind kind, int index, const uint32_t* signals, int width) {
+  if (packer->pack_count == packer->pack_capacity) {
+    packer->pack_capacity = packer->pack_capacity == 0 ? 64 : packer->pack_capacity * 2;
+    packer->packs = realloc(packer->packs, packer->pack_capacity * sizeof(Pack));
+  }
+  Pack* pack = &packer->packs[packer->pack_count];
+  pack->kind = kind;
+  pack->index = index;
+  pack->width = width;
+  for (int bit = 0; bit < width; bit++) {
+    pack->signals[bit] = signals[bit];
+    if (signals[bit] > SIGNAL_TRUE) {
+      packer->pack_of[signals[bit]] = packer->pack_count;
+      packer->slot_of[signals[bit]] = bit;
+    }
+  }
+  return packer->pack_count++;
+}
+
+// The words every chip starts with: its buses, its memories' outputs, its
+// flip-flops, which are numbered in the order the chip's parts were
+// written, so a register's are next to each other, and its adders' sums
+// and carries
+void pack_sources(Packer* packer) {
+  const Netlist* netlist = packer->netlist;
+  for (int i = 0; i < netlist->input_count; i++) {
+    if (netlist->inputs[i].width > 1 && netlist->inputs[i].memory < 0) {
+      add_pack(packer, PACK_INPUT, i, netlist->inputs[i].bits, netlist->inputs[i].width);
+    }
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    add_pack(packer, PACK_MEMORY, i, netlist->memories[i].out, 16);
+  }
+  for (int first = 0; first < netlist->flip_flop_count; first += MAX_PACK_WIDTH) {
+    uint32_t outputs[MAX_PACK_WIDTH];
+    int width = netlist->flip_flop_count - first;
+    width = width < MAX_PACK_WIDTH ? width : MAX_PACK_WIDTH;
+    for (int bit = 0; bit < width; bit++) {
+      outputs[bit] = netlist->flip_flops[first + bit].out;
+    }
+    add_pack(packer, PACK_FLIP_FLOPS, first, outputs, width);
+  }
+  for (int i = 0; i < packer->adder_count; i++) {
+    Adder* adder = &packer->adders[i];
+    adder->sum_pack = add_pack(packer, PACK_SUMS, i, adder->sums, adder->width);
+    adder->carry_pack = add_pack(packer, PACK_CARRIES, i, adder->carries, adder->width);
+  }
+}
+
+// Starting from each gate, in level order, looks for the gates that read
+// the bits beside its packed input the same way, and keeps the widest
+// group that it finds
+void pack_gates(Packer* packer) {
+  const Netlist* netlist = packer->netlist;
+  Group* best = malloc(sizeof(Group));
+  Group* group = malloc(sizeof(Group));
+  for (int gate = 0; gate < netlist->gate_count; gate++) {
+    if (packer->group_of[gate] >= 0 || !packer->kept[gate]) {
+      continue;
+    }
+    best->width = 1;
+    for (int side = 0; side < 2; side++) {
+      for (MatchKind match = MATCH_ALIGNED; match <= MATCH_FREE; match++) {
+        if (try_group(packer, gate, side, match, group) > best->width) {
+          Group* swap = best;
+          best = group;
+          group = swap;
+        }
+      }
+    }
+    if (best->width < 2) {
+      continue;
+    }
+    uint32_t outputs[MAX_PACK_WIDTH];
+    for (int k = 0; k < best->width; k++) {
+      packer->group_of[best->members[k]] = packer->group_count;
+      outputs[k] = packer->gates[best->members[k]].out;
+    }
+    best->pack = add_pack(packer, PACK_GATES, packer->group_count, outputs, best->width);
+    best->dissolved = false;
+    if (packer->group_count == packer->group_capacity) {
+      packer->group_capacity = packer->group_capacity == 0 ? 64 : packer->group_capacity * 2;
+      packer->groups = realloc(packer->groups, packer->group_capacity * sizeof(Group));
+    }
+    packer->groups[packer->group_count++] = *best;
+  }
+  free(best);
+  free(group);
+}
+
+// Grows a group around gate, whose input on side is a packed bit, through
+// the gates that read the bits beside it and match its other input.
+// Returns how many gates the group has.
+int try_group(Packer* packer, int gate, int side, MatchKind match, Group* group) {
+  const NandGate* nand = &packer->gates[gate];
+  uint32_t signal = side == 0 ? nand->a : nand->b;
+  uint32_t other = side == 0 ? nand->b : nand->a;
+  int pack_index = packer->pack_of[signal];
+  int other_index = packer->pack_of[other];
+  if (pack_index < 0 || (match == MATCH_ALIGNED && other_index < 0) ||
+      (match == MATCH_FREE && (other_index >= 0 || other <= SIGNAL_TRUE))) {
+    return 0;
+  }
+  const Pack* pack = &packer->packs[pack_index];
+  int slot = packer->slot_of[signal];
+  int distance = match == MATCH_ALIGNED ? packer->slot_of[other] - slot : 0;
+  int min_level = packer->levels[nand->out];
+  packer->member_mark++;
+  packer->members[gate] = packer->member_mark;
+  // the gates sit at their bit of the pack until the group is complete
+  group->members[slot] = gate;
+  group->a[slot] = signal;
+  group->b[slot] = other;
+  int low = slot;
+  int high = slot;
+  for (int direction = -1; direction <= 1; direction += 2) {
+    for (int k = slot + direction; k >= 0 && k < pack->width; k += direction) {
+      uint32_t expected = other;
+      if (match == MATCH_ALIGNED) {
+        const Pack* other_pack = &packer->packs[other_index];
+        if (k + distance < 0 || k + distance >= other_pack->width) {
+          break;
+        }
+        expected = other_pack->signals[k + distance];
+      }
+      if (pack->signals[k] <= SIGNAL_TRUE) {
+        break;
+      }
+      group->a[k] = pack->signals[k];
+      int member = find_member(packer, pack->signals[k], match, expected, group,
+          direction < 0 ? k : low, direction < 0 ? high : k, &min_level);
+      if (member < 0) {
+        break;
+      }
+      group->members[k] = member;
+      low = k < low ? k : low;
+      high = k > high ? k : high;
+    }
+  }
+  group->width = high - low + 1;
+  memmove(group->members, &group->members[low], group->width * sizeof(int));
+  memmove(group->a, &group->a[low], group->width * sizeof(uint32_t));
+  memmove(group->b, &group->b[low], group->width * sizeof(uint32_t));
+  return group->width;
+}
+
+// Returns a gate that isn't in a group yet and Nands signal with what
+// match expects, putting its other input in the group at signal's bit,
+// or -1. A gate found by its shape can't join a group if the group's
+// gates need each other: if any of their other inputs comes from one of
+// them. The group's gates are between low and high.
+int find_member(Packer* packer, uint32_t signal, MatchKind match, uint32_t expected,
+    Group* group, int low, int high, int* min_level) {
+  int slot = packer->slot_of[signal];
+  for (int i = packer->reader_start[signal]; i < packer->reader_start[signal + 1]; i++) {
+    int gate = packer->readers[i];
+    const NandGate* nand = &packer->gates[gate];
+    uint32_t other = nand->a == signal ? nand->b : nand->a;
+    if (packer->group_of[gate] >= 0 || packer->members[gate] == packer->member_mark) {
+      continue;
+    } else if (match != MATCH_FREE && other != expected) {
+      continue;
+    } else if (match != MATCH_FREE) {
+      group->b[slot] = other;
+      packer->members[gate] = packer->member_mark;
+      return gate;
+    }
+    if (packer->pack_of[other] >= 0 || other <= SIGNAL_TRUE ||
+        packer->shapes[other] != packer->shapes[expected]) {
+      continue;
+    }
+    packer->members[gate] = packer->member_mark;
+    int level = packer->levels[nand->out] < *min_level ? packer->levels[nand->out] : *min_level;
+    group->b[slot] = other;
+    bool independent = true;
+    for (int k = low; k <= high && independent; k++) {
+      independent = !reaches_member(packer, group->b[k], level);
+    }
+    if (independent) {
+      *min_level = level;
+      return gate;
+    }
+    packer->members[gate] = 0;
+  }
+  return -1;
+}
+
+// Whether signal comes from a gate of the group being grown. Only signals
+// at or above the level of the group's lowest gate can.
+bool reaches_member(Packer* packer, uint32_t signal, int min_level) {
+  int capacity = 64;
+  int count = 0;
+  uint32_t* stack = malloc(capacity * sizeof(uint32_t));
+  stack[count++] = signal;
+  packer->visit_mark++;
+  bool reached = false;
+  while (count > 0 && !reached) {
+    uint32_t next = stack[--count];
+    int driver = packer->drivers[next];
+    if (packer->visited[next] == packer->visit_mark || packer->levels[next] < min_level ||
+        driver == -1) {
+      continue;
+    }
+    packer->visited[next] = packer->visit_mark;
+    if (driver >= 0 && packer->members[driver] == packer->member_mark) {
+      reached = true;
+      continue;
+    }
+    uint32_t inputs[2 * MAX_PACK_WIDTH + 1];
+    int input_count = driver_inputs(packer, driver, inputs);
+    if (count + input_count > capacity) {
+      capacity = (count + input_count) * 2;
+      stack = realloc(stack, capacity * sizeof(uint32_t));
+    }
+    memcpy(stack + count, inputs, input_count * sizeof(uint32_t));
+    count += input_count;
+  }
+  free(stack);
+  return reached;
+}
+
+// Sorts the gates, groups, memory reads and additions so each runs after
+// what it reads. Two groups can each need bits of the other, and then one of them
+// is dissolved and the sort starts again.
+Step* order_steps(Packer* packer, int* count) {
+  const Netlist* netlist = packer->netlist;
+  int capacity = netlist->gate_count + netlist->memory_count + packer->group_count +
+      packer->adder_count + 1;
+  Step* steps = malloc(capacity * sizeof(Step));
+  Step* order = malloc(capacity * sizeof(Step));
+  int* producers = malloc(netlist->signal_count * sizeof(int));
+  int* waiting = malloc(capacity * sizeof(int));
+  int* queue = malloc(capacity * sizeof(int));
+  int** readers = malloc(capacity * sizeof(int*));
+  for (;;) {
+    int step_count = 0;
+    for (int i = 0; i < netlist->gate_count; i++) {
+      if (packer->kept[i] && packer->group_of[i] < 0) {
+        steps[step_count++] = (Step) {STEP_GATE, i};
+      }
+    }
+    for (int i = 0; i < packer->group_count; i++) {
+      if (!packer->groups[i].dissolved) {
+        steps[step_count++] = (Step) {STEP_GROUP, i};
+      }
+    }
+    for (int i = 0; i < netlist->memory_count; i++) {
+      steps[step_count++] = (Step) {STEP_MEMORY, i};
+    }
+    for (int i = 0; i < packer->adder_count; i++) {
+      steps[step_count++] = (Step) {STEP_ADDER, i};
+    }
+    for (uint32_t i = 0; i < netlist->signal_count; i++) {
+      producers[i] = -1;
+    }
+    for (int i = 0; i < step_count; i++) {
+      if (steps[i].kind == STEP_GATE) {
+        producers[packer->gates[steps[i].index].out] = i;
+      } else if (steps[i].kind == STEP_GROUP) {
+        const Group* group = &packer->groups[steps[i].index];
+        for (int k = 0; k < group->width; k++) {
+          producers[packer->gates[group->members[k]].out] = i;
+        }
+      } else if (steps[i].kind == STEP_MEMORY) {
+        for (int bit = 0; bit < 16; bit++) {
+          producers[packer->memories[steps[i].index].out[bit]] = i;
+        }
+      } else {
+        const Adder* adder = &packer->adders[steps[i].index];
+        for (int k = 0; k < adder->width; k++) {
+          if (adder->carries[k] > SIGNAL_TRUE) {
+            producers[adder->carries[k]] = i;
+          }
+          if (adder->sums[k] > SIGNAL_TRUE) {
+            producers[adder->sums[k]] = i;
+          }
+        }
+      }
+    }
+    for (int i = 0; i < step_count; i++) {
+      waiting[i] = 0;
+      readers[i] = NULL;
+    }
+    for (int i = 0; i < step_count; i++) {
+      add_reads(packer, producers, steps, i, waiting, readers);
+    }
+    int done = 0;
+    for (int i = 0; i < step_count; i++) {
+      if (waiting[i] == 0) {
+        queue[done++] = i;
+      }
+    }
+    for (int next = 0; next < done; next++) {
+      int step = queue[next];
+      order[next] = steps[step];
+      int reader_count = readers[step] != NULL ? readers[step][0] : 0;
+      for (int i = 1; i <= reader_count; i++) {
+        if (--waiting[readers[step][i]] == 0) {
+          queue[done++] = readers[step][i];
+        }
+      }
+    }
+    for (int i = 0; i < step_count; i++) {
+      free(readers[i]);
+    }
+    if (done == step_count) {
+      *count = step_count;
+      free(steps);
+      free(producers);
+      free(waiting);
+      free(queue);
+      free(readers);
+      return order;
+    }
+    // some group still waiting is on a loop
+    int stuck = -1;
+    for (int i = 0; i < step_count && stuck < 0; i++) {
+      if (waiting[i] > 0 && steps[i].kind == STEP_GROUP) {
+        stuck = steps[i].index;
+      }
+    }
+    dissolve_group(packer, stuck);
+  }
+}
+
+// Counts what step waits for, and adds it to the readers of each step it
+// reads from. readers[i][0] is how many readers step i has.
+void add_reads(const Packer* packer, const int* producers, const Step* steps, int step,
+    int* waiting, int** readers) {
+  uint32_t inputs[2 * MAX_PACK_WIDTH + 1];
+  int input_count = 0;
+  if (steps[step].kind == STEP_GATE) {
+    inputs[input_count++] = packer->gates[steps[step].index].a;
+    inputs[input_count++] = packer->gates[steps[step].index].b;
+  } else if (steps[step].kind == STEP_GROUP) {
+    const Group* group = &packer->groups[steps[step].index];
+    memcpy(inputs, group->a, group->width * sizeof(uint32_t));
+    memcpy(inputs + group->width, group->b, group->width * sizeof(uint32_t));
+    input_count = 2 * group->width;
+  } else if (steps[step].kind == STEP_MEMORY) {
+    input_count = driver_inputs(packer, -2 - steps[step].index, inputs);
+  } else {
+    input_count = driver_inputs(packer, -2 - packer->netlist->memory_count - steps[step].index,
+        inputs);
+  }
+  for (int i = 0; i < input_count; i++) {
+    int producer = producers[inputs[i]];
+    if (producer < 0) {
+      continue;
+    }
+    waiting[step]++;
+    int reader_count = readers[producer] != NULL ? readers[producer][0] : 0;
+    // the list grows whenever it fills a power of two
+    if ((reader_count & (reader_count + 1)) == 0) {
+      readers[producer] = realloc(readers[producer], (reader_count + 1) * 2 * sizeof(int));
+    }
+    readers[producer][0] = reader_count + 1;
+    readers[producer][reader_count + 1] = step;
+  }
+}
+
+void dissolve_group(Packer* packer, int index) {
+  Group* group = &packer->groups[index];
+  group->dissolved = true;
+  for (int k = 0; k < group->width; k++) {
+    packer->group_of[group->members[k]] = -1;
+    packer->pack_of[packer->gates[group->members[k]].out] = -1;
+  }
+}
+
+// Chooses the bit each single gate keeps its output in: where most of what
+// reads it wants it, and where its inputs are, so it is shifted as seldom
+// as can be. Goes through the steps from the last, so a gate's readers
+// have their places first, and then again now that its inputs have theirs.
+void place_signals(Packer* packer, const Step* steps, int count) {
+  const Netlist* netlist = packer->netlist;
+  uint16_t (*demands)[MAX_PACK_WIDTH] = calloc(netlist->signal_count, sizeof(*demands));
+  for (int pass = 0; pass < 3; pass++) {
+    memset(demands, 0, netlist->signal_count * sizeof(*demands));
+    for (int i = 0; i < netlist->memory_count; i++) {
+      const MemoryPart* memory = &packer->memories[i];
+      for (int bit = 0; bit < memory->address_bits && memory->kind != MEMORY_KEYBOARD; bit++) {
+        add_demand(packer, demands, memory->address[bit], bit);
+      }
+      for (int bit = 0; bit < 16 && memory->kind == MEMORY_RAM; bit++) {
+        add_demand(packer, demands, memory->in[bit], bit);
+      }
+    }
+    for (int i = 0; i < netlist->flip_flop_count; i++) {
+      add_demand(packer, demands, packer->flip_flop_inputs[i], i % MAX_PACK_WIDTH);
+    }
+    for (int i = count - 1; i >= 0; i--) {
+      if (steps[i].kind == STEP_GROUP) {
+        const Group* group = &packer->groups[steps[i].index];
+        for (int k = 0; k < group->width; k++) {
+          if (!is_broadcast(group->a, group->width)) {
+            add_demand(packer, demands, group->a[k], k);
+          }
+          if (!is_broadcast(group->b, group->width)) {
+            add_demand(packer, demands, group->b[k], k);
+          }
+        }
+      }
+      if (steps[i].kind == STEP_ADDER) {
+        const Adder* adder = &packer->adders[steps[i].index];
+        for (int k = 0; k < adder->width; k++) {
+          add_demand(packer, demands, adder->a[k], k);
+          add_demand(packer, demands, adder->b[k], k);
+        }
+        add_demand(packer, demands, adder->carry_in, 0);
+      }
+      if (steps[i].kind != STEP_GATE) {
+        continue;
+      }
+      const NandGate* gate = &packer->gates[steps[i].index];
+      // an input that is packed, or placed in an earlier pass, counts as a
+      // reader that wants it where the input is
+      int a = gate->a > SIGNAL_TRUE && (pass > 0 || packer->pack_of[gate->a] >= 0) ?
+          position_of(packer, gate->a) : -1;
+      int b = gate->b > SIGNAL_TRUE && gate->b != gate->a &&
+          (pass > 0 || packer->pack_of[gate->b] >= 0) ? position_of(packer, gate->b) : -1;
+      int best = 0;
+      int best_count = -1;
+      for (int position = 0; position < MAX_PACK_WIDTH; position++) {
+        int wanted = demands[gate->out][position] + (a == position) + (b == position);
+        if (wanted > best_count) {
+          best = position;
+          best_count = wanted;
+        }
+      }
+      packer->positions[gate->out] = best;
+      add_demand(packer, demands, gate->a, best);
+      add_demand(packer, demands, gate->b, best);
+    }
+  }
+  free(demands);
+}
+
+void add_demand(const Packer* packer, uint16_t (*demands)[MAX_PACK_WIDTH], uint32_t signal,
+    int position) {
+  if (packer->pack_of[signal] < 0 && demands[signal][position] < UINT16_MAX) {
+    demands[signal][position]++;
+  }
+}
+
+// Swaps the inputs of adders' stages where that lets more of them be
+// taken from a pack at once. Which is which doesn't change the carries.
+void line_up_operands(Packer* packer) {
+  for (int i = 0; i < packer->adder_count; i++) {
+    Adder* adder = &packer->adders[i];
+    for (int k = 1; k < adder->width; k++) {
+      int kept = follows(packer, adder->a[k - 1], adder->a[k]) +
+          follows(packer, adder->b[k - 1], adder->b[k]);
+      int swapped = follows(packer, adder->a[k - 1], adder->b[k]) +
+          follows(packer, adder->b[k - 1], adder->a[k]);
+      if (swapped > kept) {
+        uint32_t a = adder->a[k];
+        adder->a[k] = adder->b[k];
+        adder->b[k] = a;
+      }
+    }
+  }
+}
+
+// Whether signal is the bit after before in a pack
+bool follows(const Packer* packer, uint32_t before, uint32_t signal) {
+  int pack = packer->pack_of[before];
+  return pack >= 0 && packer->pack_of[signal] == pack &&
+      packer->slot_of[signal] == packer->slot_of[before] + 1;
+}
+
+// Finds the signals that groups read in every bit
+void find_broadcasts(Packer* packer) {
+  for (int i = 0; i < packer->group_count; i++) {
+    const Group* group = &packer->groups[i];
+    if (group->dissolved) {
+      continue;
+    }
+    if (is_broadcast(group->a, group->width)) {
+      packer->broadcast_use[group->a[0]] = group->a[0] > SIGNAL_TRUE;
+    }
+    if (is_broadcast(group->b, group->width)) {
+      packer->broadcast_use[group->b[0]] = group->b[0] > SIGNAL_TRUE;
+    }
+  }
+}
+
+bool is_broadcast(const uint32_t* signals, int width) {
+  for (int k = 1; k < width; k++) {
+    if (signals[k] != signals[0]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int position_of(const Packer* packer, uint32_t signal) {
+  return packer->pack_of[signal] >= 0 ? packer->slot_of[signal] : packer->positions[signal];
+}
+
+// A word with the signal's value at bit position. The other bits are
+// whatever the gates left there.
+void write_operand(FILE* file, const Packer* packer, uint32_t signal, int position) {
+  if (signal == SIGNAL_FALSE) {
+    fprintf(file, "0");
+    return;
+  } else if (signal == SIGNAL_TRUE) {
+    fprintf(file, "~0ULL");
+    return;
+  }
+  int pack = packer->pack_of[signal];
+  int from = position_of(packer, signal);
+  char name[16];
+  snprintf(name, sizeof(name), pack >= 0 ? "p%i" : "s%u", pack >= 0 ? (unsigned) pack : signal);
+  if (from == position) {
+    fprintf(file, "%s", name);
+  } else if (from > position) {
+    fprintf(file, "(%s >> %i)", name, from - position);
+  } else {
+    fprintf(file, "(%s << %i)", name, position - from);
+  }
+}
+
+// A signal that groups read in every bit, as a word of copies of it
+void write_mask(FILE* file, const Packer* packer, uint32_t signal, const char* indent) {
+  if (packer->broadcast_use[signal]) {
+    fprintf(file, "%suint64_t w%u = -(", indent, signal);
+    write_operand(file, packer, signal, 0);
+    fprintf(file, " & 1);\n");
+  }
+}
+
+// A word whose bit k is signals[k]. The bits above width are left as they
+// come, since nothing reads them.
+void write_word(FILE* file, const Packer* packer, const uint32_t* signals, int width) {
+  int pack = packer->pack_of[signals[0]];
+  int slot = packer->slot_of[signals[0]];
+  bool aligned = pack >= 0;
+  for (int k = 1; k < width && aligned; k++) {
+    aligned = packer->pack_of[signals[k]] == pack && packer->slot_of[signals[k]] == slot + k;
+  }
+  if (is_broadcast(signals, width) && signals[0] > SIGNAL_TRUE) {
+    fprintf(file, "w%u", signals[0]);
+  } else if (is_broadcast(signals, width) || aligned) {
+    write_operand(file, packer, signals[0], 0);
+  } else {
+    fprintf(file, "(");
+    write_gather(file, packer, signals, width);
+    fprintf(file, ")");
+  }
+}
+
+// Puts bits together into a number, taking each run of bits that sit
+// side by side in a pack at once
+void write_gather(FILE* file, const Packer* packer, const uint32_t* bits, int width) {
+  bool first = true;
+  for (int bit = 0; bit < width;) {
+    uint32_t signal = bits[bit];
+    int pack = packer->pack_of[signal];
+    int run = 1;
+    if (signal == SIGNAL_FALSE) {
+      bit++;
+      continue;
+    }
+    fprintf(file, first ? "" : " | ");
+    first = false;
+    if (signal == SIGNAL_TRUE) {
+      fprintf(file, "0x%llxULL", 1ULL << bit);
+      bit++;
+      continue;
+    }
+    while (pack >= 0 && bit + run < width && packer->pack_of[bits[bit + run]] == pack &&
+        packer->slot_of[bits[bit + run]] == packer->slot_of[signal] + run) {
+      run++;
+    }
+    uint64_t mask = run == 64 ? ~0ULL : ((1ULL << run) - 1) << bit;
+    fprintf(file, "(");
+    write_operand(file, packer, signal, bit);
+    fprintf(file, " & 0x%llxULL)", (unsigned long long) mask);
+    bit += run;
+  }
+  if (first) {
+    fprintf(file, "0");
+  }
+}
+
+// Makes the masks for the bits of the pack that groups read in every bit
+void write_masks(FILE* file, const Packer* packer, int pack, const char* indent) {
+  const Pack* bits = &packer->packs[pack];
+  for (int bit = 0; bit < bits->width; bit++) {
+    write_mask(file, packer, bits->signals[bit], indent);
+  }
+}
+
+void write_translation(FILE* file, const void* argument) {
+  const Translation* translation = argument;
+  fwrite(translation->text, 1, translation->size, file);
+}
@@ -0,0 +1,27 @@
+#ifndef CHIPAOT_H
+#define CHIPAOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "netlist.h"
+#include "simulation.h"
+
+// Runs whole clock cycles of a chip compiled to native code. values and
+// contents are a one-lane Simulation's: the inputs are read from values,
+// the flip-flops' outputs are read from and written back to it, and the
+// memories are read and written in place.
+typedef void (*ChipCycles)(uint64_t* values, uint16_t** contents, uint64_t cycles);
+
+// A netlist translated to C and loaded from a shared object
+typedef struct {
+  void* library;
+  ChipCycles run;
+} NativeChip;
+
+void translate_netlist(const Netlist* netlist, FILE* file);
+bool NativeChip_load(NativeChip* native, const Netlist* netlist, const char* cache_dir);
+void NativeChip_free(NativeChip* native);
+void run_native_chip(Simulation* simulation, const NativeChip* native, uint64_t cycles);
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <string.h>
+#include "chips.h"
+
+#define SOURCE_SIZE 8192
+
+// A chip of the built-in library. Its parts are written out once, then
+// the repeated part once for every bit from first to last, with %1$d
+// standing for the bit and %2$d for the one after it.
+typedef struct {
+  const char* name;
+  const char* pins;
+  const char* parts;
+  const char* repeated;
+  int first;
+  int last;
+} LibraryChip;
+
+static const LibraryChip library[] = {
+  {"Nand", "IN a, b; OUT out;", "BUILTIN Nand;", NULL, 0, 0},
+  {"DFF", "IN in; OUT out;", "BUILTIN DFF;", NULL, 0, 0},
+  {"RAM8", "IN in[16], load, address[3]; OUT out[16];", "BUILTIN RAM8;", NULL, 0, 0},
+  {"RAM64", "IN in[16], load, address[6]; OUT out[16];", "BUILTIN RAM64;", NULL, 0, 0},
+  {"RAM512", "IN in[16], load, address[9]; OUT out[16];", "BUILTIN RAM512;", NULL, 0, 0},
+  {"RAM4K", "IN in[16], load, address[12]; OUT out[16];", "BUILTIN RAM4K;", NULL, 0, 0},
+  {"RAM16K", "IN in[16], load, address[14]; OUT out[16];", "BUILTIN RAM16K;", NULL, 0, 0},
+  {"Screen", "IN in[16], load, address[13]; OUT out[16];", "BUILTIN Screen;", NULL, 0, 0},
+  {"Keyboard", "OUT out[16];", "BUILTIN Keyboard;", NULL, 0, 0},
+  {"ROM32K", "IN address[15]; OUT out[16];", "BUILTIN ROM32K;", NULL, 0, 0},
+
+  {"Not", "IN in; OUT out;", "PARTS: Nand(a=in, b=in, out=out);", NULL, 0, 0},
+  {"And", "IN a, b; OUT out;",
+    "PARTS: Nand(a=a, b=b, out=n); Nand(a=n, b=n, out=out);", NULL, 0, 0},
+  {"Or", "IN a, b; OUT out;",
+    "PARTS: Nand(a=a, b=a, out=na); Nand(a=b, b=b, out=nb); Nand(a=na, b=nb, out=out);",
+    NULL, 0, 0},
+  {"Xor", "IN a, b; OUT out;",
+    "PARTS: Nand(a=a, b=b, out=n); Nand(a=a, b=n, out=x); Nand(a=n, b=b, out=y);"
+    " Nand(a=x, b=y, out=out);", NULL, 0, 0},
+  {"Mux", "IN a, b, sel; OUT out;",
+    "PARTS: Nand(a=sel, b=sel, out=nsel); Nand(a=a, b=nsel, out=x); Nand(a=b, b=sel, out=y);"
+    " Nand(a=x, b=y, out=out);", NULL, 0, 0},
+  {"DMux", "IN in, sel; OUT a, b;",
+    "PARTS: Not(in=sel, out=nsel); And(a=in, b=nsel, out=a); And(a=in, b=sel, out=b);",
+    NULL, 0, 0},
+  {"Not16", "IN in[16]; OUT out[16];", "PARTS:", "Not(in=in[%1$d], out=out[%1$d]);", 0, 15},
+  {"And16", "IN a[16], b[16]; OUT out[16];", "PARTS:",
+    "And(a=a[%1$d], b=b[%1$d], out=out[%1$d]);", 0, 15},
+  {"Or16", "IN a[16], b[16]; OUT out[16];", "PARTS:",
+    "Or(a=a[%1$d], b=b[%1$d], out=out[%1$d]);", 0, 15},
+  {"Mux16", "IN a[16], b[16], sel; OUT out[16];", "PARTS:",
+    "Mux(a=a[%1$d], b=b[%1$d], sel=sel, out=out[%1$d]);", 0, 15},
+  {"Or8Way", "IN in[8]; OUT out;",
+    "PARTS: Or(a=in[0], b=in[1], out=o1); Or(a=in[2], b=in[3], out=o2);"
+    " Or(a=in[4], b=in[5], out=o3); Or(a=in[6], b=in[7], out=o4); Or(a=o1, b=o2, out=o5);"
+    " Or(a=o3, b=o4, out=o6); Or(a=o5, b=o6, out=out);", NULL, 0, 0},
+  {"Mux4Way16", "IN a[16], b[16], c[16], d[16], sel[2]; OUT out[16];",
+    "PARTS: Mux16(a=a, b=b, sel=sel[0], out=ab); Mux16(a=c, b=d, sel=sel[0], out=cd);"
+    " Mux16(a=ab, b=cd, sel=sel[1], out=out);", NULL, 0, 0},
+  {"Mux8Way16",
+    "IN a[16], b[16], c[16], d[16], e[16], f[16], g[16], h[16], sel[3]; OUT out[16];",
+    "PARTS: Mux4Way16(a=a, b=b, c=c, d=d, sel=sel[0..1], out=ad);"
+    " Mux4Way16(a=e, b=f, c=g, d=h, sel=sel[0..1], out=eh);"
+    " Mux16(a=ad, b=eh, sel=sel[2], out=out);", NULL, 0, 0},
+  {"DMux4Way", "IN in, sel[2]; OUT a, b, c, d;",
+    "PARTS: DMux(in=in, sel=sel[1], a=ab, b=cd); DMux(in=ab, sel=sel[0], a=a, b=b);"
+    " DMux(in=cd, sel=sel[0], a=c, b=d);", NULL, 0, 0},
+  {"DMux8Way", "IN in, sel[3]; OUT a, b, c, d, e, f, g, h;",
+    "PARTS: DMux(in=in, sel=sel[2], a=ad, b=eh);"
+    " DMux4Way(in=ad, sel=sel[0..1], a=a, b=b, c=c, d=d);"
+    " DMux4Way(in=eh, sel=sel[0..1], a=e, b=f, c=g, d=h);", NULL, 0, 0},
+  {"HalfAdder", "IN a, b; OUT sum, carry;",
+    "PARTS: Xor(a=a, b=b, out=sum); And(a=a, b=b, out=carry);", NULL, 0, 0},
+  {"FullAdder", "IN a, b, c; OUT sum, carry;",
+    "PARTS: HalfAdder(a=a, b=b, sum=ab, carry=c1); HalfAdder(a=ab, b=c, sum=sum, carry=c2);"
+    " Or(a=c1, b=c2, out=carry);", NULL, 0, 0},
+  {"Add16", "IN a[16], b[16]; OUT out[16];",
+    "PARTS: HalfAdder(a=a[0], b=b[0], sum=out[0], carry=c1);",
+    "FullAdder(a=a[%1$d], b=b[%1$d], c=c%1$d, sum=out[%1$d], carry=c%2$d);", 1, 15},
+  {"Inc16", "IN in[16]; OUT out[16];", "PARTS: Add16(a=in, b[0]=true, out=out);", NULL, 0, 0},
+  {"ALU",
+    "IN x[16], y[16], zx, nx, zy, ny, f, no; OUT out[16], zr, ng;",
+    "PARTS: Mux16(a=x, b=false, sel=zx, out=x1); Not16(in=x1, out=notx1);"
+    " Mux16(a=x1, b=notx1, sel=nx, out=x2);"
+    " Mux16(a=y, b=false, sel=zy, out=y1); Not16(in=y1, out=noty1);"
+    " Mux16(a=y1, b=noty1, sel=ny, out=y2);"
+    " Add16(a=x2, b=y2, out=sum); And16(a=x2, b=y2, out=and);"
+    " Mux16(a=and, b=sum, sel=f, out=result); Not16(in=result, out=notresult);"
+    " Mux16(a=result, b=notresult, sel=no, out=out, out[15]=ng, out[0..7]=low,"
+    " out[8..15]=high);"
+    " Or8Way(in=low, out=nonzerolow); Or8Way(in=high, out=nonzerohigh);"
+    " Or(a=nonzerolow, b=nonzerohigh, out=nonzero); Not(in=nonzero, out=zr);", NULL, 0, 0},
+  {"Bit", "IN in, load; OUT out;",
+    "PARTS: Mux(a=state, b=in, sel=load, out=next); DFF(in=next, out=state, out=out);",
+    NULL, 0, 0},
+  {"Register", "IN in[16], load; OUT out[16];", "PARTS:",
+    "Bit(in=in[%1$d], load=load, out=out[%1$d]);", 0, 15},
+  {"ARegister", "IN in[16], load; OUT out[16];",
+    "PARTS: Register(in=in, load=load, out=out);", NULL, 0, 0},
+  {"DRegister", "IN in[16], load; OUT out[16];",
+    "PARTS: Register(in=in, load=load, out=out);", NULL, 0, 0},
+  {"PC", "IN in[16], load, inc, reset; OUT out[16];",
+    "PARTS: Inc16(in=state, out=next); Mux16(a=state, b=next, sel=inc, out=x1);"
+    " Mux16(a=x1, b=in, sel=load, out=x2); Mux16(a=x2, b=false, sel=reset, out=x3);"
+    " Register(in=x3, load=true, out=state, out=out);", NULL, 0, 0},
+};
+
+// Fills chip with the library's definition of name, or returns false if
+// there is none
+bool builtin_chip(const char* name, ChipDefinition* chip) {
+  for (size_t i = 0; i < sizeof(library) / sizeof(library[0]); i++) {
+    const LibraryChip* entry = &library[i];
+    if (strcmp(entry->name, name) != 0) {
+      continue;
+    }
+    char source[SOURCE_SIZE];
+    int length = snprintf(source, sizeof(source), "CHIP %s { %s %s ", entry->name, entry->pins,
+        entry->parts);
+    for (int bit = entry->first; entry->repeated != NULL && bit <= entry->last; bit++) {
+      length += snprintf(source + length, sizeof(source) - length, entry->repeated, bit,
+          bit + 1);
+    }
+    snprintf(source + length, sizeof(source) - length, " }");
+    char error[256];
+    char path[64];
+    snprintf(path, sizeof(path), "<builtin %s>", name);
+    return parse_chip(source, path, chip, error, sizeof(error));
+  }
+  return false;
+}
+
+PrimitiveKind primitive_kind(const char* name) {
+  if (strcmp(name, "Nand") == 0) {
+    return PRIMITIVE_NAND;
+  } else if (strcmp(name, "DFF") == 0) {
+    return PRIMITIVE_DFF;
+  } else if (strcmp(name, "ROM32K") == 0) {
+    return PRIMITIVE_ROM;
+  } else if (strcmp(name, "Keyboard") == 0) {
+    return PRIMITIVE_KEYBOARD;
+  } else if (strcmp(name, "Screen") == 0 || (strncmp(name, "RAM", 3) == 0 &&
+      (strcmp(name + 3, "8") == 0 || strcmp(name + 3, "64") == 0 ||
+      strcmp(name + 3, "512") == 0 || strcmp(name + 3, "4K") == 0 ||
+      strcmp(name + 3, "16K") == 0))) {
+    return PRIMITIVE_RAM;
+  }
+  return PRIMITIVE_NONE;
+}
@@ -0,0 +1,18 @@
+#ifndef CHIPS_H
+#define CHIPS_H
+
+#include <stdbool.h>
+#include "hdl.h"
+
+// What a built-in chip becomes in a netlist. The gates of the library,
+// from Not to the ALU and the registers, are written in HDL themselves and
+// are flattened like any other chip; only these are left whole.
+typedef enum {
+  PRIMITIVE_NONE, PRIMITIVE_NAND, PRIMITIVE_DFF, PRIMITIVE_RAM, PRIMITIVE_ROM,
+  PRIMITIVE_KEYBOARD
+} PrimitiveKind;
+
+bool builtin_chip(const char* name, ChipDefinition* chip);
+PrimitiveKind primitive_kind(const char* name);
+
+#endif
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "aot.h"
+#include "batch.h"
+#include "cache.h"
+#include "jobs.h"
+#include "keyboard.h"
+#include "lockstep.h"
+#include "machine.h"
+#include "profile.h"
+#include "program.h"
+#include "screen.h"
+#include "snapshot.h"
+#include "stats.h"
+
+#define MAX_REQUESTS 256
+#define DEFAULT_FRAME_INTERVAL 100000
+// Millions of instructions a second when keys are recorded
+#define DEFAULT_RECORD_SPEED 4
+// How long a typed key stays down, and how often a throttled run checks
+// the clock
+#define KEY_HOLD_SECONDS 0.15
+#define THROTTLE_SECONDS 0.01
+
+void usage(char* executable_name);
+uint64_t execute(Machine* machine, NativeProgram* native, Profile* profile, uint64_t limit);
+int run_batch(const char* manifest, uint64_t limit, int threads, bool lockstep, bool stats);
+
+int main(int argc, char *argv[]) {
+  uint64_t limit = UINT64_MAX;
+  bool stats = false;
+  bool aot = false;
+  const char* frames = NULL;
+  bool profiling = false;
+  const char* symbols = NULL;
+  const char* restore = NULL;
+  const char* save = NULL;
+  const char* replay = NULL;
+  const char* record = NULL;
+  double speed = 0;
+  uint64_t frame_interval = DEFAULT_FRAME_INTERVAL;
+  const char* input = NULL;
+  const char* manifest = NULL;
+  int threads = default_thread_count();
+  bool lockstep = false;
+  Request sets[MAX_REQUESTS];
+  int set_count = 0;
+  Request dumps[MAX_REQUESTS];
+  int dump_count = 0;
+  bool valid = true;
+  for (int i = 1; i < argc && valid; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      limit = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--set") == 0 && i + 1 < argc && set_count < MAX_REQUESTS) {
+      valid = parse_pair(argv[++i], '=', &sets[set_count++]);
+    } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc && dump_count < MAX_REQUESTS) {
+      valid = parse_pair(argv[++i], '-', &dumps[dump_count++]);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = argv[++i];
+    } else if (strcmp(argv[i], "--frame-interval") == 0 && i + 1 < argc) {
+      frame_interval = strtoull(argv[++i], NULL, 10);
+      valid = frame_interval > 0;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      profiling = true;
+    } else if (strcmp(argv[i], "--symbols") == 0 && i + 1 < argc) {
+      symbols = argv[++i];
+    } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+      restore = argv[++i];
+    } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+      save = argv[++i];
+    } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+      replay = argv[++i];
+    } else if (strcmp(argv[i], "--record-keys") == 0 && i + 1 < argc) {
+      record = argv[++i];
+    } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+      speed = strtod(argv[++i], NULL);
+      valid = speed >= 0;
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      manifest = argv[++i];
+    } else if (strcmp(argv[i], "--lockstep") == 0) {
+      lockstep = true;
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+      valid = threads > 0;
+    } else if (strcmp(argv[i], "--aot") == 0) {
+      aot = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats = true;
+    } else if (argv[i][0] != '-' && input == NULL) {
+      input = argv[i];
+    } else {
+      valid = false;
+    }
+  }
+  if (valid && manifest != NULL && input == NULL) {
+    return run_batch(manifest, limit, threads, lockstep, stats);
+  }
+  // the profile is counted by the interpreter
+  if (!valid || input == NULL || (profiling && aot) || (replay != NULL && record != NULL)) {
+    usage(argv[0]);
+    return 1;
+  }
+  KeyTrace keys;
+  KeyTrace_init(&keys);
+  if (replay != NULL && !KeyTrace_load(&keys, replay)) {
+    return 1;
+  }
+  if (record != NULL && speed == 0) {
+    // someone has to be able to play along
+    speed = DEFAULT_RECORD_SPEED;
+  }
+
+  HackProgram program;
+  if (!load_program(input, &program)) {
+    return 1;
+  }
+  Machine* machine = malloc(sizeof(Machine));
+  Machine_init(machine);
+  load_rom(machine, program.words, program.count);
+  uint64_t program_id = rom_id(program.words, program.count);
+  if (restore != NULL) {
+    Snapshot snapshot;
+    bool restored = Snapshot_load(&snapshot, restore) &&
+        restore_snapshot(machine, &snapshot, program_id);
+    Snapshot_free(&snapshot);
+    if (!restored) {
+      free(machine);
+      hack_program_free(&program);
+      return 1;
+    }
+  }
+  // --set applies on top of a snapshot, so one snapshot serves many inputs
+  for (int i = 0; i < set_count; i++) {
+    machine->ram[sets[i].first & ADDRESS_MASK] = sets[i].second;
+  }
+
+  NativeProgram native;
+  if (aot) {
+    char* cache_dir = default_cache_dir();
+    bool loaded = NativeProgram_load(&native, program.words, program.count, cache_dir);
+    free(cache_dir);
+    if (!loaded) {
+      free(machine);
+      hack_program_free(&program);
+      return 1;
+    }
+  }
+
+  Profile* profile = profiling ? calloc(1, sizeof(Profile)) : NULL;
+  FrameWriter writer;
+  if (frames != NULL && !FrameWriter_init(&writer, frames)) {
+    frames = NULL;
+  }
+
+  uint64_t first_cycle = machine->cycles;
+  uint64_t end_cycle = limit < UINT64_MAX - first_cycle ? first_cycle + limit : UINT64_MAX;
+  uint64_t next_frame = first_cycle + frame_interval;
+  uint64_t throttle_slice = speed * 1e6 * THROTTLE_SECONDS + 1;
+  uint64_t key_hold = speed * 1e6 * KEY_HOLD_SECONDS;
+  uint64_t key_release = 0;
+  KeyTrace recorded;
+  KeyTrace_init(&recorded);
+  bool running = record == NULL || open_terminal();
+  bool completed = running;
+  double seconds = 0;
+  struct timespec clock;
+  clock_gettime(CLOCK_MONOTONIC, &clock);
+  // The run is cut into slices that end where a frame is due, a key
+  // changes or the clock is next checked. Without any of them it is a
+  // single slice.
+  while (running && machine->cycles < end_cycle && !machine->halted) {
+    apply_key_events(&keys, machine);
+    if (record != NULL) {
+      running = record_terminal_keys(&recorded, machine, key_hold, &key_release);
+    }
+    uint64_t until = end_cycle;
+    if (frames != NULL && next_frame < until) {
+      until = next_frame;
+    }
+    if (next_key_cycle(&keys) < until) {
+      until = next_key_cycle(&keys);
+    }
+    if (speed > 0 && machine->cycles + throttle_slice < until) {
+      until = machine->cycles + throttle_slice;
+    }
+    uint64_t executed = execute(machine, aot ? &native : NULL, profile, until - machine->cycles);
+    // a frame after every interval in which the screen changed
+    if (frames != NULL && (machine->cycles >= next_frame || machine->cycles >= end_cycle ||
+        machine->halted || executed == 0)) {
+      write_frame(&writer, machine);
+      while (next_frame <= machine->cycles) {
+        next_frame += frame_interval;
+      }
+    }
+    if (speed > 0) {
+      seconds += seconds_since(&clock);
+      double ahead = (machine->cycles - first_cycle) / (speed * 1e6) - seconds;
+      if (ahead > 0) {
+        struct timespec pause = {(time_t) ahead, (long) ((ahead - (time_t) ahead) * 1e9)};
+        nanosleep(&pause, NULL);
+      }
+    }
+    if (executed == 0) {
+      break;
+    }
+  }
+  seconds += seconds_since(&clock);
+  if (record != NULL && completed) {
+    close_terminal();
+    completed = KeyTrace_save(&recorded, record);
+  }
+  KeyTrace_free(&recorded);
+  KeyTrace_free(&keys);
+  if (frames != NULL) {
+    FrameWriter_free(&writer);
+  }
+  uint64_t executed = machine->cycles - first_cycle;
+  bool saved = save == NULL || save_snapshot(save, machine, program_id);
+
+  for (int i = 0; i < dump_count; i++) {
+    for (int address = dumps[i].first; address <= dumps[i].second; address++) {
+      printf("RAM[%i] = %i\n", address, (int16_t) machine->ram[address & ADDRESS_MASK]);
+    }
+  }
+  if (stats) {
+    fprintf(stderr, "{\"file\":\"%s\",\"instructions\":%llu,\"halted\":%s,\"pc\":%i,"
+        "\"seconds\":%.6f,\"mips\":%.1f}\n",
+        input, (unsigned long long) executed, machine->halted ? "true" : "false",
+        machine->pc, seconds, seconds > 0 ? executed / seconds / 1e6 : 0.0);
+  }
+  if (profile != NULL) {
+    // labels from another file, for programs loaded without them
+    HackProgram labels;
+    if (symbols != NULL && load_program(symbols, &labels)) {
+      labels.count = program.count;
+      print_profile(stdout, profile, &labels);
+      hack_program_free(&labels);
+    } else {
+      print_profile(stdout, profile, &program);
+    }
+    free(profile);
+  }
+  if (aot) {
+    NativeProgram_free(&native);
+  }
+  free(machine);
+  hack_program_free(&program);
+  return saved && completed ? 0 : 1;
+}
+
+uint64_t execute(Machine* machine, NativeProgram* native, Profile* profile, uint64_t limit) {
+  if (profile != NULL) {
+    return run_profiled(machine, limit, profile);
+  }
+  return native != NULL ? run_native(machine, native, limit) : run(machine, limit);
+}
+
+// Runs every job of a manifest and prints a line of results for each
+int run_batch(const char* manifest, uint64_t limit, int threads, bool lockstep, bool stats) {
+  JobList jobs;
+  if (!JobList_load(&jobs, manifest, limit)) {
+    return 1;
+  }
+  double seconds = 0;
+  struct timespec clock;
+  clock_gettime(CLOCK_MONOTONIC, &clock);
+  if (lockstep) {
+    run_jobs_lockstep(&jobs, threads);
+  } else {
+    run_jobs(&jobs, threads);
+  }
+  seconds += seconds_since(&clock);
+  print_job_results(stdout, &jobs);
+  if (stats) {
+    uint64_t executed = 0;
+    for (int i = 0; i < jobs.count; i++) {
+      executed += jobs.jobs[i].executed;
+    }
+    fprintf(stderr, "{\"file\":\"%s\",\"jobs\":%i,\"instructions\":%llu,\"seconds\":%.6f,"
+        "\"mips\":%.1f}\n", manifest, jobs.count, (unsigned long long) executed, seconds,
+        seconds > 0 ? executed / seconds / 1e6 : 0.0);
+  }
+  JobList_free(&jobs);
+  return 0;
+}
+
+void usage(char* executable_name) {
+  printf("usage: %s [options] <program.hack|program.bin|program.asm>\n", executable_name);
+  printf("       %s [-n count] [-j threads] [--lockstep] [--stats] --batch manifest\n",
+      executable_name);
+  printf("Runs a program on an emulated Hack computer.\n");
+  printf("  -n count          stop after count instructions (default: until the\n");
+  printf("                    program reaches its final @n / 0;JMP loop)\n");
+  printf("  --set addr=value  store value in RAM before starting\n");
+  printf("  --dump first[-last]  print RAM words once stopped\n");
+  printf("  --frames path     write the screen whenever it changed: numbered\n");
+  printf("                    frames for a pattern such as f%%05d.pbm (or .ppm),\n");
+  printf("                    otherwise a stream of changed rows\n");
+  printf("  --frame-interval n  instructions between frames (default %i)\n", DEFAULT_FRAME_INTERVAL);
+  printf("  --profile         count instructions per label and print the hottest\n");
+  printf("  --symbols file.asm  take the labels for --profile from file.asm\n");
+  printf("  --snapshot file    start from the state saved in file, taken of the\n");
+  printf("                    same program\n");
+  printf("  --save-snapshot file  save the machine's state to file once stopped\n");
+  printf("  --keys trace      replay a key trace into KBD, each key at its cycle\n");
+  printf("  --record-keys trace  play from the terminal and save the keys typed;\n");
+  printf("                    Ctrl-C stops\n");
+  printf("  --speed mips      run no faster than this many million instructions a\n");
+  printf("                    second (default: as fast as possible, or %i when\n", DEFAULT_RECORD_SPEED);
+  printf("                    recording)\n");
+  printf("  --batch manifest  run a job per line of manifest, each a program and its\n");
+  printf("                    -n, --set and --dump options, and print a line of\n");
+  printf("                    JSON per job\n");
+  printf("  -j threads        threads for --batch (default: one per core)\n");
+  printf("  --lockstep        run --batch jobs that share a program %i at a time,\n", LANES);
+  printf("                    an instruction for all of them at once\n");
+  printf("  --aot             translate the program to C, compile it and run the\n");
+  printf("                    native code (kept in ~/.cache/hackc)\n");
+  printf("  --stats           write instruction count and speed to stderr as JSON\n");
+}
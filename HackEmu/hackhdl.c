@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cache.h"
+#include "chipaot.h"
+#include "netlist.h"
+#include "optimize.h"
+#include "program.h"
+#include "simulation.h"
+
+#define ERROR_SIZE 1024
+
+// Each lane of the input bits below 6 counts up through the 64 lanes of a
+// pass; the bits above count the passes
+static const uint64_t lane_patterns[6] = {
+  0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+  0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL,
+};
+
+void usage(char* executable_name);
+bool check_chip(const Netlist* chip, uint64_t vectors);
+bool run_chip(const Netlist* netlist, uint64_t cycles, const char* rom, bool native);
+bool same_pins(const Port* a, int a_count, const Port* b, int b_count);
+bool compare_outputs(const Simulation* chip, const Simulation* library);
+void report_difference(const Simulation* chip, const Simulation* library, uint64_t differ);
+uint64_t next_random(uint64_t* state);
+
+int main(int argc, char *argv[]) {
+  const char** directories = malloc(argc * sizeof(char*));
+  int directory_count = 0;
+  const char* path = NULL;
+  bool check = false;
+  uint64_t vectors = 1 << 20;
+  uint64_t cycles = 0;
+  const char* rom = NULL;
+  bool native = false;
+  bool optimize = false;
+  bool valid = true;
+  for (int i = 1; i < argc && valid; i++) {
+    if (strcmp(argv[i], "-I") == 0 && i + 1 < argc) {
+      directories[directory_count++] = argv[++i];
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check = true;
+    } else if (strcmp(argv[i], "--vectors") == 0 && i + 1 < argc) {
+      char* end;
+      vectors = strtoull(argv[++i], &end, 10);
+      valid = *end == '\0' && vectors > 0;
+    } else if (strcmp(argv[i], "--run") == 0 && i + 1 < argc) {
+      char* end;
+      cycles = strtoull(argv[++i], &end, 10);
+      valid = *end == '\0';
+    } else if (strcmp(argv[i], "--rom") == 0 && i + 1 < argc) {
+      rom = argv[++i];
+    } else if (strcmp(argv[i], "--native") == 0) {
+      native = true;
+    } else if (strcmp(argv[i], "-O") == 0) {
+      optimize = true;
+    } else if (argv[i][0] != '-' && path == NULL) {
+      path = argv[i];
+    } else {
+      valid = false;
+    }
+  }
+  if (!valid || path == NULL) {
+    usage(argv[0]);
+    free(directories);
+    return 1;
+  }
+  Netlist netlist;
+  char error[ERROR_SIZE];
+  if (!build_netlist(&netlist, path, directories, directory_count, error, sizeof(error))) {
+    fprintf(stderr, "%s\n", error);
+    free(directories);
+    return 1;
+  }
+  printf("%s: %i gates, %i flip-flops, %i memories, %i levels\n", netlist.name,
+      netlist.gate_count, netlist.flip_flop_count, netlist.memory_count, netlist.levels);
+  if (optimize) {
+    optimize_netlist(&netlist);
+    printf("Optimized to %i gates, %i levels\n", netlist.gate_count, netlist.levels);
+  }
+  int status = check && !check_chip(&netlist, vectors) ? 1 : 0;
+  if (status == 0 && (cycles > 0 || native) && !run_chip(&netlist, cycles, rom, native)) {
+    status = 1;
+  }
+  Netlist_free(&netlist);
+  free(directories);
+  return status;
+}
+
+void usage(char* executable_name) {
+  printf("usage: %s [options] <chip.hdl>\n", executable_name);
+  printf("Flattens a chip to Nand gates and flip-flops, and prints its size.\n");
+  printf("  -I directory  also look for parts in directory, after the chip's own\n");
+  printf("  -O            fold constants, merge equal gates and drop unread ones\n");
+  printf("                before anything else, and print the size that is left\n");
+  printf("  --check       compare the chip with the built-in one of the same name\n");
+  printf("  --vectors n   how many inputs to compare (default 1048576); every input\n");
+  printf("                is tried when there are no more than that, random ones\n");
+  printf("                otherwise, and clocked chips run n / 64 random cycles\n");
+  printf("  --run n       clock the chip n times, with its inputs at 0, and print its\n");
+  printf("                outputs and registers and how fast it ran\n");
+  printf("  --rom file    load a .hack or .asm program into the chip's ROM32K first\n");
+  printf("  --native      translate the chip to C, compile it and run the native code\n");
+  printf("                (kept in ~/.cache/hackc)\n");
+}
+
+// Simulates the chip next to the library's, 64 inputs a pass, until an
+// output differs
+bool check_chip(const Netlist* chip, uint64_t vectors) {
+  Netlist library;
+  char error[ERROR_SIZE];
+  if (!build_library_netlist(&library, chip->name, error, sizeof(error))) {
+    fprintf(stderr, "There is no built-in %s to compare with\n", chip->name);
+    return false;
+  }
+  if (!same_pins(chip->inputs, chip->input_count, library.inputs, library.input_count) ||
+      !same_pins(chip->outputs, chip->output_count, library.outputs, library.output_count)) {
+    fprintf(stderr, "%s does not have the pins of the built-in chip\n", chip->name);
+    Netlist_free(&library);
+    return false;
+  }
+  int input_bits = 0;
+  for (int i = 0; i < chip->input_count; i++) {
+    input_bits += chip->inputs[i].width;
+  }
+  bool clocked = !is_combinational(chip) || !is_combinational(&library);
+  bool exhaustive = !clocked && input_bits < 64 && (1ULL << input_bits) <= vectors;
+  uint64_t passes = exhaustive ? ((1ULL << input_bits) + SIMULATION_LANES - 1) / SIMULATION_LANES :
+      (vectors + SIMULATION_LANES - 1) / SIMULATION_LANES;
+  Simulation simulations[2];
+  Simulation_init(&simulations[0], chip, SIMULATION_LANES);
+  Simulation_init(&simulations[1], &library, SIMULATION_LANES);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  uint64_t random = 0x9E3779B97F4A7C15ULL;
+  bool same = true;
+  uint64_t pass = 0;
+  for (; pass < passes && same; pass++) {
+    int bit_index = 0;
+    for (int i = 0; i < chip->input_count; i++) {
+      for (int bit = 0; bit < chip->inputs[i].width; bit++, bit_index++) {
+        uint64_t lanes = !exhaustive ? next_random(&random) :
+            bit_index < 6 ? lane_patterns[bit_index] :
+            (pass >> (bit_index - 6)) & 1 ? ~0ULL : 0;
+        simulations[0].values[chip->inputs[i].bits[bit]] = lanes;
+        simulations[1].values[library.inputs[i].bits[bit]] = lanes;
+      }
+    }
+    if (clocked) {
+      tick(&simulations[0]);
+      tick(&simulations[1]);
+      same = compare_outputs(&simulations[0], &simulations[1]);
+      if (same) {
+        tock(&simulations[0]);
+        tock(&simulations[1]);
+      }
+    } else {
+      evaluate(&simulations[0]);
+      evaluate(&simulations[1]);
+    }
+    same = same && compare_outputs(&simulations[0], &simulations[1]);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  if (same && clocked) {
+    printf("Same as the built-in %s for %llu random cycles in each of %i lanes (%.1fms)\n",
+        chip->name, (unsigned long long) passes, SIMULATION_LANES, seconds * 1e3);
+  } else if (same) {
+    printf("Same as the built-in %s on %s%llu inputs (%.1fms)\n", chip->name,
+        exhaustive ? "all " : "", (unsigned long long) (exhaustive ? 1ULL << input_bits :
+        passes * SIMULATION_LANES), seconds * 1e3);
+  } else if (clocked) {
+    printf("  in cycle %llu\n", (unsigned long long) pass);
+  }
+  Simulation_free(&simulations[0]);
+  Simulation_free(&simulations[1]);
+  Netlist_free(&library);
+  return same;
+}
+
+// Clocks the chip on its own, as the computer runs a program. Registers
+// are the parts whose outputs are all flip-flops.
+bool run_chip(const Netlist* netlist, uint64_t cycles, const char* rom, bool native) {
+  Simulation simulation;
+  Simulation_init(&simulation, netlist, 1);
+  if (rom != NULL) {
+    HackProgram program;
+    int memory = 0;
+    while (memory < netlist->memory_count && netlist->memories[memory].kind != MEMORY_ROM) {
+      memory++;
+    }
+    if (memory == netlist->memory_count || !load_program(rom, &program)) {
+      fprintf(stderr, memory == netlist->memory_count ? "%s has no ROM32K\n" :
+          "Could not load %s\n", memory == netlist->memory_count ? netlist->name : rom);
+      Simulation_free(&simulation);
+      return false;
+    }
+    load_memory(&simulation, memory, program.words, program.count);
+    hack_program_free(&program);
+  }
+  evaluate(&simulation);
+  NativeChip chip;
+  if (native) {
+    char* cache_dir = default_cache_dir();
+    bool loaded = NativeChip_load(&chip, netlist, cache_dir);
+    free(cache_dir);
+    if (!loaded) {
+      fprintf(stderr, "Could not compile %s\n", netlist->name);
+      Simulation_free(&simulation);
+      return false;
+    }
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (native) {
+    run_native_chip(&simulation, &chip, cycles);
+    NativeChip_free(&chip);
+  } else {
+    for (uint64_t i = 0; i < cycles; i++) {
+      tick(&simulation);
+      tock(&simulation);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  for (int i = 0; i < netlist->output_count; i++) {
+    printf("%s=%i ", netlist->outputs[i].name, read_port(&simulation, &netlist->outputs[i], 0));
+  }
+  for (int i = 0; i < netlist->part_count; i++) {
+    const Port* part = &netlist->parts[i];
+    bool registered = part->memory < 0;
+    for (int bit = 0; bit < part->width && registered; bit++) {
+      registered = netlist->flip_flop_count > 0 && part->bits[bit] >= netlist->flip_flops[0].out &&
+          part->bits[bit] - netlist->flip_flops[0].out < (uint32_t) netlist->flip_flop_count;
+    }
+    if (registered) {
+      printf("%s[]=%i ", part->name, read_port(&simulation, part, 0));
+    }
+  }
+  printf("\nRan %llu cycles in %.3fs (%.2fM cycles/s)\n", (unsigned long long) cycles, seconds,
+      seconds > 0 ? cycles / seconds / 1e6 : 0);
+  Simulation_free(&simulation);
+  return true;
+}
+
+bool same_pins(const Port* a, int a_count, const Port* b, int b_count) {
+  if (a_count != b_count) {
+    return false;
+  }
+  for (int i = 0; i < a_count; i++) {
+    if (strcmp(a[i].name, b[i].name) != 0 || a[i].width != b[i].width) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool compare_outputs(const Simulation* chip, const Simulation* library) {
+  uint64_t differ = 0;
+  const Netlist* netlist = chip->netlist;
+  for (int i = 0; i < netlist->output_count; i++) {
+    for (int bit = 0; bit < netlist->outputs[i].width; bit++) {
+      differ |= chip->values[netlist->outputs[i].bits[bit]] ^
+          library->values[library->netlist->outputs[i].bits[bit]];
+    }
+  }
+  if (differ != 0) {
+    report_difference(chip, library, differ);
+  }
+  return differ == 0;
+}
+
+// Prints the inputs of the first lane that differs, and both outputs
+void report_difference(const Simulation* chip, const Simulation* library, uint64_t differ) {
+  int lane = __builtin_ctzll(differ);
+  const Netlist* netlist = chip->netlist;
+  printf("Differs from the built-in %s with", netlist->name);
+  for (int i = 0; i < netlist->input_count; i++) {
+    printf(" %s=%i", netlist->inputs[i].name, read_port(chip, &netlist->inputs[i], lane));
+  }
+  printf(":\n");
+  for (int i = 0; i < netlist->output_count; i++) {
+    int actual = read_port(chip, &netlist->outputs[i], lane);
+    int expected = read_port(library, &library->netlist->outputs[i], lane);
+    printf("  %s is %i%s", netlist->outputs[i].name, actual, actual != expected ? "" : "\n");
+    if (actual != expected) {
+      printf(", should be %i\n", expected);
+    }
+  }
+}
+
+// xorshift64*, so a check gives the same inputs every time it runs
+uint64_t next_random(uint64_t* state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
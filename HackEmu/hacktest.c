@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "batch.h"
+#include "machine.h"
+#include "pool.h"
+#include "program.h"
+#include "script.h"
+
+#define MESSAGE_SIZE 1024
+
+// Shared by the workers. Each worker claims the next script that has not
+// been run, and prints its result as soon as it has one.
+typedef struct {
+  FileList* scripts;
+  ScriptOptions options;
+  bool verbose;
+  WorkQueue queue;
+  atomic_int passed;
+  atomic_int failed;
+  atomic_int skipped;
+} Suite;
+
+void usage(char* executable_name);
+void* test_worker(void* argument);
+
+int main(int argc, char *argv[]) {
+  int threads = default_thread_count();
+  bool verbose = false;
+  ScriptOptions options = {false, false};
+  FileList scripts = {NULL, 0, 0};
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else if (strcmp(argv[i], "--gates") == 0) {
+      options.gates = true;
+    } else if (strcmp(argv[i], "--native") == 0) {
+      options.native = true;
+    } else if (argv[i][0] != '-') {
+      // missing scripts fail when they are run
+      collect_files(&scripts, argv[i], ".tst");
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (scripts.count == 0 || threads < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  sort_files(&scripts);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  Suite suite;
+  suite.scripts = &scripts;
+  suite.options = options;
+  suite.verbose = verbose;
+  WorkQueue_init(&suite.queue, scripts.count);
+  atomic_init(&suite.passed, 0);
+  atomic_init(&suite.failed, 0);
+  atomic_init(&suite.skipped, 0);
+  run_threads(test_worker, &suite, 0, threads < scripts.count ? threads : scripts.count);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  int failed = atomic_load(&suite.failed);
+  printf("%i passed, %i failed, %i skipped in %.3fs\n", atomic_load(&suite.passed), failed,
+      atomic_load(&suite.skipped),
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+  FileList_free(&scripts);
+  return failed > 0 ? 1 : 0;
+}
+
+void usage(char* executable_name) {
+  printf("usage: %s [options] <script.tst|directory>...\n", executable_name);
+  printf("Runs test scripts for the CPU emulator and the Hardware Simulator, and compares\n");
+  printf("their output.\n");
+  printf("Directories are searched for .tst files.\n");
+  printf("  -j threads  run this many scripts at once (default: one per core)\n");
+  printf("  -v          also list the scripts that were skipped, and why\n");
+  printf("  --gates     simulate Computer.hdl from its gates, not on the emulator\n");
+  printf("  --native    compile clocked chips to C, for the cycles that run with\n");
+  printf("              nothing printed between them (kept in ~/.cache/hackc)\n");
+}
+
+// Each worker has its own machine, used for every script it runs
+void* test_worker(void* argument) {
+  Suite* suite = argument;
+  Machine* machine = malloc(sizeof(Machine));
+  char message[MESSAGE_SIZE];
+  char report[MESSAGE_SIZE + 4096];
+  int index;
+  while ((index = claim_work(&suite->queue)) >= 0) {
+    const char* path = suite->scripts->paths[index];
+    TestResult result = run_script(path, machine, &suite->options, message,
+        sizeof(message));
+    if (result == TEST_PASSED) {
+      atomic_fetch_add(&suite->passed, 1);
+      snprintf(report, sizeof(report), "pass  %s\n", path);
+    } else if (result == TEST_FAILED) {
+      atomic_fetch_add(&suite->failed, 1);
+      snprintf(report, sizeof(report), "FAIL  %s: %s\n", path, message);
+    } else {
+      atomic_fetch_add(&suite->skipped, 1);
+      snprintf(report, sizeof(report), "skip  %s: %s\n", path, message);
+    }
+    // one write per result keeps the lines of different workers apart
+    if (result != TEST_SKIPPED || suite->verbose) {
+      fputs(report, stdout);
+      fflush(stdout);
+    }
+  }
+  free(machine);
+  return NULL;
+}
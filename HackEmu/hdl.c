@@ -0,0 +1,317 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hdl.h"
+
+// A name, a number, .. or one of { } ( ) [ ] ; , = :
+typedef struct {
+  const char* text;
+  int length;
+  int line;
+} HdlToken;
+
+typedef struct {
+  const char* path;
+  const char* next;
+  int line;
+  HdlToken token;
+  char* error;
+  size_t error_size;
+  bool failed;
+} HdlParser;
+
+void next_token(HdlParser* parser);
+bool accept_token(HdlParser* parser, const char* text);
+bool expect_token(HdlParser* parser, const char* text);
+char* expect_name(HdlParser* parser);
+bool parse_number_token(HdlParser* parser, int* value);
+bool parse_pins(HdlParser* parser, PinDeclaration** pins, int* count);
+bool parse_part(HdlParser* parser, Part* part);
+bool parse_range(HdlParser* parser, int* first, int* last);
+bool is_name_character(char c);
+bool parse_error(HdlParser* parser, const char* format, ...);
+
+// Reads a chip:
+//
+//   CHIP Name {
+//     IN a[16], b;
+//     OUT out[16];
+//     PARTS:
+//     Part(pin=signal, pin[0..7]=signal[3], ...);
+//   }
+//
+// or a chip with BUILTIN Name; in place of its parts. CLOCKED lines are
+// read and ignored, since which chips are clocked follows from their DFFs.
+bool parse_chip(const char* source, const char* path, ChipDefinition* chip, char* error,
+    size_t error_size) {
+  memset(chip, 0, sizeof(ChipDefinition));
+  chip->path = strdup(path);
+  HdlParser parser = {path, source, 1, {NULL, 0, 0}, error, error_size, false};
+  next_token(&parser);
+  if (!expect_token(&parser, "CHIP") || (chip->name = expect_name(&parser)) == NULL ||
+      !expect_token(&parser, "{")) {
+    ChipDefinition_free(chip);
+    return false;
+  }
+  bool valid = true;
+  if (accept_token(&parser, "IN")) {
+    valid = parse_pins(&parser, &chip->inputs, &chip->input_count);
+  }
+  if (valid && accept_token(&parser, "OUT")) {
+    valid = parse_pins(&parser, &chip->outputs, &chip->output_count);
+  }
+  if (valid && accept_token(&parser, "BUILTIN")) {
+    valid = (chip->builtin = expect_name(&parser)) != NULL && expect_token(&parser, ";");
+    while (valid && accept_token(&parser, "CLOCKED")) {
+      PinDeclaration* pins = NULL;
+      int count = 0;
+      valid = parse_pins(&parser, &pins, &count);
+      for (int i = 0; i < count; i++) {
+        free(pins[i].name);
+      }
+      free(pins);
+    }
+    valid = valid && expect_token(&parser, "}");
+  } else if (valid && expect_token(&parser, "PARTS") && expect_token(&parser, ":")) {
+    int capacity = 0;
+    while (valid && !accept_token(&parser, "}")) {
+      if (parser.token.length == 0) {
+        valid = parse_error(&parser, "expected }");
+        break;
+      }
+      if (chip->part_count == capacity) {
+        capacity = capacity == 0 ? 16 : capacity * 2;
+        chip->parts = realloc(chip->parts, capacity * sizeof(Part));
+      }
+      valid = parse_part(&parser, &chip->parts[chip->part_count]);
+      chip->part_count += valid;
+    }
+  } else {
+    valid = false;
+  }
+  if (!valid) {
+    ChipDefinition_free(chip);
+  }
+  return valid;
+}
+
+void ChipDefinition_free(ChipDefinition* chip) {
+  for (int i = 0; i < chip->input_count; i++) {
+    free(chip->inputs[i].name);
+  }
+  for (int i = 0; i < chip->output_count; i++) {
+    free(chip->outputs[i].name);
+  }
+  for (int i = 0; i < chip->part_count; i++) {
+    Part* part = &chip->parts[i];
+    for (int j = 0; j < part->connection_count; j++) {
+      free(part->connections[j].pin);
+      free(part->connections[j].signal);
+    }
+    free(part->connections);
+    free(part->chip);
+  }
+  free(chip->name);
+  free(chip->path);
+  free(chip->inputs);
+  free(chip->outputs);
+  free(chip->parts);
+  free(chip->builtin);
+  memset(chip, 0, sizeof(ChipDefinition));
+}
+
+// Returns the pin called name and sets input to whether it is an IN pin,
+// or returns NULL if the chip has no such pin
+const PinDeclaration* find_pin(const ChipDefinition* chip, const char* name, bool* input) {
+  for (int i = 0; i < chip->input_count; i++) {
+    if (strcmp(chip->inputs[i].name, name) == 0) {
+      *input = true;
+      return &chip->inputs[i];
+    }
+  }
+  for (int i = 0; i < chip->output_count; i++) {
+    if (strcmp(chip->outputs[i].name, name) == 0) {
+      *input = false;
+      return &chip->outputs[i];
+    }
+  }
+  return NULL;
+}
+
+// Moves to the next token, skipping whitespace and comments. At the end of
+// the source the token is empty.
+void next_token(HdlParser* parser) {
+  const char* c = parser->next;
+  for (;;) {
+    if (*c == '\n') {
+      parser->line++;
+      c++;
+    } else if (*c == ' ' || *c == '\t' || *c == '\r') {
+      c++;
+    } else if (c[0] == '/' && c[1] == '/') {
+      while (*c != '\0' && *c != '\n') {
+        c++;
+      }
+    } else if (c[0] == '/' && c[1] == '*') {
+      c += 2;
+      while (*c != '\0' && !(c[0] == '*' && c[1] == '/')) {
+        parser->line += *c == '\n';
+        c++;
+      }
+      c += *c != '\0' ? 2 : 0;
+    } else {
+      break;
+    }
+  }
+  const char* start = c;
+  if (is_name_character(*c)) {
+    while (is_name_character(*c)) {
+      c++;
+    }
+  } else if (c[0] == '.' && c[1] == '.') {
+    c += 2;
+  } else if (*c != '\0') {
+    c++;
+  }
+  parser->token = (HdlToken) {start, c - start, parser->line};
+  parser->next = c;
+}
+
+// Takes the token if it is text
+bool accept_token(HdlParser* parser, const char* text) {
+  HdlToken* token = &parser->token;
+  if (token->length > 0 && strncmp(token->text, text, token->length) == 0 &&
+      text[token->length] == '\0') {
+    next_token(parser);
+    return true;
+  }
+  return false;
+}
+
+bool expect_token(HdlParser* parser, const char* text) {
+  return accept_token(parser, text) || parse_error(parser, "expected %s", text);
+}
+
+// Takes a name and returns a copy of it, or NULL if the token is not one
+char* expect_name(HdlParser* parser) {
+  HdlToken token = parser->token;
+  if (token.length == 0 || !is_name_character(token.text[0]) ||
+      (token.text[0] >= '0' && token.text[0] <= '9')) {
+    parse_error(parser, "expected a name");
+    return NULL;
+  }
+  next_token(parser);
+  return strndup(token.text, token.length);
+}
+
+bool parse_number_token(HdlParser* parser, int* value) {
+  HdlToken token = parser->token;
+  int number = 0;
+  for (int i = 0; i < token.length; i++) {
+    if (token.text[i] < '0' || token.text[i] > '9' || number > 1000) {
+      return parse_error(parser, "expected a number");
+    }
+    number = number * 10 + token.text[i] - '0';
+  }
+  if (token.length == 0) {
+    return parse_error(parser, "expected a number");
+  }
+  next_token(parser);
+  *value = number;
+  return true;
+}
+
+// a, b[16], ... ;
+bool parse_pins(HdlParser* parser, PinDeclaration** pins, int* count) {
+  do {
+    char* name = expect_name(parser);
+    int width = 1;
+    if (name == NULL) {
+      return false;
+    }
+    *pins = realloc(*pins, (*count + 1) * sizeof(PinDeclaration));
+    (*pins)[(*count)++] = (PinDeclaration) {name, 1};
+    if (accept_token(parser, "[")) {
+      if (!parse_number_token(parser, &width) || !expect_token(parser, "]")) {
+        return false;
+      }
+      if (width < 1 || width > MAX_BUS_WIDTH) {
+        return parse_error(parser, "%s is wider than %i bits", name, MAX_BUS_WIDTH);
+      }
+      (*pins)[*count - 1].width = width;
+    }
+  } while (accept_token(parser, ","));
+  return expect_token(parser, ";");
+}
+
+// Name(pin=signal, ...);
+bool parse_part(HdlParser* parser, Part* part) {
+  memset(part, 0, sizeof(Part));
+  part->line = parser->token.line;
+  if ((part->chip = expect_name(parser)) == NULL || !expect_token(parser, "(")) {
+    free(part->chip);
+    return false;
+  }
+  bool valid = true;
+  do {
+    Connection connection = {NULL, -1, -1, NULL, -1, -1, parser->token.line};
+    valid = (connection.pin = expect_name(parser)) != NULL &&
+        parse_range(parser, &connection.pin_first, &connection.pin_last) &&
+        expect_token(parser, "=") && (connection.signal = expect_name(parser)) != NULL &&
+        parse_range(parser, &connection.signal_first, &connection.signal_last);
+    part->connections = realloc(part->connections,
+        (part->connection_count + 1) * sizeof(Connection));
+    part->connections[part->connection_count++] = connection;
+  } while (valid && accept_token(parser, ","));
+  valid = valid && expect_token(parser, ")") && expect_token(parser, ";");
+  if (!valid) {
+    for (int i = 0; i < part->connection_count; i++) {
+      free(part->connections[i].pin);
+      free(part->connections[i].signal);
+    }
+    free(part->connections);
+    free(part->chip);
+  }
+  return valid;
+}
+
+// An optional [i] or [i..j]
+bool parse_range(HdlParser* parser, int* first, int* last) {
+  if (!accept_token(parser, "[")) {
+    return true;
+  }
+  if (!parse_number_token(parser, first)) {
+    return false;
+  }
+  *last = *first;
+  if (accept_token(parser, "..") && !parse_number_token(parser, last)) {
+    return false;
+  }
+  if (*last < *first || *last >= MAX_BUS_WIDTH) {
+    return parse_error(parser, "bad range");
+  }
+  return expect_token(parser, "]");
+}
+
+bool is_name_character(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+      c == '_' || c == '-';
+}
+
+// Records the first error, with the file and line. Always returns false.
+bool parse_error(HdlParser* parser, const char* format, ...) {
+  if (parser->failed) {
+    return false;
+  }
+  parser->failed = true;
+  int length = snprintf(parser->error, parser->error_size, "%s:%i: ", parser->path,
+      parser->token.line);
+  if (length >= 0 && (size_t) length < parser->error_size) {
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(parser->error + length, parser->error_size - length, format, arguments);
+    va_end(arguments);
+  }
+  return false;
+}
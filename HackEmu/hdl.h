@@ -0,0 +1,53 @@
+#ifndef HDL_H
+#define HDL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Buses are at most 16 bits wide, as in the Hardware Simulator
+#define MAX_BUS_WIDTH 16
+
+typedef struct {
+  char* name;
+  int width;
+} PinDeclaration;
+
+// One pin=signal of a part, such as out[0..14]=pc. A range of -1..-1
+// stands for the whole bus, and a signal of true or false for a constant.
+typedef struct {
+  char* pin;
+  int pin_first;
+  int pin_last;
+  char* signal;
+  int signal_first;
+  int signal_last;
+  int line;
+} Connection;
+
+typedef struct {
+  char* chip;
+  Connection* connections;
+  int connection_count;
+  int line;
+} Part;
+
+// A chip as it is written in its .hdl file. A chip with a BUILTIN line
+// has no parts and stands for the built-in chip of that name.
+typedef struct {
+  char* name;
+  char* path;
+  PinDeclaration* inputs;
+  int input_count;
+  PinDeclaration* outputs;
+  int output_count;
+  Part* parts;
+  int part_count;
+  char* builtin;
+} ChipDefinition;
+
+bool parse_chip(const char* source, const char* path, ChipDefinition* chip, char* error,
+    size_t error_size);
+void ChipDefinition_free(ChipDefinition* chip);
+const PinDeclaration* find_pin(const ChipDefinition* chip, const char* name, bool* input);
+
+#endif
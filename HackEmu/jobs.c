@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "jobs.h"
+#include "pool.h"
+#include "program.h"
+
+// The jobs a worker has left, as one word so that it can be claimed from
+// the front by its worker and split by the others with a single
+// compare-and-swap: the next job is in the low half, the end in the high
+#define RANGE(next, end) ((uint64_t) (end) << 32 | (uint32_t) (next))
+#define RANGE_NEXT(range) ((uint32_t) (range))
+#define RANGE_END(range) ((uint32_t) ((range) >> 32))
+
+typedef struct {
+  JobList* jobs;
+  _Atomic uint64_t* ranges;
+  int workers;
+  int index;
+} Worker;
+
+bool parse_job(JobList* jobs, char* line, const char* manifest, int directory_length,
+    uint64_t default_limit);
+int find_rom(JobList* jobs, const char* path);
+void* grow(void* array, int count, size_t size);
+void* job_worker(void* argument);
+int claim_job(_Atomic uint64_t* range);
+bool steal_jobs(Worker* worker);
+void run_job(JobList* jobs, Job* job, Machine* machine, int* loaded_rom);
+
+// Reads a manifest with a job per line: a program, then the options of a
+// single run, all optional:
+//
+//   ../04/mult/Mult.hack -n 1000 --set 0=6 --set 1=7 --dump 2
+//
+// Programs are found relative to the manifest, and # starts a comment.
+// Jobs without -n run for default_limit instructions at most.
+bool JobList_load(JobList* jobs, const char* path, uint64_t default_limit) {
+  memset(jobs, 0, sizeof(JobList));
+  size_t size;
+  char* manifest = read_file(path, &size);
+  if (manifest == NULL) {
+    fprintf(stderr, "%s: Could not open file\n", path);
+    return false;
+  }
+  const char* slash = strrchr(path, '/');
+  int directory_length = slash != NULL ? slash - path + 1 : 0;
+  bool valid = true;
+  int line_number = 1;
+  for (char* line = manifest; valid && *line != '\0'; line_number++) {
+    char* end = strchr(line, '\n');
+    char* next = end != NULL ? end + 1 : line + strlen(line);
+    if (end != NULL) {
+      *end = '\0';
+    }
+    char* comment = strchr(line, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    valid = parse_job(jobs, line, path, directory_length, default_limit);
+    if (!valid) {
+      fprintf(stderr, "%s:%i: Not a valid job\n", path, line_number);
+    }
+    line = next;
+  }
+  free(manifest);
+  if (valid) {
+    jobs->values = calloc(jobs->value_count > 0 ? jobs->value_count : 1, sizeof(uint16_t));
+    // a counting sort, which keeps each ROM's jobs in manifest order
+    int* starts = calloc(jobs->rom_count + 1, sizeof(int));
+    for (int i = 0; i < jobs->count; i++) {
+      starts[jobs->jobs[i].rom + 1]++;
+    }
+    for (int rom = 0; rom < jobs->rom_count; rom++) {
+      starts[rom + 1] += starts[rom];
+    }
+    jobs->order = malloc((jobs->count > 0 ? jobs->count : 1) * sizeof(int));
+    for (int i = 0; i < jobs->count; i++) {
+      jobs->order[starts[jobs->jobs[i].rom]++] = i;
+    }
+    free(starts);
+  } else {
+    JobList_free(jobs);
+  }
+  return valid;
+}
+
+void JobList_free(JobList* jobs) {
+  for (int i = 0; i < jobs->rom_count; i++) {
+    free(jobs->roms[i].path);
+    free(jobs->roms[i].ops);
+  }
+  free(jobs->roms);
+  free(jobs->jobs);
+  free(jobs->order);
+  free(jobs->sets);
+  free(jobs->dumps);
+  free(jobs->values);
+  memset(jobs, 0, sizeof(JobList));
+}
+
+bool parse_job(JobList* jobs, char* line, const char* manifest, int directory_length,
+    uint64_t default_limit) {
+  char* state;
+  char* word = strtok_r(line, " \t\r", &state);
+  if (word == NULL) {
+    return true;
+  }
+  Job job = {0};
+  job.limit = default_limit;
+  job.first_set = jobs->set_count;
+  job.first_dump = jobs->dump_count;
+  job.first_value = jobs->value_count;
+
+  size_t length = word[0] == '/' ? strlen(word) + 1 : directory_length + strlen(word) + 1;
+  char* path = malloc(length);
+  snprintf(path, length, "%.*s%s", word[0] == '/' ? 0 : directory_length, manifest, word);
+  job.rom = find_rom(jobs, path);
+  free(path);
+  if (job.rom < 0) {
+    return false;
+  }
+  while ((word = strtok_r(NULL, " \t\r", &state)) != NULL) {
+    char* value = strtok_r(NULL, " \t\r", &state);
+    Request request;
+    if (value == NULL) {
+      return false;
+    } else if (strcmp(word, "-n") == 0) {
+      char* end;
+      job.limit = strtoull(value, &end, 10);
+      if (*end != '\0') {
+        return false;
+      }
+    } else if (strcmp(word, "--set") == 0 && parse_pair(value, '=', &request)) {
+      jobs->sets = grow(jobs->sets, jobs->set_count, sizeof(Request));
+      jobs->sets[jobs->set_count++] = request;
+      job.set_count++;
+    } else if (strcmp(word, "--dump") == 0 && parse_pair(value, '-', &request) &&
+        request.first >= 0 && request.first <= request.second && request.second < RAM_WORDS) {
+      jobs->dumps = grow(jobs->dumps, jobs->dump_count, sizeof(Request));
+      jobs->dumps[jobs->dump_count++] = request;
+      job.dump_count++;
+      jobs->value_count += request.second - request.first + 1;
+    } else {
+      return false;
+    }
+  }
+  jobs->jobs = grow(jobs->jobs, jobs->count, sizeof(Job));
+  jobs->jobs[jobs->count++] = job;
+  return true;
+}
+
+// Returns the index of the program at path, loading and decoding it the
+// first time it is asked for, or -1 if it could not be loaded
+int find_rom(JobList* jobs, const char* path) {
+  for (int i = 0; i < jobs->rom_count; i++) {
+    if (strcmp(jobs->roms[i].path, path) == 0) {
+      return i;
+    }
+  }
+  HackProgram program;
+  if (!load_program(path, &program)) {
+    return -1;
+  }
+  jobs->roms = grow(jobs->roms, jobs->rom_count, sizeof(DecodedRom));
+  DecodedRom* rom = &jobs->roms[jobs->rom_count];
+  rom->path = strdup(path);
+  rom->ops = malloc(ROM_WORDS * sizeof(Op));
+  rom->count = decode_rom(rom->ops, program.words, program.count);
+  hack_program_free(&program);
+  return jobs->rom_count++;
+}
+
+// Makes room for one more element. Capacities are powers of two, so an
+// array is full whenever its count is one.
+void* grow(void* array, int count, size_t size) {
+  if (count != 0 && (count & (count - 1)) != 0) {
+    return array;
+  }
+  return realloc(array, (count == 0 ? 1 : count * 2) * size);
+}
+
+// Each worker starts with an equal share of the jobs, grouped by ROM so
+// that a worker rarely has to switch. A worker that runs out takes the
+// second half of what another has left.
+void run_jobs(JobList* jobs, int threads) {
+  if (threads > jobs->count) {
+    threads = jobs->count;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+  _Atomic uint64_t* ranges = malloc(threads * sizeof(_Atomic uint64_t));
+  Worker* workers = malloc(threads * sizeof(Worker));
+  for (int i = 0; i < threads; i++) {
+    uint32_t first = (uint64_t) jobs->count * i / threads;
+    uint32_t end = (uint64_t) jobs->count * (i + 1) / threads;
+    atomic_init(&ranges[i], RANGE(first, end));
+    workers[i] = (Worker) {jobs, ranges, threads, i};
+  }
+  run_threads(job_worker, workers, sizeof(Worker), threads);
+  free(workers);
+  free(ranges);
+}
+
+void* job_worker(void* argument) {
+  Worker* worker = argument;
+  Machine* machine = malloc(sizeof(Machine));
+  int loaded_rom = -1;
+  for (;;) {
+    int index = claim_job(&worker->ranges[worker->index]);
+    if (index >= 0) {
+      Job* job = &worker->jobs->jobs[worker->jobs->order[index]];
+      run_job(worker->jobs, job, machine, &loaded_rom);
+    } else if (!steal_jobs(worker)) {
+      break;
+    }
+  }
+  free(machine);
+  return NULL;
+}
+
+// Takes the next job of a range, or returns -1 if it is empty
+int claim_job(_Atomic uint64_t* range) {
+  uint64_t current = atomic_load(range);
+  while (RANGE_NEXT(current) < RANGE_END(current)) {
+    uint32_t next = RANGE_NEXT(current);
+    if (atomic_compare_exchange_weak(range, &current, RANGE(next + 1, RANGE_END(current)))) {
+      return next;
+    }
+  }
+  return -1;
+}
+
+// Moves the second half of another worker's jobs, or its last job, to
+// this worker's range. Returns false once every range is empty.
+bool steal_jobs(Worker* worker) {
+  for (int i = 1; i < worker->workers; i++) {
+    _Atomic uint64_t* victim = &worker->ranges[(worker->index + i) % worker->workers];
+    uint64_t current = atomic_load(victim);
+    while (RANGE_NEXT(current) < RANGE_END(current)) {
+      uint32_t next = RANGE_NEXT(current);
+      uint32_t end = RANGE_END(current);
+      uint32_t middle = next + (end - next) / 2;
+      if (atomic_compare_exchange_weak(victim, &current, RANGE(next, middle))) {
+        // nobody else changes an empty range, so a plain store will do
+        atomic_store(&worker->ranges[worker->index], RANGE(middle, end));
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// The ROM is only copied into the machine when it differs from the last
+// job's. RAM starts cleared, as it does for a single run.
+void run_job(JobList* jobs, Job* job, Machine* machine, int* loaded_rom) {
+  if (*loaded_rom != job->rom) {
+    const DecodedRom* rom = &jobs->roms[job->rom];
+    memcpy(machine->rom, rom->ops, ROM_WORDS * sizeof(Op));
+    machine->rom_count = rom->count;
+    *loaded_rom = job->rom;
+  }
+  Machine_reset(machine);
+  memset(machine->ram, 0, sizeof(machine->ram));
+  for (int i = 0; i < job->set_count; i++) {
+    const Request* set = &jobs->sets[job->first_set + i];
+    machine->ram[set->first & ADDRESS_MASK] = set->second;
+  }
+  job->executed = run(machine, job->limit);
+  job->pc = machine->pc;
+  job->halted = machine->halted;
+  uint16_t* values = &jobs->values[job->first_value];
+  for (int i = 0; i < job->dump_count; i++) {
+    const Request* dump = &jobs->dumps[job->first_dump + i];
+    int words = dump->second - dump->first + 1;
+    memcpy(values, &machine->ram[dump->first], words * sizeof(uint16_t));
+    values += words;
+  }
+}
+
+// One JSON object per job, in manifest order, with the dumped words in
+// the order they were asked for
+void print_job_results(FILE* file, const JobList* jobs) {
+  for (int i = 0; i < jobs->count; i++) {
+    const Job* job = &jobs->jobs[i];
+    fprintf(file, "{\"job\":%i,\"instructions\":%llu,\"halted\":%s,\"pc\":%i,\"ram\":[", i,
+        (unsigned long long) job->executed, job->halted ? "true" : "false", job->pc);
+    int values = i + 1 < jobs->count ? jobs->jobs[i + 1].first_value : jobs->value_count;
+    for (int value = job->first_value; value < values; value++) {
+      fprintf(file, value > job->first_value ? ",%i" : "%i", (int16_t) jobs->values[value]);
+    }
+    fprintf(file, "]}\n");
+  }
+}
+
+// Reads "first<separator>second", or a lone number which stands for both
+bool parse_pair(const char* text, char separator, Request* request) {
+  char* end;
+  request->first = strtol(text, &end, 10);
+  request->second = request->first;
+  if (end == text) {
+    return false;
+  }
+  if (*end == separator) {
+    const char* second = end + 1;
+    request->second = strtol(second, &end, 10);
+    return end != second && *end == '\0';
+  }
+  return *end == '\0' && separator == '-';
+}
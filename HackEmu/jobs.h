@@ -0,0 +1,63 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "machine.h"
+
+// A RAM address and value for --set, or an address range for --dump
+typedef struct {
+  int first;
+  int second;
+} Request;
+
+// One run of a program: its ROM, the RAM words set before it starts, how
+// many instructions it may run and the RAM words read once it stops.
+// Requests and dumped values live in the JobList's shared arrays, from
+// first_set, first_dump and first_value on.
+typedef struct {
+  int rom;
+  uint64_t limit;
+  int first_set;
+  int set_count;
+  int first_dump;
+  int dump_count;
+  int first_value;
+  uint64_t executed;
+  uint16_t pc;
+  bool halted;
+} Job;
+
+// Every ROM in a manifest, decoded once however many jobs run it
+typedef struct {
+  char* path;
+  int count;
+  Op* ops;
+} DecodedRom;
+
+// A manifest and, once run, its results. Everything a job needs is
+// allocated while the manifest is read, so running the jobs allocates
+// nothing but a machine per thread.
+typedef struct {
+  DecodedRom* roms;
+  int rom_count;
+  Job* jobs;
+  int count;
+  // the jobs grouped by ROM, the order they are run in
+  int* order;
+  Request* sets;
+  int set_count;
+  Request* dumps;
+  int dump_count;
+  uint16_t* values;
+  int value_count;
+} JobList;
+
+bool JobList_load(JobList* jobs, const char* path, uint64_t default_limit);
+void JobList_free(JobList* jobs);
+void run_jobs(JobList* jobs, int threads);
+void print_job_results(FILE* file, const JobList* jobs);
+bool parse_pair(const char* text, char separator, Request* request);
+
+#endif
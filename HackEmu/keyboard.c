@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "keyboard.h"
+
+#define TRACE_MAGIC "HKEY"
+#define EVENT_SIZE 10
+
+// The terminal's settings before open_terminal changed them
+struct termios saved_terminal;
+int saved_flags;
+
+void KeyTrace_init(KeyTrace* trace) {
+  trace->events = NULL;
+  trace->count = 0;
+  trace->capacity = 0;
+  trace->next = 0;
+}
+
+void KeyTrace_free(KeyTrace* trace) {
+  free(trace->events);
+  KeyTrace_init(trace);
+}
+
+bool KeyTrace_load(KeyTrace* trace, const char* path) {
+  KeyTrace_init(trace);
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "%s: Could not open file\n", path);
+    return false;
+  }
+  char magic[4];
+  bool valid = fread(magic, 1, 4, file) == 4 && memcmp(magic, TRACE_MAGIC, 4) == 0;
+  uint8_t bytes[EVENT_SIZE];
+  uint64_t last = 0;
+  while (valid && fread(bytes, 1, EVENT_SIZE, file) == EVENT_SIZE) {
+    uint64_t cycle = 0;
+    for (int i = 0; i < 8; i++) {
+      cycle |= (uint64_t) bytes[i] << (i * 8);
+    }
+    valid = cycle >= last;
+    last = cycle;
+    add_key_event(trace, cycle, bytes[8] | bytes[9] << 8);
+  }
+  valid = valid && feof(file) && !ferror(file);
+  fclose(file);
+  if (!valid) {
+    fprintf(stderr, "%s: Not a key trace, or events out of order\n", path);
+    KeyTrace_free(trace);
+  }
+  return valid;
+}
+
+bool KeyTrace_save(const KeyTrace* trace, const char* path) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "%s: Could not open output file\n", path);
+    return false;
+  }
+  bool written = fwrite(TRACE_MAGIC, 1, 4, file) == 4;
+  for (int i = 0; i < trace->count && written; i++) {
+    uint8_t bytes[EVENT_SIZE];
+    for (int byte = 0; byte < 8; byte++) {
+      bytes[byte] = (trace->events[i].cycle >> (byte * 8)) & 0xFF;
+    }
+    bytes[8] = trace->events[i].key & 0xFF;
+    bytes[9] = trace->events[i].key >> 8;
+    written = fwrite(bytes, 1, EVENT_SIZE, file) == EVENT_SIZE;
+  }
+  written = fclose(file) == 0 && written;
+  if (!written) {
+    fprintf(stderr, "%s: Could not write key trace\n", path);
+  }
+  return written;
+}
+
+void add_key_event(KeyTrace* trace, uint64_t cycle, uint16_t key) {
+  if (trace->count == trace->capacity) {
+    trace->capacity = trace->capacity == 0 ? 256 : trace->capacity * 2;
+    trace->events = realloc(trace->events, trace->capacity * sizeof(KeyEvent));
+  }
+  trace->events[trace->count++] = (KeyEvent) {cycle, key};
+}
+
+// Stores the key of every event due by the machine's current cycle in KBD
+void apply_key_events(KeyTrace* trace, Machine* machine) {
+  while (trace->next < trace->count && trace->events[trace->next].cycle <= machine->cycles) {
+    machine->ram[KBD] = trace->events[trace->next++].key;
+  }
+}
+
+// The cycle the next event is due, or UINT64_MAX if there are none left
+uint64_t next_key_cycle(const KeyTrace* trace) {
+  return trace->next < trace->count ? trace->events[trace->next].cycle : UINT64_MAX;
+}
+
+// Stores the keys typed since the last call in KBD and adds them to trace.
+// A terminal only reports key presses, so a key is held for hold cycles,
+// or longer while it repeats, and released at *release. Returns false
+// once the user asked to stop.
+bool record_terminal_keys(KeyTrace* trace, Machine* machine, uint64_t hold, uint64_t* release) {
+  int pressed = -1;
+  int key;
+  while ((key = read_terminal_key()) != -1) {
+    if (key == KEY_STOP) {
+      return false;
+    }
+    pressed = key;
+  }
+  if (pressed != -1) {
+    if (machine->ram[KBD] != pressed) {
+      machine->ram[KBD] = pressed;
+      add_key_event(trace, machine->cycles, pressed);
+    }
+    *release = machine->cycles + hold;
+  } else if (machine->ram[KBD] != 0 && machine->cycles >= *release) {
+    machine->ram[KBD] = 0;
+    add_key_event(trace, machine->cycles, 0);
+  }
+  return true;
+}
+
+// Puts the terminal in raw mode and makes reading it never wait, so keys
+// can be polled between slices of a run
+bool open_terminal() {
+  if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_terminal) != 0) {
+    fprintf(stderr, "Recording keys needs a terminal\n");
+    return false;
+  }
+  struct termios raw = saved_terminal;
+  raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+  raw.c_iflag &= ~(IXON | ICRNL);
+  raw.c_cc[VMIN] = 0;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+  saved_flags = fcntl(STDIN_FILENO, F_GETFL);
+  fcntl(STDIN_FILENO, F_SETFL, saved_flags | O_NONBLOCK);
+  return true;
+}
+
+void close_terminal() {
+  tcsetattr(STDIN_FILENO, TCSANOW, &saved_terminal);
+  fcntl(STDIN_FILENO, F_SETFL, saved_flags);
+}
+
+// Returns the Hack code of the next key typed, -1 if there is none, or
+// KEY_STOP for Ctrl-C or Ctrl-D. Arrow keys arrive as ESC [ A to D.
+int read_terminal_key() {
+  unsigned char bytes[3];
+  if (read(STDIN_FILENO, bytes, 1) != 1) {
+    return -1;
+  }
+  switch (bytes[0]) {
+    case 3:
+    case 4: return KEY_STOP;
+    case '\r':
+    case '\n': return KEY_NEWLINE;
+    case 8:
+    case 127: return KEY_BACKSPACE;
+    case 27:
+      if (read(STDIN_FILENO, bytes + 1, 2) == 2 && bytes[1] == '[') {
+        switch (bytes[2]) {
+          case 'A': return KEY_UP;
+          case 'B': return KEY_DOWN;
+          case 'C': return KEY_RIGHT;
+          case 'D': return KEY_LEFT;
+        }
+      }
+      return KEY_ESCAPE;
+  }
+  return bytes[0] < 128 ? bytes[0] : -1;
+}
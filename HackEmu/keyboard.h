@@ -0,0 +1,53 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "machine.h"
+
+// Hack key codes beyond ASCII
+#define KEY_NEWLINE 128
+#define KEY_BACKSPACE 129
+#define KEY_LEFT 130
+#define KEY_UP 131
+#define KEY_RIGHT 132
+#define KEY_DOWN 133
+#define KEY_ESCAPE 140
+
+// Returned by read_terminal_key when the user asked to stop
+#define KEY_STOP -2
+
+// The value KBD takes from a cycle on, 0 when the key is released
+typedef struct {
+  uint64_t cycle;
+  uint16_t key;
+} KeyEvent;
+
+// Key events in cycle order. A trace file is
+//
+//   "HKEY"
+//   then per event: uint64 cycle, uint16 key
+//
+// with every number little-endian. next is the first event not yet
+// applied to the machine.
+typedef struct {
+  KeyEvent* events;
+  int count;
+  int capacity;
+  int next;
+} KeyTrace;
+
+void KeyTrace_init(KeyTrace* trace);
+void KeyTrace_free(KeyTrace* trace);
+bool KeyTrace_load(KeyTrace* trace, const char* path);
+bool KeyTrace_save(const KeyTrace* trace, const char* path);
+void add_key_event(KeyTrace* trace, uint64_t cycle, uint16_t key);
+void apply_key_events(KeyTrace* trace, Machine* machine);
+uint64_t next_key_cycle(const KeyTrace* trace);
+
+bool record_terminal_keys(KeyTrace* trace, Machine* machine, uint64_t hold, uint64_t* release);
+bool open_terminal();
+void close_terminal();
+int read_terminal_key();
+
+#endif
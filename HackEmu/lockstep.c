@@ -0,0 +1,407 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lockstep.h"
+#include "pool.h"
+
+// Lanes still apart after this many steps in a row are peeled off and run
+// one at a time
+#define PEEL_AFTER 4096
+// The per-lane instruction counts are 16 bits during a chunk of steps
+#define MAX_CHUNK 65535
+
+// Shared by the workers. Each worker claims the next block of jobs, the
+// jobs of a block being neighbours in jobs->order with the same ROM.
+typedef struct {
+  JobList* jobs;
+  int* block_starts;
+  int block_count;
+  WorkQueue queue;
+} LockstepRun;
+
+void* lockstep_worker(void* argument);
+void start_lanes(LaneBlock* block, JobList* jobs, const int* order, int count);
+void finish_lanes(LaneBlock* block, JobList* jobs, const int* order, int count);
+void run_lanes(LaneBlock* block, const Op* rom, Machine* machine);
+uint64_t step_lanes(LaneBlock* block, const Op* rom, uint64_t steps, Lanes* counts, int* apart);
+void peel_lanes(LaneBlock* block, Machine* machine);
+uint16_t lowest_lane(Lanes values);
+bool all_lanes(Lanes mask);
+
+// Runs the jobs of a manifest like run_jobs, in blocks of up to LANES jobs
+// that share a ROM
+void run_jobs_lockstep(JobList* jobs, int threads) {
+  LockstepRun lockstep;
+  lockstep.jobs = jobs;
+  lockstep.block_starts = malloc((jobs->count + 1) * sizeof(int));
+  lockstep.block_count = 0;
+  for (int i = 0; i < jobs->count; i++) {
+    int start = lockstep.block_count > 0 ? lockstep.block_starts[lockstep.block_count - 1] : 0;
+    if (lockstep.block_count == 0 || i - start == LANES ||
+        jobs->jobs[jobs->order[i]].rom != jobs->jobs[jobs->order[start]].rom) {
+      lockstep.block_starts[lockstep.block_count++] = i;
+    }
+  }
+  lockstep.block_starts[lockstep.block_count] = jobs->count;
+  WorkQueue_init(&lockstep.queue, lockstep.block_count);
+  run_threads(lockstep_worker, &lockstep, 0,
+      threads < lockstep.block_count ? threads : lockstep.block_count);
+  free(lockstep.block_starts);
+}
+
+// Each worker has one block of lanes, and a machine to run peeled lanes on
+void* lockstep_worker(void* argument) {
+  LockstepRun* lockstep = argument;
+  JobList* jobs = lockstep->jobs;
+  LaneBlock* block = aligned_alloc(sizeof(Lanes), sizeof(LaneBlock));
+  memset(block->ram, 0, sizeof(block->ram));
+  memset(block->dirty_pages, 0, sizeof(block->dirty_pages));
+  Machine* machine = malloc(sizeof(Machine));
+  int loaded_rom = -1;
+  int index;
+  while ((index = claim_work(&lockstep->queue)) >= 0) {
+    const int* order = &jobs->order[lockstep->block_starts[index]];
+    int count = lockstep->block_starts[index + 1] - lockstep->block_starts[index];
+    int rom = jobs->jobs[order[0]].rom;
+    if (loaded_rom != rom) {
+      memcpy(machine->rom, jobs->roms[rom].ops, ROM_WORDS * sizeof(Op));
+      machine->rom_count = jobs->roms[rom].count;
+      loaded_rom = rom;
+    }
+    start_lanes(block, jobs, order, count);
+    run_lanes(block, machine->rom, machine);
+    finish_lanes(block, jobs, order, count);
+  }
+  free(machine);
+  free(block);
+  return NULL;
+}
+
+// Gives each job a lane, with cleared registers and RAM and its pokes.
+// The last block's RAM is cleared where it was written.
+void start_lanes(LaneBlock* block, JobList* jobs, const int* order, int count) {
+  Lanes zero = {0};
+  for (int page = 0; page < PAGES; page++) {
+    if (block->dirty_pages[page]) {
+      memset(&block->ram[page * PAGE_WORDS], 0, PAGE_WORDS * sizeof(Lanes));
+      block->dirty_pages[page] = 0;
+    }
+  }
+  block->a = zero;
+  block->d = zero;
+  block->pc = zero;
+  block->halted = zero;
+  block->stopped = zero;
+  for (int lane = 0; lane < LANES; lane++) {
+    block->executed[lane] = 0;
+    block->limits[lane] = 0;
+    if (lane >= count) {
+      block->stopped[lane] = 0xFFFF;
+      continue;
+    }
+    const Job* job = &jobs->jobs[order[lane]];
+    block->limits[lane] = job->limit;
+    for (int i = 0; i < job->set_count; i++) {
+      const Request* set = &jobs->sets[job->first_set + i];
+      block->ram[set->first & ADDRESS_MASK][lane] = set->second;
+      block->dirty_pages[(set->first & ADDRESS_MASK) / PAGE_WORDS] = 1;
+    }
+  }
+}
+
+void finish_lanes(LaneBlock* block, JobList* jobs, const int* order, int count) {
+  for (int lane = 0; lane < count; lane++) {
+    Job* job = &jobs->jobs[order[lane]];
+    job->executed = block->executed[lane];
+    job->pc = block->pc[lane];
+    job->halted = block->halted[lane] != 0;
+    uint16_t* values = &jobs->values[job->first_value];
+    for (int i = 0; i < job->dump_count; i++) {
+      const Request* dump = &jobs->dumps[job->first_dump + i];
+      for (int address = dump->first; address <= dump->second; address++) {
+        *values++ = block->ram[address][lane];
+      }
+    }
+  }
+}
+
+// Runs every lane until it halts or reaches its limit. A chunk of steps is
+// never longer than the lane closest to its limit has left, so no lane
+// can run past it.
+void run_lanes(LaneBlock* block, const Op* rom, Machine* machine) {
+  int apart = 0;
+  for (;;) {
+    uint64_t chunk = MAX_CHUNK;
+    for (int lane = 0; lane < LANES; lane++) {
+      if (block->stopped[lane]) {
+        continue;
+      }
+      uint64_t remaining = block->limits[lane] - block->executed[lane];
+      if (remaining == 0) {
+        block->stopped[lane] = 0xFFFF;
+      } else if (remaining < chunk) {
+        chunk = remaining;
+      }
+    }
+    if (all_lanes(block->stopped)) {
+      return;
+    }
+    Lanes counts = {0};
+    step_lanes(block, rom, chunk, &counts, &apart);
+    for (int lane = 0; lane < LANES; lane++) {
+      block->executed[lane] += counts[lane];
+    }
+    if (apart > PEEL_AFTER) {
+      peel_lanes(block, machine);
+      apart = 0;
+    }
+  }
+}
+
+// Runs up to steps instructions. Each step runs the instruction at the
+// lowest PC of any lane, in every lane at that PC, so lanes that branched
+// apart wait for each other where their paths meet again. While all lanes
+// share a PC, finding it costs nothing. counts gains one in a lane for
+// every instruction it ran, and apart counts the steps in a row that
+// left some lanes waiting. Stops early once that reaches PEEL_AFTER.
+uint64_t step_lanes(LaneBlock* block, const Op* rom, uint64_t steps, Lanes* counts, int* apart) {
+  Lanes a = block->a;
+  Lanes d = block->d;
+  Lanes pc = block->pc;
+  Lanes halted = block->halted;
+  Lanes stopped = block->stopped;
+  Lanes count = *counts;
+  Lanes* ram = block->ram;
+  uint8_t* dirty_pages = block->dirty_pages;
+  // the shared PC and A of the running lanes, when they have one
+  bool together = *apart == 0 && all_lanes((Lanes) (pc == lowest_lane(pc | stopped)) | stopped);
+  uint16_t p = lowest_lane(pc | stopped);
+  bool shared_a = false;
+
+  uint64_t step;
+  for (step = 0; step < steps; step++) {
+    Lanes mask = ~stopped;
+    if (!together) {
+      Lanes waiting = pc | stopped;
+      p = lowest_lane(waiting);
+      if (p == 0xFFFF) {
+        break;
+      }
+      mask = (Lanes) (waiting == p);
+      together = all_lanes(mask | stopped);
+      if (together) {
+        *apart = 0;
+      } else if (++*apart > PEEL_AFTER) {
+        break;
+      }
+      // a lane's A is only known to match those it ran with
+      shared_a = false;
+    }
+    Op op = rom[p];
+    if (op.comp == OP_LOAD) {
+      a = (a & ~mask) | (mask & op.value);
+      shared_a = together;
+      count += mask & 1;
+      p = (p + 1) & ADDRESS_MASK;
+      pc = (pc & ~mask) | (mask & p);
+      continue;
+    }
+    if (op.comp == OP_HALT) {
+      a = (a & ~mask) | (mask & op.value);
+      halted |= mask;
+      stopped |= mask;
+      together = false;
+      if (all_lanes(stopped)) {
+        step++;
+        break;
+      }
+      continue;
+    }
+
+    // M is one vector when every running lane has the same A
+    Lanes m = {0};
+    uint16_t address = 0;
+    bool uses_m = (op.comp & 0x40) || (op.control & DEST_M);
+    if (uses_m && !shared_a) {
+      uint16_t lowest = lowest_lane(a | ~mask);
+      shared_a = all_lanes((Lanes) (a == lowest) | ~mask);
+    }
+    if (uses_m) {
+      if (shared_a) {
+        address = lowest_lane(a | ~mask) & ADDRESS_MASK;
+        m = ram[address];
+      } else {
+        for (int lane = 0; lane < LANES; lane++) {
+          m[lane] = ram[a[lane] & ADDRESS_MASK][lane];
+        }
+      }
+    }
+
+    // The ALU, with the comp bits deciding between whole vectors
+    Lanes zero = {0};
+    Lanes x = d;
+    Lanes y = (op.comp & 0x40) ? m : a;
+    if (op.comp & 0x20) {
+      x = zero;
+    }
+    if (op.comp & 0x10) {
+      x = ~x;
+    }
+    if (op.comp & 0x08) {
+      y = zero;
+    }
+    if (op.comp & 0x04) {
+      y = ~y;
+    }
+    Lanes out = (op.comp & 0x02) ? x + y : x & y;
+    if (op.comp & 0x01) {
+      out = ~out;
+    }
+
+    // M is written at the old A, and the jump goes to the old A
+    Lanes target = a & ADDRESS_MASK;
+    if (op.control & DEST_M) {
+      if (shared_a) {
+        ram[address] = (ram[address] & ~mask) | (out & mask);
+        dirty_pages[address / PAGE_WORDS] = 1;
+      } else {
+        for (int lane = 0; lane < LANES; lane++) {
+          if (mask[lane]) {
+            ram[a[lane] & ADDRESS_MASK][lane] = out[lane];
+            dirty_pages[(a[lane] & ADDRESS_MASK) / PAGE_WORDS] = 1;
+          }
+        }
+      }
+    }
+    if (op.control & DEST_A) {
+      a = (a & ~mask) | (out & mask);
+      shared_a = false;
+    }
+    if (op.control & DEST_D) {
+      d = (d & ~mask) | (out & mask);
+    }
+    count += mask & 1;
+    uint16_t following = (p + 1) & ADDRESS_MASK;
+    if ((op.control & (JUMP_LT | JUMP_EQ | JUMP_GT)) == 0) {
+      p = following;
+      pc = (pc & ~mask) | (mask & p);
+      continue;
+    }
+    Lanes equal = (Lanes) (out == 0);
+    Lanes less = (Lanes) ((SignedLanes) out < 0);
+    Lanes jump = zero;
+    if (op.control & JUMP_EQ) {
+      jump |= equal;
+    }
+    if (op.control & JUMP_LT) {
+      jump |= less;
+    }
+    if (op.control & JUMP_GT) {
+      jump |= ~(equal | less);
+    }
+    Lanes next = (jump & target) | (~jump & following);
+    pc = (pc & ~mask) | (next & mask);
+    if (together) {
+      // lanes that jumped differently, or to different targets, part
+      p = lowest_lane(pc | stopped);
+      together = all_lanes((Lanes) (pc == p) | stopped);
+    }
+    if (!together) {
+      // A lane that jumped to the final loop would wait there for all
+      // the others, so it stops now. It halts, as it would on its next
+      // step, only if its limit leaves it that step.
+      for (int lane = 0; lane < LANES; lane++) {
+        if (mask[lane] && rom[pc[lane]].comp == OP_HALT) {
+          stopped[lane] = 0xFFFF;
+          if (block->executed[lane] + count[lane] < block->limits[lane]) {
+            a[lane] = rom[pc[lane]].value;
+            halted[lane] = 0xFFFF;
+          }
+        }
+      }
+      if (all_lanes(stopped)) {
+        step++;
+        break;
+      }
+      p = lowest_lane(pc | stopped);
+      together = all_lanes((Lanes) (pc == p) | stopped);
+    }
+  }
+
+  block->a = a;
+  block->d = d;
+  block->pc = pc;
+  block->halted = halted;
+  block->stopped = stopped;
+  *counts = count;
+  return step;
+}
+
+// Runs every running lane but those at the most common PC to the end on
+// its own, which costs a copy of its RAM each way
+void peel_lanes(LaneBlock* block, Machine* machine) {
+  int best = 0;
+  int most = 0;
+  for (int lane = 0; lane < LANES; lane++) {
+    int same = 0;
+    for (int other = 0; other < LANES && !block->stopped[lane]; other++) {
+      same += !block->stopped[other] && block->pc[other] == block->pc[lane];
+    }
+    if (same > most) {
+      most = same;
+      best = block->pc[lane];
+    }
+  }
+  for (int lane = 0; lane < LANES; lane++) {
+    if (block->stopped[lane] || block->pc[lane] == best) {
+      continue;
+    }
+    Machine_reset(machine);
+    machine->a = block->a[lane];
+    machine->d = block->d[lane];
+    machine->pc = block->pc[lane];
+    memset(machine->ram, 0, sizeof(machine->ram));
+    for (int page = 0; page < PAGES; page++) {
+      for (int address = page * PAGE_WORDS; block->dirty_pages[page] &&
+          address < (page + 1) * PAGE_WORDS; address++) {
+        machine->ram[address] = block->ram[address][lane];
+      }
+    }
+    block->executed[lane] += run(machine, block->limits[lane] - block->executed[lane]);
+    // A page needs copying back if it was written before, or now holds a
+    // word that is not zero. Writing only zeros left a clear page as it was.
+    for (int page = 0; page < PAGES; page++) {
+      const uint16_t* words = &machine->ram[page * PAGE_WORDS];
+      bool written = block->dirty_pages[page];
+      for (int i = 0; i < PAGE_WORDS && !written; i++) {
+        written = words[i] != 0;
+      }
+      for (int i = 0; i < PAGE_WORDS && written; i++) {
+        block->ram[page * PAGE_WORDS + i][lane] = words[i];
+      }
+      block->dirty_pages[page] |= written;
+    }
+    block->a[lane] = machine->a;
+    block->d[lane] = machine->d;
+    block->pc[lane] = machine->pc;
+    block->halted[lane] = machine->halted ? 0xFFFF : 0;
+    block->stopped[lane] = 0xFFFF;
+  }
+}
+
+inline __attribute__((always_inline))
+uint16_t lowest_lane(Lanes values) {
+  uint16_t lowest = values[0];
+  for (int lane = 1; lane < LANES; lane++) {
+    lowest = values[lane] < lowest ? values[lane] : lowest;
+  }
+  return lowest;
+}
+
+inline __attribute__((always_inline))
+bool all_lanes(Lanes mask) {
+  uint16_t all = mask[0];
+  for (int lane = 1; lane < LANES; lane++) {
+    all &= mask[lane];
+  }
+  return all == 0xFFFF;
+}
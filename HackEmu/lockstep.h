@@ -0,0 +1,37 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "jobs.h"
+#include "machine.h"
+
+// Instances of one program run side by side, a lane each. Eight 16-bit
+// lanes fill a 128-bit register, which SSE2 and NEON always have.
+#define LANES 8
+// RAM is cleared between blocks a page at a time, only where it was written
+#define PAGE_WORDS 64
+#define PAGES (RAM_WORDS / PAGE_WORDS)
+
+// A value per lane, worked on with the compiler's vector extensions
+typedef uint16_t Lanes __attribute__((vector_size(LANES * sizeof(uint16_t))));
+typedef int16_t SignedLanes __attribute__((vector_size(LANES * sizeof(uint16_t))));
+
+// Up to LANES instances of the same program, with their registers stored
+// as one vector each and their RAM interleaved, so that lanes reading the
+// same address read one vector. stopped has every bit set in the lanes
+// that halted, used up their instructions, were peeled off to run alone,
+// or hold no instance. dirty_pages marks the pages of RAM written to.
+typedef struct {
+  Lanes a;
+  Lanes d;
+  Lanes pc;
+  Lanes halted;
+  Lanes stopped;
+  uint64_t executed[LANES];
+  uint64_t limits[LANES];
+  uint8_t dirty_pages[PAGES];
+  Lanes ram[RAM_WORDS];
+} LaneBlock;
+
+void run_jobs_lockstep(JobList* jobs, int threads);
+
+#endif
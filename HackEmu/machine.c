@@ -0,0 +1,199 @@
+#include <string.h>
+#include "machine.h"
+
+// A machine with an empty ROM (every word is @0) and cleared RAM
+void Machine_init(Machine* machine) {
+  memset(machine->ram, 0, sizeof(machine->ram));
+  memset(machine->dirty_rows, 0, sizeof(machine->dirty_rows));
+  load_rom(machine, NULL, 0);
+}
+
+// Like the reset button: registers are cleared, memory is kept
+void Machine_reset(Machine* machine) {
+  machine->a = 0;
+  machine->d = 0;
+  machine->pc = 0;
+  machine->halted = false;
+  machine->cycles = 0;
+}
+
+// Decodes the whole program once and resets the machine
+void load_rom(Machine* machine, const uint16_t* words, int count) {
+  machine->rom_count = decode_rom(machine->rom, words, count);
+  Machine_reset(machine);
+}
+
+// Decodes a program into all ROM_WORDS entries of rom, and returns how
+// many words of it there are. Addresses past the end of the program read
+// as 0, which is @0, as they would on the real ROM chip.
+int decode_rom(Op* rom, const uint16_t* words, int count) {
+  if (count > ROM_WORDS) {
+    count = ROM_WORDS;
+  }
+  Op empty = decode(0);
+  for (int i = 0; i < ROM_WORDS; i++) {
+    rom[i] = i < count ? decode(words[i]) : empty;
+  }
+  // @n at address n, then an unconditional jump that writes nothing, is
+  // the loop a finished program spins in
+  for (int i = 0; i + 1 < count; i++) {
+    if (rom[i].comp == OP_LOAD && rom[i].value == i && rom[i + 1].comp != OP_LOAD &&
+        rom[i + 1].control == (JUMP_LT | JUMP_EQ | JUMP_GT)) {
+      rom[i].comp = OP_HALT;
+    }
+  }
+  return count;
+}
+
+// Turns the halt loops back into plain instructions, for callers that
+// need every cycle of the loop and not only the time it started
+void unmark_halts(Machine* machine) {
+  for (int i = 0; i < ROM_WORDS; i++) {
+    if (machine->rom[i].comp == OP_HALT) {
+      machine->rom[i].comp = OP_LOAD;
+    }
+  }
+}
+
+Op decode(uint16_t word) {
+  Op op;
+  if ((word & 0x8000) == 0) {
+    op.comp = OP_LOAD;
+    op.value = word;
+    op.control = 0;
+  } else {
+    op.comp = (word >> 6) & 0x7F;
+    op.value = 0;
+    op.control = word & 0x3F;
+  }
+  return op;
+}
+
+uint64_t run_counted(Machine* machine, uint64_t limit, Profile* profile);
+
+// Runs until the program halts or limit instructions have been executed,
+// and returns how many were.
+uint64_t run(Machine* machine, uint64_t limit) {
+  return run_counted(machine, limit, NULL);
+}
+
+// Like run, and also counts every instruction executed and every backward
+// jump taken in profile
+uint64_t run_profiled(Machine* machine, uint64_t limit, Profile* profile) {
+  return run_counted(machine, limit, profile);
+}
+
+// The interpreter. The registers live in locals for the length of the
+// call. It is inlined into run and run_profiled, so the profile checks
+// disappear from run.
+inline __attribute__((always_inline))
+uint64_t run_counted(Machine* machine, uint64_t limit, Profile* profile) {
+  if (machine->halted) {
+    return 0;
+  }
+  uint16_t a = machine->a;
+  uint16_t d = machine->d;
+  uint16_t pc = machine->pc;
+  uint16_t* ram = machine->ram;
+  uint8_t* dirty_rows = machine->dirty_rows;
+  const Op* rom = machine->rom;
+  uint64_t remaining = limit;
+
+#define M ram[a & ADDRESS_MASK]
+  while (remaining > 0) {
+    Op op = rom[pc];
+    uint16_t out;
+    if (profile != NULL && op.comp != OP_HALT) {
+      profile->counts[pc]++;
+    }
+    switch (op.comp) {
+      case OP_LOAD:
+        a = op.value;
+        pc = (pc + 1) & ADDRESS_MASK;
+        remaining--;
+        continue;
+      case OP_HALT:
+        a = op.value;
+        machine->halted = true;
+        limit -= remaining;
+        remaining = 0;
+        continue;
+      case 0x2A: out = 0; break;
+      case 0x3F: out = 1; break;
+      case 0x3A: out = 0xFFFF; break;
+      case 0x0C: out = d; break;
+      case 0x30: out = a; break;
+      case 0x70: out = M; break;
+      case 0x0D: out = ~d; break;
+      case 0x31: out = ~a; break;
+      case 0x71: out = ~M; break;
+      case 0x0F: out = -d; break;
+      case 0x33: out = -a; break;
+      case 0x73: out = -M; break;
+      case 0x1F: out = d + 1; break;
+      case 0x37: out = a + 1; break;
+      case 0x77: out = M + 1; break;
+      case 0x0E: out = d - 1; break;
+      case 0x32: out = a - 1; break;
+      case 0x72: out = M - 1; break;
+      case 0x02: out = d + a; break;
+      case 0x42: out = d + M; break;
+      case 0x13: out = d - a; break;
+      case 0x53: out = d - M; break;
+      case 0x07: out = a - d; break;
+      case 0x47: out = M - d; break;
+      case 0x00: out = d & a; break;
+      case 0x40: out = d & M; break;
+      case 0x15: out = d | a; break;
+      case 0x55: out = d | M; break;
+      default: out = alu(op.comp, d, a, M); break;
+    }
+    // M is written at the old A, and the jump goes to the old A
+    uint16_t target = a;
+    if (op.control & DEST_M) {
+      M = out;
+      MARK_SCREEN_WRITE(dirty_rows, a & ADDRESS_MASK);
+    }
+    if (op.control & DEST_A) {
+      a = out;
+    }
+    if (op.control & DEST_D) {
+      d = out;
+    }
+    int condition = out == 0 ? JUMP_EQ : (out & 0x8000) ? JUMP_LT : JUMP_GT;
+    uint16_t next = (op.control & condition) ? target & ADDRESS_MASK : (pc + 1) & ADDRESS_MASK;
+    if (profile != NULL && next <= pc) {
+      profile->back_edges[pc]++;
+    }
+    pc = next;
+    remaining--;
+  }
+#undef M
+
+  machine->a = a;
+  machine->d = d;
+  machine->pc = pc;
+  machine->cycles += limit;
+  return limit;
+}
+
+// The ALU for any comp field, including ones the assembler has no
+// mnemonic for. The bits are zx nx zy ny f no, with the a-bit above them.
+uint16_t alu(int comp, uint16_t d, uint16_t a, uint16_t m) {
+  uint16_t x = d;
+  uint16_t y = (comp & 0x40) ? m : a;
+  if (comp & 0x20) {
+    x = 0;
+  }
+  if (comp & 0x10) {
+    x = ~x;
+  }
+  if (comp & 0x08) {
+    y = 0;
+  }
+  if (comp & 0x04) {
+    y = ~y;
+  }
+  uint16_t out = (comp & 0x02) ? x + y : x & y;
+  return (comp & 0x01) ? ~out : out;
+}
@@ -0,0 +1,80 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The Hack computer has 32K words of ROM and a 15-bit data address space,
+// with the screen and keyboard mapped into it.
+#define ROM_WORDS 32768
+#define RAM_WORDS 32768
+#define ADDRESS_MASK 0x7FFF
+#define SCREEN 16384
+#define KBD 24576
+#define SCREEN_ROWS 256
+#define SCREEN_ROW_WORDS 32
+#define SCREEN_WORDS (SCREEN_ROWS * SCREEN_ROW_WORDS)
+
+// Marks the row of a screen word as changed. Every other address marks the
+// spare entry past the last row, so a write costs a store and no branch.
+#define MARK_SCREEN_WRITE(dirty_rows, address) \
+  do { \
+    uint16_t offset = (uint16_t) ((address) - SCREEN); \
+    (dirty_rows)[(offset < SCREEN_WORDS ? offset : SCREEN_WORDS) / SCREEN_ROW_WORDS] = 1; \
+  } while (0)
+
+// Op kinds beyond the 128 values of a C instruction's comp field
+#define OP_LOAD 0x80
+#define OP_HALT 0x81
+
+// Dest and jump bits, where they are in a C instruction
+#define DEST_A 0x20
+#define DEST_D 0x10
+#define DEST_M 0x08
+#define JUMP_LT 0x04
+#define JUMP_EQ 0x02
+#define JUMP_GT 0x01
+
+// An instruction decoded once when the ROM is loaded. comp is the 7-bit
+// comp field of a C instruction, a-bit included, or OP_LOAD for an A
+// instruction with the address in value. control holds the dest and jump
+// bits. OP_HALT marks the @n / 0;JMP loop at address n that programs end
+// with.
+typedef struct {
+  uint16_t value;
+  uint8_t comp;
+  uint8_t control;
+} Op;
+
+// Per ROM address: how many times the instruction ran, and how many times
+// it jumped backwards (to itself or an earlier address)
+typedef struct {
+  uint64_t counts[ROM_WORDS];
+  uint64_t back_edges[ROM_WORDS];
+} Profile;
+
+typedef struct {
+  uint16_t a;
+  uint16_t d;
+  uint16_t pc;
+  bool halted;
+  // instructions executed since the last reset
+  uint64_t cycles;
+  int rom_count;
+  // set when a word in the screen row is written
+  uint8_t dirty_rows[SCREEN_ROWS + 1];
+  Op rom[ROM_WORDS];
+  uint16_t ram[RAM_WORDS];
+} Machine;
+
+void Machine_init(Machine* machine);
+void Machine_reset(Machine* machine);
+void load_rom(Machine* machine, const uint16_t* words, int count);
+void unmark_halts(Machine* machine);
+int decode_rom(Op* rom, const uint16_t* words, int count);
+Op decode(uint16_t word);
+uint64_t run(Machine* machine, uint64_t limit);
+uint64_t run_profiled(Machine* machine, uint64_t limit, Profile* profile);
+uint16_t alu(int comp, uint16_t d, uint16_t a, uint16_t m);
+
+#endif
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "cache.h"
+#include "native.h"
+
+// Compiling and loading the C that the ahead of time translators write.
+//
+// Objects are kept in the cache directory as <key>-<name>.so, and one is
+// only loaded from there if the current user owns it and no one else can
+// write to it: whoever can plant an object there runs code as whoever
+// loads it. Without a cache directory an object is compiled into a
+// private temporary directory, loaded, and removed.
+//
+// The compiler is $CC, or cc, run without a shell so no path needs
+// quoting. Its source and output are temporary files made by mkstemp
+// beside the entry, and the output is renamed into place, so compiles of
+// the same entry at once never see each other's half written files.
+// Within a process, such as hacktest running scripts on threads, loads
+// take turns, so an entry is compiled once and the others find it.
+
+#define MAX_COMPILER_WORDS 32
+
+pthread_mutex_t native_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void* load_uncached(const char* name, NativeWriter writer, const void* argument,
+    const char* optimization);
+bool compile_native(NativeWriter writer, const void* argument, const char* optimization,
+    const char* path);
+bool run_compiler(const char* optimization, const char* object, const char* source);
+bool is_trusted(const char* path);
+void* open_library(const char* path);
+
+// Finds the object in the cache, compiling it first if it isn't there or
+// can't be trusted. Returns the dlopen handle, or NULL if it could not be
+// compiled or loaded.
+void* load_native(uint64_t key, const char* name, NativeWriter writer, const void* argument,
+    const char* optimization, const char* cache_dir) {
+  if (cache_dir == NULL) {
+    return load_uncached(name, writer, argument, optimization);
+  }
+  make_directories(cache_dir);
+  size_t length = strlen(cache_dir) + strlen(name) + 24;
+  char* path = malloc(length);
+  if (path == NULL) {
+    return NULL;
+  }
+  snprintf(path, length, "%s/%016llx-%s.so", cache_dir, (unsigned long long) key, name);
+  void* library = NULL;
+  pthread_mutex_lock(&native_lock);
+  if (is_trusted(path) || compile_native(writer, argument, optimization, path)) {
+    if (is_trusted(path)) {
+      library = open_library(path);
+    } else {
+      fprintf(stderr, "%s: Not loading, others could have written it\n", path);
+    }
+  }
+  pthread_mutex_unlock(&native_lock);
+  free(path);
+  return library;
+}
+
+void* load_uncached(const char* name, NativeWriter writer, const void* argument,
+    const char* optimization) {
+  const char* base = getenv("TMPDIR");
+  if (base == NULL || base[0] == '\0') {
+    base = "/tmp";
+  }
+  size_t length = strlen(base) + strlen(name) + 32;
+  char* directory = malloc(length);
+  char* path = malloc(length);
+  if (directory == NULL || path == NULL) {
+    free(directory);
+    free(path);
+    return NULL;
+  }
+  snprintf(directory, length, "%s/hackemu-XXXXXX", base);
+  void* library = NULL;
+  if (mkdtemp(directory) == NULL) {
+    fprintf(stderr, "%s: Could not make a directory to compile in\n", directory);
+  } else {
+    snprintf(path, length, "%s/%s.so", directory, name);
+    if (compile_native(writer, argument, optimization, path)) {
+      library = open_library(path);
+      remove(path);
+    }
+    rmdir(directory);
+  }
+  free(directory);
+  free(path);
+  return library;
+}
+
+// Writes the source and compiles it, then renames the object to path
+bool compile_native(NativeWriter writer, const void* argument, const char* optimization,
+    const char* path) {
+  size_t length = strlen(path) + 8;
+  char* source = malloc(length);
+  char* object = malloc(length);
+  if (source == NULL || object == NULL) {
+    free(source);
+    free(object);
+    return false;
+  }
+  snprintf(source, length, "%s.XXXXXX", path);
+  snprintf(object, length, "%s.XXXXXX", path);
+  int source_file = mkstemp(source);
+  int object_file = source_file >= 0 ? mkstemp(object) : -1;
+  if (object_file < 0) {
+    fprintf(stderr, "%s: Could not write translation\n", path);
+    if (source_file >= 0) {
+      close(source_file);
+      remove(source);
+    }
+    free(source);
+    free(object);
+    return false;
+  }
+  close(object_file);
+  FILE* file = fdopen(source_file, "w");
+  bool written = file != NULL;
+  if (written) {
+    writer(file, argument);
+    written = !ferror(file);
+    written = fclose(file) == 0 && written;
+  } else {
+    close(source_file);
+  }
+  if (!written) {
+    fprintf(stderr, "%s: Could not write translation\n", source);
+  }
+  // the object is only ever written by this user, whatever the umask says
+  bool compiled = written && run_compiler(optimization, object, source) &&
+      chmod(object, 0644) == 0 && rename(object, path) == 0;
+  if (written && !compiled) {
+    fprintf(stderr, "%s: Could not compile translation\n", source);
+  }
+  if (!compiled) {
+    remove(object);
+  }
+  remove(source);
+  free(source);
+  free(object);
+  return compiled;
+}
+
+// Runs $CC, split at spaces, as in "ccache cc", and waits for it
+bool run_compiler(const char* optimization, const char* object, const char* source) {
+  const char* compiler = getenv("CC");
+  char* words = strdup(compiler != NULL && compiler[0] != '\0' ? compiler : "cc");
+  if (words == NULL) {
+    return false;
+  }
+  char* arguments[MAX_COMPILER_WORDS + 10];
+  int count = 0;
+  char* state;
+  for (char* word = strtok_r(words, " \t", &state); word != NULL && count < MAX_COMPILER_WORDS;
+      word = strtok_r(NULL, " \t", &state)) {
+    arguments[count++] = word;
+  }
+  if (count == 0) {
+    arguments[count++] = "cc";
+  }
+  // the source has no .c, so the language is given
+  const char* options[] = {optimization, "-w", "-shared", "-fPIC", "-o", object, "-x", "c",
+      source, NULL};
+  for (int i = 0; i < 10; i++) {
+    arguments[count++] = (char*) options[i];
+  }
+  pid_t child = fork();
+  if (child == 0) {
+    execvp(arguments[0], arguments);
+    _exit(127);
+  }
+  int status = 0;
+  bool succeeded = child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+      WEXITSTATUS(status) == 0;
+  free(words);
+  return succeeded;
+}
+
+// Whether path is a file, not a link, that only the current user can
+// have written
+bool is_trusted(const char* path) {
+  int file = open(path, O_RDONLY | O_NOFOLLOW);
+  if (file < 0) {
+    return false;
+  }
+  struct stat info;
+  bool trusted = fstat(file, &info) == 0 && S_ISREG(info.st_mode) &&
+      info.st_uid == geteuid() && (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+  close(file);
+  return trusted;
+}
+
+void* open_library(const char* path) {
+  void* library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (library == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+  }
+  return library;
+}
@@ -0,0 +1,13 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Writes the C source of a native object for argument
+typedef void (*NativeWriter)(FILE* file, const void* argument);
+
+void* load_native(uint64_t key, const char* name, NativeWriter writer, const void* argument,
+    const char* optimization, const char* cache_dir);
+
+#endif
@@ -0,0 +1,810 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chips.h"
+#include "netlist.h"
+#include "program.h"
+
+// Chips nested deeper than this contain themselves
+#define MAX_DEPTH 64
+
+typedef struct {
+  ChipDefinition definition;
+  PrimitiveKind primitive;
+} LoadedChip;
+
+// A bus inside a chip being flattened: one of its pins, or a signal
+// between its parts
+typedef struct {
+  const char* name;
+  int width;
+  uint32_t bits[MAX_BUS_WIDTH];
+  bool input;
+} Wire;
+
+// While a chip is flattened, every pin and internal signal gets its own
+// signal number. Connecting an output to one makes the output's signal
+// its source, so each signal stands for its source once they are resolved.
+typedef struct {
+  Netlist* netlist;
+  uint32_t* sources;
+  bool* driven;
+  uint32_t signal_capacity;
+  LoadedChip** chips;
+  int chip_count;
+  char* chip_directory;
+  const char** directories;
+  int directory_count;
+  int gate_capacity;
+  int flip_flop_capacity;
+  int memory_capacity;
+  int part_capacity;
+  char* error;
+  size_t error_size;
+  bool failed;
+} Builder;
+
+void start_builder(Builder* builder, Netlist* netlist, char* error, size_t error_size);
+bool finish_builder(Builder* builder, bool valid);
+bool flatten(Builder* builder, LoadedChip* top);
+LoadedChip* load_chip(Builder* builder, const char* name, const char* path, int line);
+bool read_chip_file(Builder* builder, const char* path, ChipDefinition* definition);
+bool instantiate(Builder* builder, const LoadedChip* chip, uint32_t (*inputs)[MAX_BUS_WIDTH],
+    uint32_t (*outputs)[MAX_BUS_WIDTH], int depth);
+bool instantiate_primitive(Builder* builder, const LoadedChip* chip,
+    uint32_t (*inputs)[MAX_BUS_WIDTH], uint32_t (*outputs)[MAX_BUS_WIDTH]);
+bool instantiate_part(Builder* builder, const ChipDefinition* chip, const Part* part,
+    Wire* wires, int wire_count, int depth);
+bool declare_internal_wires(Builder* builder, const ChipDefinition* chip, Wire** wires,
+    int* wire_count);
+Wire* find_wire(Wire* wires, int count, const char* name);
+void add_part_port(Builder* builder, const LoadedChip* chip, uint32_t* bits);
+uint32_t new_signal(Builder* builder, bool driven);
+uint32_t find_source(Builder* builder, uint32_t signal);
+bool connect_signal(Builder* builder, uint32_t signal, uint32_t source, const char* path, int line,
+    const char* name);
+bool resolve_signals(Builder* builder);
+bool levelize(Builder* builder);
+void* grow_array(void* array, int count, int* capacity, size_t size);
+bool build_error(Builder* builder, const char* path, int line, const char* format, ...);
+
+// Flattens the chip in path. Parts are looked for first in the chip's own
+// directory, then in directories, then in the built-in library.
+bool build_netlist(Netlist* netlist, const char* path, const char** directories,
+    int directory_count, char* error, size_t error_size) {
+  Builder builder;
+  start_builder(&builder, netlist, error, error_size);
+  builder.directories = directories;
+  builder.directory_count = directory_count;
+  const char* slash = strrchr(path, '/');
+  builder.chip_directory = slash != NULL ? strndup(path, slash - path) : strdup(".");
+  LoadedChip* top = malloc(sizeof(LoadedChip));
+  top->primitive = PRIMITIVE_NONE;
+  if (!read_chip_file(&builder, path, &top->definition)) {
+    free(top);
+    return finish_builder(&builder, false);
+  }
+  return finish_builder(&builder, flatten(&builder, top));
+}
+
+// Flattens the built-in chip called name, made of nothing but the library
+bool build_library_netlist(Netlist* netlist, const char* name, char* error,
+    size_t error_size) {
+  Builder builder;
+  start_builder(&builder, netlist, error, error_size);
+  LoadedChip* top = load_chip(&builder, name, "<builtin>", 0);
+  return finish_builder(&builder, top != NULL && flatten(&builder, top));
+}
+
+void start_builder(Builder* builder, Netlist* netlist, char* error, size_t error_size) {
+  memset(netlist, 0, sizeof(Netlist));
+  memset(builder, 0, sizeof(Builder));
+  builder->netlist = netlist;
+  builder->error = error;
+  builder->error_size = error_size;
+  new_signal(builder, true);
+  new_signal(builder, true);
+}
+
+bool finish_builder(Builder* builder, bool valid) {
+  for (int i = 0; i < builder->chip_count; i++) {
+    ChipDefinition_free(&builder->chips[i]->definition);
+    free(builder->chips[i]);
+  }
+  free(builder->chips);
+  free(builder->chip_directory);
+  free(builder->sources);
+  free(builder->driven);
+  if (!valid) {
+    Netlist_free(builder->netlist);
+  }
+  return valid;
+}
+
+// Adds the top chip, with a signal for each bit of its inputs, then sorts
+// the gates and numbers the signals
+bool flatten(Builder* builder, LoadedChip* top) {
+  Netlist* netlist = builder->netlist;
+  if (builder->chip_count == 0 || builder->chips[builder->chip_count - 1] != top) {
+    builder->chips = realloc(builder->chips, (builder->chip_count + 1) * sizeof(LoadedChip*));
+    builder->chips[builder->chip_count++] = top;
+  }
+  const ChipDefinition* definition = &top->definition;
+  netlist->name = strdup(definition->name);
+  netlist->input_count = definition->input_count;
+  netlist->output_count = definition->output_count;
+  netlist->inputs = calloc(definition->input_count + 1, sizeof(Port));
+  netlist->outputs = calloc(definition->output_count + 1, sizeof(Port));
+  uint32_t (*inputs)[MAX_BUS_WIDTH] = calloc(definition->input_count + 1, sizeof(*inputs));
+  uint32_t (*outputs)[MAX_BUS_WIDTH] = calloc(definition->output_count + 1, sizeof(*outputs));
+  for (int i = 0; i < definition->input_count; i++) {
+    for (int bit = 0; bit < definition->inputs[i].width; bit++) {
+      inputs[i][bit] = new_signal(builder, true);
+    }
+  }
+  bool valid = instantiate(builder, top, inputs, outputs, 0);
+  for (int i = 0; i < definition->input_count; i++) {
+    Port* port = &netlist->inputs[i];
+    *port = (Port) {strdup(definition->inputs[i].name), definition->inputs[i].width, {0}, -1};
+    memcpy(port->bits, inputs[i], sizeof(port->bits));
+  }
+  for (int i = 0; i < definition->output_count; i++) {
+    Port* port = &netlist->outputs[i];
+    *port = (Port) {strdup(definition->outputs[i].name), definition->outputs[i].width, {0}, -1};
+    memcpy(port->bits, outputs[i], sizeof(port->bits));
+  }
+  free(inputs);
+  free(outputs);
+  valid = valid && resolve_signals(builder) && levelize(builder);
+  if (valid) {
+    renumber_signals(netlist);
+  }
+  return valid;
+}
+
+void Netlist_free(Netlist* netlist) {
+  for (int i = 0; i < netlist->memory_count; i++) {
+    free(netlist->memories[i].name);
+  }
+  for (int i = 0; i < netlist->input_count; i++) {
+    free(netlist->inputs[i].name);
+  }
+  for (int i = 0; i < netlist->output_count; i++) {
+    free(netlist->outputs[i].name);
+  }
+  for (int i = 0; i < netlist->part_count; i++) {
+    free(netlist->parts[i].name);
+  }
+  free(netlist->name);
+  free(netlist->gates);
+  free(netlist->flip_flops);
+  free(netlist->memories);
+  free(netlist->inputs);
+  free(netlist->outputs);
+  free(netlist->parts);
+  memset(netlist, 0, sizeof(Netlist));
+}
+
+// Returns the port whose name is the first length characters of name, or
+// NULL
+const Port* find_port(const Port* ports, int count, const char* name, int length) {
+  for (int i = 0; i < count; i++) {
+    if (strncmp(ports[i].name, name, length) == 0 && ports[i].name[length] == '\0') {
+      return &ports[i];
+    }
+  }
+  return NULL;
+}
+
+// Whether the chip's outputs depend on nothing but its inputs, so that
+// every set of inputs can be evaluated on its own
+bool is_combinational(const Netlist* netlist) {
+  return netlist->flip_flop_count == 0 && netlist->memory_count == 0;
+}
+
+// Returns the chip called name, reading it the first time it is used by a
+// part at line of the chip in path
+LoadedChip* load_chip(Builder* builder, const char* name, const char* path, int line) {
+  for (int i = 0; i < builder->chip_count; i++) {
+    if (strcmp(builder->chips[i]->definition.name, name) == 0) {
+      return builder->chips[i];
+    }
+  }
+  ChipDefinition definition;
+  bool found = false;
+  for (int i = -1; i < builder->directory_count && !found && !builder->failed; i++) {
+    const char* directory = i < 0 ? builder->chip_directory : builder->directories[i];
+    if (directory == NULL) {
+      continue;
+    }
+    size_t length = strlen(directory) + strlen(name) + 6;
+    char* file = malloc(length);
+    snprintf(file, length, "%s/%s.hdl", directory, name);
+    FILE* handle = fopen(file, "r");
+    if (handle != NULL) {
+      fclose(handle);
+      found = read_chip_file(builder, file, &definition);
+    }
+    free(file);
+  }
+  if (builder->failed) {
+    return NULL;
+  }
+  // a chip that says it is built in is replaced by the library's
+  if (found && definition.builtin != NULL) {
+    char* builtin = strdup(definition.builtin);
+    ChipDefinition_free(&definition);
+    found = builtin_chip(builtin, &definition);
+    free(builtin);
+  } else if (!found) {
+    found = builtin_chip(name, &definition);
+  }
+  if (!found) {
+    build_error(builder, path, line, "there is no chip called %s", name);
+    return NULL;
+  }
+  LoadedChip* chip = malloc(sizeof(LoadedChip));
+  chip->definition = definition;
+  chip->primitive = definition.builtin != NULL ? primitive_kind(definition.builtin) :
+      PRIMITIVE_NONE;
+  if (strcmp(definition.name, name) != 0) {
+    free(chip->definition.name);
+    chip->definition.name = strdup(name);
+  }
+  builder->chips = realloc(builder->chips, (builder->chip_count + 1) * sizeof(LoadedChip*));
+  builder->chips[builder->chip_count++] = chip;
+  return chip;
+}
+
+bool read_chip_file(Builder* builder, const char* path, ChipDefinition* definition) {
+  size_t size;
+  char* source = read_file(path, &size);
+  if (source == NULL) {
+    return build_error(builder, path, 0, "could not open file");
+  }
+  bool valid = parse_chip(source, path, definition, builder->error, builder->error_size);
+  free(source);
+  builder->failed |= !valid;
+  return valid;
+}
+
+// Adds the gates of one instance of chip, whose input pins carry the
+// signals in inputs. Sets outputs to the signals of its output pins.
+bool instantiate(Builder* builder, const LoadedChip* chip, uint32_t (*inputs)[MAX_BUS_WIDTH],
+    uint32_t (*outputs)[MAX_BUS_WIDTH], int depth) {
+  const ChipDefinition* definition = &chip->definition;
+  if (depth > MAX_DEPTH) {
+    return build_error(builder, definition->path, 0, "%s contains itself", definition->name);
+  }
+  if (chip->primitive != PRIMITIVE_NONE) {
+    return instantiate_primitive(builder, chip, inputs, outputs);
+  } else if (definition->builtin != NULL) {
+    return build_error(builder, definition->path, 0, "there is no built-in chip called %s",
+        definition->builtin);
+  }
+  int wire_count = definition->input_count + definition->output_count;
+  Wire* wires = malloc(wire_count * sizeof(Wire));
+  for (int i = 0; i < definition->input_count; i++) {
+    wires[i] = (Wire) {definition->inputs[i].name, definition->inputs[i].width, {0}, true};
+    memcpy(wires[i].bits, inputs[i], sizeof(wires[i].bits));
+  }
+  for (int i = 0; i < definition->output_count; i++) {
+    Wire* wire = &wires[definition->input_count + i];
+    *wire = (Wire) {definition->outputs[i].name, definition->outputs[i].width, {0}, false};
+    for (int bit = 0; bit < wire->width; bit++) {
+      wire->bits[bit] = new_signal(builder, false);
+    }
+  }
+  bool valid = declare_internal_wires(builder, definition, &wires, &wire_count);
+  for (int i = 0; valid && i < definition->part_count; i++) {
+    valid = instantiate_part(builder, definition, &definition->parts[i], wires, wire_count,
+        depth);
+  }
+  for (int i = 0; i < definition->output_count; i++) {
+    memcpy(outputs[i], wires[definition->input_count + i].bits, sizeof(outputs[i]));
+  }
+  free(wires);
+  return valid;
+}
+
+// Nand gates, flip-flops and memories are added as they are
+bool instantiate_primitive(Builder* builder, const LoadedChip* chip,
+    uint32_t (*inputs)[MAX_BUS_WIDTH], uint32_t (*outputs)[MAX_BUS_WIDTH]) {
+  Netlist* netlist = builder->netlist;
+  const ChipDefinition* definition = &chip->definition;
+  if (chip->primitive == PRIMITIVE_NAND) {
+    netlist->gates = grow_array(netlist->gates, netlist->gate_count, &builder->gate_capacity,
+        sizeof(NandGate));
+    outputs[0][0] = new_signal(builder, true);
+    netlist->gates[netlist->gate_count++] = (NandGate) {inputs[0][0], inputs[1][0],
+        outputs[0][0]};
+    return true;
+  } else if (chip->primitive == PRIMITIVE_DFF) {
+    netlist->flip_flops = grow_array(netlist->flip_flops, netlist->flip_flop_count,
+        &builder->flip_flop_capacity, sizeof(FlipFlop));
+    outputs[0][0] = new_signal(builder, true);
+    netlist->flip_flops[netlist->flip_flop_count++] = (FlipFlop) {inputs[0][0], outputs[0][0]};
+    return true;
+  }
+  netlist->memories = grow_array(netlist->memories, netlist->memory_count,
+      &builder->memory_capacity, sizeof(MemoryPart));
+  MemoryPart* memory = &netlist->memories[netlist->memory_count];
+  memset(memory, 0, sizeof(MemoryPart));
+  memory->name = strdup(definition->name);
+  for (int bit = 0; bit < 16; bit++) {
+    memory->out[bit] = outputs[0][bit] = new_signal(builder, true);
+  }
+  if (chip->primitive == PRIMITIVE_RAM) {
+    memory->kind = MEMORY_RAM;
+    memcpy(memory->in, inputs[0], sizeof(memory->in));
+    memory->load = inputs[1][0];
+    memory->address_bits = definition->inputs[2].width;
+    memcpy(memory->address, inputs[2], memory->address_bits * sizeof(uint32_t));
+  } else if (chip->primitive == PRIMITIVE_ROM) {
+    memory->kind = MEMORY_ROM;
+    memory->address_bits = definition->inputs[0].width;
+    memcpy(memory->address, inputs[0], memory->address_bits * sizeof(uint32_t));
+  } else {
+    memory->kind = MEMORY_KEYBOARD;
+  }
+  netlist->memory_count++;
+  return true;
+}
+
+// Connects a part's inputs to the wires they name, adds it, and connects
+// the wires its outputs name to its outputs
+bool instantiate_part(Builder* builder, const ChipDefinition* chip, const Part* part,
+    Wire* wires, int wire_count, int depth) {
+  const LoadedChip* part_chip = load_chip(builder, part->chip, chip->path, part->line);
+  if (part_chip == NULL) {
+    return false;
+  }
+  const ChipDefinition* definition = &part_chip->definition;
+  uint32_t (*inputs)[MAX_BUS_WIDTH] = calloc(definition->input_count + 1, sizeof(*inputs));
+  uint32_t (*outputs)[MAX_BUS_WIDTH] = calloc(definition->output_count + 1, sizeof(*outputs));
+  bool valid = true;
+  for (int pass = 0; pass < 2 && valid; pass++) {
+    // inputs are connected before the part is added, outputs after
+    for (int i = 0; i < part->connection_count && valid; i++) {
+      const Connection* connection = &part->connections[i];
+      bool input;
+      const PinDeclaration* pin = find_pin(definition, connection->pin, &input);
+      if (pin == NULL) {
+        valid = build_error(builder, chip->path, connection->line, "%s has no pin called %s",
+            part->chip, connection->pin);
+        break;
+      }
+      if (input != (pass == 0)) {
+        continue;
+      }
+      int pin_first = connection->pin_first >= 0 ? connection->pin_first : 0;
+      int pin_last = connection->pin_first >= 0 ? connection->pin_last : pin->width - 1;
+      if (pin_last >= pin->width) {
+        valid = build_error(builder, chip->path, connection->line, "%s is only %i bits wide",
+            pin->name, pin->width);
+        break;
+      }
+      int index = input ? pin - definition->inputs : pin - definition->outputs;
+      uint32_t* bits = input ? inputs[index] : outputs[index];
+      bool constant = strcmp(connection->signal, "true") == 0 ||
+          strcmp(connection->signal, "false") == 0;
+      if (constant && input) {
+        uint32_t value = connection->signal[0] == 't' ? SIGNAL_TRUE : SIGNAL_FALSE;
+        for (int bit = pin_first; bit <= pin_last; bit++) {
+          bits[bit] = value;
+        }
+        continue;
+      }
+      Wire* wire = constant ? NULL : find_wire(wires, wire_count, connection->signal);
+      if (wire == NULL) {
+        valid = build_error(builder, chip->path, connection->line,
+            constant ? "%s cannot be an output" : "%s has no source", connection->signal);
+        break;
+      } else if (!input && wire->input) {
+        valid = build_error(builder, chip->path, connection->line,
+            "%s is an input of %s and cannot be an output", wire->name, chip->name);
+        break;
+      }
+      int signal_first = connection->signal_first >= 0 ? connection->signal_first : 0;
+      int signal_last = connection->signal_first >= 0 ? connection->signal_last :
+          wire->width - 1;
+      if (signal_last >= wire->width || signal_last - signal_first != pin_last - pin_first) {
+        valid = build_error(builder, chip->path, connection->line,
+            "%s and %s are not the same width", connection->pin, connection->signal);
+        break;
+      }
+      for (int bit = 0; bit <= pin_last - pin_first && valid; bit++) {
+        if (input) {
+          bits[pin_first + bit] = wire->bits[signal_first + bit];
+        } else {
+          valid = connect_signal(builder, wire->bits[signal_first + bit], bits[pin_first + bit],
+              chip->path, connection->line, wire->name);
+        }
+      }
+    }
+    if (pass == 0 && valid) {
+      valid = instantiate(builder, part_chip, inputs, outputs, depth + 1);
+      if (valid) {
+        add_part_port(builder, part_chip, outputs[0]);
+      }
+    }
+  }
+  free(inputs);
+  free(outputs);
+  return valid;
+}
+
+// Adds a wire for each signal between the parts. Its width is that of
+// the part output which drives it.
+bool declare_internal_wires(Builder* builder, const ChipDefinition* chip, Wire** wires,
+    int* wire_count) {
+  int capacity = *wire_count;
+  for (int i = 0; i < chip->part_count; i++) {
+    const Part* part = &chip->parts[i];
+    const LoadedChip* part_chip = load_chip(builder, part->chip, chip->path, part->line);
+    if (part_chip == NULL) {
+      return false;
+    }
+    for (int j = 0; j < part->connection_count; j++) {
+      const Connection* connection = &part->connections[j];
+      bool input;
+      const PinDeclaration* pin = find_pin(&part_chip->definition, connection->pin, &input);
+      if (pin == NULL || input) {
+        continue;
+      }
+      int width = connection->pin_first >= 0 ?
+          connection->pin_last - connection->pin_first + 1 : pin->width;
+      Wire* wire = find_wire(*wires, *wire_count, connection->signal);
+      if (wire == NULL) {
+        if (connection->signal_first >= 0) {
+          return build_error(builder, chip->path, connection->line,
+              "%s is not a pin of %s, so it cannot be split", connection->signal, chip->name);
+        }
+        *wires = grow_array(*wires, *wire_count, &capacity, sizeof(Wire));
+        wire = &(*wires)[(*wire_count)++];
+        *wire = (Wire) {connection->signal, width, {0}, false};
+        for (int bit = 0; bit < width; bit++) {
+          wire->bits[bit] = new_signal(builder, false);
+        }
+      } else if (wire->width != width && connection->signal_first < 0 &&
+          wire - *wires >= chip->input_count + chip->output_count) {
+        return build_error(builder, chip->path, connection->line,
+            "%s is driven with different widths", connection->signal);
+      }
+    }
+  }
+  return true;
+}
+
+Wire* find_wire(Wire* wires, int count, const char* name) {
+  for (int i = 0; i < count; i++) {
+    if (strcmp(wires[i].name, name) == 0) {
+      return &wires[i];
+    }
+  }
+  return NULL;
+}
+
+// Keeps the outputs of the first instance of each chip, so that scripts
+// can print the registers and memories inside a chip
+void add_part_port(Builder* builder, const LoadedChip* chip, uint32_t* bits) {
+  Netlist* netlist = builder->netlist;
+  const ChipDefinition* definition = &chip->definition;
+  if (definition->output_count == 0 ||
+      find_port(netlist->parts, netlist->part_count, definition->name,
+      strlen(definition->name)) != NULL) {
+    return;
+  }
+  netlist->parts = grow_array(netlist->parts, netlist->part_count, &builder->part_capacity,
+      sizeof(Port));
+  Port* port = &netlist->parts[netlist->part_count++];
+  *port = (Port) {strdup(definition->name), definition->outputs[0].width, {0}, -1};
+  memcpy(port->bits, bits, sizeof(port->bits));
+  if (chip->primitive == PRIMITIVE_RAM || chip->primitive == PRIMITIVE_ROM ||
+      chip->primitive == PRIMITIVE_KEYBOARD) {
+    port->memory = netlist->memory_count - 1;
+  }
+}
+
+uint32_t new_signal(Builder* builder, bool driven) {
+  Netlist* netlist = builder->netlist;
+  if (netlist->signal_count == builder->signal_capacity) {
+    builder->signal_capacity = builder->signal_capacity == 0 ? 1024 :
+        builder->signal_capacity * 2;
+    builder->sources = realloc(builder->sources, builder->signal_capacity * sizeof(uint32_t));
+    builder->driven = realloc(builder->driven, builder->signal_capacity * sizeof(bool));
+  }
+  uint32_t signal = netlist->signal_count++;
+  builder->sources[signal] = signal;
+  builder->driven[signal] = driven;
+  return signal;
+}
+
+uint32_t find_source(Builder* builder, uint32_t signal) {
+  uint32_t* sources = builder->sources;
+  while (sources[signal] != signal) {
+    sources[signal] = sources[sources[signal]];
+    signal = sources[signal];
+  }
+  return signal;
+}
+
+// Makes source drive signal, which must not have a source yet
+bool connect_signal(Builder* builder, uint32_t signal, uint32_t source, const char* path, int line,
+    const char* name) {
+  signal = find_source(builder, signal);
+  source = find_source(builder, source);
+  if (signal == source) {
+    return true;
+  } else if (builder->driven[signal]) {
+    return build_error(builder, path, line, "%s has more than one source", name);
+  }
+  builder->sources[signal] = source;
+  return true;
+}
+
+// Replaces every signal with its source. Signals that nothing drives, such
+// as the outputs of a chip with no parts, are false.
+bool resolve_signals(Builder* builder) {
+  Netlist* netlist = builder->netlist;
+  for (uint32_t i = 0; i < netlist->signal_count; i++) {
+    uint32_t source = find_source(builder, i);
+    builder->sources[i] = builder->driven[source] ? source : SIGNAL_FALSE;
+  }
+  uint32_t* sources = builder->sources;
+  for (int i = 0; i < netlist->gate_count; i++) {
+    NandGate* gate = &netlist->gates[i];
+    gate->a = sources[gate->a];
+    gate->b = sources[gate->b];
+  }
+  for (int i = 0; i < netlist->flip_flop_count; i++) {
+    netlist->flip_flops[i].in = sources[netlist->flip_flops[i].in];
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    MemoryPart* memory = &netlist->memories[i];
+    for (int bit = 0; bit < 16; bit++) {
+      memory->in[bit] = sources[memory->in[bit]];
+    }
+    for (int bit = 0; bit < memory->address_bits; bit++) {
+      memory->address[bit] = sources[memory->address[bit]];
+    }
+    memory->load = sources[memory->load];
+  }
+  Port* port_lists[] = {netlist->inputs, netlist->outputs, netlist->parts};
+  int port_counts[] = {netlist->input_count, netlist->output_count, netlist->part_count};
+  for (int list = 0; list < 3; list++) {
+    for (int i = 0; i < port_counts[list]; i++) {
+      for (int bit = 0; bit < port_lists[list][i].width; bit++) {
+        port_lists[list][i].bits[bit] = sources[port_lists[list][i].bits[bit]];
+      }
+    }
+  }
+  return true;
+}
+
+// Sorts the gates by level. A memory's out is read once every gate below
+// its level has run, so it gets the level after its address.
+bool levelize(Builder* builder) {
+  Netlist* netlist = builder->netlist;
+  int node_count = netlist->gate_count + netlist->memory_count;
+  // the gate or memory that drives each signal, or -1
+  int* drivers = malloc(netlist->signal_count * sizeof(int));
+  for (uint32_t i = 0; i < netlist->signal_count; i++) {
+    drivers[i] = -1;
+  }
+  for (int i = 0; i < netlist->gate_count; i++) {
+    drivers[netlist->gates[i].out] = i;
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    if (netlist->memories[i].kind != MEMORY_KEYBOARD) {
+      for (int bit = 0; bit < 16; bit++) {
+        drivers[netlist->memories[i].out[bit]] = netlist->gate_count + i;
+      }
+    }
+  }
+  // levels of 0 are not known yet, and -1 marks a node being visited
+  int* levels = calloc(node_count + 1, sizeof(int));
+  int* stack = malloc((node_count + 1) * sizeof(int));
+  bool valid = true;
+  for (int root = 0; root < node_count && valid; root++) {
+    if (levels[root] != 0) {
+      continue;
+    }
+    int depth = 0;
+    stack[depth++] = root;
+    levels[root] = -1;
+    while (depth > 0 && valid) {
+      int node = stack[depth - 1];
+      uint32_t inputs[2];
+      const uint32_t* reads = inputs;
+      int read_count = 2;
+      if (node < netlist->gate_count) {
+        inputs[0] = netlist->gates[node].a;
+        inputs[1] = netlist->gates[node].b;
+      } else {
+        reads = netlist->memories[node - netlist->gate_count].address;
+        read_count = netlist->memories[node - netlist->gate_count].address_bits;
+      }
+      int level = 1;
+      bool ready = true;
+      for (int i = 0; i < read_count; i++) {
+        int driver = drivers[reads[i]];
+        if (driver < 0) {
+          continue;
+        } else if (levels[driver] == -1) {
+          valid = build_error(builder, netlist->name, 0, "a loop of gates has no DFF in it");
+          break;
+        } else if (levels[driver] == 0) {
+          levels[driver] = -1;
+          stack[depth++] = driver;
+          ready = false;
+          break;
+        } else if (levels[driver] + 1 > level) {
+          level = levels[driver] + 1;
+        }
+      }
+      if (ready && valid) {
+        levels[node] = level;
+        depth--;
+      }
+    }
+  }
+  if (valid) {
+    sort_by_level(netlist, levels);
+  }
+  free(drivers);
+  free(levels);
+  free(stack);
+  return valid;
+}
+
+// Sorts the gates by level, keeping those of a level in order, and puts
+// each memory before the first gate of its level. levels has the gates'
+// levels and then the memories'.
+void sort_by_level(Netlist* netlist, const int* levels) {
+  int node_count = netlist->gate_count + netlist->memory_count;
+  // a counting sort by level, which keeps gates of a level in order
+  int max_level = 0;
+  for (int i = 0; i < node_count; i++) {
+    max_level = levels[i] > max_level ? levels[i] : max_level;
+  }
+  int* starts = calloc(max_level + 2, sizeof(int));
+  for (int i = 0; i < netlist->gate_count; i++) {
+    starts[levels[i] + 1]++;
+  }
+  for (int level = 0; level <= max_level; level++) {
+    starts[level + 1] += starts[level];
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    MemoryPart* memory = &netlist->memories[i];
+    memory->position = memory->kind == MEMORY_KEYBOARD ? 0 :
+        starts[levels[netlist->gate_count + i]];
+  }
+  NandGate* sorted = malloc((netlist->gate_count + 1) * sizeof(NandGate));
+  for (int i = 0; i < netlist->gate_count; i++) {
+    sorted[starts[levels[i]]++] = netlist->gates[i];
+  }
+  free(netlist->gates);
+  netlist->gates = sorted;
+  netlist->levels = max_level;
+  free(starts);
+  // memories are read in the order of their positions
+  int* order = malloc((netlist->memory_count + 1) * sizeof(int));
+  int* indices = malloc((netlist->memory_count + 1) * sizeof(int));
+  for (int i = 0; i < netlist->memory_count; i++) {
+    int j = i;
+    for (; j > 0 && netlist->memories[order[j - 1]].position >
+        netlist->memories[i].position; j--) {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+  }
+  MemoryPart* memories = malloc((netlist->memory_count + 1) * sizeof(MemoryPart));
+  for (int i = 0; i < netlist->memory_count; i++) {
+    memories[i] = netlist->memories[order[i]];
+    indices[order[i]] = i;
+  }
+  for (int i = 0; i < netlist->part_count; i++) {
+    if (netlist->parts[i].memory >= 0) {
+      netlist->parts[i].memory = indices[netlist->parts[i].memory];
+    }
+  }
+  free(netlist->memories);
+  netlist->memories = memories;
+  free(order);
+  free(indices);
+}
+
+// Numbers the signals again, without the ones that were only pins, so
+// that a gate's output is next to those of the gates before it
+void renumber_signals(Netlist* netlist) {
+  uint32_t* numbers = malloc(netlist->signal_count * sizeof(uint32_t));
+  for (uint32_t i = 0; i < netlist->signal_count; i++) {
+    numbers[i] = UINT32_MAX;
+  }
+  numbers[SIGNAL_FALSE] = SIGNAL_FALSE;
+  numbers[SIGNAL_TRUE] = SIGNAL_TRUE;
+  uint32_t count = 2;
+  for (int i = 0; i < netlist->input_count; i++) {
+    for (int bit = 0; bit < netlist->inputs[i].width; bit++) {
+      if (numbers[netlist->inputs[i].bits[bit]] == UINT32_MAX) {
+        numbers[netlist->inputs[i].bits[bit]] = count++;
+      }
+    }
+  }
+  for (int i = 0; i < netlist->flip_flop_count; i++) {
+    numbers[netlist->flip_flops[i].out] = count++;
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    for (int bit = 0; bit < 16; bit++) {
+      numbers[netlist->memories[i].out[bit]] = count++;
+    }
+  }
+  for (int i = 0; i < netlist->gate_count; i++) {
+    numbers[netlist->gates[i].out] = count++;
+  }
+  // a signal that is never driven was resolved to false already
+  for (uint32_t i = 0; i < netlist->signal_count; i++) {
+    if (numbers[i] == UINT32_MAX) {
+      numbers[i] = SIGNAL_FALSE;
+    }
+  }
+  for (int i = 0; i < netlist->gate_count; i++) {
+    NandGate* gate = &netlist->gates[i];
+    *gate = (NandGate) {numbers[gate->a], numbers[gate->b], numbers[gate->out]};
+  }
+  for (int i = 0; i < netlist->flip_flop_count; i++) {
+    FlipFlop* flip_flop = &netlist->flip_flops[i];
+    *flip_flop = (FlipFlop) {numbers[flip_flop->in], numbers[flip_flop->out]};
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    MemoryPart* memory = &netlist->memories[i];
+    for (int bit = 0; bit < 16; bit++) {
+      memory->in[bit] = numbers[memory->in[bit]];
+      memory->out[bit] = numbers[memory->out[bit]];
+    }
+    for (int bit = 0; bit < memory->address_bits; bit++) {
+      memory->address[bit] = numbers[memory->address[bit]];
+    }
+    memory->load = numbers[memory->load];
+  }
+  Port* port_lists[] = {netlist->inputs, netlist->outputs, netlist->parts};
+  int port_counts[] = {netlist->input_count, netlist->output_count, netlist->part_count};
+  for (int list = 0; list < 3; list++) {
+    for (int i = 0; i < port_counts[list]; i++) {
+      for (int bit = 0; bit < port_lists[list][i].width; bit++) {
+        port_lists[list][i].bits[bit] = numbers[port_lists[list][i].bits[bit]];
+      }
+    }
+  }
+  netlist->signal_count = count;
+  free(numbers);
+}
+
+// Makes room for one more element, doubling the capacity when it is full
+void* grow_array(void* array, int count, int* capacity, size_t size) {
+  if (count < *capacity) {
+    return array;
+  }
+  *capacity = *capacity == 0 ? 16 : *capacity * 2;
+  return realloc(array, *capacity * size);
+}
+
+// Records the first error. Always returns false.
+bool build_error(Builder* builder, const char* path, int line, const char* format, ...) {
+  if (builder->failed) {
+    return false;
+  }
+  builder->failed = true;
+  int length = line > 0 ?
+      snprintf(builder->error, builder->error_size, "%s:%i: ", path, line) :
+      snprintf(builder->error, builder->error_size, "%s: ", path);
+  if (length >= 0 && (size_t) length < builder->error_size) {
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(builder->error + length, builder->error_size - length, format, arguments);
+    va_end(arguments);
+  }
+  return false;
+}
@@ -0,0 +1,82 @@
+#ifndef NETLIST_H
+#define NETLIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hdl.h"
+
+// Signals 0 and 1 are the constants false and true
+#define SIGNAL_FALSE 0
+#define SIGNAL_TRUE 1
+
+typedef struct {
+  uint32_t a;
+  uint32_t b;
+  uint32_t out;
+} NandGate;
+
+typedef struct {
+  uint32_t in;
+  uint32_t out;
+} FlipFlop;
+
+typedef enum {MEMORY_RAM, MEMORY_ROM, MEMORY_KEYBOARD} MemoryKind;
+
+// A RAM, the ROM or the keyboard, which are simulated whole rather than
+// as gates. Its out is read from the address before gate position runs,
+// and a RAM writes in at address on the clock when load is set.
+typedef struct {
+  MemoryKind kind;
+  char* name;
+  int address_bits;
+  uint32_t in[16];
+  uint32_t load;
+  uint32_t address[15];
+  uint32_t out[16];
+  int position;
+} MemoryPart;
+
+// Pins that scripts can set and print: the chip's own, and for each chip
+// used as a part, the outputs of its first instance, which scripts name
+// as ARegister[] or RAM16K[5]. memory is the part's index in memories,
+// or -1.
+typedef struct {
+  char* name;
+  int width;
+  uint32_t bits[MAX_BUS_WIDTH];
+  int memory;
+} Port;
+
+// A chip flattened to Nand gates and flip-flops. The gates are sorted by
+// level, the longest path from a flip-flop, memory or input of the chip to
+// the gate, so each one runs after every gate it reads.
+typedef struct {
+  char* name;
+  uint32_t signal_count;
+  NandGate* gates;
+  int gate_count;
+  FlipFlop* flip_flops;
+  int flip_flop_count;
+  MemoryPart* memories;
+  int memory_count;
+  int levels;
+  Port* inputs;
+  int input_count;
+  Port* outputs;
+  int output_count;
+  Port* parts;
+  int part_count;
+} Netlist;
+
+bool build_netlist(Netlist* netlist, const char* path, const char** directories,
+    int directory_count, char* error, size_t error_size);
+bool build_library_netlist(Netlist* netlist, const char* name, char* error,
+    size_t error_size);
+void Netlist_free(Netlist* netlist);
+const Port* find_port(const Port* ports, int count, const char* name, int length);
+bool is_combinational(const Netlist* netlist);
+void sort_by_level(Netlist* netlist, const int* levels);
+void renumber_signals(Netlist* netlist);
+
+#endif
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimize.h"
+
+uint32_t lookup_gate(uint32_t* table, uint32_t mask, const NandGate* gates, uint32_t a,
+    uint32_t b, uint32_t gate);
+void replace_signals(Netlist* netlist, const uint32_t* same);
+void drop_dead_gates(const Netlist* netlist, bool* kept);
+void keep_gates(Netlist* netlist, const bool* kept);
+
+void optimize_netlist(Netlist* netlist) {
+  bool* kept = calloc(netlist->gate_count + 1, sizeof(bool));
+  uint32_t* same = fold_gates(netlist, netlist->gates, kept);
+  replace_signals(netlist, same);
+  drop_dead_gates(netlist, kept);
+  keep_gates(netlist, kept);
+  renumber_signals(netlist);
+  free(same);
+  free(kept);
+}
+
+// Goes through the gates in order, finding for each signal the one it is
+// the same as, which is the signal itself unless its gate was folded or
+// merged. A gate with a false input is true, one with a true input is a
+// Not of the other, the Not of a Not is what it negates, a gate that Nands
+// a signal and its Not is true, and a gate that Nands what an earlier one
+// does equals it. Each gate that is left is marked in kept and written to
+// folded, which may be the netlist's own gates, reading the signals its
+// inputs are the same as, the lower one first. Signals keep their numbers.
+uint32_t* fold_gates(const Netlist* netlist, NandGate* folded, bool* kept) {
+  uint32_t* same = malloc(netlist->signal_count * sizeof(uint32_t));
+  for (uint32_t i = 0; i < netlist->signal_count; i++) {
+    same[i] = i;
+  }
+  // the gates by their inputs, as indices in gates plus one
+  uint32_t size = 1;
+  while (size < 2 * (uint32_t) netlist->gate_count + 2) {
+    size *= 2;
+  }
+  uint32_t* table = calloc(size, sizeof(uint32_t));
+  // for the output of a Not, what it negates, or SIGNAL_FALSE
+  uint32_t* negates = calloc(netlist->signal_count, sizeof(uint32_t));
+  // the pins of parts, which between the tick and the tock show a flip-flop's
+  // next state, so one that a gate drives can't become a flip-flop's output
+  bool* shown = calloc(netlist->signal_count, sizeof(bool));
+  for (int i = 0; i < netlist->part_count; i++) {
+    for (int bit = 0; bit < netlist->parts[i].width; bit++) {
+      shown[netlist->parts[i].bits[bit]] = true;
+    }
+  }
+  uint32_t first_flip_flop = netlist->flip_flop_count > 0 ? netlist->flip_flops[0].out : 0;
+  for (int i = 0; i < netlist->gate_count; i++) {
+    const NandGate* gate = &netlist->gates[i];
+    uint32_t a = same[gate->a];
+    uint32_t b = same[gate->b];
+    uint32_t out = gate->out;
+    if (a > b) {
+      uint32_t swap = a;
+      a = b;
+      b = swap;
+    }
+    if (a == SIGNAL_TRUE) {
+      a = b;
+    }
+    if (a == SIGNAL_FALSE || negates[a] == b || negates[b] == a) {
+      same[out] = SIGNAL_TRUE;
+    } else if (a == SIGNAL_TRUE) {
+      same[out] = SIGNAL_FALSE;
+    } else if (a == b && negates[a] != SIGNAL_FALSE && (!shown[out] ||
+        negates[a] - first_flip_flop >= (uint32_t) netlist->flip_flop_count)) {
+      same[out] = negates[a];
+    } else {
+      folded[i] = (NandGate) {a, b, out};
+      uint32_t found = lookup_gate(table, size - 1, folded, a, b, i);
+      if (found != (uint32_t) i) {
+        same[out] = folded[found].out;
+      } else {
+        kept[i] = true;
+        negates[out] = a == b ? a : SIGNAL_FALSE;
+      }
+    }
+  }
+  free(table);
+  free(negates);
+  free(shown);
+  return same;
+}
+
+// Returns the first gate that Nands a and b, adding gate to the table
+// when there is none
+uint32_t lookup_gate(uint32_t* table, uint32_t mask, const NandGate* gates, uint32_t a,
+    uint32_t b, uint32_t gate) {
+  uint32_t slot = (a * 0x9E3779B1u ^ b * 0x85EBCA77u) & mask;
+  while (table[slot] != 0) {
+    const NandGate* found = &gates[table[slot] - 1];
+    if (found->a == a && found->b == b) {
+      return table[slot] - 1;
+    }
+    slot = (slot + 1) & mask;
+  }
+  table[slot] = gate + 1;
+  return gate;
+}
+
+// Makes everything that reads a signal read the one it is the same as
+void replace_signals(Netlist* netlist, const uint32_t* same) {
+  for (int i = 0; i < netlist->flip_flop_count; i++) {
+    netlist->flip_flops[i].in = same[netlist->flip_flops[i].in];
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    MemoryPart* memory = &netlist->memories[i];
+    for (int bit = 0; bit < 16; bit++) {
+      memory->in[bit] = same[memory->in[bit]];
+    }
+    for (int bit = 0; bit < memory->address_bits; bit++) {
+      memory->address[bit] = same[memory->address[bit]];
+    }
+    memory->load = same[memory->load];
+  }
+  Port* port_lists[] = {netlist->outputs, netlist->parts};
+  int port_counts[] = {netlist->output_count, netlist->part_count};
+  for (int list = 0; list < 2; list++) {
+    for (int i = 0; i < port_counts[list]; i++) {
+      for (int bit = 0; bit < port_lists[list][i].width; bit++) {
+        port_lists[list][i].bits[bit] = same[port_lists[list][i].bits[bit]];
+      }
+    }
+  }
+}
+
+// Drops the gates that nothing reads. Gates come after the gates they
+// read, so going through them from the last finds every gate that is
+// read before it is reached.
+void drop_dead_gates(const Netlist* netlist, bool* kept) {
+  bool* read = calloc(netlist->signal_count, sizeof(bool));
+  for (int i = 0; i < netlist->flip_flop_count; i++) {
+    read[netlist->flip_flops[i].in] = true;
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    const MemoryPart* memory = &netlist->memories[i];
+    for (int bit = 0; bit < 16; bit++) {
+      read[memory->in[bit]] = true;
+    }
+    for (int bit = 0; bit < memory->address_bits; bit++) {
+      read[memory->address[bit]] = true;
+    }
+    read[memory->load] = true;
+  }
+  const Port* port_lists[] = {netlist->outputs, netlist->parts};
+  int port_counts[] = {netlist->output_count, netlist->part_count};
+  for (int list = 0; list < 2; list++) {
+    for (int i = 0; i < port_counts[list]; i++) {
+      for (int bit = 0; bit < port_lists[list][i].width; bit++) {
+        read[port_lists[list][i].bits[bit]] = true;
+      }
+    }
+  }
+  for (int i = netlist->gate_count - 1; i >= 0; i--) {
+    const NandGate* gate = &netlist->gates[i];
+    kept[i] = kept[i] && read[gate->out];
+    if (kept[i]) {
+      read[gate->a] = true;
+      read[gate->b] = true;
+    }
+  }
+  free(read);
+}
+
+// Removes the gates that weren't kept, and sorts the rest by their new
+// levels, which can only have gone down
+void keep_gates(Netlist* netlist, const bool* kept) {
+  int* signal_levels = calloc(netlist->signal_count, sizeof(int));
+  NandGate* gates = malloc((netlist->gate_count + 1) * sizeof(NandGate));
+  int* levels = malloc((netlist->gate_count + netlist->memory_count + 1) * sizeof(int));
+  int count = 0;
+  int gate = 0;
+  // memory i's level is worked out where evaluate reads it, and goes at
+  // the end of levels once the gates are counted
+  int* memory_levels = malloc((netlist->memory_count + 1) * sizeof(int));
+  for (int i = 0; i <= netlist->memory_count; i++) {
+    int end = i < netlist->memory_count ? netlist->memories[i].position : netlist->gate_count;
+    for (; gate < end; gate++) {
+      const NandGate* nand = &netlist->gates[gate];
+      if (!kept[gate]) {
+        continue;
+      }
+      int level = signal_levels[nand->a] > signal_levels[nand->b] ? signal_levels[nand->a] :
+          signal_levels[nand->b];
+      signal_levels[nand->out] = level + 1;
+      levels[count] = level + 1;
+      gates[count++] = *nand;
+    }
+    if (i == netlist->memory_count) {
+      break;
+    }
+    const MemoryPart* memory = &netlist->memories[i];
+    int level = 0;
+    for (int bit = 0; bit < memory->address_bits && memory->kind != MEMORY_KEYBOARD; bit++) {
+      int address_level = signal_levels[memory->address[bit]];
+      level = address_level > level ? address_level : level;
+    }
+    memory_levels[i] = level + 1;
+    for (int bit = 0; bit < 16; bit++) {
+      signal_levels[memory->out[bit]] = level + 1;
+    }
+  }
+  memcpy(levels + count, memory_levels, netlist->memory_count * sizeof(int));
+  free(netlist->gates);
+  netlist->gates = gates;
+  netlist->gate_count = count;
+  sort_by_level(netlist, levels);
+  free(signal_levels);
+  free(levels);
+  free(memory_levels);
+}
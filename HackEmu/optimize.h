@@ -0,0 +1,14 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "netlist.h"
+
+// Makes a netlist smaller without changing anything it does. Gates with a
+// constant input are folded, a gate that Nands the same signals as an
+// earlier one is merged with it, the Not of a Not is what it negates, and
+// gates whose outputs nothing reads are dropped. The pins, registers and
+// memories that scripts can print are all kept.
+void optimize_netlist(Netlist* netlist);
+uint32_t* fold_gates(const Netlist* netlist, NandGate* folded, bool* kept);
+
+#endif
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+// Instructions executed between one label and the next
+typedef struct {
+  const char* name;
+  int address;
+  int size;
+  uint64_t executed;
+  uint64_t back_edges;
+} LabelProfile;
+
+int compare_label_profiles(const void* a, const void* b);
+
+// Attributes every instruction to the nearest label at or before it, and
+// prints the labels that ran, hottest first. Code before the first label
+// is reported as (start). Labels at the same address share one line under
+// the first name.
+void print_profile(FILE* file, const Profile* profile, const HackProgram* program) {
+  LabelProfile* labels = malloc((program->symbol_count + 1) * sizeof(LabelProfile));
+  int label_count = 0;
+  labels[label_count++] = (LabelProfile) {"(start)", 0, 0, 0, 0};
+  // symbols come sorted by kind and then address, labels first
+  for (int i = 0; i < program->symbol_count && program->symbols[i].kind == HACK_LABEL; i++) {
+    const HackSymbol* symbol = &program->symbols[i];
+    if (symbol->address >= program->count) {
+      continue;
+    }
+    if (labels[label_count - 1].address == symbol->address) {
+      if (label_count == 1) {
+        labels[0].name = symbol->name;
+      }
+      continue;
+    }
+    labels[label_count++] = (LabelProfile) {symbol->name, symbol->address, 0, 0, 0};
+  }
+
+  uint64_t total = 0;
+  for (int i = 0; i < label_count; i++) {
+    LabelProfile* label = &labels[i];
+    int end = i + 1 < label_count ? labels[i + 1].address : program->count;
+    label->size = end - label->address;
+    for (int address = label->address; address < end; address++) {
+      label->executed += profile->counts[address];
+      label->back_edges += profile->back_edges[address];
+    }
+    total += label->executed;
+  }
+  // anything run past the end of the program goes unattributed
+  uint64_t outside = 0;
+  for (int address = program->count; address < ROM_WORDS; address++) {
+    outside += profile->counts[address];
+  }
+  total += outside;
+
+  qsort(labels, label_count, sizeof(LabelProfile), compare_label_profiles);
+  fprintf(file, "%14s %7s %6s %12s  %s\n", "executed", "share", "size", "back edges", "label");
+  for (int i = 0; i < label_count && labels[i].executed > 0; i++) {
+    LabelProfile* label = &labels[i];
+    fprintf(file, "%14llu %6.2f%% %6i %12llu  %s\n", (unsigned long long) label->executed,
+        100.0 * label->executed / total, label->size, (unsigned long long) label->back_edges,
+        label->name);
+  }
+  if (outside > 0) {
+    fprintf(file, "%14llu %6.2f%% %6s %12s  (past the end of the program)\n",
+        (unsigned long long) outside, 100.0 * outside / total, "-", "-");
+  }
+  free(labels);
+}
+
+// Hottest first, then in ROM order
+int compare_label_profiles(const void* a, const void* b) {
+  const LabelProfile* first = a;
+  const LabelProfile* second = b;
+  if (first->executed != second->executed) {
+    return first->executed < second->executed ? 1 : -1;
+  }
+  return first->address - second->address;
+}
@@ -0,0 +1,10 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "assembler.h"
+#include "machine.h"
+
+void print_profile(FILE* file, const Profile* profile, const HackProgram* program);
+
+#endif
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "program.h"
+#include "rom.h"
+
+bool is_hack_text(const char* data, size_t size);
+bool parse_hack_text(const char* path, const char* data, size_t size, HackProgram* program);
+bool parse_rom_image(const char* path, const uint8_t* data, size_t size, HackProgram* program);
+
+// Loads a program from any of the forms the assembler reads or writes:
+// .asm source, assembled here and keeping its symbols, .hack text, or a
+// binary ROM image with or without a header. Reports problems on stderr
+// and returns false. The program is released with hack_program_free.
+bool load_program(const char* path, HackProgram* program) {
+  memset(program, 0, sizeof(HackProgram));
+  size_t size;
+  char* data = read_file(path, &size);
+  if (data == NULL) {
+    fprintf(stderr, "%s: Could not open file\n", path);
+    return false;
+  }
+  bool loaded;
+  if (ends_with(path, ".asm")) {
+    loaded = hack_assemble(data, size, 1, program);
+    for (int i = 0; i < program->diagnostic_count; i++) {
+      HackDiagnostic* diagnostic = &program->diagnostics[i];
+      fprintf(stderr, "%s:%i: %s: %s\n", path, diagnostic->line,
+          diagnostic->severity == HACK_ERROR ? "error" : "warning", diagnostic->message);
+    }
+  } else if (is_hack_text(data, size)) {
+    loaded = parse_hack_text(path, data, size, program);
+  } else {
+    loaded = parse_rom_image(path, (const uint8_t*) data, size, program);
+  }
+  free(data);
+  if (!loaded) {
+    hack_program_free(program);
+  }
+  return loaded;
+}
+
+// Reads a whole file, with a NUL after the last byte
+char* read_file(const char* path, size_t* size) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (length < 0) {
+    length = 0;
+  }
+  char* data = malloc(length + 1);
+  *size = fread(data, 1, length, file);
+  data[*size] = '\0';
+  fclose(file);
+  return data;
+}
+
+bool ends_with(const char* path, const char* suffix) {
+  size_t length = strlen(path);
+  size_t suffix_length = strlen(suffix);
+  return length >= suffix_length && strcmp(path + length - suffix_length, suffix) == 0;
+}
+
+// .hack files hold nothing but binary digits and line breaks
+bool is_hack_text(const char* data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    char c = data[i];
+    if (c != '0' && c != '1' && c != '\n' && c != '\r') {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool parse_hack_text(const char* path, const char* data, size_t size, HackProgram* program) {
+  program->words = malloc(ROM_SIZE * sizeof(uint16_t));
+  int line = 1;
+  int digits = 0;
+  uint16_t word = 0;
+  for (size_t i = 0; i <= size; i++) {
+    char c = i < size ? data[i] : '\n';
+    if (c == '0' || c == '1') {
+      word = (word << 1) | (c - '0');
+      digits++;
+    } else if (c == '\n') {
+      if (digits != 0 && digits != 16) {
+        fprintf(stderr, "%s:%i: error: Expected 16 binary digits.\n", path, line);
+        return false;
+      }
+      if (digits == 16) {
+        if (program->count == ROM_SIZE) {
+          fprintf(stderr, "%s:%i: error: Exceeded ROM size (%i instructions).\n", path, line, ROM_SIZE);
+          return false;
+        }
+        program->words[program->count++] = word;
+      }
+      line++;
+      digits = 0;
+      word = 0;
+    }
+  }
+  return true;
+}
+
+// Little-endian words, after a header if the image starts with one
+bool parse_rom_image(const char* path, const uint8_t* data, size_t size, HackProgram* program) {
+  if (size >= ROM_HEADER_SIZE && memcmp(data, ROM_MAGIC, 4) == 0) {
+    uint32_t count = get_uint32(data + 4);
+    if (count > ROM_SIZE || size < ROM_HEADER_SIZE + (size_t) count * 2) {
+      fprintf(stderr, "%s: ROM image is truncated\n", path);
+      return false;
+    }
+    data += ROM_HEADER_SIZE;
+    if (rom_checksum(data, (size_t) count * 2) != get_uint32(data - 4)) {
+      fprintf(stderr, "%s: ROM image checksum does not match\n", path);
+      return false;
+    }
+    size = (size_t) count * 2;
+  }
+  if (size % 2 != 0 || size / 2 > ROM_SIZE) {
+    fprintf(stderr, "%s: Not a .hack file or ROM image\n", path);
+    return false;
+  }
+  program->count = size / 2;
+  program->words = malloc((program->count > 0 ? program->count : 1) * sizeof(uint16_t));
+  for (int i = 0; i < program->count; i++) {
+    program->words[i] = data[i * 2] | data[i * 2 + 1] << 8;
+  }
+  return true;
+}
@@ -0,0 +1,11 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stdbool.h>
+#include "assembler.h"
+
+bool load_program(const char* path, HackProgram* program);
+char* read_file(const char* path, size_t* size);
+bool ends_with(const char* path, const char* suffix);
+
+#endif
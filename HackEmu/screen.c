@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include "program.h"
+#include "screen.h"
+
+#define STREAM_MAGIC "HSCR"
+
+bool is_frame_pattern(const char* path);
+void encode_row(FrameWriter* writer, const uint16_t* words, uint8_t* row);
+void put_uint16(uint8_t* bytes, uint16_t value);
+uint8_t reverse_bits(uint8_t byte);
+
+// A path ending in .pbm or .ppm is a printf pattern for numbered frame
+// files, such as frame%05d.pbm. Any other path gets a delta stream.
+bool FrameWriter_init(FrameWriter* writer, const char* path) {
+  writer->path = path;
+  writer->stream = NULL;
+  writer->image = NULL;
+  writer->frames = 0;
+  if (ends_with(path, ".pbm") || ends_with(path, ".ppm")) {
+    if (!is_frame_pattern(path)) {
+      fprintf(stderr, "%s: A frame pattern needs one %%d for the frame number, such as "
+          "f%%05d.pbm, and %%%% for any other %%\n", path);
+      return false;
+    }
+    writer->format = ends_with(path, ".pbm") ? PBM_FRAMES : PPM_FRAMES;
+    // one bit or one RGB triple per pixel, and 1 is black
+    writer->row_size = writer->format == PBM_FRAMES ? SCREEN_WIDTH / 8 : SCREEN_WIDTH * 3;
+    writer->image = malloc(writer->row_size * SCREEN_HEIGHT);
+    uint16_t blank[SCREEN_ROW_WORDS] = {0};
+    for (int row = 0; row < SCREEN_HEIGHT; row++) {
+      encode_row(writer, blank, writer->image + row * writer->row_size);
+    }
+    return true;
+  }
+  writer->format = DELTA_STREAM;
+  writer->row_size = 2 + SCREEN_ROW_WORDS * 2;
+  writer->image = malloc(writer->row_size * SCREEN_HEIGHT);
+  writer->stream = fopen(path, "wb");
+  if (writer->stream == NULL) {
+    fprintf(stderr, "%s: Could not open output file\n", path);
+    free(writer->image);
+    writer->image = NULL;
+    return false;
+  }
+  fwrite(STREAM_MAGIC, 1, 4, writer->stream);
+  return true;
+}
+
+void FrameWriter_free(FrameWriter* writer) {
+  if (writer->stream != NULL) {
+    fclose(writer->stream);
+  }
+  free(writer->image);
+  writer->stream = NULL;
+  writer->image = NULL;
+}
+
+// Writes a frame if any screen row changed since the last one, and clears
+// the dirty rows. Returns false only if the frame could not be written.
+bool write_frame(FrameWriter* writer, Machine* machine) {
+  int changed = 0;
+  for (int row = 0; row < SCREEN_ROWS; row++) {
+    if (!machine->dirty_rows[row]) {
+      continue;
+    }
+    machine->dirty_rows[row] = 0;
+    const uint16_t* words = &machine->ram[SCREEN + row * SCREEN_ROW_WORDS];
+    if (writer->format == DELTA_STREAM) {
+      // changed rows are packed together at the start of image
+      uint8_t* bytes = writer->image + changed * writer->row_size;
+      put_uint16(bytes, row);
+      for (int i = 0; i < SCREEN_ROW_WORDS; i++) {
+        put_uint16(bytes + 2 + i * 2, words[i]);
+      }
+    } else {
+      encode_row(writer, words, writer->image + row * writer->row_size);
+    }
+    changed++;
+  }
+  // writes elsewhere in memory only mark the spare entry
+  machine->dirty_rows[SCREEN_ROWS] = 0;
+  if (changed == 0) {
+    return true;
+  }
+  writer->frames++;
+
+  if (writer->format == DELTA_STREAM) {
+    uint8_t header[10];
+    for (int i = 0; i < 8; i++) {
+      header[i] = (machine->cycles >> (i * 8)) & 0xFF;
+    }
+    put_uint16(header + 8, changed);
+    fwrite(header, 1, sizeof(header), writer->stream);
+    return fwrite(writer->image, writer->row_size, changed, writer->stream) == (size_t) changed;
+  }
+  char name[4096];
+  snprintf(name, sizeof(name), writer->path, writer->frames);
+  FILE* file = fopen(name, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "%s: Could not open output file\n", name);
+    return false;
+  }
+  fprintf(file, "%s\n%i %i\n%s", writer->format == PBM_FRAMES ? "P4" : "P6",
+      SCREEN_WIDTH, SCREEN_HEIGHT, writer->format == PBM_FRAMES ? "" : "255\n");
+  bool written = fwrite(writer->image, writer->row_size, SCREEN_HEIGHT, file) == SCREEN_HEIGHT;
+  fclose(file);
+  return written;
+}
+
+// Whether path is safe to format with the frame number: it has exactly one
+// conversion, a %d or %i with no more than flags and a width, and any
+// other % is written %%
+bool is_frame_pattern(const char* path) {
+  int conversions = 0;
+  for (const char* c = path; *c != '\0'; c++) {
+    if (*c != '%') {
+      continue;
+    } else if (c[1] == '%') {
+      c++;
+      continue;
+    }
+    c++;
+    while (*c != '\0' && strchr("-+ 0", *c) != NULL) {
+      c++;
+    }
+    while (*c >= '0' && *c <= '9') {
+      c++;
+    }
+    if (*c != 'd' && *c != 'i') {
+      return false;
+    }
+    conversions++;
+  }
+  return conversions == 1;
+}
+
+// The lowest bit of a screen word is its leftmost pixel. PBM puts the
+// leftmost pixel in the highest bit of a byte.
+void encode_row(FrameWriter* writer, const uint16_t* words, uint8_t* row) {
+  for (int i = 0; i < SCREEN_ROW_WORDS; i++) {
+    uint16_t word = words[i];
+    if (writer->format == PBM_FRAMES) {
+      row[i * 2] = reverse_bits(word & 0xFF);
+      row[i * 2 + 1] = reverse_bits(word >> 8);
+    } else {
+      for (int bit = 0; bit < 16; bit++) {
+        uint8_t shade = (word >> bit) & 1 ? 0 : 255;
+        memset(row + (i * 16 + bit) * 3, shade, 3);
+      }
+    }
+  }
+}
+
+void put_uint16(uint8_t* bytes, uint16_t value) {
+  bytes[0] = value & 0xFF;
+  bytes[1] = value >> 8;
+}
+
+uint8_t reverse_bits(uint8_t byte) {
+  byte = (byte & 0xF0) >> 4 | (byte & 0x0F) << 4;
+  byte = (byte & 0xCC) >> 2 | (byte & 0x33) << 2;
+  return (byte & 0xAA) >> 1 | (byte & 0x55) << 1;
+}
@@ -0,0 +1,38 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "machine.h"
+
+#define SCREEN_WIDTH 512
+#define SCREEN_HEIGHT 256
+
+// Frames are written as numbered .pbm or .ppm files, or as a delta stream:
+//
+//   "HSCR"
+//   then per frame:
+//     uint64 instructions executed so far
+//     uint16 number of rows that changed
+//     per changed row: uint16 row, then the row's 32 words
+//
+// with every number little-endian. A stream starts from a blank screen.
+typedef enum {PBM_FRAMES, PPM_FRAMES, DELTA_STREAM} FrameFormat;
+
+// Rows are encoded when they change and kept, so a frame only costs the
+// rows that changed since the last one.
+typedef struct {
+  FrameFormat format;
+  const char* path;
+  FILE* stream;
+  uint8_t* image;
+  size_t row_size;
+  int frames;
+} FrameWriter;
+
+bool FrameWriter_init(FrameWriter* writer, const char* path);
+void FrameWriter_free(FrameWriter* writer);
+bool write_frame(FrameWriter* writer, Machine* machine);
+
+#endif
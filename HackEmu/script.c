@@ -0,0 +1,946 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "batch.h"
+#include "cache.h"
+#include "chipaot.h"
+#include "netlist.h"
+#include "optimize.h"
+#include "program.h"
+#include "script.h"
+#include "simulation.h"
+
+#define MAX_COLUMNS 64
+#define MAX_LINE 4096
+#define ERROR_SIZE 1024
+
+// A word of the script, a quoted string, or one of the separators , ; { }
+typedef struct {
+  const char* text;
+  int length;
+  int line;
+} Token;
+
+typedef enum {
+  VARIABLE_A, VARIABLE_D, VARIABLE_PC, VARIABLE_RAM, VARIABLE_TIME, VARIABLE_RESET,
+  VARIABLE_INPUT, VARIABLE_OUTPUT, VARIABLE_PART, VARIABLE_MEMORY
+} VariableKind;
+
+// A register of the computer, or a pin of a chip, the outputs of one of
+// its parts, or a word of one of its memories
+typedef struct {
+  VariableKind kind;
+  int address;
+  const Port* port;
+} Variable;
+
+// One entry of output-list, such as RAM[0]%D2.6.2: the value is printed
+// in decimal, six characters wide, with two spaces on either side
+typedef struct {
+  Variable variable;
+  Token name;
+  char format;
+  int left;
+  int width;
+  int right;
+} Column;
+
+// An output of a combinational chip, printed once its lane has run. The
+// values of its other columns are kept from when it was asked for.
+typedef struct {
+  int lane;
+  bool ticked;
+  int values[MAX_COLUMNS];
+} PendingOutput;
+
+typedef struct {
+  const char* path;
+  // the script's directory, which the files it names are relative to
+  int directory_length;
+  Machine* machine;
+  const ScriptOptions* options;
+  Token* tokens;
+  int token_count;
+  Column columns[MAX_COLUMNS];
+  int column_count;
+  // the compare file, and the start of the line the next output is
+  // checked against
+  char* expected;
+  char* next_expected;
+  int compared;
+  // clock cycles, and whether the clock is between tick and tock
+  uint64_t time;
+  bool ticked;
+  bool reset;
+  bool loaded;
+  // a chip other than the computer, simulated as gates, and the values
+  // its inputs were set to
+  Netlist* netlist;
+  Simulation* simulation;
+  int* inputs;
+  // a clocked chip compiled with --native, when it could be
+  NativeChip native;
+  // A combinational chip runs 64 evals at once, each in its own lane. The
+  // last eval is in lane, with its inputs kept in lane_inputs, and the
+  // lanes run once they are full or something else has to be printed.
+  int* lane_inputs;
+  int lane;
+  int next_lane;
+  PendingOutput* pending;
+  int pending_count;
+  int pending_capacity;
+  TestResult result;
+  char* message;
+  size_t message_size;
+} Script;
+
+bool tokenize(Script* script, const char* source);
+void add_token(Script* script, const char* text, int length, int line);
+bool run_block(Script* script, int first, int end);
+int block_end(Script* script, int first);
+int steps_per_iteration(Script* script, int first, int end);
+bool run_command(Script* script, const Token* words, int count);
+bool load(Script* script, const Token* file, bool computer);
+bool load_chip_script(Script* script, const char* path);
+bool load_chip_rom(Script* script, const char* path, const Token* file);
+void free_chip(Script* script);
+bool compare_to(Script* script, const Token* file);
+bool output_list(Script* script, const Token* words, int count);
+bool output(Script* script);
+bool print_values(Script* script, const int* values, bool ticked);
+bool set(Script* script, const Token* name, const Token* value);
+void step(Script* script, uint64_t count);
+bool eval(Script* script);
+void tick_chip(Script* script);
+bool tock_chip(Script* script);
+bool flush_lanes(Script* script);
+bool parse_variable(Script* script, const Token* token, Variable* variable);
+bool parse_chip_variable(Script* script, const Token* token, Variable* variable);
+bool parse_value(const Token* token, int* value);
+bool parse_number(const char* text, int length, int base, int* value);
+int read_variable(Script* script, const Variable* variable, int lane);
+bool depends_on_lane(const Variable* variable);
+void format_value(const Column* column, int value, bool ticked, char* field);
+bool check_line(Script* script, const char* line);
+bool token_is(const Token* token, const char* text);
+char* script_relative_path(Script* script, const Token* file);
+bool stop(Script* script, TestResult result, const char* format, ...);
+
+TestResult run_script(const char* path, Machine* machine, const ScriptOptions* options,
+    char* message, size_t message_size) {
+  Script script;
+  memset(&script, 0, sizeof(script));
+  script.path = path;
+  const char* slash = strrchr(path, '/');
+  script.directory_length = slash != NULL ? slash - path + 1 : 0;
+  script.machine = machine;
+  script.options = options;
+  script.result = TEST_PASSED;
+  script.message = message;
+  script.message_size = message_size;
+  message[0] = '\0';
+
+  size_t size;
+  char* source = read_file(path, &size);
+  if (source == NULL) {
+    stop(&script, TEST_FAILED, "Could not open file");
+  } else if (tokenize(&script, source) && run_block(&script, 0, script.token_count) &&
+      flush_lanes(&script) && script.expected == NULL) {
+    stop(&script, TEST_SKIPPED, "nothing to compare against");
+  }
+  free_chip(&script);
+  free(source);
+  free(script.tokens);
+  free(script.expected);
+  return script.result;
+}
+
+bool tokenize(Script* script, const char* source) {
+  int line = 1;
+  const char* c = source;
+  while (*c != '\0') {
+    if (*c == '\n') {
+      line++;
+      c++;
+    } else if (*c == ' ' || *c == '\t' || *c == '\r') {
+      c++;
+    } else if (c[0] == '/' && c[1] == '/') {
+      while (*c != '\0' && *c != '\n') {
+        c++;
+      }
+    } else if (c[0] == '/' && c[1] == '*') {
+      c += 2;
+      while (*c != '\0' && !(c[0] == '*' && c[1] == '/')) {
+        line += *c == '\n';
+        c++;
+      }
+      c += *c != '\0' ? 2 : 0;
+    } else if (*c == '"') {
+      const char* start = c++;
+      while (*c != '\0' && *c != '"' && *c != '\n') {
+        c++;
+      }
+      if (*c != '"') {
+        return stop(script, TEST_FAILED, "line %i: unterminated string", line);
+      }
+      c++;
+      add_token(script, start, c - start, line);
+    } else if (strchr(",;{}", *c) != NULL) {
+      add_token(script, c++, 1, line);
+    } else {
+      const char* start = c;
+      while (*c != '\0' && strchr(" \t\r\n,;{}\"", *c) == NULL) {
+        c++;
+      }
+      add_token(script, start, c - start, line);
+    }
+  }
+  return true;
+}
+
+void add_token(Script* script, const char* text, int length, int line) {
+  // grows in powers of two from 256
+  if (script->token_count >= 256 && (script->token_count & (script->token_count - 1)) == 0) {
+    script->tokens = realloc(script->tokens, script->token_count * 2 * sizeof(Token));
+  } else if (script->tokens == NULL) {
+    script->tokens = malloc(256 * sizeof(Token));
+  }
+  script->tokens[script->token_count++] = (Token) {text, length, line};
+}
+
+// Runs the commands in tokens first to end. A command is a list of words
+// ended by , or ; and a repeat is followed by a block in braces.
+bool run_block(Script* script, int first, int end) {
+  int i = first;
+  while (i < end) {
+    const Token* words = &script->tokens[i];
+    if (token_is(words, "repeat") || token_is(words, "while")) {
+      int open = i + 1;
+      int times = 0;
+      if (token_is(words, "while")) {
+        return stop(script, TEST_SKIPPED, "line %i: while is not supported", words->line);
+      }
+      if (open < end && !token_is(&script->tokens[open], "{")) {
+        if (!parse_value(&script->tokens[open], &times) || times < 0) {
+          return stop(script, TEST_FAILED, "line %i: bad repeat count", words->line);
+        }
+        open++;
+      } else {
+        return stop(script, TEST_SKIPPED, "line %i: repeat without a count never ends",
+            words->line);
+      }
+      int close = open < end ? block_end(script, open) : -1;
+      if (close < 0) {
+        return stop(script, TEST_FAILED, "line %i: repeat without a block", words->line);
+      }
+      // a block that only clocks the computer runs in one go
+      int steps = steps_per_iteration(script, open + 1, close);
+      if (steps > 0) {
+        step(script, (uint64_t) steps * times);
+      } else {
+        for (int n = 0; n < times; n++) {
+          if (!run_block(script, open + 1, close)) {
+            return false;
+          }
+        }
+      }
+      i = close + 1;
+      continue;
+    }
+    int count = 0;
+    while (i + count < end && !token_is(&words[count], ",") && !token_is(&words[count], ";")) {
+      if (token_is(&words[count], "{") || token_is(&words[count], "}")) {
+        return stop(script, TEST_FAILED, "line %i: unexpected %.*s", words[count].line,
+            words[count].length, words[count].text);
+      }
+      count++;
+    }
+    if (count > 0 && !run_command(script, words, count)) {
+      return false;
+    }
+    i += count + 1;
+  }
+  return true;
+}
+
+// Returns the index of the brace that closes the one at first, or -1
+int block_end(Script* script, int first) {
+  if (!token_is(&script->tokens[first], "{")) {
+    return -1;
+  }
+  int depth = 0;
+  for (int i = first; i < script->token_count; i++) {
+    if (token_is(&script->tokens[i], "{")) {
+      depth++;
+    } else if (token_is(&script->tokens[i], "}") && --depth == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// How many clock cycles one pass over the block runs, if all it does is
+// tick and tock in pairs, or 0
+int steps_per_iteration(Script* script, int first, int end) {
+  int steps = 0;
+  bool ticked = script->ticked;
+  for (int i = first; i < end; i++) {
+    const Token* token = &script->tokens[i];
+    if (token_is(token, ",") || token_is(token, ";")) {
+      continue;
+    }
+    if (token_is(token, "ticktock") && !ticked) {
+      steps++;
+    } else if (token_is(token, "tick") && !ticked) {
+      ticked = true;
+    } else if (token_is(token, "tock") && ticked) {
+      ticked = false;
+      steps++;
+    } else {
+      return 0;
+    }
+  }
+  return ticked ? 0 : steps;
+}
+
+bool run_command(Script* script, const Token* words, int count) {
+  const Token* command = &words[0];
+  if (token_is(command, "load") && count == 2) {
+    return load(script, &words[1], false);
+  } else if (token_is(command, "load")) {
+    return stop(script, TEST_SKIPPED, "line %i: load needs a file", command->line);
+  } else if (token_is(command, "ROM32K") && count == 3 && token_is(&words[1], "load")) {
+    return load(script, &words[2], true);
+  }
+  if (token_is(command, "output-file") || token_is(command, "echo") ||
+      token_is(command, "clear-echo")) {
+    // nothing is written, the output is only compared
+    return true;
+  } else if (token_is(command, "compare-to") && count == 2) {
+    return compare_to(script, &words[1]);
+  } else if (!script->loaded) {
+    return stop(script, TEST_FAILED, "line %i: nothing is loaded", command->line);
+  } else if (token_is(command, "output-list")) {
+    return output_list(script, words + 1, count - 1);
+  } else if (token_is(command, "output") && count == 1) {
+    return output(script);
+  } else if (token_is(command, "set") && count == 3) {
+    return set(script, &words[1], &words[2]);
+  } else if (token_is(command, "eval") && count == 1 && script->netlist != NULL) {
+    return eval(script);
+  } else if (token_is(command, "ticktock") && count == 1 && !script->ticked) {
+    if (script->netlist != NULL) {
+      tick_chip(script);
+      return tock_chip(script);
+    }
+    step(script, 1);
+    return true;
+  } else if (token_is(command, "tick") && count == 1 && !script->ticked) {
+    if (script->netlist != NULL) {
+      tick_chip(script);
+    }
+    script->ticked = true;
+    return true;
+  } else if (token_is(command, "tock") && count == 1 && script->ticked) {
+    if (script->netlist != NULL) {
+      return tock_chip(script);
+    }
+    step(script, 1);
+    return true;
+  }
+  return stop(script, TEST_SKIPPED, "line %i: %.*s is not supported", command->line,
+      command->length, command->text);
+}
+
+// Loads a program or a chip. The Computer chip runs as the emulated
+// machine, unless it is run as gates, and its ROM is then loaded by
+// ROM32K load.
+bool load(Script* script, const Token* file, bool computer) {
+  char* path = script_relative_path(script, file);
+  bool loaded = false;
+  if (computer && script->netlist != NULL) {
+    loaded = load_chip_rom(script, path, file);
+  } else if (computer && !script->loaded) {
+    stop(script, TEST_FAILED, "line %i: ROM32K needs the Computer chip", file->line);
+  } else if (script->loaded && !computer) {
+    stop(script, TEST_SKIPPED, "line %i: only one load is supported", file->line);
+  } else if (ends_with(path, ".hdl")) {
+    const char* slash = strrchr(path, '/');
+    const char* name = slash != NULL ? slash + 1 : path;
+    if (strcmp(name, "Computer.hdl") == 0 && !script->options->gates) {
+      Machine_init(script->machine);
+      script->loaded = loaded = true;
+    } else {
+      script->loaded = loaded = load_chip_script(script, path);
+    }
+  } else if (ends_with(path, ".vm") || !memchr(file->text, '.', file->length) || is_directory(path)) {
+    stop(script, TEST_SKIPPED, "line %i: VM programs are not supported", file->line);
+  } else if (access(path, F_OK) != 0) {
+    // programs translated from VM code are not part of the tree
+    stop(script, TEST_SKIPPED, "line %i: %.*s does not exist yet", file->line, file->length,
+        file->text);
+  } else {
+    HackProgram program;
+    if (!load_program(path, &program)) {
+      stop(script, TEST_FAILED, "line %i: could not load %.*s", file->line, file->length,
+          file->text);
+    } else {
+      if (!computer) {
+        Machine_init(script->machine);
+      }
+      load_rom(script->machine, program.words, program.count);
+      // scripts watch every cycle, including those of the final loop
+      unmark_halts(script->machine);
+      hack_program_free(&program);
+      script->loaded = loaded = true;
+    }
+  }
+  free(path);
+  if (loaded && !computer) {
+    script->time = 0;
+    script->ticked = false;
+    script->reset = false;
+  }
+  return loaded;
+}
+
+// Flattens a chip for the script. Its parts are found the way the
+// Hardware Simulator finds them, in the chip's directory and then among
+// the built-in chips.
+bool load_chip_script(Script* script, const char* path) {
+  Netlist* netlist = malloc(sizeof(Netlist));
+  char error[ERROR_SIZE];
+  if (!build_netlist(netlist, path, NULL, 0, error, sizeof(error))) {
+    free(netlist);
+    return stop(script, TEST_FAILED, "%s", error);
+  }
+  const char* slash = strrchr(path, '/');
+  if (netlist->gate_count == 0 && netlist->flip_flop_count == 0 &&
+      netlist->memory_count == 0) {
+    Netlist_free(netlist);
+    free(netlist);
+    return stop(script, TEST_SKIPPED, "%s has no parts yet", slash != NULL ? slash + 1 : path);
+  }
+  optimize_netlist(netlist);
+  script->netlist = netlist;
+  script->simulation = malloc(sizeof(Simulation));
+  Simulation_init(script->simulation, netlist,
+      is_combinational(netlist) ? SIMULATION_LANES : 1);
+  script->inputs = calloc(netlist->input_count + 1, sizeof(int));
+  script->lane_inputs = calloc(netlist->input_count + 1, sizeof(int));
+  script->lane = 0;
+  script->next_lane = 1;
+  evaluate(script->simulation);
+  if (script->options->native && script->simulation->lane_count == 1) {
+    // a chip that can't be compiled is simulated as it would have been
+    char* cache_dir = default_cache_dir();
+    NativeChip_load(&script->native, netlist, cache_dir);
+    free(cache_dir);
+  }
+  return true;
+}
+
+// Loads a program into the ROM of a chip run as gates
+bool load_chip_rom(Script* script, const char* path, const Token* file) {
+  const Netlist* netlist = script->netlist;
+  int rom = 0;
+  while (rom < netlist->memory_count && netlist->memories[rom].kind != MEMORY_ROM) {
+    rom++;
+  }
+  if (rom == netlist->memory_count) {
+    return stop(script, TEST_FAILED, "line %i: ROM32K needs the Computer chip", file->line);
+  } else if (access(path, F_OK) != 0) {
+    return stop(script, TEST_SKIPPED, "line %i: %.*s does not exist yet", file->line,
+        file->length, file->text);
+  }
+  HackProgram program;
+  if (!load_program(path, &program)) {
+    return stop(script, TEST_FAILED, "line %i: could not load %.*s", file->line, file->length,
+        file->text);
+  }
+  load_memory(script->simulation, rom, program.words, program.count);
+  hack_program_free(&program);
+  evaluate(script->simulation);
+  return true;
+}
+
+void free_chip(Script* script) {
+  if (script->netlist == NULL) {
+    return;
+  }
+  NativeChip_free(&script->native);
+  Simulation_free(script->simulation);
+  Netlist_free(script->netlist);
+  free(script->simulation);
+  free(script->netlist);
+  free(script->inputs);
+  free(script->lane_inputs);
+  free(script->pending);
+  script->netlist = NULL;
+}
+
+bool compare_to(Script* script, const Token* file) {
+  if (!flush_lanes(script)) {
+    return false;
+  }
+  char* path = script_relative_path(script, file);
+  size_t size;
+  free(script->expected);
+  script->expected = read_file(path, &size);
+  script->next_expected = script->expected;
+  script->compared = 0;
+  free(path);
+  if (script->expected == NULL) {
+    return stop(script, TEST_FAILED, "line %i: could not open %.*s", file->line, file->length,
+        file->text);
+  }
+  return true;
+}
+
+// Sets the columns and prints the header line, each name centred in its
+// column
+bool output_list(Script* script, const Token* words, int count) {
+  if (!flush_lanes(script)) {
+    return false;
+  }
+  if (count > MAX_COLUMNS) {
+    return stop(script, TEST_FAILED, "line %i: too many columns", words->line);
+  }
+  char line[MAX_LINE];
+  size_t length = 0;
+  for (int i = 0; i < count; i++) {
+    Column* column = &script->columns[i];
+    const Token* word = &words[i];
+    const char* percent = memchr(word->text, '%', word->length);
+    if (percent == NULL) {
+      return stop(script, TEST_FAILED, "line %i: %.*s has no format", word->line,
+          word->length, word->text);
+    }
+    column->name = (Token) {word->text, percent - word->text, word->line};
+    if (!parse_variable(script, &column->name, &column->variable)) {
+      return stop(script, TEST_SKIPPED, "line %i: %.*s is not supported", word->line,
+          column->name.length, column->name.text);
+    }
+    column->format = percent[1];
+    char spec[32];
+    int spec_length = word->length - (percent + 2 - word->text);
+    snprintf(spec, sizeof(spec), "%.*s", spec_length > 0 ? spec_length : 0, percent + 2);
+    if (strchr("BDSX", column->format) == NULL ||
+        sscanf(spec, "%d.%d.%d", &column->left, &column->width, &column->right) != 3 ||
+        column->left < 0 || column->width < 0 || column->right < 0 ||
+        length + column->left + column->width + column->right + 2 >= MAX_LINE) {
+      return stop(script, TEST_FAILED, "line %i: bad format %.*s", word->line, word->length,
+          word->text);
+    }
+    int size = column->left + column->width + column->right;
+    int shown = column->name.length < size ? column->name.length : size;
+    int before = (size - shown) / 2;
+    line[length++] = '|';
+    memset(line + length, ' ', size);
+    memcpy(line + length + before, column->name.text, shown);
+    length += size;
+  }
+  script->column_count = count;
+  line[length++] = '|';
+  line[length] = '\0';
+  return check_line(script, line);
+}
+
+// Prints a line of values, or for a combinational chip, keeps what it
+// can of one until the lanes have run
+bool output(Script* script) {
+  PendingOutput output;
+  output.lane = script->lane;
+  output.ticked = script->ticked;
+  for (int i = 0; i < script->column_count; i++) {
+    const Variable* variable = &script->columns[i].variable;
+    output.values[i] = depends_on_lane(variable) && script->simulation->lane_count > 1 ? 0 :
+        read_variable(script, variable, 0);
+  }
+  if (script->netlist == NULL || script->simulation->lane_count == 1) {
+    return print_values(script, output.values, output.ticked);
+  }
+  if (script->pending_count == script->pending_capacity) {
+    script->pending_capacity = script->pending_capacity == 0 ? 64 :
+        script->pending_capacity * 2;
+    script->pending = realloc(script->pending, script->pending_capacity * sizeof(PendingOutput));
+  }
+  script->pending[script->pending_count++] = output;
+  return true;
+}
+
+bool print_values(Script* script, const int* values, bool ticked) {
+  char line[MAX_LINE];
+  size_t length = 0;
+  for (int i = 0; i < script->column_count; i++) {
+    const Column* column = &script->columns[i];
+    line[length++] = '|';
+    memset(line + length, ' ', column->left);
+    length += column->left;
+    format_value(column, values[i], ticked, line + length);
+    length += column->width;
+    memset(line + length, ' ', column->right);
+    length += column->right;
+  }
+  line[length++] = '|';
+  line[length] = '\0';
+  return check_line(script, line);
+}
+
+bool set(Script* script, const Token* name, const Token* value) {
+  Variable variable;
+  int number;
+  if (!parse_variable(script, name, &variable) || variable.kind == VARIABLE_TIME ||
+      (script->netlist != NULL && variable.kind != VARIABLE_INPUT &&
+      variable.kind != VARIABLE_MEMORY)) {
+    return stop(script, TEST_SKIPPED, "line %i: %.*s is not supported", name->line,
+        name->length, name->text);
+  }
+  if (!parse_value(value, &number)) {
+    return stop(script, TEST_FAILED, "line %i: bad value %.*s", value->line, value->length,
+        value->text);
+  }
+  if (script->netlist != NULL && variable.kind == VARIABLE_MEMORY) {
+    write_memory(script->simulation, variable.port->memory, variable.address, number);
+    return true;
+  } else if (script->netlist != NULL) {
+    // a combinational chip's inputs go to a lane at the next eval
+    int index = variable.port - script->netlist->inputs;
+    script->inputs[index] = number & ((1 << variable.port->width) - 1);
+    if (script->simulation->lane_count == 1) {
+      set_port(script->simulation, variable.port, 1, number);
+    }
+    return true;
+  }
+  Machine* machine = script->machine;
+  switch (variable.kind) {
+    case VARIABLE_A: machine->a = number; break;
+    case VARIABLE_D: machine->d = number; break;
+    case VARIABLE_PC: machine->pc = number & ADDRESS_MASK; break;
+    case VARIABLE_RAM: machine->ram[variable.address] = number; break;
+    case VARIABLE_RESET: script->reset = number & 1; break;
+    default: break;
+  }
+  return true;
+}
+
+// Clocks the computer or the chip count times. With reset set, the
+// computer's instruction still runs and the PC is then cleared.
+void step(Script* script, uint64_t count) {
+  Machine* machine = script->machine;
+  if (script->netlist != NULL && script->native.run != NULL) {
+    run_native_chip(script->simulation, &script->native, count);
+    script->time += count;
+    script->ticked = false;
+    return;
+  } else if (script->netlist != NULL) {
+    for (uint64_t i = 0; i < count && script->result == TEST_PASSED; i++) {
+      tick_chip(script);
+      script->ticked = true;
+      tock_chip(script);
+    }
+    return;
+  } else if (script->reset) {
+    for (uint64_t i = 0; i < count; i++) {
+      run(machine, 1);
+      machine->pc = 0;
+    }
+  } else {
+    run(machine, count);
+  }
+  script->time += count;
+  script->ticked = false;
+}
+
+// A combinational chip's inputs are put in the next lane, and a clocked
+// chip's outputs settle
+bool eval(Script* script) {
+  Simulation* simulation = script->simulation;
+  if (simulation->lane_count == 1) {
+    evaluate(simulation);
+    return true;
+  }
+  if (script->next_lane == SIMULATION_LANES && !flush_lanes(script)) {
+    return false;
+  }
+  script->lane = script->next_lane++;
+  for (int i = 0; i < script->netlist->input_count; i++) {
+    set_port(simulation, &script->netlist->inputs[i], 1ULL << script->lane, script->inputs[i]);
+    script->lane_inputs[i] = script->inputs[i];
+  }
+  return true;
+}
+
+// A combinational chip has nothing to clock, so a tick or tock only
+// evaluates it
+void tick_chip(Script* script) {
+  if (script->simulation->lane_count == 1) {
+    tick(script->simulation);
+  } else if (eval(script)) {
+    flush_lanes(script);
+  }
+}
+
+bool tock_chip(Script* script) {
+  if (script->simulation->lane_count == 1) {
+    tock(script->simulation);
+  } else if (eval(script)) {
+    flush_lanes(script);
+  }
+  script->time++;
+  script->ticked = false;
+  return script->result == TEST_PASSED;
+}
+
+// Evaluates every lane in use and prints the outputs waiting for them.
+// The last eval's inputs move to the first lane, so that it can be printed
+// again.
+bool flush_lanes(Script* script) {
+  if (script->netlist == NULL || script->simulation->lane_count == 1) {
+    return true;
+  }
+  Simulation* simulation = script->simulation;
+  evaluate(simulation);
+  bool valid = true;
+  for (int i = 0; i < script->pending_count && valid; i++) {
+    PendingOutput* output = &script->pending[i];
+    for (int column = 0; column < script->column_count; column++) {
+      const Variable* variable = &script->columns[column].variable;
+      if (depends_on_lane(variable)) {
+        output->values[column] = read_variable(script, variable, output->lane);
+      }
+    }
+    valid = print_values(script, output->values, output->ticked);
+  }
+  script->pending_count = 0;
+  for (int i = 0; i < script->netlist->input_count; i++) {
+    set_port(simulation, &script->netlist->inputs[i], 1, script->lane_inputs[i]);
+  }
+  script->lane = 0;
+  script->next_lane = 1;
+  return valid;
+}
+
+// The CPU emulator's names, and the Computer chip's for the same state
+bool parse_variable(Script* script, const Token* token, Variable* variable) {
+  if (script->netlist != NULL) {
+    return parse_chip_variable(script, token, variable);
+  }
+  static const struct {
+    const char* name;
+    VariableKind kind;
+    int address;
+  } names[] = {
+    {"A", VARIABLE_A, 0}, {"ARegister[]", VARIABLE_A, 0}, {"ARegister[0]", VARIABLE_A, 0},
+    {"D", VARIABLE_D, 0}, {"DRegister[]", VARIABLE_D, 0}, {"DRegister[0]", VARIABLE_D, 0},
+    {"PC", VARIABLE_PC, 0}, {"PC[]", VARIABLE_PC, 0}, {"time", VARIABLE_TIME, 0},
+    {"reset", VARIABLE_RESET, 0}, {"Keyboard[]", VARIABLE_RAM, KBD},
+    {"RAM[", VARIABLE_RAM, 0}, {"RAM16K[", VARIABLE_RAM, 0}, {"Screen[", VARIABLE_RAM, SCREEN},
+  };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    int length = strlen(names[i].name);
+    if (names[i].name[length - 1] != '[') {
+      if (token->length == length && memcmp(token->text, names[i].name, length) == 0) {
+        variable->kind = names[i].kind;
+        variable->address = names[i].address;
+        return true;
+      }
+      continue;
+    }
+    int index;
+    if (token->length > length + 1 && memcmp(token->text, names[i].name, length) == 0 &&
+        token->text[token->length - 1] == ']' &&
+        parse_number(token->text + length, token->length - length - 1, 10, &index) &&
+        index >= 0 && names[i].address + index < RAM_WORDS) {
+      variable->kind = names[i].kind;
+      variable->address = names[i].address + index;
+      return true;
+    }
+  }
+  return false;
+}
+
+// A chip's pins by name, and its parts' outputs and memories as the
+// Hardware Simulator names them: ARegister[] or RAM16K[5]
+bool parse_chip_variable(Script* script, const Token* token, Variable* variable) {
+  const Netlist* netlist = script->netlist;
+  variable->address = 0;
+  if (token_is(token, "time")) {
+    variable->kind = VARIABLE_TIME;
+    return true;
+  } else if ((variable->port = find_port(netlist->inputs, netlist->input_count, token->text,
+      token->length)) != NULL) {
+    variable->kind = VARIABLE_INPUT;
+    return true;
+  } else if ((variable->port = find_port(netlist->outputs, netlist->output_count, token->text,
+      token->length)) != NULL) {
+    variable->kind = VARIABLE_OUTPUT;
+    return true;
+  }
+  const char* open = memchr(token->text, '[', token->length);
+  if (open == NULL || token->text[token->length - 1] != ']') {
+    return false;
+  }
+  variable->port = find_port(netlist->parts, netlist->part_count, token->text,
+      open - token->text);
+  int index_length = token->length - (open + 1 - token->text) - 1;
+  int index = 0;
+  if (variable->port == NULL ||
+      (index_length > 0 && !parse_number(open + 1, index_length, 10, &index))) {
+    return false;
+  }
+  if (variable->port->memory >= 0) {
+    const MemoryPart* memory = &netlist->memories[variable->port->memory];
+    variable->kind = VARIABLE_MEMORY;
+    variable->address = index;
+    return index >= 0 && index < 1 << memory->address_bits;
+  }
+  variable->kind = VARIABLE_PART;
+  return index == 0;
+}
+
+// A decimal number, or %B, %D or %X followed by a number in that base
+bool parse_value(const Token* token, int* value) {
+  if (token->length > 2 && token->text[0] == '%') {
+    int base = token->text[1] == 'B' ? 2 : token->text[1] == 'X' ? 16 :
+        token->text[1] == 'D' ? 10 : 0;
+    return base != 0 && parse_number(token->text + 2, token->length - 2, base, value);
+  }
+  return parse_number(token->text, token->length, 10, value);
+}
+
+bool parse_number(const char* text, int length, int base, int* value) {
+  bool negative = length > 0 && text[0] == '-';
+  int i = negative ? 1 : 0;
+  if (i == length) {
+    return false;
+  }
+  long number = 0;
+  for (; i < length; i++) {
+    char c = text[i];
+    int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+        c >= 'A' && c <= 'F' ? c - 'A' + 10 : base;
+    if (digit >= base || number > 0xFFFFF) {
+      return false;
+    }
+    number = number * base + digit;
+  }
+  *value = negative ? -number : number;
+  return true;
+}
+
+int read_variable(Script* script, const Variable* variable, int lane) {
+  Machine* machine = script->machine;
+  switch (variable->kind) {
+    case VARIABLE_A: return machine->a;
+    case VARIABLE_D: return machine->d;
+    case VARIABLE_PC: return machine->pc;
+    case VARIABLE_RAM: return machine->ram[variable->address];
+    case VARIABLE_RESET: return script->reset;
+    case VARIABLE_TIME: return script->time;
+    case VARIABLE_INPUT: return script->inputs[variable->port - script->netlist->inputs];
+    case VARIABLE_OUTPUT: return read_port(script->simulation, variable->port, lane);
+    case VARIABLE_PART:
+      return script->ticked ? read_next_state(script->simulation, variable->port, lane) :
+          read_port(script->simulation, variable->port, lane);
+    case VARIABLE_MEMORY:
+      return read_memory(script->simulation, variable->port->memory, variable->address, lane);
+  }
+  return 0;
+}
+
+// Whether a variable is read from the simulation, rather than from what
+// the script set
+bool depends_on_lane(const Variable* variable) {
+  return variable->kind == VARIABLE_OUTPUT || variable->kind == VARIABLE_PART ||
+      variable->kind == VARIABLE_MEMORY;
+}
+
+// Writes exactly column->width characters to field. Decimals are signed
+// 16-bit and right-aligned, strings left-aligned, and binary and hex show
+// the low bits of the value, padded with zeros.
+void format_value(const Column* column, int value, bool ticked, char* field) {
+  int width = column->width;
+  char text[64];
+  if (column->variable.kind == VARIABLE_TIME) {
+    snprintf(text, sizeof(text), "%i%s", value, ticked ? "+" : "");
+  } else if (column->format == 'D' || column->format == 'S') {
+    snprintf(text, sizeof(text), "%i", (int16_t) value);
+  } else if (column->format == 'X') {
+    snprintf(text, sizeof(text), "%04X", value & 0xFFFF);
+  } else {
+    for (int bit = 0; bit < 16; bit++) {
+      text[bit] = (value >> (15 - bit)) & 1 ? '1' : '0';
+    }
+    text[16] = '\0';
+  }
+  int length = strlen(text);
+  if (column->format == 'B' || column->format == 'X') {
+    // the lowest digits, with zeros in front if the column is wider
+    for (int i = 0; i < width; i++) {
+      int digit = length - width + i;
+      field[i] = digit >= 0 ? text[digit] : '0';
+    }
+  } else if (length >= width) {
+    memcpy(field, text, width);
+  } else if (column->format == 'S') {
+    memcpy(field, text, length);
+    memset(field + length, ' ', width - length);
+  } else {
+    memset(field, ' ', width - length);
+    memcpy(field + width - length, text, length);
+  }
+}
+
+// Checks a line of output against the next line of the compare file, where
+// * matches any character
+bool check_line(Script* script, const char* line) {
+  if (script->expected == NULL) {
+    return true;
+  }
+  script->compared++;
+  char* expected = script->next_expected;
+  if (*expected == '\0') {
+    return stop(script, TEST_FAILED, "line %i: the compare file has no more lines",
+        script->compared);
+  }
+  size_t length = strcspn(expected, "\n");
+  script->next_expected = expected + length + (expected[length] == '\n');
+  while (length > 0 && expected[length - 1] == '\r') {
+    length--;
+  }
+  bool same = strlen(line) == length;
+  for (size_t i = 0; same && i < length; i++) {
+    same = expected[i] == '*' || expected[i] == line[i];
+  }
+  if (!same) {
+    return stop(script, TEST_FAILED, "line %i:\n  expected %.*s\n  actual   %s",
+        script->compared, (int) length, expected, line);
+  }
+  return true;
+}
+
+bool token_is(const Token* token, const char* text) {
+  return strncmp(token->text, text, token->length) == 0 && text[token->length] == '\0';
+}
+
+char* script_relative_path(Script* script, const Token* file) {
+  char* path = malloc(script->directory_length + file->length + 1);
+  memcpy(path, script->path, script->directory_length);
+  memcpy(path + script->directory_length, file->text, file->length);
+  path[script->directory_length + file->length] = '\0';
+  return path;
+}
+
+// Records why the script stopped. Always returns false, so callers can
+// return its result.
+bool stop(Script* script, TestResult result, const char* format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(script->message, script->message_size, format, arguments);
+  va_end(arguments);
+  script->result = result;
+  return false;
+}
@@ -0,0 +1,28 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "machine.h"
+
+// Runs the test scripts (.tst) of the CPU emulator: a program is loaded
+// with load, driven with set, repeat, tick, tock and ticktock, and printed
+// with output-list and output, each line checked against the compare-to
+// file as it is printed. Scripts for Computer.hdl are run the same way,
+// with the computer's pins and registers as aliases for the machine's.
+// Other chips are flattened to gates and simulated, with eval for their
+// combinational logic; VM programs are skipped.
+typedef enum {TEST_PASSED, TEST_FAILED, TEST_SKIPPED} TestResult;
+
+// gates simulates Computer.hdl as gates like any other chip, instead of
+// running it on the emulator, and native compiles clocked chips to C for
+// the clock cycles that run with nothing printed between them
+typedef struct {
+  bool gates;
+  bool native;
+} ScriptOptions;
+
+TestResult run_script(const char* path, Machine* machine, const ScriptOptions* options,
+    char* message, size_t message_size);
+
+#endif
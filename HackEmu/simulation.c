@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+#include "simulation.h"
+
+void read_memory_part(Simulation* simulation, int index);
+void gather_words(const Simulation* simulation, const uint32_t* bits, int width,
+    uint16_t* words);
+
+void Simulation_init(Simulation* simulation, const Netlist* netlist, int lane_count) {
+  simulation->netlist = netlist;
+  simulation->lane_count = lane_count;
+  simulation->values = calloc(netlist->signal_count, sizeof(uint64_t));
+  simulation->values[SIGNAL_TRUE] = ~0ULL;
+  simulation->sampled = calloc(netlist->flip_flop_count + 1, sizeof(uint64_t));
+  int memories = netlist->memory_count + 1;
+  simulation->contents = calloc(memories, sizeof(uint16_t*));
+  simulation->write_lanes = calloc(memories, sizeof(uint64_t));
+  simulation->write_addresses = calloc(memories, sizeof(*simulation->write_addresses));
+  simulation->write_words = calloc(memories, sizeof(*simulation->write_words));
+  for (int i = 0; i < netlist->memory_count; i++) {
+    const MemoryPart* memory = &netlist->memories[i];
+    size_t words = memory->kind == MEMORY_ROM ? (size_t) 1 << memory->address_bits :
+        memory->kind == MEMORY_KEYBOARD ? lane_count :
+        ((size_t) 1 << memory->address_bits) * lane_count;
+    simulation->contents[i] = calloc(words, sizeof(uint16_t));
+  }
+}
+
+void Simulation_free(Simulation* simulation) {
+  for (int i = 0; i < simulation->netlist->memory_count; i++) {
+    free(simulation->contents[i]);
+  }
+  free(simulation->values);
+  free(simulation->sampled);
+  free(simulation->contents);
+  free(simulation->write_lanes);
+  free(simulation->write_addresses);
+  free(simulation->write_words);
+}
+
+// Runs every gate once, in level order, reading each memory once the
+// gates that drive its address have run
+void evaluate(Simulation* simulation) {
+  const Netlist* netlist = simulation->netlist;
+  uint64_t* values = simulation->values;
+  const NandGate* gates = netlist->gates;
+  int gate = 0;
+  for (int i = 0; i <= netlist->memory_count; i++) {
+    int end = i < netlist->memory_count ? netlist->memories[i].position : netlist->gate_count;
+    for (; gate < end; gate++) {
+      values[gates[gate].out] = ~(values[gates[gate].a] & values[gates[gate].b]);
+    }
+    if (i < netlist->memory_count) {
+      read_memory_part(simulation, i);
+    }
+  }
+}
+
+// The first half of a clock cycle: the inputs settle, and the flip-flops
+// and RAMs take in what they will hold after the tock
+void tick(Simulation* simulation) {
+  evaluate(simulation);
+  const Netlist* netlist = simulation->netlist;
+  for (int i = 0; i < netlist->flip_flop_count; i++) {
+    simulation->sampled[i] = simulation->values[netlist->flip_flops[i].in];
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    const MemoryPart* memory = &netlist->memories[i];
+    if (memory->kind != MEMORY_RAM) {
+      continue;
+    }
+    uint64_t lanes = simulation->values[memory->load];
+    if (simulation->lane_count < SIMULATION_LANES) {
+      lanes &= (1ULL << simulation->lane_count) - 1;
+    }
+    simulation->write_lanes[i] = lanes;
+    if (lanes != 0) {
+      gather_words(simulation, memory->address, memory->address_bits,
+          simulation->write_addresses[i]);
+      gather_words(simulation, memory->in, 16, simulation->write_words[i]);
+    }
+  }
+}
+
+// The second half: the outputs of the flip-flops change, and so does
+// everything after them
+void tock(Simulation* simulation) {
+  const Netlist* netlist = simulation->netlist;
+  for (int i = 0; i < netlist->flip_flop_count; i++) {
+    simulation->values[netlist->flip_flops[i].out] = simulation->sampled[i];
+  }
+  for (int i = 0; i < netlist->memory_count; i++) {
+    uint64_t lanes = simulation->write_lanes[i];
+    simulation->write_lanes[i] = 0;
+    for (; lanes != 0; lanes &= lanes - 1) {
+      int lane = __builtin_ctzll(lanes);
+      size_t word = (size_t) simulation->write_addresses[i][lane] * simulation->lane_count + lane;
+      simulation->contents[i][word] = simulation->write_words[i][lane];
+    }
+  }
+  evaluate(simulation);
+}
+
+// Sets the low bits of value on the port's signals, in each of lanes
+void set_port(Simulation* simulation, const Port* port, uint64_t lanes, int value) {
+  if (port->memory >= 0) {
+    // the keyboard's value is held by the keyboard itself
+    for (int lane = 0; lane < simulation->lane_count; lane++) {
+      if ((lanes >> lane) & 1) {
+        simulation->contents[port->memory][lane] = value;
+      }
+    }
+    return;
+  }
+  for (int bit = 0; bit < port->width; bit++) {
+    uint64_t* signal = &simulation->values[port->bits[bit]];
+    *signal = (value >> bit) & 1 ? *signal | lanes : *signal & ~lanes;
+  }
+}
+
+int read_port(const Simulation* simulation, const Port* port, int lane) {
+  int value = 0;
+  for (int bit = 0; bit < port->width; bit++) {
+    value |= ((simulation->values[port->bits[bit]] >> lane) & 1) << bit;
+  }
+  return value;
+}
+
+// What a register's outputs will be after the tock, as the Hardware
+// Simulator shows a register between tick and tock. Flip-flop outputs are
+// numbered one after another, so a bit is a flip-flop's when it is in
+// their range.
+int read_next_state(const Simulation* simulation, const Port* port, int lane) {
+  const Netlist* netlist = simulation->netlist;
+  int value = 0;
+  for (int bit = 0; bit < port->width; bit++) {
+    uint32_t flip_flop = port->bits[bit] - (netlist->flip_flop_count > 0 ?
+        netlist->flip_flops[0].out : 0);
+    uint64_t lanes = flip_flop < (uint32_t) netlist->flip_flop_count ?
+        simulation->sampled[flip_flop] : simulation->values[port->bits[bit]];
+    value |= ((lanes >> lane) & 1) << bit;
+  }
+  return value;
+}
+
+int read_memory(const Simulation* simulation, int memory, int address, int lane) {
+  const MemoryPart* part = &simulation->netlist->memories[memory];
+  address &= (1 << part->address_bits) - 1;
+  if (part->kind == MEMORY_ROM) {
+    return simulation->contents[memory][address];
+  } else if (part->kind == MEMORY_KEYBOARD) {
+    return simulation->contents[memory][lane];
+  }
+  return simulation->contents[memory][(size_t) address * simulation->lane_count + lane];
+}
+
+// Fills a ROM, or a RAM in every lane, with words
+void load_memory(Simulation* simulation, int memory, const uint16_t* words, int count) {
+  const MemoryPart* part = &simulation->netlist->memories[memory];
+  int size = part->kind == MEMORY_KEYBOARD ? 1 : 1 << part->address_bits;
+  count = count < size ? count : size;
+  if (part->kind == MEMORY_ROM) {
+    memset(simulation->contents[memory], 0, size * sizeof(uint16_t));
+    memcpy(simulation->contents[memory], words, count * sizeof(uint16_t));
+    return;
+  }
+  for (int address = 0; address < size; address++) {
+    for (int lane = 0; lane < simulation->lane_count; lane++) {
+      simulation->contents[memory][(size_t) address * simulation->lane_count + lane] =
+          address < count ? words[address] : 0;
+    }
+  }
+}
+
+// Stores value at address, in every lane
+void write_memory(Simulation* simulation, int memory, int address, int value) {
+  const MemoryPart* part = &simulation->netlist->memories[memory];
+  address &= (1 << part->address_bits) - 1;
+  if (part->kind == MEMORY_ROM) {
+    simulation->contents[memory][address] = value;
+    return;
+  }
+  int lanes = simulation->lane_count;
+  for (int lane = 0; lane < lanes; lane++) {
+    simulation->contents[memory][part->kind == MEMORY_KEYBOARD ? lane :
+        (size_t) address * lanes + lane] = value;
+  }
+}
+
+// Puts the word at each lane's address on the memory's outputs
+void read_memory_part(Simulation* simulation, int index) {
+  const MemoryPart* memory = &simulation->netlist->memories[index];
+  uint16_t addresses[SIMULATION_LANES] = {0};
+  uint16_t words[SIMULATION_LANES] = {0};
+  gather_words(simulation, memory->address, memory->address_bits, addresses);
+  const uint16_t* contents = simulation->contents[index];
+  for (int lane = 0; lane < simulation->lane_count; lane++) {
+    words[lane] = memory->kind == MEMORY_ROM ? contents[addresses[lane]] :
+        memory->kind == MEMORY_KEYBOARD ? contents[lane] :
+        contents[(size_t) addresses[lane] * simulation->lane_count + lane];
+  }
+  for (int bit = 0; bit < 16; bit++) {
+    uint64_t value = 0;
+    for (int lane = 0; lane < simulation->lane_count; lane++) {
+      value |= (uint64_t) ((words[lane] >> bit) & 1) << lane;
+    }
+    simulation->values[memory->out[bit]] = value;
+  }
+}
+
+// Turns a bus of signals into a word for each lane
+void gather_words(const Simulation* simulation, const uint32_t* bits, int width,
+    uint16_t* words) {
+  for (int lane = 0; lane < simulation->lane_count; lane++) {
+    words[lane] = 0;
+  }
+  for (int bit = 0; bit < width; bit++) {
+    uint64_t value = simulation->values[bits[bit]];
+    for (int lane = 0; lane < simulation->lane_count; lane++) {
+      words[lane] |= ((value >> lane) & 1) << bit;
+    }
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdint.h>
+#include "netlist.h"
+
+// Each signal is a 64-bit word, one bit per lane, so a pass over the gates
+// evaluates the chip for 64 sets of inputs at once
+#define SIMULATION_LANES 64
+
+// The state of a netlist being simulated. Flip-flops keep their state in
+// the values of their outputs. Each memory has a copy of its words for
+// every lane in use, one word of every lane after another, except for the
+// ROM, which all lanes share.
+typedef struct {
+  const Netlist* netlist;
+  // how many lanes memories are read and written for
+  int lane_count;
+  uint64_t* values;
+  // what the flip-flops and RAMs took in at the last tick
+  uint64_t* sampled;
+  uint16_t** contents;
+  uint64_t* write_lanes;
+  uint16_t (*write_addresses)[SIMULATION_LANES];
+  uint16_t (*write_words)[SIMULATION_LANES];
+} Simulation;
+
+void Simulation_init(Simulation* simulation, const Netlist* netlist, int lane_count);
+void Simulation_free(Simulation* simulation);
+void evaluate(Simulation* simulation);
+void tick(Simulation* simulation);
+void tock(Simulation* simulation);
+void set_port(Simulation* simulation, const Port* port, uint64_t lanes, int value);
+int read_port(const Simulation* simulation, const Port* port, int lane);
+int read_next_state(const Simulation* simulation, const Port* port, int lane);
+int read_memory(const Simulation* simulation, int memory, int address, int lane);
+void load_memory(Simulation* simulation, int memory, const uint16_t* words, int count);
+void write_memory(Simulation* simulation, int memory, int address, int value);
+
+#endif
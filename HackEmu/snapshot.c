@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "HSNP"
+
+// Programs are told apart by a hash of their words
+uint64_t rom_id(const uint16_t* words, int count) {
+  return hash_source((const char*) words, (size_t) count * sizeof(uint16_t));
+}
+
+// Writes the machine's state as a single block. The file is written under
+// a temporary name and renamed, so a snapshot is never seen half written.
+bool save_snapshot(const char* path, const Machine* machine, uint64_t rom_id) {
+  SnapshotImage* image = malloc(sizeof(SnapshotImage));
+  memcpy(image->magic, SNAPSHOT_MAGIC, 4);
+  image->version = SNAPSHOT_VERSION;
+  image->rom_id = rom_id;
+  image->cycles = machine->cycles;
+  image->a = machine->a;
+  image->d = machine->d;
+  image->pc = machine->pc;
+  image->halted = machine->halted;
+  memcpy(image->ram, machine->ram, sizeof(image->ram));
+
+  size_t length = strlen(path) + 5;
+  char* temporary = malloc(length);
+  snprintf(temporary, length, "%s.tmp", path);
+  FILE* file = fopen(temporary, "wb");
+  bool saved = file != NULL && fwrite(image, sizeof(SnapshotImage), 1, file) == 1;
+  if (file != NULL) {
+    saved = fclose(file) == 0 && saved && rename(temporary, path) == 0;
+  }
+  if (!saved) {
+    fprintf(stderr, "%s: Could not write snapshot\n", path);
+    remove(temporary);
+  }
+  free(temporary);
+  free(image);
+  return saved;
+}
+
+bool Snapshot_load(Snapshot* snapshot, const char* path) {
+  snapshot->image = NULL;
+  snapshot->size = 0;
+  int descriptor = open(path, O_RDONLY);
+  if (descriptor == -1) {
+    fprintf(stderr, "%s: Could not open file\n", path);
+    return false;
+  }
+  struct stat info;
+  void* data = MAP_FAILED;
+  if (fstat(descriptor, &info) == 0 && info.st_size == sizeof(SnapshotImage)) {
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+  }
+  close(descriptor);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "%s: Not a snapshot\n", path);
+    return false;
+  }
+  const SnapshotImage* image = data;
+  if (memcmp(image->magic, SNAPSHOT_MAGIC, 4) != 0 || image->version != SNAPSHOT_VERSION) {
+    fprintf(stderr, "%s: Not a snapshot, or from another version\n", path);
+    munmap(data, info.st_size);
+    return false;
+  }
+  snapshot->image = image;
+  snapshot->size = info.st_size;
+  return true;
+}
+
+void Snapshot_free(Snapshot* snapshot) {
+  if (snapshot->image != NULL) {
+    munmap((void*) snapshot->image, snapshot->size);
+  }
+  snapshot->image = NULL;
+}
+
+// Puts the machine back in the snapshot's state, which costs one copy of
+// RAM. The whole screen is marked as changed, since a frame writer has not
+// seen it yet.
+bool restore_snapshot(Machine* machine, const Snapshot* snapshot, uint64_t rom_id) {
+  const SnapshotImage* image = snapshot->image;
+  if (image->rom_id != rom_id) {
+    fprintf(stderr, "The snapshot was taken of another program\n");
+    return false;
+  }
+  machine->cycles = image->cycles;
+  machine->a = image->a;
+  machine->d = image->d;
+  machine->pc = image->pc & ADDRESS_MASK;
+  machine->halted = image->halted;
+  memcpy(machine->ram, image->ram, sizeof(machine->ram));
+  memset(machine->dirty_rows, 1, SCREEN_ROWS);
+  return true;
+}
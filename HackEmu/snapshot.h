@@ -0,0 +1,44 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "machine.h"
+
+#define SNAPSHOT_VERSION 1
+
+// The state of a machine part way through a program, laid out as it is
+// on disk, in the host's byte order:
+//
+//   "HSNP", version, hash of the ROM it ran, instructions executed,
+//   A, D, PC, halted, then all of RAM
+//
+// The ROM itself is not kept. A snapshot can only be restored into a
+// machine running the same program, so rom_id is checked first.
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t rom_id;
+  uint64_t cycles;
+  uint16_t a;
+  uint16_t d;
+  uint16_t pc;
+  uint16_t halted;
+  uint16_t ram[RAM_WORDS];
+} SnapshotImage;
+
+// A snapshot file mapped into memory, which any number of machines can be
+// restored from
+typedef struct {
+  const SnapshotImage* image;
+  size_t size;
+} Snapshot;
+
+uint64_t rom_id(const uint16_t* words, int count);
+bool save_snapshot(const char* path, const Machine* machine, uint64_t rom_id);
+bool Snapshot_load(Snapshot* snapshot, const char* path);
+void Snapshot_free(Snapshot* snapshot);
+bool restore_snapshot(Machine* machine, const Snapshot* snapshot, uint64_t rom_id);
+
+#endif